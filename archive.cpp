@@ -0,0 +1,427 @@
+#include "archive.hpp"
+#include "fuzzy_index.hpp"
+#include "time_window.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+
+namespace archive {
+
+// --- TIERS ---
+// ~/.den_den_ink.db keeps its 2023 notes in ~/.den_den_ink.2023.db
+std::string tier_path(const std::string& hot_path, int year) {
+    return db::sidecar_path(hot_path, "." + std::to_string(year) + ".db");
+}
+
+const std::string LIST_TIERS_SQL =
+    "SELECT year, oldest, newest, notes FROM archive_tiers "
+    "WHERE (?1 = '' OR newest >= ?1) AND (?2 = '' OR oldest < ?2) ORDER BY year DESC;";
+
+std::vector<Tier> list_tiers(db::Database& hot, const std::string& since, const std::string& until) {
+    std::vector<Tier> tiers;
+    const std::string hot_path = db::file_path(hot);
+    db::Statement stmt = hot.prepare(LIST_TIERS_SQL);
+    stmt.bind(1, since).bind(2, until);
+    while (stmt.step()) {
+        int year = stmt.column_int(0);
+        tiers.push_back({year, tier_path(hot_path, year), stmt.column_text(1), stmt.column_text(2), stmt.column_int64(3)});
+    }
+    return tiers;
+}
+
+bool tier_present(const Tier& tier) {
+    std::error_code ec;
+    return std::filesystem::exists(tier.path, ec);
+}
+
+std::shared_ptr<db::Database> open_tier(const Tier& tier, Missing* missing) {
+    auto db = tier_present(tier) ? std::make_shared<db::Database>(tier.path) : nullptr;
+    if (db && db->is_open()) return db;
+    if (missing) missing->push_back(tier.path);
+    return nullptr;
+}
+
+void report_missing(const Missing& missing, std::ostream& err) {
+    for (const auto& path : missing) {
+        err << "Warning: Archive " << path << " is missing or unreadable; its notes are left out." << std::endl;
+    }
+}
+
+// --- MOVING NOTES ---
+// Notes per transaction. Each batch is copied, committed in the archive, and
+// only then deleted from the hot database.
+const long long ARCHIVE_BATCH = 5000;
+
+// Run on the archive's connection with the hot database attached as `hot`.
+// Unqualified names are the archive's own tables.
+const std::string SELECT_BATCH_SQL =
+    "INSERT INTO temp.moving (id) SELECT n.id FROM hot.notes n WHERE n.timestamp < ?1 "
+    "AND NOT EXISTS (SELECT 1 FROM hot.metadata m WHERE m.note_id = n.id AND m.enrichment = 'pending') "
+    "ORDER BY n.timestamp LIMIT ?2;";
+// The batch's notes the archive doesn't have yet. A batch that was copied
+// but not deleted from the hot database (a crash in between) has none.
+const std::string SELECT_COPYING_SQL =
+    "INSERT INTO temp.copying (id) SELECT id FROM temp.moving WHERE id NOT IN (SELECT id FROM notes);";
+// Dictionary ids differ between databases, so tags and directories are
+// matched up by name. The search index and counter triggers are deferred,
+// as for a bulk load, and the batch is indexed and counted as a whole.
+const std::vector<std::string> COPY_BATCH_SQL = {
+    "UPDATE search_index_state SET deferred = 1;",
+    "INSERT OR IGNORE INTO dir_dict (path) SELECT DISTINCT d.path FROM hot.metadata m JOIN hot.dir_dict d ON d.id = m.dir_id "
+        "WHERE m.note_id IN (SELECT id FROM temp.copying);",
+    "INSERT INTO notes (id, text, timestamp, type) SELECT id, text, timestamp, type FROM hot.notes "
+        "WHERE id IN (SELECT id FROM temp.copying);",
+    // Bodies already in the archive are shared, as in the hot database
+    "INSERT INTO blobs (hash, size, head, data) SELECT b.hash, b.size, b.head, b.data FROM hot.blobs b "
+        "WHERE b.id IN (SELECT blob_id FROM hot.note_bodies WHERE note_id IN (SELECT id FROM temp.copying)) "
+        "AND NOT EXISTS (SELECT 1 FROM blobs a WHERE a.hash = b.hash AND a.size = b.size AND a.data = b.data);",
+    "INSERT INTO note_bodies (note_id, blob_id) SELECT nb.note_id, (SELECT a.id FROM blobs a WHERE a.hash = b.hash AND a.size = b.size AND a.data = b.data) "
+        "FROM hot.note_bodies nb JOIN hot.blobs b ON b.id = nb.blob_id WHERE nb.note_id IN (SELECT id FROM temp.copying);",
+    "INSERT INTO note_tags (tag_id, note_id) SELECT a.id, nt.note_id FROM hot.note_tags nt "
+        "JOIN hot.tag_dict t ON t.id = nt.tag_id JOIN tag_dict a ON a.name = t.name WHERE nt.note_id IN (SELECT id FROM temp.copying);",
+    "INSERT INTO metadata (note_id, dir_id, last_edited_file, git_branch, recent_commit_hash, enrichment) "
+        "SELECT m.note_id, a.id, m.last_edited_file, m.git_branch, m.recent_commit_hash, m.enrichment FROM hot.metadata m "
+        "LEFT JOIN hot.dir_dict d ON d.id = m.dir_id LEFT JOIN dir_dict a ON a.path = d.path WHERE m.note_id IN (SELECT id FROM temp.copying);",
+    "INSERT INTO notes_fts (rowid, text, current_directory, last_edited_file, git_branch) "
+        "SELECT n.id, n.text, d.path, m.last_edited_file, m.git_branch FROM notes n LEFT JOIN metadata m ON n.id = m.note_id "
+        "LEFT JOIN dir_dict d ON d.id = m.dir_id WHERE n.id IN (SELECT id FROM temp.copying);",
+    "UPDATE stat_totals SET count = count + (SELECT COUNT(*) FROM temp.copying) WHERE name = 'notes';",
+    "INSERT INTO stat_daily_counts (day, count) SELECT STRFTIME('%Y-%m-%d', timestamp), COUNT(*) FROM notes "
+        "WHERE id IN (SELECT id FROM temp.copying) GROUP BY 1 ON CONFLICT(day) DO UPDATE SET count = count + excluded.count;",
+    "INSERT INTO stat_tag_counts (tag_id, count) SELECT tag_id, COUNT(*) FROM note_tags WHERE note_id IN (SELECT id FROM temp.copying) "
+        "GROUP BY tag_id ON CONFLICT(tag_id) DO UPDATE SET count = count + excluded.count;",
+    "INSERT INTO stat_project_counts (dir_id, count) SELECT dir_id, COUNT(*) FROM metadata WHERE note_id IN (SELECT id FROM temp.copying) "
+        "AND dir_id IS NOT NULL GROUP BY dir_id ON CONFLICT(dir_id) DO UPDATE SET count = count + excluded.count;",
+    "UPDATE search_index_state SET deferred = 0;",
+    // Keys come over as they are; their trigger adds them to sync_days
+    "INSERT INTO sync_keys (note_id, key, day, meta) SELECT note_id, key, day, meta FROM hot.sync_keys WHERE note_id IN (SELECT id FROM temp.copying);"
+};
+// A note lists its tags in tag id order, so the archive numbers them in the
+// hot database's order to keep that listing the same
+const std::string COPY_TAGS_SQL = "INSERT OR IGNORE INTO tag_dict (name) SELECT name FROM hot.tag_dict ORDER BY id;";
+const std::string BATCH_WORDS_SQL =
+    "SELECT n.text, m.last_edited_file FROM hot.notes n LEFT JOIN hot.metadata m ON m.note_id = n.id "
+    "WHERE n.id IN (SELECT id FROM temp.copying);";
+// The index entries go first: otherwise each metadata row's delete trigger
+// rewrites its note's entry only for the note's own trigger to drop it
+const std::vector<std::string> REMOVE_BATCH_SQL = {
+    "DELETE FROM hot.notes_fts WHERE rowid IN (SELECT id FROM temp.moving);",
+    "DELETE FROM hot.notes WHERE id IN (SELECT id FROM temp.moving);"
+};
+const std::string RECORD_TIER_SQL =
+    "INSERT INTO hot.archive_tiers (year, oldest, newest, notes) VALUES (?, (SELECT MIN(timestamp) FROM notes), "
+    "(SELECT MAX(timestamp) FROM notes), (SELECT count FROM stat_totals WHERE name = 'notes')) "
+    "ON CONFLICT(year) DO UPDATE SET oldest = excluded.oldest, newest = excluded.newest, notes = excluded.notes;";
+
+// Copies the next batch of notes before `end` into the archive, leaving
+// their ids in temp.moving. Returns how many, 0 once none are left, or -1.
+long long copy_batch(db::Database& tier, const std::string& end) {
+    INK_TRACE_SCOPE("archive_copy");
+    db::Transaction txn(tier);
+    if (!txn.ok() || !tier.execute("DELETE FROM temp.moving;") || !tier.execute("DELETE FROM temp.copying;")) return -1;
+    if (!tier.prepare(SELECT_BATCH_SQL).bind(1, end).bind(2, ARCHIVE_BATCH).run() || !tier.execute(SELECT_COPYING_SQL)) return -1;
+    db::Statement count = tier.prepare("SELECT COUNT(*) FROM temp.moving;");
+    long long moving = count.step() ? count.column_int64(0) : 0;
+    if (moving == 0) return 0;
+
+    for (const auto& sql : COPY_BATCH_SQL) {
+        if (!tier.execute(sql)) return -1;
+    }
+    // The archive keeps its own vocabulary for `ink search --fuzzy`
+    db::Statement words = tier.prepare(BATCH_WORDS_SQL);
+    while (words.step()) {
+        if (!fuzzy_index::add_words(tier, words.column_view(0)) || !fuzzy_index::add_words(tier, words.column_view(1))) return -1;
+    }
+    return txn.commit() ? moving : -1;
+}
+
+// Deletes a copied batch from the hot database and updates the archive's
+// entry in archive_tiers, in one transaction of its own.
+bool remove_batch(db::Database& tier, int year) {
+    INK_TRACE_SCOPE("archive_delete");
+    db::Transaction txn(tier, true);
+    if (!txn.ok()) return false;
+    for (const auto& sql : REMOVE_BATCH_SQL) {
+        if (!tier.execute(sql)) return false;
+    }
+    return tier.prepare(RECORD_TIER_SQL).bind(1, year).run() && txn.commit();
+}
+
+// Moves every note before `end` into the archive for `year`.
+long long archive_year(db::Database& hot, int year, const std::string& end) {
+    const std::string hot_path = db::file_path(hot);
+    db::Database tier(tier_path(hot_path, year));
+    if (!tier.is_open()) return -1;
+    if (!tier.prepare("ATTACH DATABASE ? AS hot;").bind(1, hot_path).run() ||
+        !tier.execute("CREATE TEMP TABLE IF NOT EXISTS moving (id INTEGER PRIMARY KEY);") ||
+        !tier.execute("CREATE TEMP TABLE IF NOT EXISTS copying (id INTEGER PRIMARY KEY);") ||
+        !tier.execute(COPY_TAGS_SQL)) {
+        return -1;
+    }
+    long long moved = 0;
+    for (long long batch; (batch = copy_batch(tier, end)) != 0; moved += batch) {
+        // Only now that the archive holds the batch does it leave the hot database
+        if (batch < 0 || !remove_batch(tier, year)) return -1;
+    }
+    return moved;
+}
+
+// The oldest timestamp from `from` on
+std::string oldest_from(db::Database& hot, const std::string& from) {
+    db::Statement stmt = hot.prepare("SELECT MIN(timestamp) FROM notes WHERE timestamp >= ?;");
+    return stmt.bind(1, from).step() ? stmt.column_text(0) : "";
+}
+
+// Whether any note in [from, end) is ready to move. Notes still waiting on
+// their metadata stay in the hot database until it arrives.
+bool any_ready(db::Database& hot, const std::string& from, const std::string& end) {
+    db::Statement stmt = hot.prepare(
+        "SELECT 1 FROM notes n WHERE n.timestamp >= ?1 AND n.timestamp < ?2 "
+        "AND NOT EXISTS (SELECT 1 FROM metadata m WHERE m.note_id = n.id AND m.enrichment = 'pending') LIMIT 1;");
+    return stmt.bind(1, from).bind(2, end).step();
+}
+
+long long archive_notes(db::Database& hot, const std::string& cutoff, std::ostream& out) {
+    INK_TRACE_SCOPE("archive_notes");
+    long long total = 0;
+    std::string from;
+    while (true) {
+        std::string oldest = oldest_from(hot, from);
+        if (oldest.empty() || oldest >= cutoff) break;
+        long long epoch;
+        if (!time_window::parse_timestamp(oldest, epoch)) {
+            std::cerr << "Error: Can't tell which year the timestamp \"" << oldest << "\" falls in." << std::endl;
+            return -1;
+        }
+        // Nothing from `from` on is older than `oldest`, so the notes up to
+        // the next New Year all belong to its year
+        int year = std::stoi(oldest.substr(0, 4));
+        std::string end = std::min(std::to_string(year + 1) + "-01-01 00:00:00", cutoff);
+        if (any_ready(hot, oldest, end)) {
+            long long moved = archive_year(hot, year, end);
+            if (moved < 0) {
+                std::cerr << "Error: Failed to archive notes from " << year << "." << std::endl;
+                return -1;
+            }
+            out << "🐌 Archived " << moved << " note(s) from " << year << " into " << tier_path(db::file_path(hot), year) << std::endl;
+            total += moved;
+        }
+        from = end;
+    }
+    return total;
+}
+
+// --- COMPACTION ---
+// Pages handed back per step. Each step is its own short write transaction,
+// so notes can still be saved while a large file is compacted.
+const int COMPACT_STEP_PAGES = 2048;
+
+long long read_pragma(db::Database& db, const std::string& sql) {
+    db::Statement stmt = db.prepare(sql);
+    return stmt.step() ? stmt.column_int64(0) : -1;
+}
+
+bool compact_database(db::Database& db, std::ostream& out) {
+    const long long page_size = read_pragma(db, "PRAGMA page_size;");
+    const long long before = read_pragma(db, "PRAGMA page_count;") * page_size;
+    if (!db.execute("INSERT INTO notes_fts (notes_fts) VALUES ('optimize');")) return false;
+    if (read_pragma(db, "PRAGMA auto_vacuum;") != 2) {
+        // Databases from before incremental vacuum was turned on switch over once, with a full rebuild
+        if (!db.execute("PRAGMA auto_vacuum = INCREMENTAL;") || !db.execute("VACUUM;")) return false;
+    } else {
+        while (read_pragma(db, "PRAGMA freelist_count;") > 0) {
+            if (!db.execute("PRAGMA incremental_vacuum(" + std::to_string(COMPACT_STEP_PAGES) + ");")) return false;
+        }
+    }
+    db.execute("PRAGMA wal_checkpoint(TRUNCATE);");
+    const long long after = read_pragma(db, "PRAGMA page_count;") * page_size;
+    out << "🐌 " << db::file_path(db) << ": " << (before + 512 * 1024) / (1024 * 1024) << " MB -> "
+        << (after + 512 * 1024) / (1024 * 1024) << " MB" << std::endl;
+    return true;
+}
+
+bool compact(db::Database& hot, std::ostream& out, Missing& missing) {
+    INK_TRACE_SCOPE("compact");
+    if (!compact_database(hot, out)) return false;
+    for (const auto& tier : list_tiers(hot)) {
+        auto db = open_tier(tier, &missing);
+        if (db && !compact_database(*db, out)) return false;
+    }
+    return true;
+}
+
+// --- READING ACROSS TIERS ---
+// Runs the query on one database
+using Query = std::function<db::NoteCursor(db::Database&, const PageOptions&)>;
+
+// Rows read from each tier at a time
+const size_t TIER_BATCH_ROWS = 64;
+
+// Feeds a NoteCursor from the hot database and whichever archives it turns
+// out to need. Listings merge the tiers by (timestamp, id), newest first;
+// searches read them one after another, since each ranks its own matches.
+class TieredSource : public db::NoteSource {
+public:
+    TieredSource(db::Database& hot, std::vector<Tier> archives, Query query, const PageOptions& page, bool merge, Missing& missing)
+        : hot_(hot), query_(std::move(query)), page_(page), merge_(merge), missing_(missing) {
+        tiers_.push_back({0, db::file_path(hot), "", "", 0});
+        tiers_.insert(tiers_.end(), archives.begin(), archives.end());
+        cursors_.resize(tiers_.size());
+        if (page_.after_id >= 0) resume_after();
+    }
+
+    bool next_batch(db::NoteBatch& batch, size_t max_rows) override {
+        batch.clear();
+        while (batch.size() < max_rows && (page_.limit < 0 || emitted_ < page_.limit)) {
+            size_t next = merge_ ? newest_head() : first_head();
+            if (next == NONE) break;
+            TierCursor& tier = cursors_[next];
+            db::NoteView note = tier.batch[tier.at++];
+            // A batch copied into an archive but not yet deleted from the
+            // hot database shows up twice, side by side
+            if (note.id == last_id_) continue;
+            batch.append(note);
+            last_id_ = note.id;
+            ++emitted_;
+        }
+        return !batch.empty();
+    }
+
+private:
+    static constexpr size_t NONE = static_cast<size_t>(-1);
+
+    struct TierCursor {
+        std::shared_ptr<db::Database> db; // Null for the hot database; outlives `cursor`
+        db::NoteCursor cursor;
+        db::NoteBatch batch;
+        size_t at = 0;
+        bool started = false;
+        bool done = false;
+        bool unreadable = false; // Already added to missing_
+        long long after_id = -1;
+    };
+
+    // Finds where the page left off. A listing carries the note's timestamp
+    // to every tier; a search continues in the tier holding the note and
+    // starts the ones after it afresh. An unknown note ends the results, as
+    // it does without archives.
+    void resume_after() {
+        for (size_t i = 0; i < tiers_.size(); ++i) {
+            db::Database* db = open(i);
+            std::string timestamp = db ? db::get_note_timestamp(*db, page_.after_id) : "";
+            if (timestamp.empty()) {
+                cursors_[i].done = !merge_;
+                continue;
+            }
+            if (merge_) {
+                page_.after_timestamp = timestamp;
+            } else {
+                cursors_[i].after_id = page_.after_id;
+            }
+            return;
+        }
+        for (auto& cursor : cursors_) cursor.done = true;
+    }
+
+    db::Database* open(size_t i) {
+        if (i == 0) return &hot_;
+        TierCursor& tier = cursors_[i];
+        if (!tier.db && !tier.unreadable) {
+            tier.db = open_tier(tiers_[i], &missing_);
+            tier.unreadable = !tier.db;
+        }
+        return tier.db.get();
+    }
+
+    void start(size_t i) {
+        TierCursor& tier = cursors_[i];
+        tier.started = true;
+        if (tier.done) return;
+        db::Database* db = open(i);
+        if (!db) {
+            tier.done = true;
+            return;
+        }
+        PageOptions page = page_;
+        if (!merge_) {
+            page.after_id = tier.after_id;
+            if (page.limit >= 0) page.limit = static_cast<int>(page_.limit - emitted_);
+        }
+        tier.cursor = query_(*db, page);
+    }
+
+    // Whether tier i has a row at `at`, reading the next batch if needed
+    bool has_head(size_t i) {
+        TierCursor& tier = cursors_[i];
+        if (tier.done) return false;
+        if (tier.at < tier.batch.size()) return true;
+        tier.at = 0;
+        tier.done = !tier.cursor.next_batch(tier.batch, TIER_BATCH_ROWS);
+        return !tier.done;
+    }
+
+    db::NoteView head(size_t i) const { return cursors_[i].batch[cursors_[i].at]; }
+
+    size_t first_head() {
+        for (size_t i = 0; i < tiers_.size(); ++i) {
+            if (!cursors_[i].started) start(i);
+            if (has_head(i)) return i;
+        }
+        return NONE;
+    }
+
+    // Tiers run newest year first, so an archive only has to be opened once
+    // the best row so far is no newer than the archive's newest note.
+    size_t newest_head() {
+        size_t best = NONE;
+        for (size_t i = 0; i < tiers_.size(); ++i) {
+            if (!cursors_[i].started) {
+                if (best != NONE && head(best).timestamp > std::string_view(tiers_[i].newest)) break;
+                start(i);
+            }
+            if (!has_head(i)) continue;
+            if (best == NONE) {
+                best = i;
+                continue;
+            }
+            db::NoteView a = head(i), b = head(best);
+            if (a.timestamp > b.timestamp || (a.timestamp == b.timestamp && a.id > b.id)) best = i;
+        }
+        return best;
+    }
+
+    db::Database& hot_;
+    Query query_;
+    PageOptions page_;
+    bool merge_;
+    Missing& missing_;
+    std::vector<Tier> tiers_; // The hot database first
+    std::vector<TierCursor> cursors_;
+    long long emitted_ = 0;
+    long long last_id_ = -1;
+};
+
+db::NoteCursor list_notes(db::Database& hot, const TagExpression* tags, const PageOptions& page, Missing& missing) {
+    auto expr = tags ? std::make_shared<const TagExpression>(*tags) : nullptr;
+    Query query = [expr](db::Database& db, const PageOptions& p) {
+        return expr ? db::list_notes_by_tags(db, tag_index::evaluate(db, *expr), p) : db::list_recent_notes(db, p);
+    };
+    std::vector<Tier> tiers = list_tiers(hot, page.since, page.until);
+    if (tiers.empty()) return query(hot, page);
+    return db::NoteCursor(std::make_unique<TieredSource>(hot, std::move(tiers), std::move(query), page, true, missing));
+}
+
+db::NoteCursor search_notes(db::Database& hot, const std::string& query, const TagExpression* tags, bool fuzzy, const PageOptions& page,
+                            Missing& missing) {
+    auto expr = tags ? std::make_shared<const TagExpression>(*tags) : nullptr;
+    Query search = [expr, query, fuzzy](db::Database& db, const PageOptions& p) {
+        TagFilter filter = expr ? tag_index::evaluate(db, *expr) : TagFilter();
+        return fuzzy ? db::fuzzy_search_notes(db, query, filter, p) : db::search_notes(db, query, filter, p);
+    };
+    std::vector<Tier> tiers = list_tiers(hot, page.since, page.until);
+    if (tiers.empty()) return search(hot, page);
+    return db::NoteCursor(std::make_unique<TieredSource>(hot, std::move(tiers), std::move(search), page, false, missing));
+}
+
+}
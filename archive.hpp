@@ -0,0 +1,71 @@
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "database.hpp"
+#include "tag_index.hpp"
+
+// Tiered storage. `ink archive` moves notes older than a cutoff out of the
+// hot database into one archive database per year beside it
+// (~/.den_den_ink.2023.db next to ~/.den_den_ink.db), so the database every
+// command opens stays small. Archives share the hot database's schema, and
+// note ids stay unique across them since new notes only go to the hot one.
+//
+// Reads start with the hot database. An archive is opened only when the
+// --since/--until window reaches its year and the results so far don't
+// already fill the page with newer notes.
+namespace archive {
+    // One archived year, as listed in the hot database's archive_tiers table
+    struct Tier {
+        int year;
+        std::string path;
+        std::string oldest; // Timestamps of its oldest and newest notes
+        std::string newest;
+        long long notes;
+    };
+
+    // Archived years holding notes in [since, until), newest first. Empty
+    // bounds are open.
+    std::vector<Tier> list_tiers(db::Database& hot, const std::string& since = "", const std::string& until = "");
+
+    // Paths of the archives a read had to leave out, for the command to
+    // report on its error stream with report_missing
+    using Missing = std::vector<std::string>;
+
+    // Whether an archive's file is there
+    bool tier_present(const Tier& tier);
+
+    // Opens an archive. Null if its file is gone or can't be opened; its
+    // path is then added to `missing`, if given.
+    std::shared_ptr<db::Database> open_tier(const Tier& tier, Missing* missing = nullptr);
+
+    // Warns that each archive in `missing` was left out.
+    void report_missing(const Missing& missing, std::ostream& err);
+
+    // Moves notes with timestamps before `cutoff` (stored form) into their
+    // year's archive, a batch per transaction, and reports each year on
+    // `out`. Returns how many notes moved, or -1 on error.
+    long long archive_notes(db::Database& hot, const std::string& cutoff, std::ostream& out);
+
+    // Merges each full-text index into one segment and hands free pages back
+    // to the file system, in the hot database and every archive that can
+    // be opened; the others are added to `missing`.
+    bool compact(db::Database& hot, std::ostream& out, Missing& missing);
+
+    // list_recent_notes and list_notes_by_tags over every tier the page
+    // needs, merged newest first. `tags` may be null. Archives that can't be
+    // read are left out and added to `missing` as the cursor reaches them.
+    db::NoteCursor list_notes(db::Database& hot, const TagExpression* tags, const PageOptions& page, Missing& missing);
+
+    // search_notes or fuzzy_search_notes over the tiers the page needs. Each
+    // tier is ranked on its own and the next one is read only if the page
+    // isn't full yet, hot database first and then newest year first.
+    // Unreadable archives are handled as in list_notes.
+    db::NoteCursor search_notes(db::Database& hot, const std::string& query, const TagExpression* tags, bool fuzzy, const PageOptions& page,
+                                Missing& missing);
+}
+
+#endif
@@ -0,0 +1,509 @@
+#include "commands.hpp"
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <ctime>
+#include <cctype>
+#include <filesystem>
+#include <unistd.h>
+#include "archive.hpp"
+#include "completion.hpp"
+#include "metadata_collector.hpp"
+#include "note_body.hpp"
+#include "note_formatter.hpp"
+#include "stats_engine.hpp"
+#include "note_importer.hpp"
+#include "note_sync.hpp"
+#include "similar_index.hpp"
+#include "tag_index.hpp"
+#include "time_window.hpp"
+
+namespace commands {
+
+void show_usage(std::ostream& out) {
+    out << "Welcome to Den Den Ink! 🐌" << std::endl;
+    out << "A simple CLI note-taking tool." << std::endl;
+    out << "\nUsage:" << std::endl;
+    out << "  ink \"note text\" [#tags...]" << std::endl;
+    out << "  ink p \"coding note\" [#tags...]" << std::endl;
+    out << "  command | ink [p] - [\"title\"] [#tags...]" << std::endl;
+    out << "  ink search \"query\" [tag query] [--fuzzy] [--since T] [--until T] [--limit N] [--after ID] [--format F]" << std::endl;
+    out << "  ink list [tag query] [--since T] [--until T] [--limit N] [--after ID] [--format F]" << std::endl;
+    out << "  (tag query: #tags with AND, OR, NOT and ( ), e.g. #cpp AND #perf NOT #draft)" << std::endl;
+    out << "  ink similar ID [--limit N] [--format F]" << std::endl;
+    out << "  ink show ID" << std::endl;
+    out << "  ink stats [--rebuild] [--since T] [--until T] [--format F]" << std::endl;
+    out << "  (T: YYYY-MM-DD[ HH:MM[:SS]] in UTC, today, yesterday, or an age like 12h, 7d, 4w)" << std::endl;
+    out << "  (F: text, json, jsonl, tsv or nul)" << std::endl;
+    out << "  ink import [file|-] [--format jsonl|csv] [--batch N] [--restart]" << std::endl;
+    out << "  ink archive [--older-than T]" << std::endl;
+    out << "  ink compact" << std::endl;
+    out << "  ink sync OTHER.db|DIR" << std::endl;
+    out << "  ink serve" << std::endl;
+}
+
+// Stands for a note body piped in on stdin, as in `ink p - #crash`
+const std::string STDIN_ARG = "-";
+
+void parse_note_input(const std::vector<std::string>& args, int start_index, std::string& text, std::vector<std::string>& tags) {
+    auto add_tag = [&](std::string_view tag) {
+        if (std::find(tags.begin(), tags.end(), tag) == tags.end()) tags.emplace_back(tag);
+    };
+    text.clear();
+    bool first = true;
+    for (size_t i = start_index; i < args.size(); ++i) {
+        if (args[i] == STDIN_ARG) continue;
+        if (!args[i].empty() && args[i][0] == '#') {
+            add_tag(args[i]);
+            continue;
+        }
+        if (!first) text += ' ';
+        text += args[i];
+        first = false;
+    }
+    if (text.length() >= 2 && text.front() == '"' && text.back() == '"') {
+        text.pop_back();
+        text.erase(0, 1);
+    }
+    // #words inside the text are tags as well
+    std::string_view rest = text;
+    while (!rest.empty()) {
+        size_t start = 0;
+        while (start < rest.size() && std::isspace(static_cast<unsigned char>(rest[start]))) ++start;
+        size_t end = start;
+        while (end < rest.size() && !std::isspace(static_cast<unsigned char>(rest[end]))) ++end;
+        if (end > start && rest[start] == '#') add_tag(rest.substr(start, end - start));
+        rest.remove_prefix(end);
+    }
+}
+
+// Reads the body of a note whose arguments include "-". A note with no text
+// of its own takes the body's first line. False, with a message, on error
+// or when there is nothing to save.
+bool read_piped_body(const std::vector<std::string>& args, int start_index, note_body::Spool& body, std::string& text, std::ostream& err) {
+    if (std::find(args.begin() + start_index, args.end(), STDIN_ARG) == args.end()) return true;
+    if (!body.read(STDIN_FILENO)) return false;
+    if (text.empty()) text = body.first_line();
+    if (text.empty()) {
+        err << "Error: Note text cannot be empty." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string join_args(const std::vector<std::string>& args, size_t start_index) {
+    std::string joined;
+    for (size_t i = start_index; i < args.size(); ++i) {
+        if (i > start_index) joined += ' ';
+        joined += args[i];
+    }
+    return joined;
+}
+
+// Removes --after ID and --limit N (or --after=ID, --limit=N) from args.
+// Returns false if either value isn't a number.
+bool take_page_options(std::vector<std::string>& args, PageOptions& page) {
+    std::vector<std::string> rest;
+    for (size_t i = 0; i < args.size(); ++i) {
+        std::string name = args[i], value;
+        size_t eq = name.find('=');
+        if (name.rfind("--", 0) == 0 && eq != std::string::npos) {
+            value = name.substr(eq + 1);
+            name.erase(eq);
+        }
+        if (name != "--after" && name != "--limit") {
+            rest.push_back(args[i]);
+            continue;
+        }
+        if (eq == std::string::npos) {
+            if (i + 1 >= args.size()) return false;
+            value = args[++i];
+        }
+        char* end = nullptr;
+        long long number = std::strtoll(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || number < 0) return false;
+        if (name == "--after") page.after_id = number;
+        else page.limit = static_cast<int>(std::min<long long>(number, 1000000000));
+    }
+    args = std::move(rest);
+    return true;
+}
+
+// Removes --format F (or --format=F) from args. Returns false if the value
+// isn't a known format.
+bool take_format_option(std::vector<std::string>& args, formatter::Format& format) {
+    std::vector<std::string> rest;
+    for (size_t i = 0; i < args.size(); ++i) {
+        std::string value;
+        if (args[i] == "--format") {
+            if (i + 1 >= args.size()) return false;
+            value = args[++i];
+        } else if (args[i].rfind("--format=", 0) == 0) {
+            value = args[i].substr(9);
+        } else {
+            rest.push_back(args[i]);
+            continue;
+        }
+        if (!formatter::parse_format(value, format)) return false;
+    }
+    args = std::move(rest);
+    return true;
+}
+
+// A --since/--until window as epoch seconds, -1 for an open end
+struct Window {
+    long long since = -1;
+    long long until = -1;
+    bool set() const { return since >= 0 || until >= 0; }
+};
+
+// Removes --since T and --until T (or --since=T, --until=T) from args.
+// Returns false if a value isn't a date or age, or the window is empty.
+bool take_window_options(std::vector<std::string>& args, Window& window) {
+    const long long now = static_cast<long long>(std::time(nullptr));
+    std::vector<std::string> rest;
+    for (size_t i = 0; i < args.size(); ++i) {
+        std::string name = args[i], value;
+        size_t eq = name.find('=');
+        if (name.rfind("--", 0) == 0 && eq != std::string::npos) {
+            value = name.substr(eq + 1);
+            name.erase(eq);
+        }
+        if (name != "--since" && name != "--until") {
+            rest.push_back(args[i]);
+            continue;
+        }
+        if (eq == std::string::npos) {
+            if (i + 1 >= args.size()) return false;
+            value = args[++i];
+        }
+        bool until = name == "--until";
+        if (!time_window::parse_bound(value, until, now, until ? window.until : window.since)) return false;
+    }
+    args = std::move(rest);
+    return !(window.since >= 0 && window.until >= 0 && window.since >= window.until);
+}
+
+// Narrows a page to the window, in the timestamps' stored form.
+void apply_window(const Window& window, PageOptions& page) {
+    if (window.since >= 0) page.since = time_window::format_timestamp(window.since);
+    if (window.until >= 0) page.until = time_window::format_timestamp(window.until);
+}
+
+// Prints a page of notes, with a hint for fetching the next one when the
+// page came back full. Machine-readable output keeps the hint on stderr.
+void print_page(db::NoteCursor cursor, const PageOptions& page, formatter::Format format, CommandIO& io) {
+    formatter::PrintSummary summary = formatter::print_notes(cursor, io.out, io.highlight, format);
+    if (page.limit > 0 && summary.count == static_cast<size_t>(page.limit)) {
+        (format == formatter::Format::Text ? io.out : io.err) << "More: repeat with --after " << summary.last_id << std::endl;
+    }
+}
+
+bool is_write_command(const std::vector<std::string>& args) {
+    if (args.size() < 2) return false;
+    const std::string& command = args[1];
+    if (command == "list" || command == "search" || command == "show") return false;
+    if (command == "stats") return std::find(args.begin() + 2, args.end(), "--rebuild") != args.end();
+    return true;
+}
+
+int run(db::Database& db, const std::vector<std::string>& args, CommandIO& io) {
+    if (args.size() < 2) {
+        show_usage(io.out);
+        return 0;
+    }
+
+    std::string command = args[1];
+
+    if (command == "p") {
+        if (args.size() < 3) {
+            io.err << "Error: Programming note text cannot be empty." << std::endl;
+            show_usage(io.out);
+        } else {
+            std::string note_text;
+            std::vector<std::string> tags;
+            parse_note_input(args, 2, note_text, tags);
+            note_body::Spool body;
+            if (!read_piped_body(args, 2, body, note_text, io.err)) return 1;
+            const note_body::Spool* piped = body.size() > 0 ? &body : nullptr;
+            bool saved;
+            if (io.defer_metadata) {
+                io.note_id = db::add_pending_prog_note(db, note_text, tags, io.cwd.string(), piped);
+                saved = io.note_id >= 0;
+            } else {
+                ProgMetadata metadata = io.cwd.empty() ? metadata::collect_metadata() : metadata::collect_metadata(io.cwd);
+                saved = db::add_prog_note(db, note_text, tags, metadata, piped);
+            }
+            if (saved) {
+                io.out << "\n🐌 Ink captured!" << std::endl;
+            } else {
+                io.err << "Error: Failed to save your programming note." << std::endl;
+            }
+        }
+    } else if (command == "list") {
+        std::vector<std::string> list_args = args;
+        PageOptions page;
+        Window window;
+        formatter::Format format = formatter::Format::Text;
+        std::string text;
+        std::vector<std::string> tag_tokens;
+        TagExpression expr;
+        archive::Missing missing;
+        bool options_valid = take_page_options(list_args, page) && take_window_options(list_args, window) &&
+                             take_format_option(list_args, format);
+        apply_window(window, page);
+        // Tokenized like search input, so a quoted "#cpp AND #perf" works too
+        if (options_valid && list_args.size() > 2) tag_index::split_query(join_args(list_args, 2), text, tag_tokens);
+        if (!options_valid) {
+            show_usage(io.out);
+        } else if (list_args.size() == 2) {
+            if (page.limit < 0) page.limit = 10;
+            print_page(archive::list_notes(db, nullptr, page, missing), page, format, io);
+            archive::report_missing(missing, io.err);
+        } else if (text.empty() && tag_index::parse(tag_tokens, expr)) {
+            print_page(archive::list_notes(db, &expr, page, missing), page, format, io);
+            archive::report_missing(missing, io.err);
+        } else {
+            io.err << "Error: Invalid tag query." << std::endl;
+            show_usage(io.out);
+        }
+    } else if (command == "search") {
+        std::vector<std::string> search_args = args;
+        PageOptions page;
+        formatter::Format format = formatter::Format::Text;
+        std::string query;
+        std::vector<std::string> tag_tokens;
+        TagExpression expr;
+        archive::Missing missing;
+        auto fuzzy_flag = std::find(search_args.begin() + 2, search_args.end(), "--fuzzy");
+        bool fuzzy = fuzzy_flag != search_args.end();
+        if (fuzzy) search_args.erase(fuzzy_flag);
+        Window window;
+        bool options_valid = take_page_options(search_args, page) && take_window_options(search_args, window) &&
+                             take_format_option(search_args, format);
+        apply_window(window, page);
+        if (options_valid && search_args.size() >= 3) {
+            std::string input = join_args(search_args, 2);
+            if (input.size() >= 2 && input.front() == '"' && input.back() == '"' && search_args.size() == 3) {
+                input = input.substr(1, input.size() - 2);
+            }
+            tag_index::split_query(input, query, tag_tokens);
+        }
+        if (!options_valid) {
+            show_usage(io.out);
+        } else if (search_args.size() < 3 || (query.empty() && tag_tokens.empty())) {
+            io.err << "Error: Search query cannot be empty." << std::endl;
+            show_usage(io.out);
+        } else if (!tag_tokens.empty() && !tag_index::parse(tag_tokens, expr)) {
+            io.err << "Error: Invalid tag query." << std::endl;
+            show_usage(io.out);
+        } else {
+            print_page(archive::search_notes(db, query, tag_tokens.empty() ? nullptr : &expr, fuzzy, page, missing), page, format, io);
+            archive::report_missing(missing, io.err);
+        }
+    } else if (command == "similar") {
+        std::vector<std::string> similar_args = args;
+        PageOptions page;
+        formatter::Format format = formatter::Format::Text;
+        long long note_id = -1;
+        bool options_valid = take_page_options(similar_args, page) && take_format_option(similar_args, format) &&
+                             page.after_id < 0 && similar_args.size() == 3;
+        if (options_valid) {
+            char* end = nullptr;
+            note_id = std::strtoll(similar_args[2].c_str(), &end, 10);
+            options_valid = !similar_args[2].empty() && *end == '\0' && note_id >= 0;
+        }
+        std::vector<similar_index::Match> matches;
+        if (!options_valid) {
+            show_usage(io.out);
+        } else if (db::get_note_timestamp(db, note_id).empty()) {
+            io.err << "Error: No note with id " << note_id << "." << std::endl;
+            return 1;
+        } else if (!similar_index::find_similar(db, note_id, page.limit < 0 ? 10 : static_cast<size_t>(page.limit), matches)) {
+            io.err << "Error: Failed to find similar notes." << std::endl;
+            return 1;
+        } else {
+            std::vector<long long> ids;
+            for (const auto& match : matches) ids.push_back(match.id);
+            db::NoteCursor cursor = db::get_notes(db, ids);
+            formatter::print_notes(cursor, io.out, io.highlight, format);
+        }
+    } else if (command == "show") {
+        long long note_id = -1;
+        if (args.size() == 3) {
+            char* end = nullptr;
+            note_id = std::strtoll(args[2].c_str(), &end, 10);
+            if (args[2].empty() || *end != '\0') note_id = -1;
+        }
+        if (note_id < 0) {
+            show_usage(io.out);
+            return 0;
+        }
+        // The note may have been archived
+        db::Database* holder = &db;
+        std::shared_ptr<db::Database> tier;
+        archive::Missing missing;
+        if (db::get_note_timestamp(db, note_id).empty()) {
+            holder = nullptr;
+            for (const auto& entry : archive::list_tiers(db)) {
+                tier = archive::open_tier(entry, &missing);
+                if (tier && !db::get_note_timestamp(*tier, note_id).empty()) {
+                    holder = tier.get();
+                    break;
+                }
+            }
+        }
+        if (!holder) {
+            archive::report_missing(missing, io.err);
+            io.err << "Error: No note with id " << note_id << "." << std::endl;
+            return 1;
+        }
+        // Without a body, the note's own text
+        if (note_body::write(*holder, note_id, io.out) < 0) {
+            db::NoteCursor cursor = db::get_notes(*holder, {note_id});
+            FullNote note;
+            if (cursor.next(note)) io.out << note.text << std::endl;
+        }
+    } else if (command == "import") {
+        ImportOptions options;
+        bool valid = true;
+        for (size_t i = 2; i < args.size() && valid; ++i) {
+            if (args[i] == "--format" && i + 1 < args.size()) {
+                options.format = args[++i];
+            } else if (args[i].rfind("--format=", 0) == 0) {
+                options.format = args[i].substr(9);
+            } else if (args[i] == "--batch" && i + 1 < args.size()) {
+                options.batch_size = std::strtoul(args[++i].c_str(), nullptr, 10);
+                valid = options.batch_size > 0;
+            } else if (args[i] == "--restart") {
+                options.restart = true;
+            } else if (args[i] != "-" && args[i][0] == '-') {
+                valid = false;
+            } else {
+                options.source = args[i];
+            }
+        }
+        if (!valid) {
+            show_usage(io.out);
+        } else if (!importer::run_import(db, options, io.out, io.err)) {
+            return 1;
+        } else {
+            completion::rebuild(db);
+        }
+    } else if (command == "archive") {
+        // The cutoff is an age or date, as for --since
+        const char* default_age = getenv("INK_ARCHIVE_AGE");
+        std::string older_than = default_age && default_age[0] ? default_age : "365d";
+        if (args.size() == 4 && args[2] == "--older-than") {
+            older_than = args[3];
+        } else if (args.size() == 3 && args[2].rfind("--older-than=", 0) == 0) {
+            older_than = args[2].substr(13);
+        } else if (args.size() != 2) {
+            show_usage(io.out);
+            return 0;
+        }
+        long long cutoff;
+        if (!time_window::parse_bound(older_than, false, static_cast<long long>(std::time(nullptr)), cutoff)) {
+            io.err << "Error: Invalid --older-than value \"" << older_than << "\"." << std::endl;
+            return 1;
+        }
+        long long moved = archive::archive_notes(db, time_window::format_timestamp(cutoff), io.out);
+        if (moved < 0) return 1;
+        if (moved == 0) io.out << "🐌 Nothing to archive." << std::endl;
+    } else if (command == "compact") {
+        archive::Missing missing;
+        if (args.size() != 2) {
+            show_usage(io.out);
+        } else if (!archive::compact(db, io.out, missing)) {
+            io.err << "Error: Failed to compact the database." << std::endl;
+            return 1;
+        } else {
+            archive::report_missing(missing, io.err);
+        }
+    } else if (command == "sync") {
+        if (args.size() != 3) {
+            show_usage(io.out);
+            return 0;
+        }
+        // A directory stands for the database of the same name inside it,
+        // such as a synced folder or a mounted home directory
+        const std::filesystem::path local_path = db::file_path(db);
+        std::filesystem::path other_path = args[2];
+        std::error_code ec;
+        if (std::filesystem::is_directory(other_path, ec)) other_path /= local_path.filename();
+        if (!std::filesystem::is_regular_file(other_path, ec)) {
+            io.err << "Error: No database at " << other_path.string() << "." << std::endl;
+            return 1;
+        }
+        if (std::filesystem::equivalent(other_path, local_path, ec)) {
+            io.err << "Error: " << other_path.string() << " is this database." << std::endl;
+            return 1;
+        }
+        db::Database other(other_path.string());
+        note_sync::SyncReport report;
+        if (!other.is_open() || !note_sync::sync(db, other, report)) {
+            archive::report_missing(report.missing_archives, io.err);
+            io.err << "Error: Failed to sync with " << other_path.string() << "." << std::endl;
+            return 1;
+        }
+        // Replaced metadata may name new projects on either side
+        if (report.pulled > 0 || report.updated > 0) completion::rebuild(db);
+        if (report.pushed > 0 || report.updated > 0) completion::rebuild(other);
+        if (report.days == 0) {
+            io.out << "🐌 Already in sync with " << other_path.string() << "." << std::endl;
+        } else {
+            io.out << "🐌 Synced with " << other_path.string() << ": " << report.pulled << " note(s) in, " << report.pushed
+                   << " note(s) out, " << report.updated << " note(s) with newer metadata, from " << report.days << " day(s) that differed." << std::endl;
+        }
+    } else if (command == "stats") {
+        std::vector<std::string> stats_args = args;
+        formatter::Format format = formatter::Format::Text;
+        auto rebuild_flag = std::find(stats_args.begin() + 2, stats_args.end(), "--rebuild");
+        bool rebuild = rebuild_flag != stats_args.end();
+        if (rebuild) stats_args.erase(rebuild_flag);
+        Window window;
+        if (!take_window_options(stats_args, window) || !take_format_option(stats_args, format) || stats_args.size() != 2) {
+            show_usage(io.out);
+            return 0;
+        }
+        if (rebuild) {
+            if (!db::rebuild_stats(db)) {
+                io.err << "Error: Failed to rebuild statistics." << std::endl;
+                return 1;
+            }
+            completion::rebuild(db);
+            (format == formatter::Format::Text ? io.out : io.err) << "🐌 Statistics rebuilt." << std::endl;
+        }
+        if (window.set()) {
+            ActivityReport report = stats::gather_activity(db, window.since, window.until, static_cast<long long>(std::time(nullptr)));
+            archive::report_missing(report.missing_archives, io.err);
+            stats::print_activity(report, io.out, format);
+        } else {
+            AppStats app_stats = stats::gather_stats(db);
+            archive::report_missing(app_stats.missing_archives, io.err);
+            stats::print_stats(app_stats, io.out, format);
+        }
+    } else {
+        // Default action: General note
+        std::string note_text;
+        std::vector<std::string> tags;
+        parse_note_input(args, 1, note_text, tags);
+        note_body::Spool body;
+        if (!read_piped_body(args, 1, body, note_text, io.err)) return 1;
+        if (note_text.empty()) {
+            io.err << "Error: Note text cannot be empty." << std::endl;
+            show_usage(io.out);
+        } else {
+            if (db::add_general_note(db, note_text, tags, body.size() > 0 ? &body : nullptr)) {
+                io.out << "\n🐌 Ink captured!" << std::endl;
+            } else {
+                io.err << "Error: Failed to save your note." << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
+
+}
@@ -0,0 +1,33 @@
+#ifndef COMMANDS_HPP
+#define COMMANDS_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <filesystem>
+#include "database.hpp"
+
+// Where a command writes its output, and the caller's working directory.
+struct CommandIO {
+    std::ostream& out;
+    std::ostream& err;
+    std::filesystem::path cwd;
+    bool highlight; // Output is a terminal, so search matches may be bolded
+    bool defer_metadata = false; // `p` saves only the directory; the caller enriches the note afterwards
+    long long note_id = -1;      // The note a deferred `p` saved, for the caller to enrich
+};
+
+namespace commands {
+    void show_usage(std::ostream& out);
+    void parse_note_input(const std::vector<std::string>& args, int start_index, std::string& text, std::vector<std::string>& tags);
+
+    // True for commands that modify the database. The server runs these on
+    // its single writer connection.
+    bool is_write_command(const std::vector<std::string>& args);
+
+    // Runs one `ink` command line (args[0] is the program name) and returns
+    // the process exit code.
+    int run(db::Database& db, const std::vector<std::string>& args, CommandIO& io);
+}
+
+#endif
@@ -0,0 +1,367 @@
+#include "completion.hpp"
+#include "archive.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <queue>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace completion {
+
+// --- TRIE FILE ---
+// A header, the nodes breadth first (so each node's children sit side by
+// side, ordered by their first byte), then every label in one block. The
+// file is a cache of the counter tables, so it is written in the machine's
+// own byte order.
+const char TRIE_MAGIC[8] = {'I', 'N', 'K', 'T', 'R', 'I', 'E', '1'};
+
+struct TrieHeader {
+    char magic[8];
+    uint32_t node_count;
+    uint32_t label_bytes;
+};
+
+struct Trie::Node {
+    uint32_t label_offset;
+    uint32_t label_length;
+    uint32_t first_child;
+    uint32_t child_count;
+    uint32_t weight; // Notes carrying the text ending here, 0 if none does
+    uint32_t best;   // Largest weight in this subtree
+};
+
+Trie::~Trie() {
+    if (map_) munmap(map_, size_);
+}
+
+bool Trie::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(TrieHeader))) {
+        close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    map_ = map;
+    size_ = static_cast<size_t>(st.st_size);
+
+    const auto* header = static_cast<const TrieHeader*>(map_);
+    const size_t node_bytes = static_cast<size_t>(header->node_count) * sizeof(Node);
+    if (std::memcmp(header->magic, TRIE_MAGIC, sizeof(TRIE_MAGIC)) != 0 || header->node_count == 0 ||
+        size_ != sizeof(TrieHeader) + node_bytes + header->label_bytes) {
+        return false;
+    }
+    nodes_ = reinterpret_cast<const Node*>(static_cast<const char*>(map_) + sizeof(TrieHeader));
+    node_count_ = header->node_count;
+    label_bytes_ = header->label_bytes;
+    labels_ = static_cast<const char*>(map_) + sizeof(TrieHeader) + node_bytes;
+    return true;
+}
+
+const Trie::Node* Trie::node(uint32_t i) const {
+    if (i >= node_count_) return nullptr;
+    const Node& n = nodes_[i];
+    if (n.label_offset > label_bytes_ || n.label_length > label_bytes_ - n.label_offset) return nullptr;
+    // Children always come later in the file, so a damaged one can't loop
+    if (n.child_count > 0 && (n.first_child <= i || n.first_child > node_count_ || n.child_count > node_count_ - n.first_child)) return nullptr;
+    return &n;
+}
+
+std::string_view Trie::label(const Node& node) const {
+    return std::string_view(labels_ + node.label_offset, node.label_length);
+}
+
+bool Trie::find(std::string_view prefix, uint32_t& found, std::string& path) const {
+    uint32_t at = 0;
+    size_t matched = 0;
+    path.clear();
+    while (const Node* current = node(at)) {
+        std::string_view text = label(*current);
+        size_t common = std::min(text.size(), prefix.size() - matched);
+        if (text.compare(0, common, prefix.substr(matched, common)) != 0) return false;
+        path.append(text);
+        matched += common;
+        if (matched == prefix.size()) {
+            found = at;
+            return true;
+        }
+        // Children are ordered by their first byte, and no two share one
+        const unsigned char next = static_cast<unsigned char>(prefix[matched]);
+        uint32_t low = current->first_child, high = current->first_child + current->child_count;
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2;
+            const Node* child = node(middle);
+            if (!child || child->label_length == 0) return false;
+            unsigned char first = static_cast<unsigned char>(labels_[child->label_offset]);
+            if (first == next) break;
+            if (first < next) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        if (low >= high) return false;
+        at = low + (high - low) / 2;
+    }
+    return false;
+}
+
+std::vector<Candidate> Trie::complete(std::string_view prefix, size_t limit) const {
+    std::vector<Candidate> found;
+    uint32_t start;
+    std::string path;
+    if (limit == 0 || !find(prefix, start, path)) return found;
+
+    // Best first: a subtree is queued by the largest weight inside it, which
+    // no candidate below it can beat, so candidates leave the queue in order
+    struct Item {
+        long long priority;
+        std::string text;
+        uint32_t node;
+        bool candidate;
+    };
+    auto later = [](const Item& a, const Item& b) {
+        return a.priority != b.priority ? a.priority < b.priority : a.text > b.text;
+    };
+    std::priority_queue<Item, std::vector<Item>, decltype(later)> queue(later);
+    queue.push({node(start)->best, path, start, false});
+    while (!queue.empty() && found.size() < limit) {
+        Item item = queue.top();
+        queue.pop();
+        if (item.candidate) {
+            found.push_back({std::move(item.text), item.priority});
+            continue;
+        }
+        const Node& current = nodes_[item.node];
+        if (current.weight > 0) queue.push({current.weight, item.text, item.node, true});
+        for (uint32_t i = current.first_child; i < current.first_child + current.child_count; ++i) {
+            if (const Node* child = node(i)) queue.push({child->best, item.text + std::string(label(*child)), i, false});
+        }
+    }
+    return found;
+}
+
+long long Trie::weight(std::string_view text) const {
+    uint32_t at;
+    std::string path;
+    if (!find(text, at, path) || path.size() != text.size()) return 0;
+    return nodes_[at].weight;
+}
+
+bool write_trie(const std::string& path, std::vector<Candidate> candidates) {
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.text < b.text; });
+
+    // Breadth first over the sorted texts: a node takes the prefix its whole
+    // range shares, and its children split the rest by their next byte
+    struct Range {
+        uint32_t node;
+        size_t begin, end, depth;
+    };
+    std::vector<Trie::Node> nodes(1, Trie::Node{});
+    std::string labels;
+    std::vector<Range> ranges = {{0, 0, candidates.size(), 0}};
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        Range range = ranges[r];
+        if (range.begin == range.end) continue;
+        const std::string& first = candidates[range.begin].text;
+        const std::string& last = candidates[range.end - 1].text;
+        size_t shared = range.depth;
+        while (shared < first.size() && shared < last.size() && first[shared] == last[shared]) ++shared;
+        if (labels.size() + (shared - range.depth) > std::numeric_limits<uint32_t>::max()) return false;
+
+        Trie::Node& node = nodes[range.node];
+        node.label_offset = static_cast<uint32_t>(labels.size());
+        node.label_length = static_cast<uint32_t>(shared - range.depth);
+        labels.append(first, range.depth, shared - range.depth);
+        if (first.size() == shared) {
+            long long weight = std::max(1LL, candidates[range.begin].weight);
+            node.weight = static_cast<uint32_t>(std::min<long long>(weight, std::numeric_limits<uint32_t>::max()));
+            ++range.begin;
+        }
+        node.first_child = static_cast<uint32_t>(nodes.size());
+        for (size_t i = range.begin; i < range.end;) {
+            size_t j = i + 1;
+            while (j < range.end && candidates[j].text[shared] == candidates[i].text[shared]) ++j;
+            ranges.push_back({static_cast<uint32_t>(nodes.size()), i, j, shared});
+            nodes.push_back(Trie::Node{});
+            i = j;
+        }
+        nodes[range.node].child_count = static_cast<uint32_t>(nodes.size()) - nodes[range.node].first_child;
+    }
+    // Children come after their parents, so one backward pass fills in `best`
+    for (size_t i = nodes.size(); i-- > 0;) {
+        Trie::Node& node = nodes[i];
+        node.best = node.weight;
+        for (uint32_t c = node.first_child; c < node.first_child + node.child_count; ++c) node.best = std::max(node.best, nodes[c].best);
+    }
+
+    TrieHeader header;
+    std::memcpy(header.magic, TRIE_MAGIC, sizeof(TRIE_MAGIC));
+    header.node_count = static_cast<uint32_t>(nodes.size());
+    header.label_bytes = static_cast<uint32_t>(labels.size());
+    // Written aside and renamed over the old file, so a lookup that already
+    // mapped it keeps reading a whole trie
+    const std::string temp_path = path + "." + std::to_string(getpid());
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(nodes.data()), static_cast<std::streamsize>(nodes.size() * sizeof(Trie::Node)));
+        out.write(labels.data(), static_cast<std::streamsize>(labels.size()));
+        if (!out.flush()) {
+            std::remove(temp_path.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// --- KEEPING IT CURRENT ---
+// Past this size the log is folded into a fresh trie, about 3000 entries
+const off_t LOG_LIMIT = 64 * 1024;
+
+std::string trie_path(const std::string& db_path) {
+    return db::sidecar_path(db_path, ".complete");
+}
+
+std::string log_path(const std::string& db_path) {
+    return db::sidecar_path(db_path, ".complete.log");
+}
+
+void add_counts(db::Database& db, std::map<std::string, long long>& weights) {
+    for (const auto& tag : db::get_tag_counts(db, -1)) weights["#" + tag.first] += tag.second;
+    for (const auto& project : db::get_project_counts(db, -1)) weights[project.first] += project.second;
+}
+
+bool rebuild(db::Database& db) {
+    INK_TRACE_SCOPE("rebuild_completions");
+    const std::string path = db::file_path(db);
+    if (path.empty()) return false;
+    // Emptied before the counters are read: a note saved from here on is
+    // either counted below or logged again, never dropped
+    if (truncate(log_path(path).c_str(), 0) != 0 && errno != ENOENT) return false;
+
+    std::map<std::string, long long> weights;
+    add_counts(db, weights);
+    for (const auto& tier : archive::list_tiers(db)) {
+        if (auto archive_db = archive::open_tier(tier)) add_counts(*archive_db, weights);
+    }
+    std::vector<Candidate> candidates;
+    candidates.reserve(weights.size());
+    for (auto& entry : weights) {
+        if (entry.second > 0) candidates.push_back({entry.first, entry.second});
+    }
+    return write_trie(trie_path(path), std::move(candidates));
+}
+
+void note_added(db::Database& db, const std::vector<std::string>& tags, const std::string& directory) {
+    const std::string path = db::file_path(db);
+    if (path.empty()) return;
+    // One line per candidate, each worth one note
+    std::string entries;
+    for (const auto& tag : tags) {
+        std::string_view name = (!tag.empty() && tag[0] == '#') ? std::string_view(tag).substr(1) : std::string_view(tag);
+        if (name.empty() || name.find('\n') != std::string_view::npos) continue;
+        entries.append("#").append(name).append("\n");
+    }
+    if (!directory.empty() && directory.find('\n') == std::string::npos) entries.append(directory).append("\n");
+
+    int fd = ::open(log_path(path).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    // One write, so entries from concurrent saves don't interleave
+    bool written = entries.empty() || write(fd, entries.data(), entries.size()) == static_cast<ssize_t>(entries.size());
+    struct stat st;
+    bool full = fstat(fd, &st) == 0 && st.st_size > LOG_LIMIT;
+    close(fd);
+    if (!written || full || access(trie_path(path).c_str(), F_OK) != 0) rebuild(db);
+}
+
+// --- LOOKUPS ---
+// Candidates printed per completion
+const size_t COMPLETE_LIMIT = 100;
+
+const std::vector<std::string> COMMANDS = {"p", "search", "list", "similar", "show", "stats", "import", "archive", "compact", "sync", "serve"};
+
+// Counts the log's entries that start with `prefix`
+std::unordered_map<std::string, long long> read_log(const std::string& path, std::string_view prefix) {
+    std::unordered_map<std::string, long long> counts;
+    std::ifstream in(path, std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.compare(0, prefix.size(), prefix) == 0) ++counts[line];
+    }
+    return counts;
+}
+
+std::vector<Candidate> lookup(const std::string& db_path, const std::string& prefix) {
+    INK_TRACE_SCOPE("complete_lookup");
+    Trie trie;
+    if (!trie.open(trie_path(db_path))) {
+        // Built once, the first time completion runs on an existing database
+        db::Database db(db_path);
+        if (!db.is_open() || !rebuild(db) || !trie.open(trie_path(db_path))) return {};
+    }
+    std::vector<Candidate> found = trie.complete(prefix, COMPLETE_LIMIT);
+    auto logged = read_log(log_path(db_path), prefix);
+    if (logged.empty()) return found;
+
+    // The trie's top matches plus anything logged since it was built is
+    // enough: a candidate that is in neither can't outweigh those that are
+    for (auto& candidate : found) {
+        auto it = logged.find(candidate.text);
+        if (it == logged.end()) continue;
+        candidate.weight += it->second;
+        logged.erase(it);
+    }
+    for (const auto& entry : logged) found.push_back({entry.first, trie.weight(entry.first) + entry.second});
+    std::sort(found.begin(), found.end(), [](const Candidate& a, const Candidate& b) {
+        return a.weight != b.weight ? a.weight > b.weight : a.text < b.text;
+    });
+    if (found.size() > COMPLETE_LIMIT) found.resize(COMPLETE_LIMIT);
+    return found;
+}
+
+int run(const std::string& db_path, const std::vector<std::string>& words, std::ostream& out) {
+    INK_TRACE_SCOPE("complete");
+    const std::string current = words.empty() ? "" : words.back();
+    const std::string command = words.size() >= 2 ? words.front() : "";
+    const std::string previous = words.size() >= 2 ? words[words.size() - 2] : "";
+    std::vector<std::string> matches;
+    auto offer = [&](const std::vector<std::string>& options) {
+        for (const auto& option : options) {
+            if (option.compare(0, current.size(), current) == 0) matches.push_back(option);
+        }
+    };
+
+    if (words.size() <= 1) {
+        offer(COMMANDS);
+    } else if (previous == "--format") {
+        offer(command == "import" ? std::vector<std::string>{"jsonl", "csv"} : std::vector<std::string>{"text", "json", "jsonl", "tsv", "nul"});
+    } else if (current.compare(0, 1, "#") == 0 || (command == "search" && current.compare(0, 1, "/") == 0)) {
+        // Tags anywhere; project directories in a search, which matches them
+        for (auto& candidate : lookup(db_path, current)) matches.push_back(std::move(candidate.text));
+    }
+
+    std::string output;
+    for (const auto& match : matches) output.append(match).append("\n");
+    out << output;
+    out.flush();
+    return 0;
+}
+
+}
@@ -0,0 +1,82 @@
+#ifndef COMPLETION_HPP
+#define COMPLETION_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "database.hpp"
+
+// Shell completion for #tags and project directories. The candidates live
+// in a prefix trie serialized next to the database (~/.den_den_ink.complete)
+// and mapped read-only, so a lookup never opens SQLite. Saving a note
+// appends its tags and directory to a small log beside the trie
+// (~/.den_den_ink.complete.log), which lookups fold in; once the log grows
+// past a few thousand entries the next save rebuilds the trie from the
+// counter tables and empties it.
+namespace completion {
+    struct Candidate {
+        std::string text; // "#tag" or a directory path
+        long long weight; // Notes carrying it
+    };
+
+    // A radix trie of candidates mapped from a file. Each node carries the
+    // largest weight below it, so the heaviest matches come out first
+    // without visiting the rest.
+    class Trie {
+    public:
+        struct Node; // As laid out in the file
+
+        Trie() = default;
+        ~Trie();
+        Trie(const Trie&) = delete;
+        Trie& operator=(const Trie&) = delete;
+
+        // Maps the file. False if it is missing or malformed.
+        bool open(const std::string& path);
+        // The `limit` heaviest candidates starting with `prefix`, by weight
+        // and then text.
+        std::vector<Candidate> complete(std::string_view prefix, size_t limit) const;
+        // The weight of exactly `text`, or 0.
+        long long weight(std::string_view text) const;
+
+    private:
+        // The node whose subtree holds every candidate starting with
+        // `prefix`, and the text leading up to it. False if there is none.
+        bool find(std::string_view prefix, uint32_t& found, std::string& path) const;
+        // Node i, or null if it points outside the file. Nodes are checked as
+        // they are reached, so a lookup only touches the pages it needs.
+        const Node* node(uint32_t i) const;
+        std::string_view label(const Node& node) const;
+
+        void* map_ = nullptr;
+        size_t size_ = 0;
+        const Node* nodes_ = nullptr;
+        uint32_t node_count_ = 0;
+        uint32_t label_bytes_ = 0;
+        const char* labels_ = nullptr;
+    };
+
+    // Serializes candidates as a trie file. Texts must be unique.
+    bool write_trie(const std::string& path, std::vector<Candidate> candidates);
+
+    // Paths of the trie and its log for a database file.
+    std::string trie_path(const std::string& db_path);
+    std::string log_path(const std::string& db_path);
+
+    // Rebuilds the trie from the tag and project counters of the database
+    // and its archives, and empties the log.
+    bool rebuild(db::Database& db);
+
+    // Records a saved note's tags and directory in the log, rebuilding the
+    // trie when it is missing or the log has grown. Failures only cost
+    // completions, so they are ignored.
+    void note_added(db::Database& db, const std::vector<std::string>& tags, const std::string& directory);
+
+    // `ink __complete WORD...`: the words after `ink` up to the one being
+    // completed, which may be empty. Prints one candidate per line.
+    int run(const std::string& db_path, const std::vector<std::string>& words, std::ostream& out);
+}
+
+#endif
@@ -1,10 +1,109 @@
 #include "database.hpp"
+#include "completion.hpp"
+#include "fuzzy_index.hpp"
+#include "note_body.hpp"
+#include "note_sync.hpp"
+#include "query_executor.hpp"
+#include "similar_index.hpp"
+#include "tag_index.hpp"
+#include "trace.hpp"
 #include <iostream>
 #include <vector>
 #include <sstream>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+#include <limits>
 
 namespace db {
 
+// --- STATEMENT HANDLE ---
+Statement::Statement(sqlite3_stmt* stmt, bool* in_use) : stmt_(stmt), in_use_(in_use) {}
+
+Statement::Statement(Statement&& other) noexcept : stmt_(other.stmt_), in_use_(other.in_use_) {
+    other.stmt_ = nullptr;
+    other.in_use_ = nullptr;
+}
+
+Statement& Statement::operator=(Statement&& other) noexcept {
+    if (this != &other) {
+        release();
+        stmt_ = other.stmt_;
+        in_use_ = other.in_use_;
+        other.stmt_ = nullptr;
+        other.in_use_ = nullptr;
+    }
+    return *this;
+}
+
+Statement::~Statement() { release(); }
+
+void Statement::release() {
+    if (!stmt_) return;
+    if (in_use_) {
+        // Hand the statement back to the cache in a clean state
+        sqlite3_reset(stmt_);
+        sqlite3_clear_bindings(stmt_);
+        *in_use_ = false;
+    } else {
+        sqlite3_finalize(stmt_);
+    }
+    stmt_ = nullptr;
+    in_use_ = nullptr;
+}
+
+Statement& Statement::bind(int index, int value) { sqlite3_bind_int(stmt_, index, value); return *this; }
+Statement& Statement::bind(int index, long long value) { sqlite3_bind_int64(stmt_, index, value); return *this; }
+Statement& Statement::bind(int index, double value) { sqlite3_bind_double(stmt_, index, value); return *this; }
+Statement& Statement::bind(int index, const std::string& value) {
+    sqlite3_bind_text(stmt_, index, value.c_str(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+    return *this;
+}
+Statement& Statement::bind(int index, const char* value) { sqlite3_bind_text(stmt_, index, value, -1, SQLITE_TRANSIENT); return *this; }
+Statement& Statement::bind_null(int index) { sqlite3_bind_null(stmt_, index); return *this; }
+Statement& Statement::bind_pointer(int index, const void* value, const char* type) {
+    sqlite3_bind_pointer(stmt_, index, const_cast<void*>(value), type, nullptr);
+    return *this;
+}
+Statement& Statement::bind_optional(int index, const std::string& value) {
+    return value.empty() ? bind_null(index) : bind(index, value);
+}
+Statement& Statement::bind_blob(int index, std::string_view value) {
+    sqlite3_bind_blob(stmt_, index, value.data(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+    return *this;
+}
+
+bool Statement::step() { return stmt_ && sqlite3_step(stmt_) == SQLITE_ROW; }
+
+bool Statement::run() {
+    if (!stmt_) return false;
+    int rc = sqlite3_step(stmt_);
+    sqlite3_reset(stmt_);
+    return rc == SQLITE_DONE;
+}
+
+void Statement::reset() { if (stmt_) sqlite3_reset(stmt_); }
+
+int Statement::column_count() const { return sqlite3_column_count(stmt_); }
+int Statement::column_int(int index) const { return sqlite3_column_int(stmt_, index); }
+long long Statement::column_int64(int index) const { return sqlite3_column_int64(stmt_, index); }
+std::string Statement::column_text(int index) const {
+    const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt_, index));
+    return text ? std::string(text, sqlite3_column_bytes(stmt_, index)) : std::string();
+}
+std::string_view Statement::column_view(int index) const {
+    const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt_, index));
+    return text ? std::string_view(text, sqlite3_column_bytes(stmt_, index)) : std::string_view();
+}
+std::string_view Statement::column_blob(int index) const {
+    const char* blob = static_cast<const char*>(sqlite3_column_blob(stmt_, index));
+    return blob ? std::string_view(blob, sqlite3_column_bytes(stmt_, index)) : std::string_view();
+}
+
 // --- CORE HELPER AND INIT FUNCTIONS ---
 bool execute_sql(sqlite3* db, const std::string& sql) {
     char* errmsg = nullptr;
@@ -17,194 +116,1360 @@ bool execute_sql(sqlite3* db, const std::string& sql) {
     return true;
 }
 
-sqlite3* init_database(const std::string& db_path) {
-    sqlite3* db;
-    if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK) {
-        std::cerr << "Can't open database: " << sqlite3_errmsg(db) << std::endl;
-        return nullptr;
-    }
-    execute_sql(db, "PRAGMA foreign_keys = ON;");
-    const std::vector<std::string> create_tables_sql = {
+// --- SCHEMA MIGRATIONS ---
+// Recomputes the stats counter tables from scratch, as of migration v5.
+// Frozen with that migration; STATS_REBUILD_SQL follows the current schema.
+const std::vector<std::string> STATS_REBUILD_SQL_V5 = {
+    "DELETE FROM stat_totals;",
+    "DELETE FROM stat_tag_counts;",
+    "DELETE FROM stat_project_counts;",
+    "DELETE FROM stat_daily_counts;",
+    "INSERT INTO stat_totals (name, count) SELECT 'notes', COUNT(*) FROM notes;",
+    "INSERT INTO stat_tag_counts (tag_name, count) SELECT tag_name, COUNT(*) FROM tags GROUP BY tag_name;",
+    "INSERT INTO stat_project_counts (current_directory, count) SELECT current_directory, COUNT(*) FROM metadata WHERE current_directory IS NOT NULL GROUP BY current_directory;",
+    "INSERT INTO stat_daily_counts (day, count) SELECT STRFTIME('%Y-%m-%d', timestamp), COUNT(*) FROM notes GROUP BY 1;"
+};
+
+// Recomputes the stats counter tables from scratch. Shared by migration v7
+// and `ink stats --rebuild`.
+const std::vector<std::string> STATS_REBUILD_SQL = {
+    "DELETE FROM stat_totals;",
+    "DELETE FROM stat_tag_counts;",
+    "DELETE FROM stat_project_counts;",
+    "DELETE FROM stat_daily_counts;",
+    "INSERT INTO stat_totals (name, count) SELECT 'notes', COUNT(*) FROM notes;",
+    "INSERT INTO stat_tag_counts (tag_id, count) SELECT tag_id, COUNT(*) FROM note_tags GROUP BY tag_id;",
+    "INSERT INTO stat_project_counts (dir_id, count) SELECT dir_id, COUNT(*) FROM metadata WHERE dir_id IS NOT NULL GROUP BY dir_id;",
+    "INSERT INTO stat_daily_counts (day, count) SELECT STRFTIME('%Y-%m-%d', timestamp), COUNT(*) FROM notes GROUP BY 1;"
+};
+
+std::vector<std::string> concat_sql(std::vector<std::string> first, const std::vector<std::string>& second) {
+    first.insert(first.end(), second.begin(), second.end());
+    return first;
+}
+
+// A note's entry in sync_days, its key XOR its metadata's key, which SQLite
+// spells (a | b) & ~(a & b), and the two halves that get summed
+#define SYNC_ENTRY(row) "((" row ".key | " row ".meta) & ~(" row ".key & " row ".meta))"
+#define SYNC_LOW(row) "(" SYNC_ENTRY(row) " & 4294967295)"
+#define SYNC_HIGH(row) "(" SYNC_ENTRY(row) " >> 32)"
+// The metadata key of one note, or NULL if it has no metadata
+#define SYNC_META_QUERY(note_id) \
+    "SELECT ink_metadata_key(d.path, m.last_edited_file, m.git_branch, m.recent_commit_hash) FROM metadata m LEFT JOIN dir_dict d ON d.id = m.dir_id WHERE m.note_id = " note_id
+
+// Each entry upgrades the schema by one version, tracked in PRAGMA user_version.
+// Entries are append-only: never edit a migration that has already shipped.
+// Statements are idempotent so databases created before versioning existed
+// (user_version 0) can be upgraded in place.
+const std::vector<std::vector<std::string>> SCHEMA_MIGRATIONS = {
+    // v1: Base tables
+    {
         "CREATE TABLE IF NOT EXISTS notes (id INTEGER PRIMARY KEY AUTOINCREMENT, text TEXT NOT NULL, timestamp DATETIME DEFAULT CURRENT_TIMESTAMP, type TEXT NOT NULL);",
         "CREATE TABLE IF NOT EXISTS tags (id INTEGER PRIMARY KEY AUTOINCREMENT, note_id INTEGER NOT NULL, tag_name TEXT NOT NULL, FOREIGN KEY(note_id) REFERENCES notes(id) ON DELETE CASCADE);",
         "CREATE TABLE IF NOT EXISTS metadata (note_id INTEGER PRIMARY KEY, current_directory TEXT, last_edited_file TEXT, git_branch TEXT, recent_commit_hash TEXT, FOREIGN KEY(note_id) REFERENCES notes(id) ON DELETE CASCADE);"
-    };
-    for(const auto& sql : create_tables_sql) {
-        if (!execute_sql(db, sql)) { sqlite3_close(db); return nullptr; }
+    },
+    // v2: FTS5 index over note text and programming metadata, kept in sync by triggers
+    {
+        "CREATE VIRTUAL TABLE IF NOT EXISTS notes_fts USING fts5(text, current_directory, last_edited_file, git_branch);",
+        "CREATE TRIGGER IF NOT EXISTS notes_fts_ai AFTER INSERT ON notes BEGIN INSERT INTO notes_fts (rowid, text) VALUES (new.id, new.text); END;",
+        "CREATE TRIGGER IF NOT EXISTS notes_fts_ad AFTER DELETE ON notes BEGIN DELETE FROM notes_fts WHERE rowid = old.id; END;",
+        "CREATE TRIGGER IF NOT EXISTS notes_fts_au AFTER UPDATE OF text ON notes BEGIN UPDATE notes_fts SET text = new.text WHERE rowid = new.id; END;",
+        "CREATE TRIGGER IF NOT EXISTS metadata_fts_ai AFTER INSERT ON metadata BEGIN UPDATE notes_fts SET current_directory = new.current_directory, last_edited_file = new.last_edited_file, git_branch = new.git_branch WHERE rowid = new.note_id; END;",
+        "CREATE TRIGGER IF NOT EXISTS metadata_fts_au AFTER UPDATE ON metadata BEGIN UPDATE notes_fts SET current_directory = new.current_directory, last_edited_file = new.last_edited_file, git_branch = new.git_branch WHERE rowid = new.note_id; END;",
+        "CREATE TRIGGER IF NOT EXISTS metadata_fts_ad AFTER DELETE ON metadata BEGIN UPDATE notes_fts SET current_directory = NULL, last_edited_file = NULL, git_branch = NULL WHERE rowid = old.note_id; END;",
+        // Backfill notes written before the index existed
+        "INSERT INTO notes_fts (rowid, text, current_directory, last_edited_file, git_branch) SELECT n.id, n.text, m.current_directory, m.last_edited_file, m.git_branch FROM notes n LEFT JOIN metadata m ON n.id = m.note_id WHERE n.id NOT IN (SELECT rowid FROM notes_fts);"
+    },
+    // v3: Secondary indexes for tag lookups, recency ordering and project grouping
+    {
+        "CREATE INDEX IF NOT EXISTS idx_tags_name_note ON tags (tag_name, note_id);",
+        "CREATE INDEX IF NOT EXISTS idx_tags_note_name ON tags (note_id, tag_name);",
+        "CREATE INDEX IF NOT EXISTS idx_notes_timestamp ON notes (timestamp);",
+        "CREATE INDEX IF NOT EXISTS idx_metadata_directory ON metadata (current_directory);"
+    },
+    // v4: Bulk import support. import_progress holds checkpoints that let an
+    // interrupted `ink import` resume. search_index_state lets a bulk load
+    // switch off the per-row FTS triggers (each one forces FTS5 to flush a tiny
+    // segment) and index the whole batch with one INSERT ... SELECT instead.
+    {
+        "CREATE TABLE IF NOT EXISTS import_progress (source TEXT PRIMARY KEY, byte_offset INTEGER NOT NULL, records INTEGER NOT NULL, completed INTEGER NOT NULL DEFAULT 0);",
+        "CREATE TABLE IF NOT EXISTS search_index_state (id INTEGER PRIMARY KEY CHECK (id = 0), deferred INTEGER NOT NULL DEFAULT 0);",
+        "INSERT OR IGNORE INTO search_index_state (id, deferred) VALUES (0, 0);",
+        "DROP TRIGGER IF EXISTS notes_fts_ai;",
+        "DROP TRIGGER IF EXISTS metadata_fts_ai;",
+        "CREATE TRIGGER notes_fts_ai AFTER INSERT ON notes WHEN (SELECT deferred FROM search_index_state) = 0 BEGIN INSERT INTO notes_fts (rowid, text) VALUES (new.id, new.text); END;",
+        "CREATE TRIGGER metadata_fts_ai AFTER INSERT ON metadata WHEN (SELECT deferred FROM search_index_state) = 0 BEGIN UPDATE notes_fts SET current_directory = new.current_directory, last_edited_file = new.last_edited_file, git_branch = new.git_branch WHERE rowid = new.note_id; END;"
+    },
+    // v5: Counter tables behind `ink stats`, kept current by triggers so the
+    // stats read path is a handful of top-N index lookups. Bulk loads defer
+    // these triggers too and add each batch's counts in flush_bulk_insert.
+    concat_sql({
+        "CREATE TABLE IF NOT EXISTS stat_totals (name TEXT PRIMARY KEY, count INTEGER NOT NULL);",
+        "CREATE TABLE IF NOT EXISTS stat_tag_counts (tag_name TEXT PRIMARY KEY, count INTEGER NOT NULL);",
+        "CREATE TABLE IF NOT EXISTS stat_project_counts (current_directory TEXT PRIMARY KEY, count INTEGER NOT NULL);",
+        "CREATE TABLE IF NOT EXISTS stat_daily_counts (day TEXT PRIMARY KEY, count INTEGER NOT NULL);",
+        "CREATE INDEX IF NOT EXISTS idx_stat_tag_counts_count ON stat_tag_counts (count);",
+        "CREATE INDEX IF NOT EXISTS idx_stat_project_counts_count ON stat_project_counts (count);",
+        "CREATE TRIGGER IF NOT EXISTS notes_stats_ai AFTER INSERT ON notes WHEN (SELECT deferred FROM search_index_state) = 0 BEGIN "
+            "UPDATE stat_totals SET count = count + 1 WHERE name = 'notes'; "
+            "INSERT INTO stat_daily_counts (day, count) VALUES (STRFTIME('%Y-%m-%d', new.timestamp), 1) ON CONFLICT(day) DO UPDATE SET count = count + 1; END;",
+        "CREATE TRIGGER IF NOT EXISTS notes_stats_ad AFTER DELETE ON notes BEGIN "
+            "UPDATE stat_totals SET count = count - 1 WHERE name = 'notes'; "
+            "UPDATE stat_daily_counts SET count = count - 1 WHERE day = STRFTIME('%Y-%m-%d', old.timestamp); "
+            "DELETE FROM stat_daily_counts WHERE day = STRFTIME('%Y-%m-%d', old.timestamp) AND count <= 0; END;",
+        "CREATE TRIGGER IF NOT EXISTS notes_stats_au AFTER UPDATE OF timestamp ON notes BEGIN "
+            "UPDATE stat_daily_counts SET count = count - 1 WHERE day = STRFTIME('%Y-%m-%d', old.timestamp); "
+            "DELETE FROM stat_daily_counts WHERE day = STRFTIME('%Y-%m-%d', old.timestamp) AND count <= 0; "
+            "INSERT INTO stat_daily_counts (day, count) VALUES (STRFTIME('%Y-%m-%d', new.timestamp), 1) ON CONFLICT(day) DO UPDATE SET count = count + 1; END;",
+        "CREATE TRIGGER IF NOT EXISTS tags_stats_ai AFTER INSERT ON tags WHEN (SELECT deferred FROM search_index_state) = 0 BEGIN "
+            "INSERT INTO stat_tag_counts (tag_name, count) VALUES (new.tag_name, 1) ON CONFLICT(tag_name) DO UPDATE SET count = count + 1; END;",
+        "CREATE TRIGGER IF NOT EXISTS tags_stats_ad AFTER DELETE ON tags BEGIN "
+            "UPDATE stat_tag_counts SET count = count - 1 WHERE tag_name = old.tag_name; "
+            "DELETE FROM stat_tag_counts WHERE tag_name = old.tag_name AND count <= 0; END;",
+        "CREATE TRIGGER IF NOT EXISTS metadata_stats_ai AFTER INSERT ON metadata WHEN new.current_directory IS NOT NULL AND (SELECT deferred FROM search_index_state) = 0 BEGIN "
+            "INSERT INTO stat_project_counts (current_directory, count) VALUES (new.current_directory, 1) ON CONFLICT(current_directory) DO UPDATE SET count = count + 1; END;",
+        "CREATE TRIGGER IF NOT EXISTS metadata_stats_ad AFTER DELETE ON metadata WHEN old.current_directory IS NOT NULL BEGIN "
+            "UPDATE stat_project_counts SET count = count - 1 WHERE current_directory = old.current_directory; "
+            "DELETE FROM stat_project_counts WHERE current_directory = old.current_directory AND count <= 0; END;",
+        "CREATE TRIGGER IF NOT EXISTS metadata_stats_au AFTER UPDATE OF current_directory ON metadata BEGIN "
+            "UPDATE stat_project_counts SET count = count - 1 WHERE current_directory = old.current_directory; "
+            "DELETE FROM stat_project_counts WHERE current_directory = old.current_directory AND count <= 0; "
+            "INSERT INTO stat_project_counts (current_directory, count) SELECT new.current_directory, 1 WHERE new.current_directory IS NOT NULL ON CONFLICT(current_directory) DO UPDATE SET count = count + 1; END;"
+    }, STATS_REBUILD_SQL_V5),
+    // v6: Enrichment state for programming notes. `ink p` saves the note with
+    // just its directory and fills in the git and file details afterwards:
+    // 'pending' while that runs, 'timed_out' if it gave up.
+    {
+        "ALTER TABLE metadata ADD COLUMN enrichment TEXT NOT NULL DEFAULT 'done' CHECK (enrichment IN ('pending', 'done', 'timed_out'));",
+        "CREATE INDEX IF NOT EXISTS idx_metadata_pending ON metadata (note_id) WHERE enrichment = 'pending';"
+    },
+    // v7: Tag names and directories move into dictionaries, and rows refer to
+    // them by integer id. note_tags is keyed on (tag_id, note_id) without a
+    // rowid, so a tag's posting list is one range of the primary key. The
+    // counter tables and their triggers switch to ids as well.
+    concat_sql({
+        "CREATE TABLE tag_dict (id INTEGER PRIMARY KEY, name TEXT NOT NULL UNIQUE);",
+        "CREATE TABLE dir_dict (id INTEGER PRIMARY KEY, path TEXT NOT NULL UNIQUE);",
+        "INSERT INTO tag_dict (name) SELECT DISTINCT tag_name FROM tags;",
+        "CREATE TABLE note_tags (tag_id INTEGER NOT NULL REFERENCES tag_dict(id), note_id INTEGER NOT NULL REFERENCES notes(id) ON DELETE CASCADE, PRIMARY KEY (tag_id, note_id)) WITHOUT ROWID;",
+        "INSERT OR IGNORE INTO note_tags (tag_id, note_id) SELECT d.id, t.note_id FROM tags t JOIN tag_dict d ON d.name = t.tag_name;",
+        "CREATE INDEX idx_note_tags_note ON note_tags (note_id, tag_id);",
+        "DROP TABLE tags;",
+        "INSERT INTO dir_dict (path) SELECT DISTINCT current_directory FROM metadata WHERE current_directory IS NOT NULL;",
+        "CREATE TABLE metadata_v7 (note_id INTEGER PRIMARY KEY, dir_id INTEGER REFERENCES dir_dict(id), last_edited_file TEXT, git_branch TEXT, recent_commit_hash TEXT, "
+            "enrichment TEXT NOT NULL DEFAULT 'done' CHECK (enrichment IN ('pending', 'done', 'timed_out')), FOREIGN KEY(note_id) REFERENCES notes(id) ON DELETE CASCADE);",
+        "INSERT INTO metadata_v7 (note_id, dir_id, last_edited_file, git_branch, recent_commit_hash, enrichment) "
+            "SELECT m.note_id, d.id, m.last_edited_file, m.git_branch, m.recent_commit_hash, m.enrichment FROM metadata m LEFT JOIN dir_dict d ON d.path = m.current_directory;",
+        "DROP TABLE metadata;",
+        "ALTER TABLE metadata_v7 RENAME TO metadata;",
+        "CREATE INDEX idx_metadata_dir ON metadata (dir_id);",
+        "CREATE INDEX idx_metadata_pending ON metadata (note_id) WHERE enrichment = 'pending';",
+        "DROP TABLE stat_tag_counts;",
+        "DROP TABLE stat_project_counts;",
+        "CREATE TABLE stat_tag_counts (tag_id INTEGER PRIMARY KEY, count INTEGER NOT NULL);",
+        "CREATE TABLE stat_project_counts (dir_id INTEGER PRIMARY KEY, count INTEGER NOT NULL);",
+        "CREATE INDEX idx_stat_tag_counts_count ON stat_tag_counts (count);",
+        "CREATE INDEX idx_stat_project_counts_count ON stat_project_counts (count);",
+        "CREATE TRIGGER metadata_fts_ai AFTER INSERT ON metadata WHEN (SELECT deferred FROM search_index_state) = 0 BEGIN "
+            "UPDATE notes_fts SET current_directory = (SELECT path FROM dir_dict WHERE id = new.dir_id), last_edited_file = new.last_edited_file, git_branch = new.git_branch WHERE rowid = new.note_id; END;",
+        "CREATE TRIGGER metadata_fts_au AFTER UPDATE ON metadata BEGIN "
+            "UPDATE notes_fts SET current_directory = (SELECT path FROM dir_dict WHERE id = new.dir_id), last_edited_file = new.last_edited_file, git_branch = new.git_branch WHERE rowid = new.note_id; END;",
+        "CREATE TRIGGER metadata_fts_ad AFTER DELETE ON metadata BEGIN UPDATE notes_fts SET current_directory = NULL, last_edited_file = NULL, git_branch = NULL WHERE rowid = old.note_id; END;",
+        "CREATE TRIGGER note_tags_stats_ai AFTER INSERT ON note_tags WHEN (SELECT deferred FROM search_index_state) = 0 BEGIN "
+            "INSERT INTO stat_tag_counts (tag_id, count) VALUES (new.tag_id, 1) ON CONFLICT(tag_id) DO UPDATE SET count = count + 1; END;",
+        "CREATE TRIGGER note_tags_stats_ad AFTER DELETE ON note_tags BEGIN "
+            "UPDATE stat_tag_counts SET count = count - 1 WHERE tag_id = old.tag_id; "
+            "DELETE FROM stat_tag_counts WHERE tag_id = old.tag_id AND count <= 0; END;",
+        "CREATE TRIGGER metadata_stats_ai AFTER INSERT ON metadata WHEN new.dir_id IS NOT NULL AND (SELECT deferred FROM search_index_state) = 0 BEGIN "
+            "INSERT INTO stat_project_counts (dir_id, count) VALUES (new.dir_id, 1) ON CONFLICT(dir_id) DO UPDATE SET count = count + 1; END;",
+        "CREATE TRIGGER metadata_stats_ad AFTER DELETE ON metadata WHEN old.dir_id IS NOT NULL BEGIN "
+            "UPDATE stat_project_counts SET count = count - 1 WHERE dir_id = old.dir_id; "
+            "DELETE FROM stat_project_counts WHERE dir_id = old.dir_id AND count <= 0; END;",
+        "CREATE TRIGGER metadata_stats_au AFTER UPDATE OF dir_id ON metadata BEGIN "
+            "UPDATE stat_project_counts SET count = count - 1 WHERE dir_id = old.dir_id; "
+            "DELETE FROM stat_project_counts WHERE dir_id = old.dir_id AND count <= 0; "
+            "INSERT INTO stat_project_counts (dir_id, count) SELECT new.dir_id, 1 WHERE new.dir_id IS NOT NULL ON CONFLICT(dir_id) DO UPDATE SET count = count + 1; END;"
+    }, STATS_REBUILD_SQL),
+    // v8: Vocabulary for `ink search --fuzzy`: every word of note text and
+    // last_edited_file, up to 64 bytes, and an inverted index from trigrams
+    // of the space-padded word to the words holding them. New words are
+    // added from C++ as notes are written (fuzzy_index::add_words); existing
+    // ones are read here out of the full-text index.
+    {
+        "CREATE TABLE fuzzy_terms (id INTEGER PRIMARY KEY, term TEXT NOT NULL UNIQUE);",
+        "CREATE TABLE fuzzy_trigrams (trigram TEXT NOT NULL, term_id INTEGER NOT NULL REFERENCES fuzzy_terms(id), PRIMARY KEY (trigram, term_id)) WITHOUT ROWID;",
+        "CREATE VIRTUAL TABLE temp.notes_fts_vocab USING fts5vocab(main, notes_fts, col);",
+        "INSERT INTO fuzzy_terms (term) SELECT DISTINCT term FROM temp.notes_fts_vocab WHERE col IN ('text', 'last_edited_file') AND length(CAST(term AS BLOB)) <= 64;",
+        "DROP TABLE temp.notes_fts_vocab;",
+        // Trigrams are byte triples, so the padded word is sliced as a blob
+        "WITH RECURSIVE grams(term_id, padded, at) AS ("
+            "SELECT id, CAST(' ' || term || ' ' AS BLOB), 1 FROM fuzzy_terms "
+            "UNION ALL SELECT term_id, padded, at + 1 FROM grams WHERE at + 3 <= length(padded)) "
+            "INSERT OR IGNORE INTO fuzzy_trigrams (trigram, term_id) SELECT CAST(substr(padded, at, 3) AS TEXT), term_id FROM grams;"
+    },
+    // v9: Tiered storage. `ink archive` moves old notes into one database per
+    // year beside this one, each with this same schema; archive_tiers lists
+    // them with the span of timestamps they hold, so reads can tell which
+    // archives a query needs without opening them.
+    {
+        "CREATE TABLE archive_tiers (year INTEGER PRIMARY KEY, oldest TEXT NOT NULL, newest TEXT NOT NULL, notes INTEGER NOT NULL);"
+    },
+    // v10: Term vectors behind `ink similar`, one packed blob per note,
+    // written from C++ along with the note (similar_index::save). Notes
+    // saved before get theirs the first time `ink similar` runs.
+    {
+        "CREATE TABLE note_vectors (note_id INTEGER PRIMARY KEY REFERENCES notes(id) ON DELETE CASCADE, features BLOB NOT NULL);"
+    },
+    // v11: Content keys for `ink sync`. A note's key hashes its timestamp,
+    // type and text (ink_note_key), so a note has the same key in every copy
+    // of the database whatever its id. sync_days folds each day's keys into
+    // a count and an XOR, which SQLite spells (a | b) & ~(a & b).
+    {
+        "CREATE TABLE sync_keys (note_id INTEGER PRIMARY KEY REFERENCES notes(id) ON DELETE CASCADE, key INTEGER NOT NULL, day TEXT NOT NULL);",
+        "CREATE INDEX idx_sync_keys_day ON sync_keys (day, key);",
+        "CREATE TABLE sync_days (day TEXT PRIMARY KEY, notes INTEGER NOT NULL, hash INTEGER NOT NULL) WITHOUT ROWID;",
+        "CREATE TRIGGER sync_keys_ai AFTER INSERT ON sync_keys BEGIN "
+            "INSERT INTO sync_days (day, notes, hash) VALUES (new.day, 1, new.key) "
+            "ON CONFLICT(day) DO UPDATE SET notes = notes + 1, hash = (hash | new.key) & ~(hash & new.key); END;",
+        "CREATE TRIGGER sync_keys_ad AFTER DELETE ON sync_keys BEGIN "
+            "UPDATE sync_days SET notes = notes - 1, hash = (hash | old.key) & ~(hash & old.key) WHERE day = old.day; "
+            "DELETE FROM sync_days WHERE day = old.day AND notes <= 0; END;",
+        "INSERT INTO sync_keys (note_id, key, day) SELECT id, ink_note_key(timestamp, type, text), substr(timestamp, 1, 10) FROM notes;"
+    },
+    // v12: Bodies piped in with `ink p -`, stored once per content and
+    // linked to their notes. data comes last so reading a blob's size and
+    // head never touches the overflow pages that hold the body. A blob goes
+    // when its last note does.
+    {
+        "CREATE TABLE blobs (id INTEGER PRIMARY KEY, hash INTEGER NOT NULL, size INTEGER NOT NULL, head TEXT NOT NULL, data BLOB NOT NULL);",
+        "CREATE INDEX idx_blobs_hash ON blobs (hash);",
+        "CREATE TABLE note_bodies (note_id INTEGER PRIMARY KEY REFERENCES notes(id) ON DELETE CASCADE, blob_id INTEGER NOT NULL REFERENCES blobs(id));",
+        "CREATE INDEX idx_note_bodies_blob ON note_bodies (blob_id);",
+        "CREATE TRIGGER note_bodies_ad AFTER DELETE ON note_bodies WHEN NOT EXISTS (SELECT 1 FROM note_bodies WHERE blob_id = old.blob_id) BEGIN "
+            "DELETE FROM blobs WHERE id = old.blob_id; END;"
+    },
+    // v13: sync_days sums each day's entries, split into 32-bit halves so
+    // the sums can't overflow, instead of XORing them: two copies of the same
+    // note no longer cancel out. Each entry is the note's key XOR a key of
+    // its metadata (ink_metadata_key, 0 for none), so metadata filled in
+    // after a note was copied shows up as a difference too.
+    {
+        "ALTER TABLE sync_keys ADD COLUMN meta INTEGER NOT NULL DEFAULT 0;",
+        "UPDATE sync_keys SET meta = (" SYNC_META_QUERY("sync_keys.note_id") ") WHERE note_id IN (SELECT note_id FROM metadata);",
+        "DROP TRIGGER sync_keys_ai;",
+        "DROP TRIGGER sync_keys_ad;",
+        "DROP TABLE sync_days;",
+        "CREATE TABLE sync_days (day TEXT PRIMARY KEY, notes INTEGER NOT NULL, key_low INTEGER NOT NULL, key_high INTEGER NOT NULL) WITHOUT ROWID;",
+        "CREATE TRIGGER sync_keys_ai AFTER INSERT ON sync_keys BEGIN "
+            "INSERT INTO sync_days (day, notes, key_low, key_high) VALUES (new.day, 1, " SYNC_LOW("new") ", " SYNC_HIGH("new") ") "
+            "ON CONFLICT(day) DO UPDATE SET notes = notes + 1, key_low = key_low + excluded.key_low, key_high = key_high + excluded.key_high; END;",
+        "CREATE TRIGGER sync_keys_ad AFTER DELETE ON sync_keys BEGIN "
+            "UPDATE sync_days SET notes = notes - 1, key_low = key_low - " SYNC_LOW("old") ", key_high = key_high - " SYNC_HIGH("old") " WHERE day = old.day; "
+            "DELETE FROM sync_days WHERE day = old.day AND notes <= 0; END;",
+        "CREATE TRIGGER sync_keys_au AFTER UPDATE OF meta ON sync_keys BEGIN "
+            "UPDATE sync_days SET key_low = key_low - " SYNC_LOW("old") " + " SYNC_LOW("new") ", "
+            "key_high = key_high - " SYNC_HIGH("old") " + " SYNC_HIGH("new") " WHERE day = new.day; END;",
+        "INSERT INTO sync_days (day, notes, key_low, key_high) SELECT day, COUNT(*), SUM(" SYNC_LOW("k") "), SUM(" SYNC_HIGH("k") ") FROM sync_keys k GROUP BY day;"
+    },
+    // v14: A bulk load switches the sync_days trigger off with the others
+    // and folds each batch's entries in per day in flush_bulk_insert.
+    {
+        "DROP TRIGGER sync_keys_ai;",
+        "CREATE TRIGGER sync_keys_ai AFTER INSERT ON sync_keys WHEN (SELECT deferred FROM search_index_state) = 0 BEGIN "
+            "INSERT INTO sync_days (day, notes, key_low, key_high) VALUES (new.day, 1, " SYNC_LOW("new") ", " SYNC_HIGH("new") ") "
+            "ON CONFLICT(day) DO UPDATE SET notes = notes + 1, key_low = key_low + excluded.key_low, key_high = key_high + excluded.key_high; END;"
     }
-    return db;
+};
+
+// Reads a single-integer PRAGMA, or -1 on error.
+int read_pragma(sqlite3* db, const char* sql) {
+    sqlite3_stmt* stmt;
+    int value = -1;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) { return value; }
+    if (sqlite3_step(stmt) == SQLITE_ROW) { value = sqlite3_column_int(stmt, 0); }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+int get_schema_version(sqlite3* db) { return read_pragma(db, "PRAGMA user_version;"); }
+
+// Applies any pending migrations, one transaction per version. When the
+// schema is already current this costs a single PRAGMA read and no DDL.
+bool migrate_schema(sqlite3* db) {
+    INK_TRACE_SCOPE("migrate_schema");
+    int version = get_schema_version(db);
+    if (version < 0) return false;
+    const int target = static_cast<int>(SCHEMA_MIGRATIONS.size());
+    for (int v = version; v < target; ++v) {
+        if (!execute_sql(db, "BEGIN IMMEDIATE TRANSACTION;")) return false;
+        // Another process may have migrated while we waited for the lock
+        if (get_schema_version(db) > v) { execute_sql(db, "ROLLBACK;"); continue; }
+        for (const auto& sql : SCHEMA_MIGRATIONS[v]) {
+            if (!execute_sql(db, sql)) { execute_sql(db, "ROLLBACK;"); return false; }
+        }
+        if (!execute_sql(db, "PRAGMA user_version = " + std::to_string(v + 1) + ";")) { execute_sql(db, "ROLLBACK;"); return false; }
+        if (!execute_sql(db, "COMMIT;")) return false;
+    }
+    // Migrations that rebuild a table (v7) leave its old pages on the freelist
+    if (version < target && read_pragma(db, "PRAGMA freelist_count;") * 4 > read_pragma(db, "PRAGMA page_count;")) {
+        execute_sql(db, "VACUUM;");
+    }
+    return true;
+}
+
+// --- DATABASE CONNECTION ---
+// WAL lets readers run alongside a writer, and with synchronous = NORMAL a
+// commit appends to the log without an fsync; only checkpoints sync. A crash
+// can't corrupt the database, though a power cut may drop the last commits.
+const char* const CONNECTION_SETTINGS =
+    "PRAGMA journal_mode = WAL;"
+    "PRAGMA synchronous = NORMAL;"
+    "PRAGMA journal_size_limit = 67108864;"
+    "PRAGMA mmap_size = 268435456;"
+    "PRAGMA cache_size = -16384;"
+    "PRAGMA foreign_keys = ON;";
+
+// How long a connection waits for another process's write lock before the
+// statement fails with SQLITE_BUSY.
+const int BUSY_TIMEOUT_MS = 5000;
+
+// Backs off 1, 2, 4 ... 32 ms between retries, with jitter so processes that
+// collided once don't keep retrying in lockstep.
+int busy_handler(void*, int attempt) {
+    static thread_local std::minstd_rand jitter(std::random_device{}());
+    int waited = 0;
+    for (int i = 0; i < attempt; ++i) waited += std::min(1 << std::min(i, 5), 32);
+    if (waited >= BUSY_TIMEOUT_MS) return 0;
+    int delay = std::min(1 << std::min(attempt, 5), 32);
+    int sleep_us = delay * 1000 - static_cast<int>(jitter() % (delay * 500));
+    std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+    return 1;
+}
+
+// ink_tag_filter(note_id, filter): true if the note passes a TagFilter
+// bound with bind_pointer. Membership is a binary search of the posting list.
+void tag_filter_function(sqlite3_context* context, int, sqlite3_value** argv) {
+    auto* filter = static_cast<const TagFilter*>(sqlite3_value_pointer(argv[1], "TagFilter"));
+    if (!filter || !filter->ids) {
+        sqlite3_result_int(context, 1);
+        return;
+    }
+    long long id = sqlite3_value_int64(argv[0]);
+    bool found = std::binary_search(filter->ids->begin(), filter->ids->end(), id);
+    sqlite3_result_int(context, found != filter->negated);
+}
+
+Database::Database(const std::string& db_path, size_t cache_capacity) : cache_capacity_(cache_capacity) {
+    INK_TRACE_SCOPE("open_database");
+    if (sqlite3_open(db_path.c_str(), &db_) != SQLITE_OK) {
+        std::cerr << "Can't open database: " << sqlite3_errmsg(db_) << std::endl;
+        sqlite3_close(db_);
+        db_ = nullptr;
+        return;
+    }
+    sqlite3_busy_handler(db_, busy_handler, nullptr);
+    // A rollback may undo dictionary rows this connection added and cached
+    sqlite3_rollback_hook(db_, [](void* self) {
+        static_cast<Database*>(self)->forget_interned();
+        static_cast<Database*>(self)->after_commit_.clear();
+    }, this);
+    // A new database frees pages incrementally (`ink compact`); an existing
+    // one switches over with a VACUUM the first time it is compacted
+    if (read_pragma(db_, "PRAGMA page_count;") == 0) execute_sql(db_, "PRAGMA auto_vacuum = INCREMENTAL;");
+    execute_sql(db_, CONNECTION_SETTINGS);
+    sqlite3_create_function(db_, "ink_tag_filter", 2, SQLITE_UTF8, nullptr, tag_filter_function, nullptr, nullptr);
+    fuzzy_index::register_functions(db_);
+    note_sync::register_functions(db_);
+    if (!migrate_schema(db_)) {
+        sqlite3_close(db_);
+        db_ = nullptr;
+    }
+}
+
+Database::~Database() {
+    for (auto& entry : lru_) { sqlite3_finalize(entry.stmt); }
+    if (db_) sqlite3_close(db_);
+}
+
+// Drops least recently used statements until the cache fits its capacity.
+// Statements that are still checked out are skipped.
+void Database::evict() {
+    auto it = lru_.end();
+    while (lru_.size() > cache_capacity_ && it != lru_.begin()) {
+        --it;
+        if (it->in_use) continue;
+        sqlite3_finalize(it->stmt);
+        cache_.erase(it->sql);
+        it = lru_.erase(it);
+    }
+}
+
+Statement Database::prepare(const std::string& sql) {
+    if (!db_) return Statement();
+    auto found = cache_.find(sql);
+    if (found != cache_.end()) {
+        auto entry = found->second;
+        if (!entry->in_use) {
+            lru_.splice(lru_.begin(), lru_, entry);
+            entry->in_use = true;
+            return Statement(entry->stmt, &entry->in_use);
+        }
+    }
+
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "SQL error: " << sqlite3_errmsg(db_) << std::endl;
+        return Statement();
+    }
+    // The same SQL is already checked out (a nested use); hand out a one-off copy
+    if (found != cache_.end()) return Statement(stmt, nullptr);
+
+    lru_.push_front({sql, stmt, true});
+    cache_[sql] = lru_.begin();
+    evict();
+    return Statement(stmt, &lru_.front().in_use);
+}
+
+bool Database::execute(const std::string& sql) { return db_ && execute_sql(db_, sql); }
+
+long long Database::last_insert_rowid() const { return sqlite3_last_insert_rowid(db_); }
+
+// --- DICTIONARY INTERNING ---
+const char* const SELECT_TAG_ID_SQL = "SELECT id FROM tag_dict WHERE name = ?;";
+const char* const INSERT_TAG_ID_SQL = "INSERT INTO tag_dict (name) VALUES (?);";
+const char* const SELECT_DIR_ID_SQL = "SELECT id FROM dir_dict WHERE path = ?;";
+const char* const INSERT_DIR_ID_SQL = "INSERT INTO dir_dict (path) VALUES (?);";
+const char* const SELECT_TERM_ID_SQL = "SELECT id FROM fuzzy_terms WHERE term = ?;";
+const char* const INSERT_TERM_ID_SQL = "INSERT INTO fuzzy_terms (term) VALUES (?);";
+
+long long Database::intern(std::unordered_map<std::string, long long>& ids, const char* select_sql, const char* insert_sql, const std::string& value, bool* added) {
+    if (added) *added = false;
+    auto found = ids.find(value);
+    if (found != ids.end()) return found->second;
+    long long id = -1;
+    {
+        Statement select = prepare(select_sql);
+        if (select.bind(1, value).step()) id = select.column_int64(0);
+    }
+    if (id < 0) {
+        if (!prepare(insert_sql).bind(1, value).run()) return -1;
+        id = last_insert_rowid();
+        if (added) *added = true;
+    }
+    ids.emplace(value, id);
+    return id;
+}
+
+long long Database::intern_tag(const std::string& name) { return intern(tag_ids_, SELECT_TAG_ID_SQL, INSERT_TAG_ID_SQL, name); }
+long long Database::intern_dir(const std::string& path) { return intern(dir_ids_, SELECT_DIR_ID_SQL, INSERT_DIR_ID_SQL, path); }
+long long Database::intern_term(const std::string& term, bool& added) { return intern(term_ids_, SELECT_TERM_ID_SQL, INSERT_TERM_ID_SQL, term, &added); }
+
+void Database::forget_interned() {
+    tag_ids_.clear();
+    dir_ids_.clear();
+    term_ids_.clear();
+}
+
+void Database::after_commit(std::function<void()> f) {
+    if (sqlite3_get_autocommit(db_)) f();
+    else after_commit_.push_back(std::move(f));
+}
+
+tag_index::TagIndex& Database::tag_index() {
+    if (!tag_index_) tag_index_ = std::make_unique<tag_index::TagIndex>();
+    return *tag_index_;
+}
+
+// --- TRANSACTION GUARD ---
+Transaction::Transaction(Database& db, bool immediate)
+    : db_(db), nested_(db.is_open() && !sqlite3_get_autocommit(db.handle())), queued_(db.after_commit_.size()) {
+    if (nested_) {
+        active_ = db_.execute("SAVEPOINT ink_txn;");
+    } else {
+        active_ = db_.execute(immediate ? "BEGIN IMMEDIATE TRANSACTION;" : "BEGIN TRANSACTION;");
+    }
+}
+
+Transaction::~Transaction() {
+    if (!active_) return;
+    db_.execute(nested_ ? "ROLLBACK TO ink_txn; RELEASE ink_txn;" : "ROLLBACK;");
+    // The rollback hook doesn't fire for savepoints
+    if (nested_) {
+        db_.forget_interned();
+        db_.after_commit_.resize(queued_);
+    }
+}
+
+bool Transaction::commit() {
+    if (!active_) return false;
+    active_ = false;
+    if (nested_) return db_.execute("RELEASE ink_txn;");
+    if (!db_.execute("COMMIT;")) return false;
+    std::vector<std::function<void()>> committed;
+    committed.swap(db_.after_commit_);
+    for (auto& f : committed) f();
+    return true;
 }
 
 
 // --- NOTE ADDING FUNCTIONS ---
-bool add_general_note(sqlite3* db, const std::string& text, const std::vector<std::string>& tags) {
-    if (!execute_sql(db, "BEGIN TRANSACTION;")) return false;
-    sqlite3_stmt* stmt;
-    std::string note_sql = "INSERT INTO notes (text, type) VALUES (?, 'general');";
-    if (sqlite3_prepare_v2(db, note_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { execute_sql(db, "ROLLBACK;"); return false; }
-    sqlite3_bind_text(stmt, 1, text.c_str(), -1, SQLITE_STATIC);
-    if (sqlite3_step(stmt) != SQLITE_DONE) { sqlite3_finalize(stmt); execute_sql(db, "ROLLBACK;"); return false; }
-    sqlite3_finalize(stmt);
-    long long note_id = sqlite3_last_insert_rowid(db);
-    std::string tag_sql = "INSERT INTO tags (note_id, tag_name) VALUES (?, ?);";
+const std::string INSERT_NOTE_SQL = "INSERT INTO notes (text, type) VALUES (?, ?);";
+const std::string INSERT_TAG_SQL = "INSERT OR IGNORE INTO note_tags (tag_id, note_id) VALUES (?, ?);";
+const std::string INSERT_METADATA_SQL = "INSERT INTO metadata (note_id, dir_id, last_edited_file, git_branch, recent_commit_hash) VALUES (?, ?, ?, ?, ?);";
+const std::string INSERT_SYNC_KEY_SQL =
+    "INSERT INTO sync_keys (note_id, key, day) SELECT id, ink_note_key(timestamp, type, text), substr(timestamp, 1, 10) FROM notes WHERE id = ?;";
+// Run whenever a note's metadata is written
+const std::string UPDATE_SYNC_META_SQL = "UPDATE sync_keys SET meta = COALESCE((" SYNC_META_QUERY("?1") "), 0) WHERE note_id = ?1;";
+
+std::string clean_tag_name(const std::string& tag) {
+    return (!tag.empty() && tag[0] == '#') ? tag.substr(1) : tag;
+}
+
+// Inserts the note row, its tags and its body if it has one, returning the
+// new note id or -1. The words and tags are added to `features` for the
+// note's vector.
+long long insert_note(Database& db, const std::string& text, const char* type, const std::vector<std::string>& tags, std::vector<uint32_t>& features,
+                      const note_body::Spool* body) {
+    if (!db.prepare(INSERT_NOTE_SQL).bind(1, text).bind(2, type).run()) return -1;
+    long long note_id = db.last_insert_rowid();
+    if (!db.prepare(INSERT_SYNC_KEY_SQL).bind(1, note_id).run()) return -1;
+    if (body && !note_body::attach(db, note_id, *body)) return -1;
+    std::vector<long long> term_ids;
+    if (!fuzzy_index::add_words(db, text, &term_ids)) return -1;
+    for (long long term_id : term_ids) features.push_back(similar_index::word_feature(term_id));
+    Statement tag_stmt = db.prepare(INSERT_TAG_SQL);
     for (const auto& tag : tags) {
-        if (sqlite3_prepare_v2(db, tag_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { execute_sql(db, "ROLLBACK;"); return false; }
-        std::string clean_tag = (tag[0] == '#') ? tag.substr(1) : tag;
-        sqlite3_bind_int64(stmt, 1, note_id);
-        sqlite3_bind_text(stmt, 2, clean_tag.c_str(), -1, SQLITE_STATIC);
-        if (sqlite3_step(stmt) != SQLITE_DONE) { sqlite3_finalize(stmt); execute_sql(db, "ROLLBACK;"); return false; }
-        sqlite3_finalize(stmt);
+        long long tag_id = db.intern_tag(clean_tag_name(tag));
+        if (tag_id < 0 || !tag_stmt.bind(1, tag_id).bind(2, note_id).run()) return -1;
+        features.push_back(similar_index::tag_feature(tag_id));
     }
-    return execute_sql(db, "COMMIT;");
+    return note_id;
 }
 
-bool add_prog_note(sqlite3* db, const std::string& text, const std::vector<std::string>& tags, const ProgMetadata& metadata) {
-    if (!execute_sql(db, "BEGIN TRANSACTION;")) return false;
-    sqlite3_stmt* stmt;
-    std::string note_sql = "INSERT INTO notes (text, type) VALUES (?, 'programming');";
-    if (sqlite3_prepare_v2(db, note_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { execute_sql(db, "ROLLBACK;"); return false; }
-    sqlite3_bind_text(stmt, 1, text.c_str(), -1, SQLITE_STATIC);
-    if (sqlite3_step(stmt) != SQLITE_DONE) { sqlite3_finalize(stmt); execute_sql(db, "ROLLBACK;"); return false; }
-    sqlite3_finalize(stmt);
-    long long note_id = sqlite3_last_insert_rowid(db);
-    std::string tag_sql = "INSERT INTO tags (note_id, tag_name) VALUES (?, ?);";
-    for (const auto& tag : tags) {
-        if (sqlite3_prepare_v2(db, tag_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { execute_sql(db, "ROLLBACK;"); return false; }
-        std::string clean_tag = (tag[0] == '#') ? tag.substr(1) : tag;
-        sqlite3_bind_int64(stmt, 1, note_id);
-        sqlite3_bind_text(stmt, 2, clean_tag.c_str(), -1, SQLITE_STATIC);
-        if (sqlite3_step(stmt) != SQLITE_DONE) { sqlite3_finalize(stmt); execute_sql(db, "ROLLBACK;"); return false; }
-        sqlite3_finalize(stmt);
-    }
-    std::string meta_sql = "INSERT INTO metadata (note_id, current_directory, last_edited_file, git_branch, recent_commit_hash) VALUES (?, ?, ?, ?, ?);";
-    if (sqlite3_prepare_v2(db, meta_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { execute_sql(db, "ROLLBACK;"); return false; }
-    sqlite3_bind_int64(stmt, 1, note_id);
-    sqlite3_bind_text(stmt, 2, metadata.current_directory.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, metadata.last_edited_file.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, metadata.git_branch.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 5, metadata.git_commit_hash.c_str(), -1, SQLITE_STATIC);
-    if (sqlite3_step(stmt) != SQLITE_DONE) { sqlite3_finalize(stmt); execute_sql(db, "ROLLBACK;"); return false; }
-    sqlite3_finalize(stmt);
-    return execute_sql(db, "COMMIT;");
+// Stores the note's vector, with its directory (if any) added to `features`.
+bool save_vector(Database& db, long long note_id, std::vector<uint32_t>& features, const std::string& directory) {
+    if (!directory.empty()) {
+        long long dir_id = db.intern_dir(directory);
+        if (dir_id < 0) return false;
+        features.push_back(similar_index::directory_feature(dir_id));
+    }
+    return similar_index::save(db, note_id, features);
+}
+
+// Binds a directory's dictionary id, or NULL for no directory.
+bool bind_directory(Database& db, Statement& stmt, int index, const std::string& path) {
+    if (path.empty()) {
+        stmt.bind_null(index);
+        return true;
+    }
+    long long dir_id = db.intern_dir(path);
+    if (dir_id < 0) return false;
+    stmt.bind(index, dir_id);
+    return true;
+}
+
+bool add_general_note(Database& db, const std::string& text, const std::vector<std::string>& tags, const note_body::Spool* body) {
+    INK_TRACE_SCOPE("insert_note");
+    Transaction txn(db, true);
+    if (!txn.ok()) return false;
+    std::vector<uint32_t> features;
+    long long note_id = insert_note(db, text, "general", tags, features, body);
+    if (note_id < 0 || !save_vector(db, note_id, features, "")) return false;
+    db.after_commit([&db, tags] { completion::note_added(db, tags, ""); });
+    return txn.commit();
+}
+
+bool add_prog_note(Database& db, const std::string& text, const std::vector<std::string>& tags, const ProgMetadata& metadata, const note_body::Spool* body) {
+    INK_TRACE_SCOPE("insert_note");
+    Transaction txn(db, true);
+    if (!txn.ok()) return false;
+    std::vector<uint32_t> features;
+    long long note_id = insert_note(db, text, "programming", tags, features, body);
+    if (note_id < 0) return false;
+    Statement meta_stmt = db.prepare(INSERT_METADATA_SQL);
+    if (!bind_directory(db, meta_stmt, 2, metadata.current_directory)) return false;
+    meta_stmt.bind(1, note_id)
+             .bind(3, metadata.last_edited_file)
+             .bind(4, metadata.git_branch)
+             .bind(5, metadata.git_commit_hash);
+    if (!meta_stmt.run() || !db.prepare(UPDATE_SYNC_META_SQL).bind(1, note_id).run() || !fuzzy_index::add_words(db, metadata.last_edited_file) ||
+        !save_vector(db, note_id, features, metadata.current_directory)) {
+        return false;
+    }
+    db.after_commit([&db, tags, directory = metadata.current_directory] { completion::note_added(db, tags, directory); });
+    return txn.commit();
+}
+
+// --- METADATA ENRICHMENT ---
+const std::string INSERT_PENDING_METADATA_SQL = "INSERT INTO metadata (note_id, dir_id, enrichment) VALUES (?, ?, 'pending');";
+const std::string ENRICH_METADATA_SQL = "UPDATE metadata SET last_edited_file = ?2, git_branch = ?3, recent_commit_hash = ?4, enrichment = 'done' WHERE note_id = ?1 AND enrichment = 'pending';";
+const std::string REPLACE_METADATA_SQL =
+    "INSERT INTO metadata (note_id, dir_id, last_edited_file, git_branch, recent_commit_hash) VALUES (?1, ?2, ?3, ?4, ?5) "
+    "ON CONFLICT(note_id) DO UPDATE SET dir_id = ?2, last_edited_file = ?3, git_branch = ?4, recent_commit_hash = ?5, enrichment = 'done';";
+const std::string EXPIRE_ENRICHMENT_SQL = "UPDATE metadata SET enrichment = 'timed_out' WHERE note_id = ? AND enrichment = 'pending';";
+// Catches rows whose enricher died without reporting back
+const std::string EXPIRE_STALE_ENRICHMENTS_SQL =
+    "UPDATE metadata SET enrichment = 'timed_out' WHERE enrichment = 'pending' "
+    "AND (SELECT timestamp FROM notes WHERE id = metadata.note_id) < DATETIME('now', '-1 minute');";
+
+long long add_pending_prog_note(Database& db, const std::string& text, const std::vector<std::string>& tags, const std::string& current_directory,
+                                const note_body::Spool* body) {
+    INK_TRACE_SCOPE("insert_note");
+    Transaction txn(db, true);
+    if (!txn.ok()) return -1;
+    std::vector<uint32_t> features;
+    long long note_id = insert_note(db, text, "programming", tags, features, body);
+    if (note_id < 0) return -1;
+    Statement meta_stmt = db.prepare(INSERT_PENDING_METADATA_SQL);
+    if (!bind_directory(db, meta_stmt, 2, current_directory) || !meta_stmt.bind(1, note_id).run() ||
+        !db.prepare(UPDATE_SYNC_META_SQL).bind(1, note_id).run() || !save_vector(db, note_id, features, current_directory)) {
+        return -1;
+    }
+    db.after_commit([&db, tags, current_directory] { completion::note_added(db, tags, current_directory); });
+    return txn.commit() ? note_id : -1;
+}
+
+bool enrich_metadata(Database& db, long long note_id, const ProgMetadata& metadata) {
+    INK_TRACE_SCOPE("enrich_metadata");
+    Transaction txn(db, true);
+    if (!txn.ok()) return false;
+    bool updated = db.prepare(ENRICH_METADATA_SQL)
+                     .bind(1, note_id)
+                     .bind(2, metadata.last_edited_file)
+                     .bind(3, metadata.git_branch)
+                     .bind(4, metadata.git_commit_hash)
+                     .run();
+    if (!updated || !db.prepare(UPDATE_SYNC_META_SQL).bind(1, note_id).run() || !fuzzy_index::add_words(db, metadata.last_edited_file)) return false;
+    return txn.commit();
+}
+
+bool replace_metadata(Database& db, long long note_id, const ProgMetadata& metadata) {
+    Transaction txn(db, true);
+    if (!txn.ok()) return false;
+    Statement stmt = db.prepare(REPLACE_METADATA_SQL);
+    if (!bind_directory(db, stmt, 2, metadata.current_directory)) return false;
+    bool replaced = stmt.bind(1, note_id)
+                        .bind(3, metadata.last_edited_file)
+                        .bind(4, metadata.git_branch)
+                        .bind(5, metadata.git_commit_hash)
+                        .run();
+    if (!replaced || !db.prepare(UPDATE_SYNC_META_SQL).bind(1, note_id).run() || !fuzzy_index::add_words(db, metadata.last_edited_file)) return false;
+    return txn.commit();
+}
+
+bool expire_enrichment(Database& db, long long note_id) {
+    return db.prepare(EXPIRE_ENRICHMENT_SQL).bind(1, note_id).run();
+}
+
+bool expire_stale_enrichments(Database& db) {
+    return db.prepare(EXPIRE_STALE_ENRICHMENTS_SQL).run();
+}
+
+// --- BULK INSERT FUNCTIONS ---
+const std::string BULK_INSERT_NOTE_SQL = "INSERT INTO notes (text, timestamp, type) VALUES (?, COALESCE(?, CURRENT_TIMESTAMP), ?);";
+// Catches the search index, sync days and stats counters up with every note from ?1 on,
+// standing in for the triggers a bulk load switches off.
+const std::vector<std::string> BULK_FLUSH_SQL = {
+    "INSERT INTO notes_fts (rowid, text, current_directory, last_edited_file, git_branch) "
+        "SELECT n.id, n.text, d.path, m.last_edited_file, m.git_branch FROM notes n LEFT JOIN metadata m ON n.id = m.note_id LEFT JOIN dir_dict d ON d.id = m.dir_id WHERE n.id >= ?1;",
+    "INSERT INTO sync_keys (note_id, key, day, meta) SELECT n.id, ink_note_key(n.timestamp, n.type, n.text), substr(n.timestamp, 1, 10), "
+        "COALESCE(ink_metadata_key(d.path, m.last_edited_file, m.git_branch, m.recent_commit_hash), 0) "
+        "FROM notes n LEFT JOIN metadata m ON n.id = m.note_id LEFT JOIN dir_dict d ON d.id = m.dir_id WHERE n.id >= ?1;",
+    // As below, the day index would be walked whole to save a sort
+    "INSERT INTO sync_days (day, notes, key_low, key_high) SELECT day, COUNT(*), SUM(" SYNC_LOW("k") "), SUM(" SYNC_HIGH("k") ") FROM sync_keys k NOT INDEXED "
+        "WHERE note_id >= ?1 GROUP BY day "
+        "ON CONFLICT(day) DO UPDATE SET notes = notes + excluded.notes, key_low = key_low + excluded.key_low, key_high = key_high + excluded.key_high;",
+    "UPDATE stat_totals SET count = count + (SELECT COUNT(*) FROM notes WHERE id >= ?1) WHERE name = 'notes';",
+    "INSERT INTO stat_daily_counts (day, count) SELECT STRFTIME('%Y-%m-%d', timestamp), COUNT(*) FROM notes WHERE id >= ?1 GROUP BY 1 "
+        "ON CONFLICT(day) DO UPDATE SET count = count + excluded.count;",
+    // Left to itself, SQLite walks these in GROUP BY order through the whole
+    // table, which is slow when only a few notes are pending
+    "INSERT INTO stat_tag_counts (tag_id, count) SELECT tag_id, COUNT(*) FROM note_tags INDEXED BY idx_note_tags_note WHERE note_id >= ?1 GROUP BY tag_id "
+        "ON CONFLICT(tag_id) DO UPDATE SET count = count + excluded.count;",
+    "INSERT INTO stat_project_counts (dir_id, count) SELECT dir_id, COUNT(*) FROM metadata NOT INDEXED WHERE note_id >= ?1 AND dir_id IS NOT NULL GROUP BY dir_id "
+        "ON CONFLICT(dir_id) DO UPDATE SET count = count + excluded.count;"
+};
+
+long long bulk_insert_note(Database& db, BulkInsert& bulk, const FullNote& note) {
+    // Turn the FTS triggers off for the rest of this transaction; flush_bulk_insert
+    // indexes the pending notes and turns them back on before the caller commits.
+    if (bulk.first_pending_id < 0 && !db.execute("UPDATE search_index_state SET deferred = 1;")) return -1;
+
+    if (!db.prepare(BULK_INSERT_NOTE_SQL).bind(1, note.text).bind_optional(2, note.timestamp).bind(3, note.type).run()) return -1;
+    long long note_id = db.last_insert_rowid();
+    if (bulk.first_pending_id < 0) bulk.first_pending_id = note_id;
+    std::vector<long long> term_ids;
+    if (!fuzzy_index::add_words(db, note.text, &term_ids)) return -1;
+    std::vector<uint32_t> features;
+    for (long long term_id : term_ids) features.push_back(similar_index::word_feature(term_id));
+
+    Statement tag_stmt = db.prepare(INSERT_TAG_SQL);
+    for (const auto& tag : note.tags) {
+        if (tag.empty()) continue;
+        long long tag_id = db.intern_tag(clean_tag_name(tag));
+        if (tag_id < 0 || !tag_stmt.bind(1, tag_id).bind(2, note_id).run()) return -1;
+        features.push_back(similar_index::tag_feature(tag_id));
+    }
+
+    if (note.type == "programming") {
+        Statement meta_stmt = db.prepare(INSERT_METADATA_SQL);
+        if (!bind_directory(db, meta_stmt, 2, note.metadata.current_directory)) return -1;
+        meta_stmt.bind(1, note_id)
+                 .bind_optional(3, note.metadata.last_edited_file)
+                 .bind_optional(4, note.metadata.git_branch)
+                 .bind_optional(5, note.metadata.git_commit_hash);
+        if (!meta_stmt.run() || !fuzzy_index::add_words(db, note.metadata.last_edited_file)) return -1;
+    }
+    if (!save_vector(db, note_id, features, note.type == "programming" ? note.metadata.current_directory : "")) return -1;
+    return note_id;
+}
+
+bool flush_bulk_insert(Database& db, BulkInsert& bulk) {
+    INK_TRACE_SCOPE("flush_bulk_insert");
+    if (bulk.first_pending_id < 0) return true;
+    for (const auto& sql : BULK_FLUSH_SQL) {
+        if (!db.prepare(sql).bind(1, bulk.first_pending_id).run()) return false;
+    }
+    bulk.first_pending_id = -1;
+    return db.execute("UPDATE search_index_state SET deferred = 0;");
 }
 
 // --- NOTE RETRIEVAL FUNCTIONS ---
-const std::string BASE_SELECT_QUERY = "SELECT n.id, n.text, n.timestamp, n.type, m.current_directory, m.last_edited_file, m.git_branch, GROUP_CONCAT(t.tag_name, ' ') FROM notes n LEFT JOIN metadata m ON n.id = m.note_id LEFT JOIN tags t ON n.id = t.note_id ";
-FullNote process_row(sqlite3_stmt* stmt) { /* Implementation from Step 5 */
-    FullNote note;
-    note.id = sqlite3_column_int64(stmt, 0);
-    note.text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-    note.timestamp = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-    note.type = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-    const char* dir = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-    note.metadata.current_directory = dir ? dir : "";
-    const char* file = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-    note.metadata.last_edited_file = file ? file : "";
-    const char* branch = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
-    note.metadata.git_branch = branch ? branch : "";
-    const char* tags_str = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 7));
-    if (tags_str) {
-        std::stringstream ss(tags_str);
-        std::string tag;
-        while (ss >> tag) { note.tags.push_back(tag); }
-    }
-    return note;
-}
-std::vector<FullNote> list_recent_notes(sqlite3* db, int limit) { /* Implementation from Step 5 */
-    std::vector<FullNote> notes;
-    sqlite3_stmt* stmt;
-    std::string sql = BASE_SELECT_QUERY + "GROUP BY n.id ORDER BY n.timestamp DESC LIMIT ?;";
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { return notes; }
-    sqlite3_bind_int(stmt, 1, limit);
-    while (sqlite3_step(stmt) == SQLITE_ROW) { notes.push_back(process_row(stmt)); }
-    sqlite3_finalize(stmt);
-    return notes;
+// Tags are gathered with a correlated subquery (served by idx_note_tags_note)
+// rather than a join + GROUP BY, so ORDER BY ... LIMIT can walk an index and
+// stop early instead of grouping every note first.
+#define NOTE_TAGS_QUERY "(SELECT GROUP_CONCAT(t.name, ' ') FROM note_tags nt JOIN tag_dict t ON t.id = nt.tag_id WHERE nt.note_id = n.id)"
+#define NOTE_METADATA_JOIN "LEFT JOIN metadata m ON n.id = m.note_id LEFT JOIN dir_dict d ON d.id = m.dir_id "
+// A piped body shows as its stored head and size; the body itself isn't read
+#define NOTE_BODY_JOIN "LEFT JOIN note_bodies nb ON nb.note_id = n.id LEFT JOIN blobs b ON b.id = nb.blob_id "
+#define NOTE_BODY_COLUMNS "b.head, b.size"
+const std::string BASE_SELECT_QUERY = "SELECT n.id, n.text, n.timestamp, n.type, d.path, m.last_edited_file, m.git_branch, " NOTE_TAGS_QUERY ", "
+                                      NOTE_BODY_COLUMNS " FROM notes n " NOTE_METADATA_JOIN NOTE_BODY_JOIN;
+// idx_notes_timestamp is ordered by (timestamp, rowid), so both the keyset
+// condition and the ORDER BY are served by walking it backwards.
+const std::string AFTER_CONDITION = "(n.timestamp, n.id) < (SELECT timestamp, id FROM notes WHERE id = :after) ";
+const std::string AFTER_TIMESTAMP_CONDITION = "(n.timestamp, n.id) < (:after_timestamp, :after) ";
+const std::string TAG_CONDITION = "ink_tag_filter(n.id, :tags) ";
+// Notes picked by id, as a JSON array; CROSS JOIN keeps the ids driving the join
+const std::string TAGGED_SELECT_QUERY = "SELECT n.id, n.text, n.timestamp, n.type, d.path, m.last_edited_file, m.git_branch, " NOTE_TAGS_QUERY ", "
+                                        NOTE_BODY_COLUMNS " FROM json_each(:ids) picked CROSS JOIN notes n ON n.id = picked.value "
+                                        NOTE_METADATA_JOIN NOTE_BODY_JOIN;
+const std::string RECENT_ORDER = "ORDER BY n.timestamp DESC, n.id DESC LIMIT :limit;";
+// A --since/--until window, a range over the same index
+const std::string SINCE_CONDITION = "n.timestamp >= :since ";
+const std::string UNTIL_CONDITION = "n.timestamp < :until ";
+
+// Same correlated tag subquery as BASE_SELECT_QUERY; a GROUP BY would also
+// stop the FTS5 ranking and snippet functions from running. Matches in the
+// note body outrank matches in the captured code metadata.
+#define SEARCH_RANK "bm25(notes_fts, 10.0, 2.0, 2.0, 1.0)"
+const std::string SEARCH_SELECT_QUERY = "SELECT n.id, n.text, n.timestamp, n.type, d.path, m.last_edited_file, m.git_branch, "
+                                        NOTE_TAGS_QUERY ", "
+                                        NOTE_BODY_COLUMNS ", "
+                                        "snippet(notes_fts, 0, '" SNIPPET_BEGIN "', '" SNIPPET_END "', '...', 16) "
+                                        "FROM notes_fts f JOIN notes n ON n.id = f.rowid " NOTE_METADATA_JOIN NOTE_BODY_JOIN
+                                        "WHERE notes_fts MATCH :match ";
+const std::string SEARCH_TAG_CONDITION = "AND ink_tag_filter(f.rowid, :tags) ";
+// The rank of the note a page ended on is recomputed, so the next page picks
+// up exactly where the last one stopped
+const std::string SEARCH_AFTER_CONDITION = "AND (" SEARCH_RANK ", -f.rowid) > ((SELECT " SEARCH_RANK " FROM notes_fts WHERE notes_fts MATCH :match AND rowid = :after), -:after) ";
+const std::string SEARCH_RANK_ORDER = "ORDER BY " SEARCH_RANK ", n.id DESC LIMIT :limit;";
+
+// A page split across reader threads is ranked per rowid range on what
+// FTS5 alone gives, each match's rowid, score and snippet; the notes that
+// make the merged page are then looked up by id.
+const std::string SEARCH_RANKED_QUERY = "SELECT f.rowid, " SEARCH_RANK ", "
+                                        "snippet(notes_fts, 0, '" SNIPPET_BEGIN "', '" SNIPPET_END "', '...', 16) FROM notes_fts f ";
+const std::string SEARCH_WINDOW_JOIN = "JOIN notes n ON n.id = f.rowid ";
+const std::string SEARCH_RANGE_CONDITION = "WHERE notes_fts MATCH :match AND f.rowid BETWEEN :low AND :high ";
+const std::string SEARCH_RANKED_ORDER = "ORDER BY 2, 1 DESC LIMIT :limit;";
+
+// Fuzzy searches match the corrected words and rank by ink_fuzzy_score,
+// then newest first. The ranking runs on rowids alone, so only the notes
+// on the page pay for their tags, metadata and snippet.
+#define FUZZY_SCORE "ink_fuzzy_score(notes_fts, :fuzzy)"
+const std::string FUZZY_RANKED_QUERY = "SELECT rowid AS id, " FUZZY_SCORE " AS score FROM notes_fts WHERE notes_fts MATCH :match ";
+const std::string FUZZY_TAG_CONDITION = "AND ink_tag_filter(rowid, :tags) ";
+const std::string FUZZY_AFTER_CONDITION = "AND (" FUZZY_SCORE ", rowid) < ((SELECT " FUZZY_SCORE " FROM notes_fts WHERE notes_fts MATCH :match AND rowid = :after), :after) ";
+// The unary + keeps SQLite from probing FTS5 once per id in the window
+const std::string FUZZY_WINDOW_CONDITION = "AND +rowid IN (SELECT n.id FROM notes n ";
+const std::string FUZZY_RANK_ORDER = "ORDER BY score DESC, id DESC LIMIT :limit";
+// When the newest :limit matches all have the best possible score, nothing
+// older can make the page, so the ranking only has to look at rowids from
+// the oldest of them on. FTS5 walks newest first and stops at the limit;
+// if the page doesn't fill, the floor is 0 and everything is ranked.
+const std::string FUZZY_FLOOR_BEGIN = "AND rowid >= (SELECT CASE WHEN COUNT(*) = :limit THEN MIN(id) ELSE 0 END FROM "
+                                      "(SELECT rowid AS id FROM notes_fts WHERE notes_fts MATCH :match AND " FUZZY_SCORE " = :best ";
+const std::string FUZZY_FLOOR_END = "ORDER BY rowid DESC LIMIT :limit)) ";
+const std::string FUZZY_SELECT_QUERY = "SELECT n.id, n.text, n.timestamp, n.type, d.path, m.last_edited_file, m.git_branch, "
+                                       NOTE_TAGS_QUERY ", "
+                                       NOTE_BODY_COLUMNS ", "
+                                       "snippet(notes_fts, 0, '" SNIPPET_BEGIN "', '" SNIPPET_END "', '...', 16) "
+                                       "FROM ranked r JOIN notes_fts f ON f.rowid = r.id JOIN notes n ON n.id = r.id " NOTE_METADATA_JOIN NOTE_BODY_JOIN
+                                       "WHERE notes_fts MATCH :match ORDER BY r.score DESC, r.id DESC;";
+
+// Fills `note` from the current row, reusing its string and vector storage.
+void read_row(const Statement& stmt, FullNote& note) {
+    note.id = stmt.column_int64(0);
+    note.text = stmt.column_text(1);
+    note.timestamp = stmt.column_text(2);
+    note.type = stmt.column_text(3);
+    note.metadata.current_directory = stmt.column_text(4);
+    note.metadata.last_edited_file = stmt.column_text(5);
+    note.metadata.git_branch = stmt.column_text(6);
+    note.tags.clear();
+    const char* tags = reinterpret_cast<const char*>(sqlite3_column_text(stmt.handle(), 7));
+    for (const char* p = tags; p && *p;) {
+        const char* end = std::strchr(p, ' ');
+        if (!end) end = p + std::strlen(p);
+        if (end > p) note.tags.emplace_back(p, end);
+        p = *end ? end + 1 : end;
+    }
+    note.body_head = stmt.column_text(8);
+    note.body_size = stmt.column_int64(9);
+    note.snippet = stmt.column_count() > 10 ? stmt.column_text(10) : std::string();
 }
-std::vector<FullNote> list_notes_by_tag(sqlite3* db, const std::string& tag) { /* Implementation from Step 5 */
-    std::vector<FullNote> notes;
-    sqlite3_stmt* stmt;
-    std::string sql = BASE_SELECT_QUERY + "WHERE n.id IN (SELECT note_id FROM tags WHERE tag_name = ?) GROUP BY n.id ORDER BY n.timestamp DESC;";
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { return notes; }
-    std::string clean_tag = (tag[0] == '#') ? tag.substr(1) : tag;
-    sqlite3_bind_text(stmt, 1, clean_tag.c_str(), -1, SQLITE_STATIC);
-    while (sqlite3_step(stmt) == SQLITE_ROW) { notes.push_back(process_row(stmt)); }
-    sqlite3_finalize(stmt);
-    return notes;
+
+NoteCursor::NoteCursor(Statement stmt, std::vector<std::shared_ptr<const void>> bound)
+    : bound_(std::move(bound)), stmt_(std::move(stmt)) {
+    if (trace::enabled() && stmt_.ok()) {
+        // Cached statements keep their counters between runs
+        sqlite3_stmt_status(stmt_.handle(), SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+        sqlite3_stmt_status(stmt_.handle(), SQLITE_STMTSTATUS_VM_STEP, 1);
+        sqlite3_stmt_status(stmt_.handle(), SQLITE_STMTSTATUS_SORT, 1);
+    }
 }
-std::vector<FullNote> search_notes(sqlite3* db, const std::string& query, const std::vector<std::string>& tags) { /* Implementation from Step 5 */
-    std::vector<FullNote> notes;
-    sqlite3_stmt* stmt;
-    std::string sql = BASE_SELECT_QUERY + "WHERE n.text LIKE ? GROUP BY n.id ORDER BY n.timestamp DESC;";
-    if (!tags.empty()) { sql = BASE_SELECT_QUERY + "WHERE n.text LIKE ? AND n.id IN (SELECT note_id FROM tags WHERE tag_name = ?) GROUP BY n.id ORDER BY n.timestamp DESC;"; }
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { return notes; }
-    std::string search_term = "%" + query + "%";
-    sqlite3_bind_text(stmt, 1, search_term.c_str(), -1, SQLITE_STATIC);
-    if (!tags.empty()) {
-        std::string clean_tag = (tags[0][0] == '#') ? tags[0].substr(1) : tags[0];
-        sqlite3_bind_text(stmt, 2, clean_tag.c_str(), -1, SQLITE_STATIC);
-    }
-    while (sqlite3_step(stmt) == SQLITE_ROW) { notes.push_back(process_row(stmt)); }
-    sqlite3_finalize(stmt);
-    return notes;
+
+NoteCursor::~NoteCursor() {
+    if (!trace::enabled() || !stmt_.ok()) return;
+    trace::count("query_rows_returned", rows_);
+    trace::count("query_fullscan_steps", sqlite3_stmt_status(stmt_.handle(), SQLITE_STMTSTATUS_FULLSCAN_STEP, 0));
+    trace::count("query_vm_steps", sqlite3_stmt_status(stmt_.handle(), SQLITE_STMTSTATUS_VM_STEP, 0));
+    trace::count("query_sorts", sqlite3_stmt_status(stmt_.handle(), SQLITE_STMTSTATUS_SORT, 0));
+    trace::count("query_step_us", step_us_);
+    trace::count("query_row_copy_us", read_us_);
 }
 
-// ===== FUNCTIONS FOR STATISTICS =====
+// Stepping and copying are interleaved with the caller's output, so while
+// tracing they are summed here rather than timed as one scope.
+// Once a statement is done, stepping it again would rerun the query, so the
+// cursor remembers that it has reached the end.
+bool NoteCursor::step() {
+    if (done_ || !stmt_.ok()) return false;
+    bool has_row;
+    if (!trace::enabled()) {
+        has_row = stmt_.step();
+    } else {
+        auto start = std::chrono::steady_clock::now();
+        has_row = stmt_.step();
+        step_us_ += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        if (has_row) ++rows_;
+    }
+    done_ = !has_row;
+    return has_row;
+}
 
-int get_total_notes_count(sqlite3* db) {
-    sqlite3_stmt* stmt;
-    int count = 0;
-    if (sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM notes;", -1, &stmt, nullptr) == SQLITE_OK) {
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            count = sqlite3_column_int(stmt, 0);
+NoteCursor::NoteCursor(std::unique_ptr<NoteSource> source) : source_(std::move(source)) {}
+
+// A view's fields copied out, as read_row would have filled them
+void copy_view(const NoteView& view, FullNote& note) {
+    note.id = view.id;
+    note.text.assign(view.text);
+    note.timestamp.assign(view.timestamp);
+    note.type.assign(view.type);
+    note.metadata.current_directory.assign(view.current_directory);
+    note.metadata.last_edited_file.assign(view.last_edited_file);
+    note.metadata.git_branch.assign(view.git_branch);
+    note.tags.clear();
+    for (std::string_view tag : view.tags) note.tags.emplace_back(tag);
+    note.body_head.assign(view.body_head);
+    note.body_size = view.body_size;
+    note.snippet.assign(view.snippet);
+}
+
+bool NoteCursor::next(FullNote& note) {
+    if (source_) {
+        if (!source_->next_batch(one_row_, 1)) return false;
+        copy_view(one_row_[0], note);
+        return true;
+    }
+    if (!step()) return false;
+    if (!trace::enabled()) {
+        read_row(stmt_, note);
+        return true;
+    }
+    auto start = std::chrono::steady_clock::now();
+    read_row(stmt_, note);
+    read_us_ += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+bool NoteCursor::next_batch(NoteBatch& batch, size_t max_rows) {
+    if (source_) return source_->next_batch(batch, max_rows);
+    batch.clear();
+    while (batch.size() < max_rows && step()) {
+        if (!trace::enabled()) {
+            batch.append_row(stmt_);
+            continue;
         }
+        auto start = std::chrono::steady_clock::now();
+        batch.append_row(stmt_);
+        read_us_ += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
     }
-    sqlite3_finalize(stmt);
-    return count;
+    return !batch.empty();
 }
 
-std::vector<std::pair<std::string, int>> get_tag_counts(sqlite3* db) {
-    std::vector<std::pair<std::string, int>> results;
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT tag_name, COUNT(*) as count FROM tags GROUP BY tag_name ORDER BY count DESC;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            std::string name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-            int count = sqlite3_column_int(stmt, 1);
-            results.push_back({name, count});
+// --- NOTE BATCHES ---
+std::string_view NoteView::TagList::operator[](size_t i) const {
+    return batch_->view(batch_->tags_[first_ + i]);
+}
+
+void NoteBatch::clear() {
+    arena_.clear();
+    records_.clear();
+    tags_.clear();
+}
+
+NoteBatch::Span NoteBatch::append(std::string_view value) {
+    Span span{static_cast<uint32_t>(arena_.size()), static_cast<uint32_t>(value.size())};
+    arena_.insert(arena_.end(), value.begin(), value.end());
+    return span;
+}
+
+// Same columns as read_row. The GROUP_CONCAT tag list is copied once and
+// split into spans over that copy.
+void NoteBatch::append_row(const Statement& stmt) {
+    Record record;
+    record.id = stmt.column_int64(0);
+    record.text = append(stmt.column_view(1));
+    record.timestamp = append(stmt.column_view(2));
+    record.type = append(stmt.column_view(3));
+    record.current_directory = append(stmt.column_view(4));
+    record.last_edited_file = append(stmt.column_view(5));
+    record.git_branch = append(stmt.column_view(6));
+    record.body_head = append(stmt.column_view(8));
+    record.body_size = stmt.column_int64(9);
+    record.snippet = stmt.column_count() > 10 ? append(stmt.column_view(10)) : Span{0, 0};
+
+    Span tags = append(stmt.column_view(7));
+    record.first_tag = static_cast<uint32_t>(tags_.size());
+    uint32_t start = tags.offset;
+    const uint32_t end = tags.offset + tags.length;
+    while (start < end) {
+        const char* space = static_cast<const char*>(std::memchr(arena_.data() + start, ' ', end - start));
+        uint32_t stop = space ? static_cast<uint32_t>(space - arena_.data()) : end;
+        if (stop > start) tags_.push_back({start, stop - start});
+        start = stop + 1;
+    }
+    record.tag_count = static_cast<uint32_t>(tags_.size()) - record.first_tag;
+    records_.push_back(record);
+}
+
+void NoteBatch::append(const NoteView& note) {
+    Record record;
+    record.id = note.id;
+    record.text = append(note.text);
+    record.timestamp = append(note.timestamp);
+    record.type = append(note.type);
+    record.current_directory = append(note.current_directory);
+    record.last_edited_file = append(note.last_edited_file);
+    record.git_branch = append(note.git_branch);
+    record.body_head = append(note.body_head);
+    record.body_size = note.body_size;
+    record.snippet = append(note.snippet);
+    record.first_tag = static_cast<uint32_t>(tags_.size());
+    for (size_t i = 0; i < note.tags.size(); ++i) tags_.push_back(append(note.tags[i]));
+    record.tag_count = static_cast<uint32_t>(note.tags.size());
+    records_.push_back(record);
+}
+
+NoteView NoteBatch::operator[](size_t i) const {
+    const Record& r = records_[i];
+    return NoteView{r.id, view(r.text), view(r.type), view(r.timestamp), view(r.current_directory),
+                    view(r.last_edited_file), view(r.git_branch), view(r.body_head), r.body_size, view(r.snippet),
+                    NoteView::TagList(*this, r.first_tag, r.tag_count)};
+}
+
+// Binds a named parameter if the statement uses it.
+void bind_named(Statement& stmt, const char* name, long long value) {
+    int index = sqlite3_bind_parameter_index(stmt.handle(), name);
+    if (index > 0) stmt.bind(index, value);
+}
+
+void bind_named(Statement& stmt, const char* name, const std::string& value) {
+    int index = sqlite3_bind_parameter_index(stmt.handle(), name);
+    if (index > 0) stmt.bind(index, value);
+}
+
+void bind_page(Statement& stmt, const PageOptions& page) {
+    bind_named(stmt, ":after", page.after_id);
+    bind_named(stmt, ":limit", static_cast<long long>(page.limit));
+    bind_named(stmt, ":since", page.since);
+    bind_named(stmt, ":until", page.until);
+    bind_named(stmt, ":after_timestamp", page.after_timestamp);
+}
+
+// Keyset condition for listings, led by AND
+std::string after_condition(const PageOptions& page) {
+    if (page.after_id < 0) return "";
+    return "AND " + (page.after_timestamp.empty() ? AFTER_CONDITION : AFTER_TIMESTAMP_CONDITION);
+}
+
+// The page's time window as conditions on notes n, each led by AND
+std::string window_conditions(const PageOptions& page) {
+    return (page.since.empty() ? "" : "AND " + SINCE_CONDITION) + (page.until.empty() ? "" : "AND " + UNTIL_CONDITION);
+}
+
+// Conditions led by AND as a WHERE clause
+std::string where_clause(const std::string& conditions) {
+    return conditions.empty() ? "" : "WHERE " + conditions.substr(4);
+}
+
+// Full-text matches are walked by rowid, so a window also bounds them to the
+// range of ids it holds and FTS5 seeks straight to it. Ids and timestamps
+// usually rise together, but imported notes need not, so callers keep the
+// exact check on the timestamp as well.
+std::string window_rowid_range(const char* column, const std::string& window) {
+    auto ids = [&](const char* bound) { return std::string("(SELECT ") + bound + "(n.id) FROM notes n " + where_clause(window) + ")"; };
+    return std::string("AND ") + column + " BETWEEN " + ids("MIN") + " AND " + ids("MAX") + " ";
+}
+
+// Ids as a JSON array, for json_each
+std::string json_ids(const std::vector<long long>& ids) {
+    std::string list = "[";
+    for (size_t i = 0; i < ids.size(); ++i) list += (i ? "," : "") + std::to_string(ids[i]);
+    return list + "]";
+}
+
+NoteCursor list_recent_notes(Database& db, const PageOptions& page) {
+    std::string conditions = window_conditions(page) + after_condition(page);
+    std::string sql = BASE_SELECT_QUERY + where_clause(conditions) + RECENT_ORDER;
+    Statement stmt = db.prepare(sql);
+    bind_page(stmt, page);
+    return NoteCursor(std::move(stmt));
+}
+
+// Looking a note up by id costs about this many steps of an index walk
+const long long ID_LOOKUP_COST = 4;
+
+// The tag query is resolved to posting lists up front. A sparse list drives
+// the query from its ids, so a rare tag costs a few lookups instead of a
+// walk through every note. A list dense enough that walking the timestamp
+// index fills the page sooner, and a negated one, walk it instead and check
+// each note's id against the lists.
+NoteCursor list_notes_by_tags(Database& db, const TagFilter& filter, const PageOptions& page) {
+    if (!filter.ids) return list_recent_notes(db, page);
+    // The walk visits about wanted * total / picked notes
+    long long picked = static_cast<long long>(filter.ids->size());
+    long long wanted = page.limit >= 0 ? std::min<long long>(page.limit, picked) : picked;
+    if (!filter.negated && ID_LOOKUP_COST * picked * picked <= wanted * get_total_notes_count(db)) {
+        std::string sql = TAGGED_SELECT_QUERY + where_clause(window_conditions(page) + after_condition(page)) + RECENT_ORDER;
+        Statement stmt = db.prepare(sql);
+        stmt.bind(sqlite3_bind_parameter_index(stmt.handle(), ":ids"), json_ids(*filter.ids));
+        bind_page(stmt, page);
+        return NoteCursor(std::move(stmt));
+    }
+    auto bound = std::make_shared<const TagFilter>(filter);
+    std::string sql = BASE_SELECT_QUERY + "WHERE " + TAG_CONDITION + window_conditions(page) + after_condition(page) + RECENT_ORDER;
+    Statement stmt = db.prepare(sql);
+    stmt.bind_pointer(sqlite3_bind_parameter_index(stmt.handle(), ":tags"), bound.get(), "TagFilter");
+    bind_page(stmt, page);
+    return NoteCursor(std::move(stmt), {std::move(bound)});
+}
+
+// Turns free-form search input into an FTS5 MATCH expression. Bare words are
+// quoted so punctuation can't break the query syntax, `"..."` stays a phrase,
+// and a trailing `*` keeps its meaning as a prefix query.
+std::string build_fts_query(const std::string& query) {
+    std::vector<std::string> terms;
+    size_t i = 0;
+    while (i < query.size()) {
+        if (std::isspace(static_cast<unsigned char>(query[i]))) { ++i; continue; }
+        std::string term;
+        bool prefix = false;
+        if (query[i] == '"') {
+            size_t end = query.find('"', i + 1);
+            if (end == std::string::npos) end = query.size();
+            term = query.substr(i + 1, end - i - 1);
+            i = end + 1;
+            if (i < query.size() && query[i] == '*') { prefix = true; ++i; }
+        } else {
+            size_t end = i;
+            while (end < query.size() && !std::isspace(static_cast<unsigned char>(query[end]))) ++end;
+            term = query.substr(i, end - i);
+            i = end;
+            if (term[0] == '#') continue; // Tags are filtered separately
+            if (term.size() > 1 && term.back() == '*') { prefix = true; term.pop_back(); }
         }
+        std::string escaped;
+        for (char c : term) {
+            if (c == '"') escaped += '"';
+            escaped += c;
+        }
+        if (escaped.find_first_not_of(" \t") == std::string::npos) continue;
+        terms.push_back("\"" + escaped + "\"" + (prefix ? "*" : ""));
     }
-    sqlite3_finalize(stmt);
-    return results;
+    std::string result;
+    for (const auto& term : terms) {
+        if (!result.empty()) result += " ";
+        result += term;
+    }
+    return result;
 }
 
-std::vector<std::pair<std::string, int>> get_project_counts(sqlite3* db) {
-    std::vector<std::pair<std::string, int>> results;
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT current_directory, COUNT(*) as count FROM metadata GROUP BY current_directory ORDER BY count DESC;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            std::string name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-            int count = sqlite3_column_int(stmt, 1);
-            results.push_back({name, count});
+// --- RANKED SEARCH ---
+// Notes per rowid range when a page's ranking is split; smaller databases
+// are ranked in one go
+const long long SEARCH_SPLIT_NOTES = 50000;
+
+// A match and its bm25 score, lower is better
+struct RankedMatch {
+    long long id;
+    double score;
+    std::string snippet;
+};
+
+struct RankQuery {
+    std::string sql;
+    std::string match;
+    const TagFilter* filter; // Null when not filtered by tags
+    PageOptions page;
+};
+
+// Ranks the matches with rowids in [low, high], best first, onto `matches`.
+// The query's LIMIT keeps that to one page.
+void rank_range(Database& db, const RankQuery& query, long long low, long long high, std::vector<RankedMatch>& matches) {
+    Statement stmt = db.prepare(query.sql);
+    bind_named(stmt, ":match", query.match);
+    bind_named(stmt, ":low", low);
+    bind_named(stmt, ":high", high);
+    if (query.filter) { stmt.bind_pointer(sqlite3_bind_parameter_index(stmt.handle(), ":tags"), query.filter, "TagFilter"); }
+    bind_page(stmt, query.page);
+    while (stmt.step()) matches.push_back({stmt.column_int64(0), sqlite3_column_double(stmt.handle(), 1), stmt.column_text(2)});
+}
+
+// On a large database a page's rowids are cut into one range per executor
+// thread, and each range's best page is ranked on its own connection. bm25
+// weighs terms by statistics of the whole index, so scores from different
+// ranges compare directly and the best of the merged pages is the same page
+// one scan would give. False when the search isn't worth splitting, or a
+// range couldn't be read; the caller then streams it on its own connection.
+bool rank_split(Database& db, const RankQuery& query, std::vector<RankedMatch>& matches) {
+    query_executor::Executor* executor = query_executor::shared();
+    const std::string path = executor && query.page.limit > 0 ? file_path(db) : "";
+    if (path.empty()) return false;
+    size_t parts = static_cast<size_t>(std::min<long long>(static_cast<long long>(executor->threads()), get_total_notes_count(db) / SEARCH_SPLIT_NOTES));
+    if (parts <= 1) return false;
+    // Apart, each is one step down the rowid b-tree; together they scan it
+    Statement bounds = db.prepare("SELECT (SELECT MIN(id) FROM notes), (SELECT MAX(id) FROM notes);");
+    if (!bounds.step()) return false;
+    const long long low = bounds.column_int64(0);
+    const long long high = bounds.column_int64(1);
+    if (high - low < static_cast<long long>(parts)) return false;
+
+    INK_TRACE_SCOPE("search_rank");
+    std::vector<std::vector<RankedMatch>> ranges(parts);
+    std::vector<query_executor::Task> tasks;
+    const long long span = high - low + 1;
+    for (size_t i = 0; i < parts; ++i) {
+        long long first = low + span * static_cast<long long>(i) / static_cast<long long>(parts);
+        long long last = low + span * static_cast<long long>(i + 1) / static_cast<long long>(parts) - 1;
+        // The first and last ranges stay open, for notes added since MIN and MAX were read
+        if (i == 0) first = std::numeric_limits<long long>::min();
+        if (i + 1 == parts) last = std::numeric_limits<long long>::max();
+        tasks.push_back({path, [&query, &ranges, i, first, last](Database& reader) { rank_range(reader, query, first, last, ranges[i]); }});
+    }
+    if (!executor->run(tasks)) return false;
+    for (auto& range : ranges) matches.insert(matches.end(), std::make_move_iterator(range.begin()), std::make_move_iterator(range.end()));
+    const size_t limit = std::min(matches.size(), static_cast<size_t>(query.page.limit));
+    std::partial_sort(matches.begin(), matches.begin() + static_cast<std::ptrdiff_t>(limit), matches.end(), [](const RankedMatch& a, const RankedMatch& b) {
+        return a.score != b.score ? a.score < b.score : a.id > b.id;
+    });
+    matches.resize(limit);
+    return true;
+}
+
+// The notes of a ranked page, looked up by id, with their snippets put back
+class RankedSource : public NoteSource {
+public:
+    RankedSource(NoteCursor notes, std::vector<RankedMatch> matches) : notes_(std::move(notes)), matches_(std::move(matches)) {}
+
+    bool next_batch(NoteBatch& batch, size_t max_rows) override {
+        if (!notes_.next_batch(rows_, max_rows)) return false;
+        batch.clear();
+        for (size_t i = 0; i < rows_.size(); ++i) {
+            NoteView note = rows_[i];
+            // A note deleted since it was ranked is simply missing
+            while (next_ < matches_.size() && matches_[next_].id != note.id) ++next_;
+            if (next_ < matches_.size()) note.snippet = matches_[next_].snippet;
+            batch.append(note);
         }
+        return true;
     }
-    sqlite3_finalize(stmt);
-    return results;
+
+private:
+    NoteCursor notes_;
+    std::vector<RankedMatch> matches_;
+    NoteBatch rows_;
+    size_t next_ = 0;
+};
+
+NoteCursor search_notes(Database& db, const std::string& query, const TagFilter& filter, const PageOptions& page) {
+    std::string match = build_fts_query(query);
+    bool filtered = filter.ids != nullptr;
+    if (match.empty() && !filtered) { return NoteCursor(); }
+    if (match.empty()) { return list_notes_by_tags(db, filter, page); }
+
+    std::string window = window_conditions(page);
+    std::string conditions = (filtered ? SEARCH_TAG_CONDITION : "") + (window.empty() ? "" : window_rowid_range("f.rowid", window) + window) +
+                             (page.after_id >= 0 ? SEARCH_AFTER_CONDITION : "");
+    RankQuery ranked{SEARCH_RANKED_QUERY + (window.empty() ? "" : SEARCH_WINDOW_JOIN) + SEARCH_RANGE_CONDITION + conditions + SEARCH_RANKED_ORDER,
+                     match, filtered ? &filter : nullptr, page};
+    std::vector<RankedMatch> matches;
+    if (rank_split(db, ranked, matches)) {
+        if (matches.empty()) { return NoteCursor(); }
+        std::vector<long long> ids;
+        ids.reserve(matches.size());
+        for (const auto& m : matches) ids.push_back(m.id);
+        return NoteCursor(std::make_unique<RankedSource>(get_notes(db, ids), std::move(matches)));
+    }
+
+    auto bound = filtered ? std::make_shared<const TagFilter>(filter) : nullptr;
+    Statement stmt = db.prepare(SEARCH_SELECT_QUERY + conditions + SEARCH_RANK_ORDER);
+    bind_named(stmt, ":match", match);
+    if (filtered) { stmt.bind_pointer(sqlite3_bind_parameter_index(stmt.handle(), ":tags"), bound.get(), "TagFilter"); }
+    bind_page(stmt, page);
+    return NoteCursor(std::move(stmt), {std::move(bound)});
+}
+
+NoteCursor fuzzy_search_notes(Database& db, const std::string& query, const TagFilter& filter, const PageOptions& page) {
+    auto fuzzy = std::make_shared<fuzzy_index::FuzzyQuery>();
+    bool matched = fuzzy_index::correct(db, query, *fuzzy);
+    bool filtered = filter.ids != nullptr;
+    if (fuzzy->word_count == 0 && filtered) { return list_notes_by_tags(db, filter, page); }
+    if (!matched) { return NoteCursor(); }
+
+    auto bound = filtered ? std::make_shared<const TagFilter>(filter) : nullptr;
+    std::string conditions = std::string(filtered ? FUZZY_TAG_CONDITION : "") + (page.after_id >= 0 ? FUZZY_AFTER_CONDITION : "");
+    std::string window = window_conditions(page);
+    if (!window.empty()) conditions += window_rowid_range("rowid", window) + FUZZY_WINDOW_CONDITION + where_clause(window) + ") ";
+    std::string floor = page.limit > 0 ? FUZZY_FLOOR_BEGIN + conditions + FUZZY_FLOOR_END : "";
+    std::string sql = "WITH ranked AS (" + FUZZY_RANKED_QUERY + floor + conditions + FUZZY_RANK_ORDER + ") " + FUZZY_SELECT_QUERY;
+    Statement stmt = db.prepare(sql);
+    bind_named(stmt, ":match", fuzzy->match);
+    int best = sqlite3_bind_parameter_index(stmt.handle(), ":best");
+    if (best > 0) stmt.bind(best, fuzzy->best_score);
+    stmt.bind_pointer(sqlite3_bind_parameter_index(stmt.handle(), ":fuzzy"), fuzzy.get(), "FuzzyQuery");
+    if (filtered) { stmt.bind_pointer(sqlite3_bind_parameter_index(stmt.handle(), ":tags"), bound.get(), "TagFilter"); }
+    bind_page(stmt, page);
+    return NoteCursor(std::move(stmt), {std::move(fuzzy), std::move(bound)});
+}
+
+// The ids go in as a JSON array, so one cached statement serves any count
+const std::string SELECT_BY_IDS_QUERY =
+    "SELECT n.id, n.text, n.timestamp, n.type, d.path, m.last_edited_file, m.git_branch, " NOTE_TAGS_QUERY ", " NOTE_BODY_COLUMNS " "
+    "FROM json_each(?1) picked JOIN notes n ON n.id = picked.value " NOTE_METADATA_JOIN NOTE_BODY_JOIN "ORDER BY picked.key;";
+
+NoteCursor get_notes(Database& db, const std::vector<long long>& ids) {
+    Statement stmt = db.prepare(SELECT_BY_IDS_QUERY);
+    stmt.bind(1, json_ids(ids));
+    return NoteCursor(std::move(stmt));
+}
+
+// ===== FUNCTIONS FOR STATISTICS =====
+
+// Counts come from the counter tables maintained since schema v5, so each
+// read is an index lookup bounded by `limit` rather than a full GROUP BY.
+int get_total_notes_count(Database& db) {
+    Statement stmt = db.prepare("SELECT count FROM stat_totals WHERE name = 'notes';");
+    return stmt.step() ? stmt.column_int(0) : 0;
 }
 
-std::vector<std::pair<std::string, int>> get_daily_counts(sqlite3* db) {
+// Reads (name, count) rows from a top-N query.
+std::vector<std::pair<std::string, int>> read_counts(Database& db, const std::string& sql, int limit) {
+    INK_TRACE_SCOPE("stats_query");
     std::vector<std::pair<std::string, int>> results;
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT STRFTIME('%Y-%m-%d', timestamp) as day, COUNT(*) as count FROM notes GROUP BY day ORDER BY day DESC;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            std::string name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-            int count = sqlite3_column_int(stmt, 1);
-            results.push_back({name, count});
-        }
+    Statement stmt = db.prepare(sql);
+    stmt.bind(1, limit);
+    while (stmt.step()) {
+        results.push_back({stmt.column_text(0), stmt.column_int(1)});
     }
-    sqlite3_finalize(stmt);
     return results;
 }
 
+std::vector<std::pair<std::string, int>> get_tag_counts(Database& db, int limit) {
+    return read_counts(db, "SELECT t.name, s.count FROM stat_tag_counts s JOIN tag_dict t ON t.id = s.tag_id ORDER BY s.count DESC LIMIT ?;", limit);
+}
+
+std::vector<std::pair<std::string, int>> get_project_counts(Database& db, int limit) {
+    return read_counts(db, "SELECT d.path, s.count FROM stat_project_counts s JOIN dir_dict d ON d.id = s.dir_id ORDER BY s.count DESC LIMIT ?;", limit);
+}
+
+std::vector<std::pair<std::string, int>> get_daily_counts(Database& db, int limit) {
+    return read_counts(db, "SELECT day, count FROM stat_daily_counts ORDER BY day DESC LIMIT ?;", limit);
+}
+
+std::vector<std::pair<std::string, int>> get_daily_counts_between(Database& db, const std::string& since, const std::string& until) {
+    std::vector<std::pair<std::string, int>> results;
+    Statement stmt = db.prepare("SELECT day, count FROM stat_daily_counts WHERE day >= substr(?1, 1, 10) AND (?2 = '' OR day < substr(?2, 1, 10)) ORDER BY day;");
+    stmt.bind(1, since).bind(2, until);
+    while (stmt.step()) results.push_back({stmt.column_text(0), stmt.column_int(1)});
+    return results;
+}
+
+bool scan_window(Database& db, const std::string& since, const std::string& until,
+                 const std::function<void(std::string_view timestamp, long long dir_id)>& f) {
+    INK_TRACE_SCOPE("scan_window");
+    PageOptions window;
+    window.since = since;
+    window.until = until;
+    std::string sql = "SELECT n.timestamp, COALESCE(m.dir_id, -1) FROM notes n LEFT JOIN metadata m ON n.id = m.note_id " +
+                      where_clause(window_conditions(window)) + ";";
+    Statement stmt = db.prepare(sql);
+    if (!stmt.ok()) return false;
+    bind_page(stmt, window);
+    while (stmt.step()) {
+        f(stmt.column_view(0), stmt.column_int64(1));
+    }
+    return true;
+}
+
+std::string get_directory_path(Database& db, long long dir_id) {
+    Statement stmt = db.prepare("SELECT path FROM dir_dict WHERE id = ?;");
+    return stmt.bind(1, dir_id).step() ? stmt.column_text(0) : "";
+}
+
+std::string get_oldest_timestamp(Database& db) {
+    Statement stmt = db.prepare("SELECT MIN(timestamp) FROM notes;");
+    return stmt.step() ? stmt.column_text(0) : "";
+}
+
+std::string get_note_timestamp(Database& db, long long note_id) {
+    Statement stmt = db.prepare("SELECT timestamp FROM notes WHERE id = ?;");
+    return stmt.bind(1, note_id).step() ? stmt.column_text(0) : "";
+}
+
+bool rebuild_stats(Database& db) {
+    INK_TRACE_SCOPE("rebuild_stats");
+    Transaction txn(db, true);
+    if (!txn.ok()) return false;
+    for (const auto& sql : STATS_REBUILD_SQL) {
+        if (!db.execute(sql)) return false;
+    }
+    return txn.commit();
+}
+
+// --- FILES ---
+std::string file_path(Database& db) {
+    const char* path = sqlite3_db_filename(db.handle(), "main");
+    return path ? path : "";
+}
+
+std::string sidecar_path(const std::string& db_path, const std::string& suffix) {
+    const std::string extension = ".db";
+    bool has_extension = db_path.size() > extension.size() &&
+                         db_path.compare(db_path.size() - extension.size(), extension.size(), extension) == 0;
+    return (has_extension ? db_path.substr(0, db_path.size() - extension.size()) : db_path) + suffix;
+}
+
 }
\ No newline at end of file
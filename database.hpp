@@ -2,11 +2,22 @@
 #define DATABASE_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <utility> 
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
 #include <sqlite3.h>
 #include "metadata_collector.hpp"
 
+// Markers wrapped around matched terms in FullNote::snippet. The formatter
+// decides how (or whether) to render them.
+#define SNIPPET_BEGIN "\x02"
+#define SNIPPET_END "\x03"
+
 struct FullNote {
     long long id;
     std::string text;
@@ -14,26 +25,346 @@ struct FullNote {
     std::string timestamp;
     std::vector<std::string> tags;
     ProgMetadata metadata;
+    // A body piped in with the note: its first lines and its full size in
+    // bytes, 0 for none. The body itself is read with note_body::write.
+    std::string body_head;
+    long long body_size = 0;
+    std::string snippet; // Highlighted excerpt, only set by searches
+};
+
+// Which slice of the results a query returns. Listings run newest first by
+// (timestamp, id); searches run by rank, then id. `since` and `until` bound
+// the notes' timestamps to [since, until), in their stored
+// "YYYY-MM-DD HH:MM:SS" form; empty leaves that end open.
+struct PageOptions {
+    long long after_id = -1; // Resume after this note, as printed at the end of a page
+    int limit = -1;          // -1 for no limit
+    std::string since;
+    std::string until;
+    // The after_id note's timestamp, for listings over a database that
+    // doesn't hold that note (an archive); empty to look it up
+    std::string after_timestamp;
+};
+
+// Notes picked out by a tag query: those in `ids`, or with `negated`, those
+// not in it. A filter without ids lets every note through.
+struct TagFilter {
+    std::shared_ptr<const std::vector<long long>> ids; // Sorted ascending
+    bool negated = false;
 };
 
+// Bookkeeping for loading many notes inside one caller-owned transaction.
+// Call flush_bulk_insert before each COMMIT.
+struct BulkInsert {
+    long long first_pending_id = -1; // First note not yet in the search index or stats
+};
+
+namespace tag_index { class TagIndex; }
+namespace note_body { class Spool; }
+
 namespace db {
-    // Initialization
-    sqlite3* init_database(const std::string& db_path);
+    // A prepared statement borrowed from Database's cache. It is reset and its
+    // bindings cleared when the handle goes out of scope, ready for reuse.
+    class Statement {
+    public:
+        Statement() = default;
+        Statement(sqlite3_stmt* stmt, bool* in_use);
+        Statement(Statement&& other) noexcept;
+        Statement& operator=(Statement&& other) noexcept;
+        Statement(const Statement&) = delete;
+        Statement& operator=(const Statement&) = delete;
+        ~Statement();
+
+        bool ok() const { return stmt_ != nullptr; }
+        sqlite3_stmt* handle() const { return stmt_; }
+
+        // Parameter indexes start at 1, as in sqlite3_bind_*
+        Statement& bind(int index, int value);
+        Statement& bind(int index, long long value);
+        Statement& bind(int index, double value);
+        Statement& bind(int index, const std::string& value);
+        Statement& bind(int index, const char* value);
+        Statement& bind_null(int index);
+        // Passes a C++ object to an SQL function; see sqlite3_bind_pointer
+        Statement& bind_pointer(int index, const void* value, const char* type);
+        // Binds NULL when the string is empty
+        Statement& bind_optional(int index, const std::string& value);
+        Statement& bind_blob(int index, std::string_view value);
+
+        // Returns true while there is a row to read.
+        bool step();
+        // Runs a statement that returns no rows; true on SQLITE_DONE.
+        bool run();
+        // Rewinds the statement so it can run again with new bindings.
+        void reset();
+
+        int column_count() const;
+        int column_int(int index) const;
+        long long column_int64(int index) const;
+        // NULL columns read back as an empty string
+        std::string column_text(int index) const;
+        // Same, without the copy. Valid until the next step or reset.
+        std::string_view column_view(int index) const;
+        std::string_view column_blob(int index) const;
+
+    private:
+        void release();
+        sqlite3_stmt* stmt_ = nullptr;
+        bool* in_use_ = nullptr; // Cache slot flag; null when this handle owns the statement
+    };
+
+    // Owns the SQLite connection and an LRU cache of prepared statements keyed
+    // by their SQL text, so repeated queries skip sqlite3_prepare_v2.
+    class Database {
+    public:
+        explicit Database(const std::string& db_path, size_t cache_capacity = 32);
+        ~Database();
+        Database(const Database&) = delete;
+        Database& operator=(const Database&) = delete;
+
+        bool is_open() const { return db_ != nullptr; }
+        sqlite3* handle() const { return db_; }
+
+        Statement prepare(const std::string& sql);
+        bool execute(const std::string& sql);
+        long long last_insert_rowid() const;
+        // Per-connection cache of tag posting lists
+        tag_index::TagIndex& tag_index();
+
+        // Dictionary ids for tag names and directories, adding them if new.
+        // Ids are cached per connection, so repeat values on the write path
+        // skip the lookup. Returns -1 on error.
+        long long intern_tag(const std::string& name);
+        long long intern_dir(const std::string& path);
+        // Same for the fuzzy search vocabulary; `added` tells whether the
+        // word is new, so its trigrams still need indexing.
+        long long intern_term(const std::string& term, bool& added);
+        // Drops the cached ids; a rollback may have undone the rows behind them.
+        void forget_interned();
+        // Runs `f` once the open transaction commits, or right away outside
+        // one. Rolling back, a savepoint included, drops what it queued.
+        void after_commit(std::function<void()> f);
+
+    private:
+        friend class Transaction;
+        struct CachedStatement {
+            std::string sql;
+            sqlite3_stmt* stmt;
+            bool in_use;
+        };
+        void evict();
+        long long intern(std::unordered_map<std::string, long long>& ids, const char* select_sql, const char* insert_sql, const std::string& value, bool* added = nullptr);
+
+        sqlite3* db_ = nullptr;
+        size_t cache_capacity_;
+        std::list<CachedStatement> lru_; // Most recently used first
+        std::unordered_map<std::string, std::list<CachedStatement>::iterator> cache_;
+        std::unique_ptr<tag_index::TagIndex> tag_index_;
+        std::unordered_map<std::string, long long> tag_ids_;
+        std::unordered_map<std::string, long long> dir_ids_;
+        std::unordered_map<std::string, long long> term_ids_;
+        std::vector<std::function<void()>> after_commit_;
+    };
+
+    // Opens a transaction that rolls back on scope exit unless commit() is called.
+    // Inside an open transaction it becomes a savepoint, so its work joins the
+    // outer commit (the server batches writes this way).
+    class Transaction {
+    public:
+        explicit Transaction(Database& db, bool immediate = false);
+        ~Transaction();
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
 
-    // Functions to add notes
-    bool add_general_note(sqlite3* db, const std::string& text, const std::vector<std::string>& tags);
-    bool add_prog_note(sqlite3* db, const std::string& text, const std::vector<std::string>& tags, const ProgMetadata& metadata);
+        bool ok() const { return active_; }
+        bool commit();
+
+    private:
+        Database& db_;
+        bool active_;
+        bool nested_;
+        size_t queued_; // after_commit work queued before the savepoint
+    };
+
+    class NoteBatch;
+
+    // One note in a NoteBatch. Its views point into the batch's arena.
+    struct NoteView {
+        long long id;
+        std::string_view text;
+        std::string_view type;
+        std::string_view timestamp;
+        std::string_view current_directory;
+        std::string_view last_edited_file;
+        std::string_view git_branch;
+        std::string_view body_head;
+        long long body_size; // 0 without a body
+        std::string_view snippet; // Only set by searches
+
+        // The note's tags, split in place without the leading '#'
+        class TagList {
+        public:
+            struct iterator {
+                const TagList* list;
+                size_t index;
+                std::string_view operator*() const { return (*list)[index]; }
+                iterator& operator++() { ++index; return *this; }
+                bool operator!=(const iterator& other) const { return index != other.index; }
+            };
+            TagList(const NoteBatch& batch, uint32_t first, uint32_t count) : batch_(&batch), first_(first), count_(count) {}
+            size_t size() const { return count_; }
+            bool empty() const { return count_ == 0; }
+            std::string_view operator[](size_t i) const;
+            iterator begin() const { return {this, 0}; }
+            iterator end() const { return {this, count_}; }
+
+        private:
+            const NoteBatch* batch_;
+            uint32_t first_;
+            uint32_t count_;
+        };
+        TagList tags;
+    };
+
+    // A run of rows filled by NoteCursor::next_batch. All of the batch's
+    // strings are copied into one arena, which keeps its capacity from batch
+    // to batch, so once it has grown to fit a page, decoding allocates nothing.
+    // Views stay valid until the batch is refilled.
+    class NoteBatch {
+    public:
+        size_t size() const { return records_.size(); }
+        bool empty() const { return records_.empty(); }
+        NoteView operator[](size_t i) const;
+        void clear();
+        // Copies a note from another batch
+        void append(const NoteView& note);
+
+    private:
+        friend class NoteCursor;
+        friend class NoteView::TagList;
+        // Offsets rather than pointers, since the arena moves as it grows
+        struct Span {
+            uint32_t offset;
+            uint32_t length;
+        };
+        struct Record {
+            long long id;
+            Span text, type, timestamp, current_directory, last_edited_file, git_branch, body_head, snippet;
+            long long body_size;
+            uint32_t first_tag;
+            uint32_t tag_count;
+        };
+
+        void append_row(const Statement& stmt);
+        Span append(std::string_view value);
+        std::string_view view(Span span) const { return std::string_view(arena_.data() + span.offset, span.length); }
+
+        std::vector<char> arena_;
+        std::vector<Record> records_;
+        std::vector<Span> tags_;
+    };
+
+    // Rows for a NoteCursor that come from somewhere other than a single
+    // statement, such as results merged from several databases.
+    class NoteSource {
+    public:
+        virtual ~NoteSource() = default;
+        // Same contract as NoteCursor::next_batch
+        virtual bool next_batch(NoteBatch& batch, size_t max_rows) = 0;
+    };
+
+    // Streams the rows of a note query. next() reads nothing ahead, and
+    // next_batch() at most one batch: stopping early, or letting the cursor
+    // go out of scope, ends the query there.
+    class NoteCursor {
+    public:
+        NoteCursor() = default;
+        explicit NoteCursor(Statement stmt, std::vector<std::shared_ptr<const void>> bound = {});
+        explicit NoteCursor(std::unique_ptr<NoteSource> source);
+        NoteCursor(NoteCursor&&) = default;
+        NoteCursor& operator=(NoteCursor&&) = default;
+        ~NoteCursor();
+
+        // Reads the next row into `note`, reusing its buffers. False at the end.
+        bool next(FullNote& note);
+        // Refills `batch` with up to `max_rows` rows. False once none are left.
+        bool next_batch(NoteBatch& batch, size_t max_rows = 128);
+
+    private:
+        bool step();
+
+        std::vector<std::shared_ptr<const void>> bound_; // Objects bound into stmt_, so they must outlive it
+        Statement stmt_;
+        std::unique_ptr<NoteSource> source_; // Replaces stmt_ when set
+        NoteBatch one_row_;                  // next() reads a source through this
+        bool done_ = false;
+        // Only kept while tracing
+        long long rows_ = 0;
+        long long step_us_ = 0;
+        long long read_us_ = 0;
+    };
+
+    // Functions to add notes. `body`, if given, is stored along with the note.
+    bool add_general_note(Database& db, const std::string& text, const std::vector<std::string>& tags, const note_body::Spool* body = nullptr);
+    bool add_prog_note(Database& db, const std::string& text, const std::vector<std::string>& tags, const ProgMetadata& metadata,
+                       const note_body::Spool* body = nullptr);
+
+    // Functions for deferred metadata. A pending note is saved with only its
+    // directory and returns its id (or -1); the enricher later fills in the
+    // rest, or marks it timed out if collection never finished.
+    long long add_pending_prog_note(Database& db, const std::string& text, const std::vector<std::string>& tags, const std::string& current_directory,
+                                    const note_body::Spool* body = nullptr);
+    bool enrich_metadata(Database& db, long long note_id, const ProgMetadata& metadata);
+    // Sets a note's metadata whatever state it was in, as `ink sync` does
+    // when the other side's copy holds more of it.
+    bool replace_metadata(Database& db, long long note_id, const ProgMetadata& metadata);
+    bool expire_enrichment(Database& db, long long note_id);
+    // Times out notes left pending for over a minute by an enricher that died.
+    bool expire_stale_enrichments(Database& db);
+
+    // Functions for bulk loading. Notes keep their own timestamp when one is
+    // set. bulk_insert_note returns the new note's id, or -1.
+    long long bulk_insert_note(Database& db, BulkInsert& bulk, const FullNote& note);
+    bool flush_bulk_insert(Database& db, BulkInsert& bulk);
 
     // Functions to retrieve notes
-    std::vector<FullNote> list_recent_notes(sqlite3* db, int limit);
-    std::vector<FullNote> list_notes_by_tag(sqlite3* db, const std::string& tag);
-    std::vector<FullNote> search_notes(sqlite3* db, const std::string& query, const std::vector<std::string>& tags);
-
-    // Functions for statistics
-    int get_total_notes_count(sqlite3* db);
-    std::vector<std::pair<std::string, int>> get_tag_counts(sqlite3* db);
-    std::vector<std::pair<std::string, int>> get_project_counts(sqlite3* db);
-    std::vector<std::pair<std::string, int>> get_daily_counts(sqlite3* db);
+    NoteCursor list_recent_notes(Database& db, const PageOptions& page);
+    NoteCursor list_notes_by_tags(Database& db, const TagFilter& filter, const PageOptions& page);
+    // Full-text search ranked by BM25. Supports "phrase" and prefix* terms.
+    NoteCursor search_notes(Database& db, const std::string& query, const TagFilter& filter, const PageOptions& page);
+    // Typo-tolerant search: each word may be a few edits off from the note
+    // text or last edited file. Ranked by similarity, then newest first.
+    NoteCursor fuzzy_search_notes(Database& db, const std::string& query, const TagFilter& filter, const PageOptions& page);
+    // The notes with these ids, in the order given. Ids not found are skipped.
+    NoteCursor get_notes(Database& db, const std::vector<long long>& ids);
+
+    // Functions for statistics. These read trigger-maintained counter tables
+    // and return only the top `limit` rows.
+    int get_total_notes_count(Database& db);
+    std::vector<std::pair<std::string, int>> get_tag_counts(Database& db, int limit);
+    std::vector<std::pair<std::string, int>> get_project_counts(Database& db, int limit);
+    std::vector<std::pair<std::string, int>> get_daily_counts(Database& db, int limit);
+    // Counts for the days from `since`'s up to `until`, oldest first, from
+    // the same counters. Empty bounds are open.
+    std::vector<std::pair<std::string, int>> get_daily_counts_between(Database& db, const std::string& since, const std::string& until);
+    // Calls `f` with the timestamp and project directory id (-1 for none) of
+    // every note in [since, until), by range over the timestamp index. Empty
+    // bounds are open. The timestamp view is only valid during the call.
+    bool scan_window(Database& db, const std::string& since, const std::string& until,
+                     const std::function<void(std::string_view timestamp, long long dir_id)>& f);
+    std::string get_directory_path(Database& db, long long dir_id);
+    // The oldest note's timestamp, or empty with no notes. An index lookup.
+    std::string get_oldest_timestamp(Database& db);
+    // A note's timestamp, or empty if this database doesn't hold it.
+    std::string get_note_timestamp(Database& db, long long note_id);
+    // Recomputes the counter tables from the notes themselves.
+    bool rebuild_stats(Database& db);
+
+    // The file behind a database, or empty for an in-memory one.
+    std::string file_path(Database& db);
+    // A file kept beside a database, named after it without the .db suffix:
+    // ~/.den_den_ink.db and ".complete" give ~/.den_den_ink.complete.
+    std::string sidecar_path(const std::string& db_path, const std::string& suffix);
 }
 
 #endif
\ No newline at end of file
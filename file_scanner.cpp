@@ -0,0 +1,336 @@
+#include "file_scanner.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace scanner {
+
+// --- GITIGNORE RULES ---
+// Matches a gitignore-style glob. `*` and `?` stop at '/', `**` crosses
+// directories, and `[...]` is a character class.
+bool glob_match(const char* p, const char* t) {
+    while (*p) {
+        if (p[0] == '*' && p[1] == '*') {
+            while (*p == '*') ++p;
+            if (*p == '\0') return true;
+            if (*p == '/') {
+                // "**/" matches zero or more leading directories
+                ++p;
+                for (const char* s = t; ; ++s) {
+                    if ((s == t || s[-1] == '/') && glob_match(p, s)) return true;
+                    if (*s == '\0') return false;
+                }
+            }
+            for (const char* s = t; ; ++s) {
+                if (glob_match(p, s)) return true;
+                if (*s == '\0') return false;
+            }
+        }
+        if (*p == '*') {
+            ++p;
+            for (const char* s = t; ; ++s) {
+                if (glob_match(p, s)) return true;
+                if (*s == '\0' || *s == '/') return false;
+            }
+        }
+        if (*t == '\0') return false;
+        if (*p == '?') {
+            if (*t == '/') return false;
+        } else if (*p == '[') {
+            const char* q = p + 1;
+            bool negate = (*q == '!' || *q == '^');
+            if (negate) ++q;
+            bool matched = false;
+            bool first = true;
+            while (*q && (first || *q != ']')) {
+                first = false;
+                if (q[1] == '-' && q[2] && q[2] != ']') {
+                    if (*t >= q[0] && *t <= q[2]) matched = true;
+                    q += 3;
+                } else {
+                    if (*t == *q) matched = true;
+                    ++q;
+                }
+            }
+            if (*q != ']') {
+                // Unterminated class: treat '[' literally
+                if (*t != '[') return false;
+            } else {
+                if (matched == negate || *t == '/') return false;
+                p = q;
+            }
+        } else {
+            if (*p == '\\' && p[1]) ++p;
+            if (*p != *t) return false;
+        }
+        ++p;
+        ++t;
+    }
+    return *t == '\0';
+}
+
+struct IgnoreRule {
+    std::string pattern;
+    bool negate = false;
+    bool dir_only = false;
+    bool basename_only = false; // Patterns without a '/' match at any depth
+};
+
+// The rules from one .gitignore, chained to those of its parent directories.
+struct IgnoreList {
+    std::shared_ptr<const IgnoreList> parent;
+    std::string base; // Directory holding the .gitignore, relative to the scan root
+    std::vector<IgnoreRule> rules;
+
+    // -1 = no rule matched, 0 = re-included by a negated rule, 1 = ignored.
+    // Rules closer to the file win, and later rules win within a file.
+    int check(const std::string& rel, const char* name, bool is_dir) const {
+        int result = parent ? parent->check(rel, name, is_dir) : -1;
+        const char* sub = rel.c_str();
+        if (!base.empty()) {
+            if (rel.compare(0, base.size(), base) != 0 || rel[base.size()] != '/') return result;
+            sub += base.size() + 1;
+        }
+        for (const auto& rule : rules) {
+            if (rule.dir_only && !is_dir) continue;
+            if (glob_match(rule.pattern.c_str(), rule.basename_only ? name : sub)) {
+                result = rule.negate ? 0 : 1;
+            }
+        }
+        return result;
+    }
+};
+
+std::shared_ptr<const IgnoreList> load_gitignore(int dir_fd, const std::string& base, std::shared_ptr<const IgnoreList> parent) {
+    int fd = openat(dir_fd, ".gitignore", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return parent;
+    std::string content;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) content.append(buffer, n);
+    close(fd);
+
+    auto list = std::make_shared<IgnoreList>();
+    list->parent = std::move(parent);
+    list->base = base;
+    size_t start = 0;
+    while (start < content.size()) {
+        size_t end = content.find('\n', start);
+        if (end == std::string::npos) end = content.size();
+        std::string line = content.substr(start, end - start);
+        start = end + 1;
+
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        IgnoreRule rule;
+        if (line[0] == '!') { rule.negate = true; line.erase(0, 1); }
+        if (!line.empty() && line.back() == '/') { rule.dir_only = true; line.pop_back(); }
+        if (line.empty()) continue;
+        rule.basename_only = line.find('/') == std::string::npos;
+        if (line[0] == '/') line.erase(0, 1);
+        rule.pattern = line;
+        list->rules.push_back(std::move(rule));
+    }
+    return list;
+}
+
+// --- WORK-STEALING SCAN ---
+struct DirTask {
+    std::string rel; // Relative to the scan root, "" for the root itself
+    int depth;
+    std::shared_ptr<const IgnoreList> ignore;
+};
+
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<DirTask> tasks;
+};
+
+struct WorkerResult {
+    std::string path;
+    long long mtime_ns = -1;
+    long long files_seen = 0;
+};
+
+long long mtime_ns_of(const struct stat& st) {
+#ifdef __APPLE__
+    return static_cast<long long>(st.st_mtimespec.tv_sec) * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    return static_cast<long long>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+}
+
+class Scan {
+public:
+    Scan(const std::string& root, const ScanOptions& options)
+        : root_(root), options_(options), skip_(options.skip_dirs.begin(), options.skip_dirs.end()),
+          deadline_(std::chrono::steady_clock::now() + std::chrono::milliseconds(options.time_budget_ms)) {
+        unsigned threads = options.threads;
+        if (threads == 0) threads = std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
+        queues_ = std::vector<WorkQueue>(threads);
+        results_ = std::vector<WorkerResult>(threads);
+    }
+
+    ScanResult run() {
+        pending_ = 1;
+        queues_[0].tasks.push_back({"", 0, nullptr});
+        std::vector<std::thread> helpers;
+        for (size_t i = 1; i < queues_.size(); ++i) helpers.emplace_back(&Scan::work, this, i);
+        work(0);
+        for (auto& t : helpers) t.join();
+
+        ScanResult result;
+        result.complete = !timed_out_;
+        long long best = -1;
+        for (const auto& r : results_) {
+            result.files_seen += r.files_seen;
+            if (r.mtime_ns > best) { best = r.mtime_ns; result.path = r.path; }
+        }
+        result.mtime_ns = best < 0 ? 0 : best;
+        return result;
+    }
+
+private:
+    const std::string& root_;
+    const ScanOptions& options_;
+    std::unordered_set<std::string> skip_;
+    std::chrono::steady_clock::time_point deadline_;
+    std::vector<WorkQueue> queues_;
+    std::vector<WorkerResult> results_;
+    std::atomic<long long> pending_{0}; // Directories queued or being read
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> timed_out_{false};
+
+    // Pops from the back of our own queue, or steals from the front of another.
+    bool next_task(size_t id, DirTask& task) {
+        {
+            std::lock_guard<std::mutex> lock(queues_[id].mutex);
+            if (!queues_[id].tasks.empty()) {
+                task = std::move(queues_[id].tasks.back());
+                queues_[id].tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues_.size(); ++i) {
+            WorkQueue& victim = queues_[(id + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t id) {
+        DirTask task;
+        while (!stop_) {
+            if (!next_task(id, task)) {
+                if (pending_ == 0) return;
+                std::this_thread::yield();
+                continue;
+            }
+            if (std::chrono::steady_clock::now() > deadline_) {
+                timed_out_ = true;
+                stop_ = true;
+                return;
+            }
+            scan_directory(id, task);
+            --pending_;
+        }
+    }
+
+    void scan_directory(size_t id, const DirTask& task) {
+        std::string dir_path = task.rel.empty() ? root_ : root_ + "/" + task.rel;
+        int dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) return;
+        DIR* dir = fdopendir(dir_fd);
+        if (!dir) { close(dir_fd); return; }
+
+        struct Entry { std::string name; unsigned char type; };
+        std::vector<Entry> entries;
+        bool has_gitignore = false;
+        while (struct dirent* ent = readdir(dir)) {
+            const char* name = ent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            if (std::strcmp(name, ".gitignore") == 0) has_gitignore = true;
+            entries.push_back({name, ent->d_type});
+        }
+
+        std::shared_ptr<const IgnoreList> ignore = task.ignore;
+        if (options_.use_gitignore && has_gitignore) ignore = load_gitignore(dir_fd, task.rel, ignore);
+
+        WorkerResult& best = results_[id];
+        std::vector<DirTask> children;
+        for (const auto& entry : entries) {
+            // d_type saves a stat for directories; only files (and filesystems
+            // that don't report a type) need the one fstatat call
+            struct stat st;
+            bool have_stat = false;
+            unsigned char type = entry.type;
+            if (type == DT_UNKNOWN) {
+                if (fstatat(dir_fd, entry.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                have_stat = true;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+            }
+            if (type != DT_DIR && type != DT_REG) continue;
+
+            std::string rel = task.rel.empty() ? entry.name : task.rel + "/" + entry.name;
+            if (type == DT_DIR) {
+                if (skip_.count(entry.name) || task.depth + 1 > options_.max_depth) continue;
+                if (ignore && ignore->check(rel, entry.name.c_str(), true) == 1) continue;
+                children.push_back({std::move(rel), task.depth + 1, ignore});
+                continue;
+            }
+            if (ignore && ignore->check(rel, entry.name.c_str(), false) == 1) continue;
+            if (!have_stat && fstatat(dir_fd, entry.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            ++best.files_seen;
+            long long mtime = mtime_ns_of(st);
+            if (mtime > best.mtime_ns) {
+                best.mtime_ns = mtime;
+                best.path = std::move(rel);
+            }
+        }
+        closedir(dir);
+
+        if (!children.empty()) {
+            pending_ += static_cast<long long>(children.size());
+            std::lock_guard<std::mutex> lock(queues_[id].mutex);
+            for (auto& child : children) queues_[id].tasks.push_back(std::move(child));
+        }
+    }
+};
+
+ScanResult find_last_edited_file(const std::string& root, const ScanOptions& options) {
+    return Scan(root, options).run();
+}
+
+ScanOptions options_from_env() {
+    ScanOptions options;
+    if (const char* skip = getenv("INK_SCAN_SKIP")) {
+        std::string list = skip;
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos) end = list.size();
+            if (end > start) options.skip_dirs.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+    if (const char* timeout = getenv("INK_SCAN_TIMEOUT_MS")) options.time_budget_ms = std::atoi(timeout);
+    if (const char* depth = getenv("INK_SCAN_MAX_DEPTH")) options.max_depth = std::atoi(depth);
+    return options;
+}
+
+}
@@ -0,0 +1,34 @@
+#ifndef FILE_SCANNER_HPP
+#define FILE_SCANNER_HPP
+
+#include <string>
+#include <vector>
+
+// Limits and filters for a directory scan.
+struct ScanOptions {
+    std::vector<std::string> skip_dirs = {".git", ".hg", ".svn", "node_modules", "__pycache__"};
+    bool use_gitignore = true;
+    int max_depth = 32;         // Directories deeper than this are not entered
+    int time_budget_ms = 300;   // The scan stops here and returns its best result so far
+    unsigned threads = 0;       // 0 picks a count from the hardware
+};
+
+struct ScanResult {
+    std::string path;           // Relative to the scanned root; empty if nothing was found
+    long long mtime_ns = 0;
+    long long files_seen = 0;
+    bool complete = true;       // False when a time budget cut the scan short
+};
+
+namespace scanner {
+    // Default options, with INK_SCAN_SKIP (comma-separated names added to the
+    // skip list), INK_SCAN_TIMEOUT_MS and INK_SCAN_MAX_DEPTH applied.
+    ScanOptions options_from_env();
+
+    // Finds the most recently modified regular file under root using a pool of
+    // work-stealing threads. Skipped and gitignored directories are pruned
+    // without being read.
+    ScanResult find_last_edited_file(const std::string& root, const ScanOptions& options);
+}
+
+#endif
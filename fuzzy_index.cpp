@@ -0,0 +1,271 @@
+#include "fuzzy_index.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+
+namespace fuzzy_index {
+
+// Longer words are left out of the vocabulary and must match exactly. This
+// also keeps every indexed word inside one 64-bit edit distance column.
+const size_t MAX_WORD_BYTES = 64;
+// Corrections kept per query word, closest first
+const size_t MAX_CORRECTIONS = 16;
+
+// --- WORDS AND TRIGRAMS ---
+// Calls `f` with each word of `text`, split the way FTS5's unicode61
+// tokenizer splits ASCII: runs of letters and digits. Bytes past ASCII count
+// as letters.
+template <typename F>
+void for_each_word(std::string_view text, F&& f) {
+    auto is_word = [&](size_t at) {
+        unsigned char c = static_cast<unsigned char>(text[at]);
+        return c >= 0x80 || (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+    };
+    size_t i = 0;
+    while (i < text.size()) {
+        if (!is_word(i)) { ++i; continue; }
+        size_t end = i;
+        while (end < text.size() && is_word(end)) ++end;
+        f(text.substr(i, end - i));
+        i = end;
+    }
+}
+
+void lowercase(std::string_view word, std::string& out) {
+    out.assign(word.begin(), word.end());
+    for (char& c : out) {
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+    }
+}
+
+// The distinct trigrams of the word padded with a space on each side, so a
+// word of n bytes has up to n of them and even one-letter words have one.
+std::vector<std::string> trigrams(const std::string& word) {
+    std::string padded = " " + word + " ";
+    std::vector<std::string> grams;
+    for (size_t i = 0; i + 3 <= padded.size(); ++i) grams.push_back(padded.substr(i, 3));
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+// Edits allowed for a query word of this length
+int max_edits(size_t length) {
+    if (length <= 2) return 0;
+    if (length <= 5) return 1;
+    return 2;
+}
+
+const std::string INSERT_TRIGRAM_SQL = "INSERT OR IGNORE INTO fuzzy_trigrams (trigram, term_id) VALUES (?, ?);";
+
+bool add_words(db::Database& db, std::string_view text, std::vector<long long>* term_ids) {
+    std::string word;
+    bool ok = true;
+    for_each_word(text, [&](std::string_view raw) {
+        if (!ok || raw.size() > MAX_WORD_BYTES) return;
+        lowercase(raw, word);
+        bool added = false;
+        long long term_id = db.intern_term(word, added);
+        if (term_id < 0) { ok = false; return; }
+        if (term_ids) term_ids->push_back(term_id);
+        if (!added) return;
+        db::Statement stmt = db.prepare(INSERT_TRIGRAM_SQL);
+        for (const auto& gram : trigrams(word)) {
+            if (!stmt.bind(1, gram).bind(2, term_id).run()) { ok = false; return; }
+        }
+    });
+    return ok;
+}
+
+// --- EDIT DISTANCE ---
+// Myers' bit-parallel algorithm, in Hyyrö's form with transpositions: one
+// 64-bit word holds a whole column of the DP matrix for `pattern`, so each
+// byte of `text` costs a handful of word operations instead of a loop over
+// the pattern.
+int bit_parallel_distance(std::string_view pattern, std::string_view text, int max_edits) {
+    thread_local uint64_t peq[256] = {};
+    const size_t m = pattern.size();
+    for (size_t i = 0; i < m; ++i) peq[static_cast<unsigned char>(pattern[i])] |= uint64_t(1) << i;
+
+    const uint64_t last = uint64_t(1) << (m - 1);
+    uint64_t vp = ~uint64_t(0);
+    uint64_t vn = 0;
+    uint64_t d0 = 0;
+    uint64_t previous_eq = 0;
+    int score = static_cast<int>(m);
+    for (size_t j = 0; j < text.size(); ++j) {
+        uint64_t eq = peq[static_cast<unsigned char>(text[j])];
+        uint64_t transposed = (((~d0) & eq) << 1) & previous_eq;
+        d0 = ((((eq & vp) + vp) ^ vp) | eq | vn) | transposed;
+        uint64_t hp = vn | ~(d0 | vp);
+        uint64_t hn = d0 & vp;
+        if (hp & last) ++score;
+        else if (hn & last) --score;
+        hp = (hp << 1) | 1;
+        hn <<= 1;
+        vp = hn | ~(d0 | hp);
+        vn = hp & d0;
+        previous_eq = eq;
+        // Each remaining byte can lower the distance by at most one
+        if (score - static_cast<int>(text.size() - j - 1) > max_edits) break;
+    }
+    for (size_t i = 0; i < m; ++i) peq[static_cast<unsigned char>(pattern[i])] = 0;
+    return std::min(score, max_edits + 1);
+}
+
+// The same distance by the textbook DP, for patterns too long for one word.
+int dp_distance(std::string_view a, std::string_view b, int max_edits) {
+    std::vector<int> before(b.size() + 1), previous(b.size() + 1), current(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); ++j) previous[j] = static_cast<int>(j);
+    for (size_t i = 1; i <= a.size(); ++i) {
+        current[0] = static_cast<int>(i);
+        int row_min = current[0];
+        for (size_t j = 1; j <= b.size(); ++j) {
+            int substitute = previous[j - 1] + (a[i - 1] != b[j - 1]);
+            current[j] = std::min({previous[j] + 1, current[j - 1] + 1, substitute});
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]) {
+                current[j] = std::min(current[j], before[j - 2] + 1);
+            }
+            row_min = std::min(row_min, current[j]);
+        }
+        // A transposition reads two rows back, so stop only once both are over
+        if (row_min > max_edits && *std::min_element(previous.begin(), previous.end()) > max_edits) return max_edits + 1;
+        std::swap(before, previous);
+        std::swap(previous, current);
+    }
+    return std::min(previous[b.size()], max_edits + 1);
+}
+
+int bounded_edit_distance(std::string_view a, std::string_view b, int max_edits) {
+    if (a.size() > b.size()) std::swap(a, b);
+    if (b.size() - a.size() > static_cast<size_t>(max_edits)) return max_edits + 1;
+    if (a.empty()) return static_cast<int>(b.size());
+    if (a.size() <= 64) return bit_parallel_distance(a, b, max_edits);
+    return dp_distance(a, b, max_edits);
+}
+
+// --- QUERY CORRECTION ---
+const std::string TRIGRAM_POSTINGS_SQL =
+    "SELECT t.id, t.term FROM fuzzy_trigrams g JOIN fuzzy_terms t ON t.id = g.term_id "
+    "WHERE g.trigram = ?1 AND length(CAST(t.term AS BLOB)) BETWEEN ?2 AND ?3;";
+
+// Vocabulary words within max_edits(word) edits of `word`, closest first.
+std::vector<Correction> corrections_for(db::Database& db, const std::string& word, size_t index) {
+    std::vector<Correction> found;
+    if (word.size() > MAX_WORD_BYTES) {
+        found.push_back({word, index, 1.0});
+        return found;
+    }
+    const int edits = max_edits(word.size());
+    std::vector<std::string> grams = trigrams(word);
+    // An edit touches at most three trigrams and a transposition four, so a
+    // word within `edits` edits shares all but 4 * edits of them. Short words
+    // can't be pruned that way and only need one in common.
+    const size_t needed = grams.size() > static_cast<size_t>(4 * edits) ? grams.size() - 4 * edits : 1;
+
+    struct Candidate {
+        size_t shared = 0;
+        std::string term;
+    };
+    std::unordered_map<long long, Candidate> candidates;
+    db::Statement stmt = db.prepare(TRIGRAM_POSTINGS_SQL);
+    for (const auto& gram : grams) {
+        stmt.bind(1, gram)
+            .bind(2, static_cast<long long>(word.size() > static_cast<size_t>(edits) ? word.size() - edits : 0))
+            .bind(3, static_cast<long long>(word.size() + edits));
+        while (stmt.step()) {
+            Candidate& candidate = candidates[stmt.column_int64(0)];
+            if (candidate.shared++ == 0) candidate.term = stmt.column_text(1);
+        }
+        stmt.reset();
+    }
+
+    for (const auto& entry : candidates) {
+        const Candidate& candidate = entry.second;
+        if (candidate.shared < needed) continue;
+        int distance = bounded_edit_distance(word, candidate.term, edits);
+        if (distance > edits) continue;
+        double longer = static_cast<double>(std::max(word.size(), candidate.term.size()));
+        found.push_back({candidate.term, index, 1.0 - distance / longer});
+    }
+    std::sort(found.begin(), found.end(), [](const Correction& a, const Correction& b) {
+        return a.similarity != b.similarity ? a.similarity > b.similarity : a.term < b.term;
+    });
+    if (found.size() > MAX_CORRECTIONS) found.resize(MAX_CORRECTIONS);
+    return found;
+}
+
+bool correct(db::Database& db, const std::string& query, FuzzyQuery& fuzzy) {
+    INK_TRACE_SCOPE("fuzzy_correct");
+    fuzzy = FuzzyQuery();
+    std::vector<std::string> words;
+    std::string word;
+    for_each_word(query, [&](std::string_view raw) {
+        lowercase(raw, word);
+        if (std::find(words.begin(), words.end(), word) == words.end()) words.push_back(word);
+    });
+    fuzzy.word_count = words.size();
+    if (words.empty()) return false;
+
+    // Every query word must be present in some corrected form:
+    // {text last_edited_file} : (("a" OR "b") AND ("c"))
+    std::string groups;
+    for (size_t i = 0; i < words.size(); ++i) {
+        std::vector<Correction> found = corrections_for(db, words[i], i);
+        if (found.empty()) return false;
+        std::string group;
+        for (const auto& correction : found) {
+            group += (group.empty() ? "(\"" : " OR \"") + correction.term + "\"";
+        }
+        groups += (groups.empty() ? "" : " AND ") + group + ")";
+        fuzzy.phrases.insert(fuzzy.phrases.end(), found.begin(), found.end());
+    }
+    fuzzy.match = "{text last_edited_file} : (" + groups + ")";
+    // Summed the way score_function sums, so a best-scoring note compares equal
+    std::vector<double> best(words.size(), 0.0);
+    for (const auto& phrase : fuzzy.phrases) best[phrase.word] = std::max(best[phrase.word], phrase.similarity);
+    double total = 0.0;
+    for (double similarity : best) total += similarity;
+    fuzzy.best_score = total / best.size();
+    return true;
+}
+
+// --- SCORING ---
+// ink_fuzzy_score(notes_fts, query): the mean, over the words of a bound
+// FuzzyQuery, of the best similarity among that word's corrections found in
+// the row; 1.0 when every word appears as typed. It reads the phrase hits
+// FTS5 already has for the row rather than the note text.
+void score_function(const Fts5ExtensionApi* api, Fts5Context* fts, sqlite3_context* context, int argc, sqlite3_value** argv) {
+    auto* query = argc > 0 ? static_cast<const FuzzyQuery*>(sqlite3_value_pointer(argv[0], "FuzzyQuery")) : nullptr;
+    if (!query || query->word_count == 0) {
+        sqlite3_result_double(context, 0.0);
+        return;
+    }
+    thread_local std::vector<double> best;
+    best.assign(query->word_count, 0.0);
+    int phrases = std::min(api->xPhraseCount(fts), static_cast<int>(query->phrases.size()));
+    for (int i = 0; i < phrases; ++i) {
+        Fts5PhraseIter iter;
+        int column = -1, offset = -1;
+        if (api->xPhraseFirst(fts, i, &iter, &column, &offset) != SQLITE_OK || column < 0) continue;
+        const Correction& phrase = query->phrases[i];
+        best[phrase.word] = std::max(best[phrase.word], phrase.similarity);
+    }
+    double total = 0.0;
+    for (double similarity : best) total += similarity;
+    sqlite3_result_double(context, total / best.size());
+}
+
+// FTS5 hands out its API through a pointer-returning SQL function.
+void register_functions(sqlite3* db) {
+    fts5_api* api = nullptr;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT fts5(?1);", -1, &stmt, nullptr) != SQLITE_OK) return;
+    sqlite3_bind_pointer(stmt, 1, &api, "fts5_api_ptr", nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (api) api->xCreateFunction(api, "ink_fuzzy_score", nullptr, score_function, nullptr);
+}
+
+}
@@ -0,0 +1,50 @@
+#ifndef FUZZY_INDEX_HPP
+#define FUZZY_INDEX_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sqlite3.h>
+#include "database.hpp"
+
+// Typo-tolerant search. The trigram index covers the vocabulary of note text
+// and last_edited_file rather than the notes themselves: each distinct word
+// is stored once in fuzzy_terms, with postings from its trigrams in
+// fuzzy_trigrams. A query word is corrected against that vocabulary, and the
+// notes holding the corrected words come from the full-text index as usual.
+namespace fuzzy_index {
+    // A vocabulary word close enough to one of the query's words.
+    struct Correction {
+        std::string term;
+        size_t word;       // Which query word it corrects
+        double similarity; // 1 - edits / length of the longer word
+    };
+
+    // A query after correction. Bound into the search to score notes with
+    // the ink_fuzzy_score FTS5 function.
+    struct FuzzyQuery {
+        size_t word_count = 0;
+        std::vector<Correction> phrases; // In the order they appear in `match`
+        std::string match;               // FTS5 expression for notes holding a correction of every word
+        double best_score = 0;           // Score of a note holding every word's closest correction
+    };
+
+    // Edit distance between a and b, counting an adjacent transposition as
+    // one edit (optimal string alignment), or max_edits + 1 as soon as it is
+    // known to be larger.
+    int bounded_edit_distance(std::string_view a, std::string_view b, int max_edits);
+
+    // Adds the words of `text` the vocabulary hasn't seen yet. Runs inside
+    // the caller's transaction. With `term_ids`, also appends the id of each
+    // word in the text, repeats included.
+    bool add_words(db::Database& db, std::string_view text, std::vector<long long>* term_ids = nullptr);
+
+    // Corrects each word of `query` against the vocabulary. Returns false,
+    // leaving `fuzzy` unusable, when some word has nothing close to it.
+    bool correct(db::Database& db, const std::string& query, FuzzyQuery& fuzzy);
+
+    // Registers the ink_fuzzy_score(notes_fts, query) FTS5 function on a connection.
+    void register_functions(sqlite3* db);
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include "git_resolver.hpp"
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace git {
+
+// Reads a small file and strips trailing whitespace. Returns false if it can't be read.
+bool read_trimmed(const fs::path& path, std::string& out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    while (!out.empty() && (out.back() == '\n' || out.back() == '\r' || out.back() == ' ')) out.pop_back();
+    return true;
+}
+
+bool is_hex_hash(const std::string& s) {
+    // SHA-1 (40) or SHA-256 (64) object names
+    if (s.size() != 40 && s.size() != 64) return false;
+    for (char c : s) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+    }
+    return true;
+}
+
+// Finds the git directory for `start`, following "gitdir:" files used by
+// worktrees and submodules. Returns an empty path outside a repository.
+fs::path find_git_dir(const fs::path& start) {
+    std::error_code ec;
+    for (fs::path dir = start; !dir.empty(); dir = dir.parent_path()) {
+        fs::path candidate = dir / ".git";
+        auto status = fs::status(candidate, ec);
+        if (fs::is_directory(status)) return candidate;
+        if (fs::is_regular_file(status)) {
+            std::string content;
+            if (!read_trimmed(candidate, content) || content.compare(0, 8, "gitdir: ") != 0) return {};
+            fs::path target = content.substr(8);
+            return target.is_absolute() ? target : (dir / target).lexically_normal();
+        }
+        if (dir == dir.root_path()) break;
+    }
+    return {};
+}
+
+// Looks a ref up in packed-refs. Peeled ("^") and comment lines are skipped.
+bool find_packed_ref(const fs::path& common_dir, const std::string& ref, std::string& hash) {
+    std::ifstream in(common_dir / "packed-refs");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#' || line[0] == '^') continue;
+        size_t space = line.find(' ');
+        if (space == std::string::npos) continue;
+        if (line.compare(space + 1, std::string::npos, ref) == 0) {
+            hash = line.substr(0, space);
+            return is_hex_hash(hash);
+        }
+    }
+    return false;
+}
+
+// Resolves a ref name to an object hash through loose refs (per-worktree dir
+// first, then the common dir) and packed-refs, following symbolic refs.
+bool resolve_ref(const fs::path& git_dir, const fs::path& common_dir, std::string ref, std::string& hash) {
+    for (int depth = 0; depth < 5; ++depth) {
+        std::string content;
+        if (!read_trimmed(git_dir / ref, content) && !read_trimmed(common_dir / ref, content)) {
+            return find_packed_ref(common_dir, ref, hash);
+        }
+        if (content.compare(0, 5, "ref: ") == 0) {
+            ref = content.substr(5);
+            continue;
+        }
+        hash = content;
+        return is_hex_hash(hash);
+    }
+    return false;
+}
+
+GitInfo resolve(const fs::path& start) {
+    GitInfo info;
+    fs::path git_dir = find_git_dir(start);
+    if (git_dir.empty()) return info;
+    info.found = true;
+
+    std::error_code ec;
+    // Worktrees keep HEAD locally but share refs through "commondir"
+    fs::path common_dir = git_dir;
+    std::string common;
+    if (read_trimmed(git_dir / "commondir", common)) {
+        fs::path p = common;
+        common_dir = p.is_absolute() ? p : (git_dir / p).lexically_normal();
+    }
+    // Repositories using the reftable backend need the git CLI
+    if (fs::exists(common_dir / "reftable", ec)) return info;
+
+    std::string head;
+    if (!read_trimmed(git_dir / "HEAD", head)) return info;
+
+    if (head.compare(0, 5, "ref: ") != 0) {
+        // Detached HEAD
+        if (!is_hex_hash(head)) return info;
+        info.branch = "HEAD";
+        info.commit_hash = head;
+        info.resolved = true;
+        return info;
+    }
+
+    std::string ref = head.substr(5);
+    const std::string heads_prefix = "refs/heads/";
+    info.branch = ref.compare(0, heads_prefix.size(), heads_prefix) == 0 ? ref.substr(heads_prefix.size()) : ref;
+    std::string hash;
+    if (resolve_ref(git_dir, common_dir, ref, hash)) {
+        info.commit_hash = hash;
+        info.resolved = true;
+    } else if (!fs::exists(git_dir / ref, ec) && !fs::exists(common_dir / ref, ec)) {
+        // Unborn branch: no commits yet, so there is no hash to report
+        info.resolved = true;
+    }
+    return info;
+}
+
+}
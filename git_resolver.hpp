@@ -0,0 +1,23 @@
+#ifndef GIT_RESOLVER_HPP
+#define GIT_RESOLVER_HPP
+
+#include <string>
+#include <filesystem>
+
+// Branch and commit for the repository containing a directory.
+struct GitInfo {
+    bool found = false;      // A .git directory or gitdir file was found
+    bool resolved = false;   // HEAD was resolved without running git
+    std::string branch;      // "HEAD" when detached, like `git rev-parse --abbrev-ref HEAD`
+    std::string commit_hash; // Empty on an unborn branch
+};
+
+namespace git {
+    // Reads HEAD, loose refs and packed-refs straight from disk. Walks up from
+    // `start` to find the repository and follows gitdir files, so worktrees and
+    // submodules work. Sets resolved = false for layouts it doesn't understand
+    // (reftable, broken refs), leaving those to the git CLI.
+    GitInfo resolve(const std::filesystem::path& start);
+}
+
+#endif
@@ -0,0 +1,735 @@
+// ink_bench: builds a reproducible synthetic database and times the core
+// operations against it. Results are written as JSON so runs from different
+// commits can be compared.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "completion.hpp"
+#include "database.hpp"
+#include "file_scanner.hpp"
+#include "git_resolver.hpp"
+#include "metadata_collector.hpp"
+#include "note_body.hpp"
+#include "query_executor.hpp"
+#include "similar_index.hpp"
+#include "stats_engine.hpp"
+#include "tag_index.hpp"
+#include "trace.hpp"
+
+namespace fs = std::filesystem;
+
+struct BenchOptions {
+    long long notes = 10000;     // Size of the generated corpus
+    int tag_vocabulary = 200;    // Distinct tags
+    double tag_skew = 1.0;       // Zipf exponent for tag popularity
+    int max_tags = 4;            // Tags per note, 1..max_tags
+    double prog_ratio = 0.3;     // Share of programming notes
+    int projects = 50;           // Distinct directories for programming notes
+    int iterations = 200;        // Timed runs per operation
+    unsigned long long seed = 42;
+    std::string db_path;         // Kept if given; a temporary file otherwise
+    std::string out_path;        // JSON destination; stdout if empty
+    std::string scan_dir = ".";  // Directory for the collect_metadata and git benchmarks
+    int writers = 0;             // Stress mode: concurrent writer processes
+    int notes_per_writer = 200;
+    int readers = 0;             // Most reader threads in the scaling runs; 0 for one per core
+    long long scan_files = 0;    // Scan mode: files in the generated tree
+    std::string scan_tree;       // Kept if given; a temporary directory otherwise
+};
+
+struct BenchResult {
+    std::string name;
+    std::vector<double> samples_us;
+};
+
+// Cost of turning query rows into notes, scaled to 100k rows.
+struct DecodeResult {
+    std::string name;
+    long long rows = 0;
+    double us_per_100k = 0;
+    double allocations_per_100k = 0;
+};
+
+// --- CORPUS GENERATION ---
+const char* const WORDS[] = {
+    "cache", "thread", "index", "query", "buffer", "socket", "parser", "delta",
+    "refactor", "deploy", "review", "latency", "schema", "migration", "kernel",
+    "vector", "branch", "commit", "merge", "release", "memory", "profile",
+    "compile", "linker", "daemon", "cursor", "search", "ranking", "journal",
+    "snapshot", "backup", "config", "meeting", "idea", "groceries", "travel",
+    "book", "lecture", "paper", "design", "sketch", "budget", "invoice",
+    "garden", "recipe", "workout", "music", "movie", "call", "email"
+};
+const size_t WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+// Picks tag ranks with probability proportional to 1 / rank^skew.
+class ZipfSampler {
+public:
+    ZipfSampler(int n, double skew) {
+        double total = 0;
+        for (int rank = 1; rank <= n; ++rank) {
+            total += 1.0 / std::pow(rank, skew);
+            cumulative_.push_back(total);
+        }
+        for (auto& c : cumulative_) c /= total;
+    }
+
+    int operator()(std::mt19937_64& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return static_cast<int>(std::lower_bound(cumulative_.begin(), cumulative_.end(), u) - cumulative_.begin());
+    }
+
+private:
+    std::vector<double> cumulative_;
+};
+
+std::string tag_name(int rank) { return "tag" + std::to_string(rank); }
+
+std::string random_text(std::mt19937_64& rng) {
+    std::uniform_int_distribution<size_t> word(0, WORD_COUNT - 1);
+    std::uniform_int_distribution<int> length(4, 24);
+    std::string text;
+    for (int i = length(rng); i > 0; --i) {
+        if (!text.empty()) text += ' ';
+        text += WORDS[word(rng)];
+    }
+    return text;
+}
+
+std::string format_timestamp(std::time_t t) {
+    char buffer[32];
+    std::tm tm_utc;
+    gmtime_r(&t, &tm_utc);
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm_utc);
+    return buffer;
+}
+
+// Loads options.notes notes through the bulk import path. Timestamps are
+// spread over the year before 2025-01-01 so daily stats have real spread.
+bool generate_corpus(db::Database& db, const BenchOptions& options, const ZipfSampler& tags) {
+    std::mt19937_64 rng(options.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<int> tag_count(1, std::max(1, options.max_tags));
+    std::uniform_int_distribution<int> project(0, std::max(1, options.projects) - 1);
+    const std::time_t end_time = 1735689600; // 2025-01-01 00:00:00 UTC
+    const double span = 365.0 * 24 * 3600;
+
+    db.execute("PRAGMA cache_size = -65536;");
+    db.execute("PRAGMA foreign_keys = OFF;");
+    BulkInsert bulk;
+    FullNote note;
+    bool ok = db.execute("BEGIN TRANSACTION;");
+    for (long long i = 0; ok && i < options.notes; ++i) {
+        note.text = random_text(rng);
+        note.tags.clear();
+        for (int t = tag_count(rng); t > 0; --t) {
+            std::string tag = tag_name(tags(rng));
+            if (std::find(note.tags.begin(), note.tags.end(), tag) == note.tags.end()) note.tags.push_back(tag);
+        }
+        // Ascending timestamps, like notes taken over time
+        note.timestamp = format_timestamp(end_time - static_cast<std::time_t>(span * (1.0 - static_cast<double>(i) / options.notes)));
+        if (unit(rng) < options.prog_ratio) {
+            note.type = "programming";
+            note.metadata.current_directory = "/home/dev/project" + std::to_string(project(rng));
+            note.metadata.last_edited_file = "main.cpp";
+            note.metadata.git_branch = "main";
+            note.metadata.git_commit_hash = "0123456789abcdef0123456789abcdef01234567";
+        } else {
+            note.type = "general";
+            note.metadata = ProgMetadata();
+        }
+        ok = db::bulk_insert_note(db, bulk, note) >= 0;
+        if (ok && (i + 1) % 50000 == 0) {
+            ok = db::flush_bulk_insert(db, bulk) && db.execute("COMMIT;") && db.execute("BEGIN TRANSACTION;");
+        }
+    }
+    ok = ok && db::flush_bulk_insert(db, bulk) && db.execute("COMMIT;");
+    if (!ok) db.execute("ROLLBACK;");
+    db.execute("PRAGMA foreign_keys = ON;");
+    return ok;
+}
+
+// --- TIMING ---
+BenchResult time_operation(const std::string& name, int iterations, const std::function<void(int)>& op) {
+    BenchResult result{name, {}};
+    result.samples_us.reserve(iterations);
+    for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        op(i);
+        auto end = std::chrono::steady_clock::now();
+        result.samples_us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    return result;
+}
+
+// A command's output without its trailing newline, read the way
+// collect_metadata runs git when it can't resolve a repository itself.
+std::string popen_output(const std::string& command) {
+    std::string output;
+    std::FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) return output;
+    char buffer[128];
+    while (std::fgets(buffer, sizeof(buffer), pipe) != nullptr) output += buffer;
+    pclose(pipe);
+    if (!output.empty() && output.back() == '\n') output.pop_back();
+    return output;
+}
+
+// Wraps a string in single quotes for use as one shell word.
+std::string shell_quote(const std::string& value) {
+    std::string quoted = "'";
+    for (char c : value) quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    return quoted + "'";
+}
+
+size_t drain(db::NoteCursor cursor) {
+    FullNote note;
+    size_t rows = 0;
+    while (cursor.next(note)) ++rows;
+    return rows;
+}
+
+// --- ROW DECODING ---
+const int DECODE_PASSES = 5;
+
+// Reads every note `DECODE_PASSES` times with `decode` and keeps the fastest
+// pass. Allocations come from the last pass, once buffers have warmed up.
+DecodeResult time_decoding(db::Database& db, const std::string& name, const std::function<long long(db::NoteCursor&)>& decode) {
+    DecodeResult result{name};
+    double best_us = -1;
+    long long allocations = 0;
+    for (int pass = 0; pass < DECODE_PASSES; ++pass) {
+        db::NoteCursor cursor = db::list_recent_notes(db, PageOptions());
+        long long before = trace::allocation_count();
+        trace::counting_allocations = true;
+        auto start = std::chrono::steady_clock::now();
+        result.rows = decode(cursor);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        trace::counting_allocations = false;
+        allocations = trace::allocation_count() - before;
+        if (best_us < 0 || us < best_us) best_us = us;
+    }
+    double scale = result.rows > 0 ? 100000.0 / result.rows : 0;
+    result.us_per_100k = best_us * scale;
+    result.allocations_per_100k = allocations * scale;
+    return result;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    double rank = p / 100.0 * (sorted.size() - 1);
+    size_t low = static_cast<size_t>(rank);
+    size_t high = std::min(low + 1, sorted.size() - 1);
+    return sorted[low] + (sorted[high] - sorted[low]) * (rank - low);
+}
+
+std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char buffer[8];
+            std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            out += buffer;
+        } else out += c;
+    }
+    return out;
+}
+
+// The "benchmarks" array, one entry per operation with its percentiles
+void write_benchmarks(std::ostream& out, std::vector<BenchResult>& results) {
+    out << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto& samples = results[i].samples_us;
+        std::sort(samples.begin(), samples.end());
+        double total = 0;
+        for (double s : samples) total += s;
+        double mean = samples.empty() ? 0 : total / samples.size();
+        out << "    {\"name\": \"" << json_escape(results[i].name) << "\", \"iterations\": " << samples.size()
+            << ", \"ops_per_sec\": " << (total > 0 ? samples.size() / (total / 1e6) : 0)
+            << ", \"mean_us\": " << mean
+            << ", \"p50_us\": " << percentile(samples, 50)
+            << ", \"p90_us\": " << percentile(samples, 90)
+            << ", \"p99_us\": " << percentile(samples, 99)
+            << ", \"max_us\": " << (samples.empty() ? 0 : samples.back()) << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]";
+}
+
+void write_json(std::ostream& out, const BenchOptions& options, double generate_seconds, std::vector<BenchResult>& results,
+                const std::vector<DecodeResult>& decoding) {
+    out << "{\n";
+    out << "  \"config\": {\"notes\": " << options.notes << ", \"tag_vocabulary\": " << options.tag_vocabulary
+        << ", \"tag_skew\": " << options.tag_skew << ", \"max_tags\": " << options.max_tags
+        << ", \"prog_ratio\": " << options.prog_ratio << ", \"projects\": " << options.projects
+        << ", \"iterations\": " << options.iterations << ", \"seed\": " << options.seed
+        << ", \"sqlite_version\": \"" << sqlite3_libversion() << "\"},\n";
+    out << "  \"generate_seconds\": " << generate_seconds << ",\n";
+    write_benchmarks(out, results);
+    out << ",\n";
+    out << "  \"row_decoding\": [\n";
+    for (size_t i = 0; i < decoding.size(); ++i) {
+        out << "    {\"name\": \"" << json_escape(decoding[i].name) << "\", \"rows\": " << decoding[i].rows
+            << ", \"us_per_100k_rows\": " << decoding[i].us_per_100k
+            << ", \"allocations_per_100k_rows\": " << decoding[i].allocations_per_100k << "}"
+            << (i + 1 < decoding.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// --- WRITER STRESS TEST ---
+// Forks `writers` processes that each add notes_per_writer notes to the same
+// database as fast as they can, then checks every note made it in. Each
+// child streams its per-insert latencies back through a pipe.
+int run_stress(const BenchOptions& options) {
+    const std::string marker = "stress-" + std::to_string(getpid());
+    { db::Database init(options.db_path); if (!init.is_open()) return 1; }
+
+    std::vector<int> pipes;
+    std::vector<pid_t> children;
+    auto start = std::chrono::steady_clock::now();
+    for (int w = 0; w < options.writers; ++w) {
+        int fds[2];
+        if (pipe(fds) != 0) { std::perror("pipe"); return 1; }
+        pid_t pid = fork();
+        if (pid < 0) { std::perror("fork"); return 1; }
+        if (pid == 0) {
+            close(fds[0]);
+            int failures = 0;
+            {
+                db::Database db(options.db_path);
+                for (int n = 0; n < options.notes_per_writer; ++n) {
+                    auto t0 = std::chrono::steady_clock::now();
+                    bool ok = db.is_open() && db::add_general_note(db, marker + " w" + std::to_string(w) + " n" + std::to_string(n), {"#stress"});
+                    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+                    if (!ok) { ++failures; us = -1; }
+                    if (write(fds[1], &us, sizeof(us)) != sizeof(us)) break;
+                }
+            }
+            close(fds[1]);
+            _exit(std::min(failures, 255));
+        }
+        close(fds[1]);
+        pipes.push_back(fds[0]);
+        children.push_back(pid);
+    }
+
+    BenchResult latencies{"stress_insert", {}};
+    for (int fd : pipes) {
+        double us;
+        while (read(fd, &us, sizeof(us)) == sizeof(us)) {
+            if (us >= 0) latencies.samples_us.push_back(us);
+        }
+        close(fd);
+    }
+    long long failed = 0;
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        failed += WIFEXITED(status) ? WEXITSTATUS(status) : options.notes_per_writer;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    long long stored = 0;
+    {
+        db::Database db(options.db_path);
+        db::Statement stmt = db.prepare("SELECT COUNT(*) FROM notes WHERE text LIKE ? || ' %';");
+        stmt.bind(1, marker);
+        if (stmt.step()) stored = stmt.column_int64(0);
+    }
+    long long expected = static_cast<long long>(options.writers) * options.notes_per_writer;
+    long long lost = expected - failed - stored;
+
+    auto& samples = latencies.samples_us;
+    std::sort(samples.begin(), samples.end());
+    std::ostringstream json;
+    json << "{\n  \"stress\": {\"writers\": " << options.writers << ", \"notes_per_writer\": " << options.notes_per_writer
+         << ", \"expected\": " << expected << ", \"stored\": " << stored << ", \"failed_inserts\": " << failed
+         << ", \"lost\": " << lost << ", \"seconds\": " << seconds
+         << ", \"inserts_per_sec\": " << (seconds > 0 ? stored / seconds : 0)
+         << ", \"p50_us\": " << percentile(samples, 50) << ", \"p90_us\": " << percentile(samples, 90)
+         << ", \"p99_us\": " << percentile(samples, 99) << ", \"max_us\": " << (samples.empty() ? 0 : samples.back())
+         << "}\n}\n";
+    if (options.out_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream(options.out_path) << json.str();
+        std::cerr << "Wrote " << options.out_path << std::endl;
+    }
+    // Inserts that reported success but aren't in the database are the real failure
+    return (lost != 0 || failed != 0) ? 1 : 0;
+}
+
+// --- DIRECTORY SCAN ---
+const long long FILES_PER_DIR = 40;
+
+// The last-edited-file walk `ink p` used before file_scanner, kept as the
+// baseline: one thread over every entry, two stats per file, and anything
+// with ".git" in its path skipped.
+std::string scan_baseline(const fs::path& directory) {
+    fs::file_time_type latest_time;
+    fs::path latest_file_path;
+    bool has_found_file = false;
+    try {
+        for (const auto& entry : fs::recursive_directory_iterator(directory, fs::directory_options::skip_permission_denied)) {
+            if (entry.is_regular_file() && entry.path().string().find(".git") == std::string::npos) {
+                if (!has_found_file || entry.last_write_time() > latest_time) {
+                    latest_time = entry.last_write_time();
+                    latest_file_path = entry.path();
+                    has_found_file = true;
+                }
+            }
+        }
+    } catch (const fs::filesystem_error&) {
+        return "";
+    }
+    return has_found_file ? fs::relative(latest_file_path, directory).string() : "";
+}
+
+// Writes a file with the given modification time.
+bool touch(const fs::path& path, std::time_t mtime, const std::string& content = "") {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+    bool ok = write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()) && futimens(fd, times) == 0;
+    return close(fd) == 0 && ok;
+}
+
+// Lays out about `files` empty files under root like a project checkout:
+// half under node_modules, a sixth under a gitignored build/, a twentieth
+// under .git and the rest under src/, FILES_PER_DIR to a directory. Layout
+// and mtimes follow the seed. The newest file is src/latest.cpp, which every
+// scanner, pruning or not, has to find.
+bool generate_tree(const fs::path& root, long long files, unsigned long long seed, long long& directories) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<std::time_t> age(0, 365 * 86400);
+    const std::time_t newest = 1735689600; // 2025-01-01 00:00:00 UTC
+    std::error_code ec;
+    fs::create_directories(root / "src", ec);
+    if (ec) return false;
+    if (!touch(root / ".gitignore", newest - 2 * 365 * 86400, "build/\n*.log\n")) return false;
+
+    directories = 0;
+    for (long long made = 0; made < files; ++directories) {
+        double area = unit(rng);
+        const char* top = area < 0.5 ? "node_modules" : area < 0.67 ? "build" : area < 0.72 ? ".git/objects" : "src";
+        fs::path dir = root / top / ("m" + std::to_string(directories / 32)) / ("d" + std::to_string(directories));
+        fs::create_directories(dir, ec);
+        if (ec) return false;
+        for (long long i = 0; i < FILES_PER_DIR && made < files; ++i, ++made) {
+            if (!touch(dir / ("f" + std::to_string(i) + ".js"), newest - 86400 - age(rng))) return false;
+        }
+    }
+    return touch(root / "src" / "latest.cpp", newest);
+}
+
+// Times the old and new last-edited-file scans over the same generated tree.
+int run_scan(const BenchOptions& options) {
+    bool temporary = options.scan_tree.empty();
+    fs::path root = temporary ? fs::temp_directory_path() / ("ink_bench_tree_" + std::to_string(getpid())) : fs::path(options.scan_tree);
+    double generate_seconds = 0;
+    long long directories = 0;
+    // A kept --scan-tree is reused as is, like --db; its sizes aren't recounted
+    const bool reused = fs::exists(root);
+    if (!reused) {
+        std::cerr << "Generating a tree of " << options.scan_files << " files..." << std::endl;
+        auto start = std::chrono::steady_clock::now();
+        if (!generate_tree(root, options.scan_files, options.seed, directories)) {
+            std::cerr << "Error: Couldn't generate a tree in " << root.string() << std::endl;
+            return 1;
+        }
+        generate_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    ScanOptions pruned;
+    pruned.time_budget_ms = 24 * 3600 * 1000; // Whole scans, not the budgeted best guess
+    pruned.max_depth = 1 << 20;
+    ScanOptions unpruned = pruned;
+    unpruned.skip_dirs = {".git"};
+    unpruned.use_gitignore = false;
+
+    // One untimed walk first, so every variant starts from a warm cache
+    std::string expected = scan_baseline(root);
+    int status = 0;
+    auto check = [&](const std::string& name, const std::string& found) {
+        if (found == expected) return;
+        std::cerr << "Error: " << name << " found '" << found << "', the baseline '" << expected << "'" << std::endl;
+        status = 1;
+    };
+    const int iterations = std::max(1, options.iterations / 40);
+    std::vector<BenchResult> results;
+    std::string found;
+    results.push_back(time_operation("scan_baseline", iterations, [&](int) { found = scan_baseline(root); }));
+    check("scan_baseline", found);
+    results.push_back(time_operation("scan_parallel", iterations, [&](int) {
+        found = scanner::find_last_edited_file(root.string(), pruned).path;
+    }));
+    check("scan_parallel", found);
+    results.push_back(time_operation("scan_parallel_unpruned", iterations, [&](int) {
+        found = scanner::find_last_edited_file(root.string(), unpruned).path;
+    }));
+    check("scan_parallel_unpruned", found);
+
+    if (temporary) {
+        std::error_code ec;
+        fs::remove_all(root, ec);
+    }
+
+    std::ostringstream json;
+    json << "{\n  \"scan_tree\": {\"files\": " << options.scan_files << ", \"directories\": " << directories
+         << ", \"reused\": " << (reused ? "true" : "false") << ", \"seed\": " << options.seed << ", \"iterations\": " << iterations
+         << ", \"generate_seconds\": " << generate_seconds << "},\n";
+    write_benchmarks(json, results);
+    json << "\n}\n";
+    if (options.out_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream(options.out_path) << json.str();
+        std::cerr << "Wrote " << options.out_path << std::endl;
+    }
+    return status;
+}
+
+void show_usage() {
+    std::cerr << "Usage: ink_bench [--notes N] [--tags N] [--tag-skew S] [--max-tags N] [--prog-ratio R]\n"
+                 "                 [--projects N] [--iterations N] [--seed N] [--db PATH] [--out FILE]\n"
+                 "                 [--scan-dir DIR] [--readers N]\n"
+                 "       ink_bench --writers N [--notes-per-writer N] [--db PATH] [--out FILE]\n"
+                 "       ink_bench --scan-files N [--scan-tree DIR] [--iterations N] [--seed N] [--out FILE]" << std::endl;
+}
+
+bool parse_options(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+        if (arg == "--notes") options.notes = std::atoll(value.c_str());
+        else if (arg == "--tags") options.tag_vocabulary = std::atoi(value.c_str());
+        else if (arg == "--tag-skew") options.tag_skew = std::atof(value.c_str());
+        else if (arg == "--max-tags") options.max_tags = std::atoi(value.c_str());
+        else if (arg == "--prog-ratio") options.prog_ratio = std::atof(value.c_str());
+        else if (arg == "--projects") options.projects = std::atoi(value.c_str());
+        else if (arg == "--iterations") options.iterations = std::atoi(value.c_str());
+        else if (arg == "--seed") options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--db") options.db_path = value;
+        else if (arg == "--out") options.out_path = value;
+        else if (arg == "--scan-dir") options.scan_dir = value;
+        else if (arg == "--writers") options.writers = std::atoi(value.c_str());
+        else if (arg == "--notes-per-writer") options.notes_per_writer = std::atoi(value.c_str());
+        else if (arg == "--readers") options.readers = std::atoi(value.c_str());
+        else if (arg == "--scan-files") options.scan_files = std::atoll(value.c_str());
+        else if (arg == "--scan-tree") options.scan_tree = value;
+        else return false;
+    }
+    return options.notes >= 0 && options.tag_vocabulary > 0 && options.iterations > 0;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        show_usage();
+        return 1;
+    }
+    if (options.scan_files > 0) return run_scan(options);
+
+    bool temporary = options.db_path.empty();
+    if (temporary) {
+        options.db_path = (fs::temp_directory_path() / ("ink_bench_" + std::to_string(getpid()) + ".db")).string();
+    }
+    bool existing = fs::exists(options.db_path);
+
+    if (options.writers > 0) {
+        int status = run_stress(options);
+        if (temporary) {
+            std::error_code ec;
+            for (const char* suffix : {"", "-journal", "-wal", "-shm"}) fs::remove(options.db_path + suffix, ec);
+        }
+        return status;
+    }
+
+    double generate_seconds = 0;
+    std::vector<BenchResult> results;
+    std::vector<DecodeResult> decoding;
+    {
+        db::Database db(options.db_path);
+        if (!db.is_open()) return 1;
+        ZipfSampler tags(options.tag_vocabulary, options.tag_skew);
+
+        // A kept --db is reused as is, so repeated runs skip generation
+        if (!existing) {
+            std::cerr << "Generating " << options.notes << " notes..." << std::endl;
+            auto start = std::chrono::steady_clock::now();
+            if (!generate_corpus(db, options, tags)) {
+                std::cerr << "Error: Corpus generation failed: " << sqlite3_errmsg(db.handle()) << std::endl;
+                return 1;
+            }
+            generate_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // Reads first, so the single-row writes below don't shift their results
+        std::mt19937_64 rng(options.seed + 1);
+        std::uniform_int_distribution<size_t> word(0, WORD_COUNT - 1);
+        PageOptions recent;
+        recent.limit = 10;
+        PageOptions page;
+        page.limit = 50;
+
+        results.push_back(time_operation("list_recent_notes", options.iterations, [&](int) {
+            drain(db::list_recent_notes(db, recent));
+        }));
+        results.push_back(time_operation("list_notes_by_tag", options.iterations, [&](int) {
+            TagExpression expr;
+            expr.tag = tag_name(tags(rng));
+            drain(db::list_notes_by_tags(db, tag_index::evaluate(db, expr), page));
+        }));
+        results.push_back(time_operation("search_notes", options.iterations, [&](int) {
+            drain(db::search_notes(db, WORDS[word(rng)], TagFilter(), page));
+        }));
+        results.push_back(time_operation("search_notes_tagged", options.iterations, [&](int) {
+            TagExpression expr;
+            expr.tag = tag_name(tags(rng));
+            drain(db::search_notes(db, WORDS[word(rng)], tag_index::evaluate(db, expr), page));
+        }));
+        // A corpus word with one letter dropped
+        results.push_back(time_operation("fuzzy_search_notes", options.iterations, [&](int) {
+            std::string typo = WORDS[word(rng)];
+            typo.erase(typo.size() / 2, 1);
+            drain(db::fuzzy_search_notes(db, typo, TagFilter(), page));
+        }));
+        // The first week of the corpus's last month
+        PageOptions week = page;
+        week.since = "2024-12-01 00:00:00";
+        week.until = "2024-12-08 00:00:00";
+        results.push_back(time_operation("search_notes_window", options.iterations, [&](int) {
+            drain(db::search_notes(db, WORDS[word(rng)], TagFilter(), week));
+        }));
+        // One std::string per column per row, against one arena per batch
+        decoding.push_back(time_decoding(db, "full_note", [](db::NoteCursor& cursor) {
+            return static_cast<long long>(drain(std::move(cursor)));
+        }));
+        decoding.push_back(time_decoding(db, "note_batch", [](db::NoteCursor& cursor) {
+            db::NoteBatch batch;
+            long long rows = 0;
+            while (cursor.next_batch(batch)) rows += static_cast<long long>(batch.size());
+            return rows;
+        }));
+        results.push_back(time_operation("gather_stats", options.iterations, [&](int) {
+            stats::gather_stats(db);
+        }));
+        // The corpus's last 30 days, ending 2025-01-01
+        results.push_back(time_operation("gather_activity_30d", std::max(1, options.iterations / 10), [&](int) {
+            stats::gather_activity(db, 1735689600 - 30 * 86400, 1735689600, 1735689600);
+        }));
+        // The two scans the query executor splits, with 1, 2, 4... reader
+        // threads up to --readers. Splitting starts at 50k notes a part, so
+        // these only spread out on corpora of 100k notes and up.
+        const int most_readers = options.readers > 0 ? options.readers : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        for (int readers = 1;; readers = std::min(readers * 2, most_readers)) {
+            query_executor::set_threads(static_cast<size_t>(readers));
+            const std::string suffix = "_readers_" + std::to_string(readers);
+            results.push_back(time_operation("search_notes" + suffix, std::max(1, options.iterations / 10), [&](int) {
+                drain(db::search_notes(db, WORDS[word(rng)], TagFilter(), page));
+            }));
+            results.push_back(time_operation("gather_activity_year" + suffix, std::max(1, options.iterations / 20), [&](int) {
+                stats::gather_activity(db, 1735689600 - 365 * 86400, 1735689600, 1735689600);
+            }));
+            if (readers == most_readers) break;
+        }
+        query_executor::set_threads(1);
+        // Tag completion for "#tag" plus the first digit of a rank, as typed at a prompt
+        completion::rebuild(db);
+        completion::Trie trie;
+        trie.open(completion::trie_path(options.db_path));
+        results.push_back(time_operation("complete_tag_prefix", options.iterations, [&](int) {
+            trie.complete("#tag" + std::to_string(tags(rng)).substr(0, 1), 100);
+        }));
+        // Notes like a random one, after building the vector snapshot
+        similar_index::rebuild(db);
+        std::uniform_int_distribution<long long> note(1, std::max(1, db::get_total_notes_count(db)));
+        std::vector<similar_index::Match> matches;
+        results.push_back(time_operation("find_similar", options.iterations, [&](int) {
+            similar_index::find_similar(db, note(rng), 10, matches);
+        }));
+        fs::path scan_dir = fs::absolute(options.scan_dir);
+        results.push_back(time_operation("collect_metadata", std::max(1, options.iterations / 10), [&](int) {
+            metadata::collect_metadata(scan_dir);
+        }));
+        ProgMetadata metadata = metadata::collect_metadata(scan_dir);
+        // Branch and commit read in-process, against the two `git rev-parse`
+        // calls through popen that every capture used to make
+        if (git::resolve(scan_dir).resolved) {
+            GitInfo info;
+            results.push_back(time_operation("git_resolve", options.iterations, [&](int) {
+                info = git::resolve(scan_dir);
+            }));
+            const std::string git = "git -C " + shell_quote(scan_dir.string());
+            std::string branch, commit;
+            results.push_back(time_operation("git_rev_parse_popen", std::max(1, options.iterations / 10), [&](int) {
+                branch = popen_output(git + " rev-parse --abbrev-ref HEAD 2>/dev/null");
+                commit = popen_output(git + " rev-parse HEAD 2>/dev/null");
+            }));
+            if (info.branch != branch || info.commit_hash != commit) {
+                std::cerr << "Warning: git::resolve gave " << info.branch << " " << info.commit_hash << ", git rev-parse " << branch << " " << commit << std::endl;
+            }
+        } else {
+            std::cerr << "Skipping the git benchmarks: " << scan_dir.string() << " isn't in a git checkout ink can read." << std::endl;
+        }
+        results.push_back(time_operation("add_general_note", options.iterations, [&](int i) {
+            db::add_general_note(db, random_text(rng), {"#" + tag_name(i % options.tag_vocabulary)});
+        }));
+        results.push_back(time_operation("add_prog_note", options.iterations, [&](int i) {
+            db::add_prog_note(db, random_text(rng), {"#" + tag_name(i % options.tag_vocabulary)}, metadata);
+        }));
+        // A 1 MiB log piped into each note, as with `ink -`. Its first line
+        // differs every time so no body is shared.
+        std::FILE* log = std::tmpfile();
+        std::string log_text;
+        while (log_text.size() < (1 << 20)) log_text += random_text(rng) + '\n';
+        if (log && std::fwrite(log_text.data(), 1, log_text.size(), log) == log_text.size() && std::fflush(log) == 0) {
+            int fd = fileno(log);
+            results.push_back(time_operation("add_piped_note", std::max(1, options.iterations / 10), [&](int i) {
+                char first_line[17];
+                std::snprintf(first_line, sizeof(first_line), "run %011d\n", i);
+                if (pwrite(fd, first_line, 16, 0) != 16 || lseek(fd, 0, SEEK_SET) != 0) return;
+                note_body::Spool body;
+                if (body.read(fd)) db::add_general_note(db, body.first_line(), {"#log"}, &body);
+            }));
+        }
+        if (log) std::fclose(log);
+    }
+
+    if (temporary) {
+        std::error_code ec;
+        for (const char* suffix : {"", "-journal", "-wal", "-shm"}) fs::remove(options.db_path + suffix, ec);
+        fs::remove(completion::trie_path(options.db_path), ec);
+        fs::remove(completion::log_path(options.db_path), ec);
+        fs::remove(similar_index::snapshot_path(options.db_path), ec);
+    }
+
+    if (options.out_path.empty()) {
+        write_json(std::cout, options, generate_seconds, results, decoding);
+    } else {
+        std::ofstream out(options.out_path);
+        write_json(out, options, generate_seconds, results, decoding);
+        std::cerr << "Wrote " << options.out_path << std::endl;
+    }
+    return 0;
+}
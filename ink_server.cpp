@@ -0,0 +1,564 @@
+#include "ink_server.hpp"
+#include "commands.hpp"
+#include "metadata_collector.hpp"
+#include "metadata_enricher.hpp"
+#include "database.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+namespace server {
+
+// --- WIRE FORMAT ---
+// Every message is one frame: a big-endian u32 payload length, then the
+// payload. Strings inside a payload are a u32 length followed by the bytes.
+//   request:  version, flags, cwd, argc, args...
+//   reply:    any number of chunk frames (REPLY_OUT or REPLY_ERR, bytes),
+//             then one exit frame (REPLY_EXIT, exit code)
+// Output goes out in chunks as the command prints it, so a reply of any
+// size streams and a client that stops reading stops the command.
+const uint32_t PROTOCOL_VERSION = 2;
+const uint32_t FLAG_HIGHLIGHT = 1;
+const uint32_t REPLY_EXIT = 0;
+const uint32_t REPLY_OUT = 1;
+const uint32_t REPLY_ERR = 2;
+const uint32_t MAX_FRAME_SIZE = 64u << 20;
+const size_t CHUNK_SIZE = 64 * 1024;
+const int CLIENT_TIMEOUT_SECONDS = 30;
+// Most writes one group commit takes on
+const size_t MAX_COMMIT_GROUP = 256;
+
+void append_u32(std::string& buffer, uint32_t value) {
+    char bytes[4] = {
+        static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+        static_cast<char>(value >> 8), static_cast<char>(value)
+    };
+    buffer.append(bytes, 4);
+}
+
+void append_string(std::string& buffer, const std::string& value) {
+    append_u32(buffer, static_cast<uint32_t>(value.size()));
+    buffer += value;
+}
+
+// Reads fields back out of a payload. Every read fails once the payload is exhausted.
+struct PayloadReader {
+    const std::string& buffer;
+    size_t pos = 0;
+
+    bool u32(uint32_t& value) {
+        if (buffer.size() - pos < 4) return false;
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(buffer.data() + pos);
+        value = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        pos += 4;
+        return true;
+    }
+
+    bool str(std::string& value) {
+        uint32_t size;
+        if (!u32(size) || buffer.size() - pos < size) return false;
+        value.assign(buffer, pos, size);
+        pos += size;
+        return true;
+    }
+};
+
+bool write_all(int fd, const char* data, size_t size) {
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL; // A client that hung up must not kill the server
+#endif
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool read_all(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool write_frame(int fd, const std::string& payload) {
+    std::string header;
+    append_u32(header, static_cast<uint32_t>(payload.size()));
+    return write_all(fd, header.data(), header.size()) && write_all(fd, payload.data(), payload.size());
+}
+
+bool read_frame(int fd, std::string& payload) {
+    std::string header(4, '\0');
+    if (!read_all(fd, &header[0], 4)) return false;
+    PayloadReader reader{header};
+    uint32_t size;
+    if (!reader.u32(size) || size > MAX_FRAME_SIZE) return false;
+    payload.resize(size);
+    return size == 0 || read_all(fd, &payload[0], size);
+}
+
+bool write_chunk(int fd, uint32_t kind, const char* data, size_t size) {
+    std::string payload;
+    append_u32(payload, kind);
+    append_string(payload, std::string(data, size));
+    return write_frame(fd, payload);
+}
+
+// Sends a whole string as a run of chunk frames.
+bool write_chunks(int fd, uint32_t kind, const std::string& data) {
+    for (size_t pos = 0; pos < data.size(); pos += CHUNK_SIZE) {
+        if (!write_chunk(fd, kind, data.data() + pos, std::min(CHUNK_SIZE, data.size() - pos))) return false;
+    }
+    return true;
+}
+
+bool write_exit(int fd, int code) {
+    std::string payload;
+    append_u32(payload, REPLY_EXIT);
+    append_u32(payload, static_cast<uint32_t>(code));
+    return write_frame(fd, payload);
+}
+
+// A stream buffer that sends what a command prints as chunk frames, whenever
+// CHUNK_SIZE bytes have built up and on every flush. Once a send fails, every
+// write fails, so the command sees its output stream go bad.
+class ChunkBuffer : public std::streambuf {
+public:
+    ChunkBuffer(int fd, uint32_t kind) : fd_(fd), kind_(kind) { pending_.reserve(CHUNK_SIZE); }
+    ~ChunkBuffer() override { sync(); }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return sync() == 0 ? traits_type::not_eof(c) : traits_type::eof();
+        char byte = traits_type::to_char_type(c);
+        return xsputn(&byte, 1) == 1 ? c : traits_type::eof();
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize size) override {
+        if (failed_) return 0;
+        pending_.append(data, static_cast<size_t>(size));
+        if (pending_.size() >= CHUNK_SIZE && sync() != 0) return 0;
+        return size;
+    }
+
+    int sync() override {
+        if (!failed_ && !pending_.empty()) failed_ = !write_chunks(fd_, kind_, pending_);
+        pending_.clear();
+        return failed_ ? -1 : 0;
+    }
+
+private:
+    int fd_;
+    uint32_t kind_;
+    std::string pending_;
+    bool failed_ = false;
+};
+
+void set_no_sigpipe(int fd) {
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+    (void)fd;
+#endif
+}
+
+// Fills in a socket address. Fails if the path doesn't fit in sun_path.
+bool make_address(const std::string& socket_path, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) return false;
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    return true;
+}
+
+// Returns a connected socket, or -1 if nothing is listening at the path.
+int connect_to(const std::string& socket_path) {
+    sockaddr_un address;
+    if (!make_address(socket_path, address)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    set_no_sigpipe(fd);
+    return fd;
+}
+
+// --- CLIENT ---
+// Long-running maintenance runs in the calling process rather than holding up
+// the daemon's writer.
+bool should_forward(const std::vector<std::string>& args) {
+    if (args.size() < 2) return false;
+    const std::string& command = args[1];
+    if (command == "import" || command == "serve" || command == "archive" || command == "compact" || command == "sync") return false;
+    // The server can't read the caller's stdin, and would hold a whole body in
+    // memory to send it back
+    if (command == "show" || std::find(args.begin() + 1, args.end(), "-") != args.end()) return false;
+    const char* disabled = getenv("INK_NO_DAEMON");
+    return disabled == nullptr || disabled[0] == '\0' || std::strcmp(disabled, "0") == 0;
+}
+
+bool forward(const std::string& socket_path, const std::vector<std::string>& args,
+             const std::string& cwd, bool highlight, int& exit_code) {
+    INK_TRACE_SCOPE("forward");
+    int fd = connect_to(socket_path);
+    if (fd < 0) return false;
+
+    std::string request;
+    append_u32(request, PROTOCOL_VERSION);
+    append_u32(request, highlight ? FLAG_HIGHLIGHT : 0);
+    append_string(request, cwd);
+    append_u32(request, static_cast<uint32_t>(args.size()));
+    for (const auto& arg : args) append_string(request, arg);
+
+    if (!write_frame(fd, request)) {
+        // Nothing reached the server, so running the command here is safe
+        close(fd);
+        return false;
+    }
+
+    timeval timeout{CLIENT_TIMEOUT_SECONDS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Once the request is out, the command may already have run; falling back
+    // to direct mode could save a note twice
+    std::string frame, chunk;
+    while (true) {
+        uint32_t kind = 0, code = 1;
+        bool received = read_frame(fd, frame);
+        PayloadReader reader{frame};
+        if (received && reader.u32(kind) && kind == REPLY_EXIT && reader.u32(code)) {
+            exit_code = static_cast<int>(code);
+            break;
+        }
+        if (!received || (kind != REPLY_OUT && kind != REPLY_ERR) || !reader.str(chunk)) {
+            std::cerr << "Error: No response from ink server at " << socket_path << "." << std::endl;
+            exit_code = 1;
+            break;
+        }
+        std::ostream& target = kind == REPLY_OUT ? std::cout : std::cerr;
+        target.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        target.flush();
+        // Whoever reads our output stopped; hanging up stops the command too
+        if (!target) {
+            exit_code = 1;
+            break;
+        }
+    }
+    close(fd);
+    return true;
+}
+
+// --- SERVER ---
+volatile sig_atomic_t stop_requested = 0;
+
+void handle_stop_signal(int) { stop_requested = 1; }
+
+// Metadata for a `p` note, collected while the note itself is being saved.
+// Only the writer thread touches note_id.
+struct Enrichment {
+    long long note_id = -1;  // Set once the writer has saved the note
+    ProgMetadata metadata;
+    bool collected = false;  // False when collection ran past its deadline
+};
+
+// A write waiting for the writer thread. The writer replies on `fd` once
+// the group it joined has committed. A job with no fd carries the metadata
+// for a note an earlier job saved; nobody waits on it.
+struct WriteJob {
+    int fd;
+    std::vector<std::string> args;
+    std::string cwd;
+    bool highlight;
+    std::shared_ptr<Enrichment> enrichment;
+};
+
+class Server {
+public:
+    Server(const std::string& db_path) : db_path_(db_path), writer_(db_path) {
+        // Notes a previous server left pending will never be enriched now
+        if (writer_.is_open()) db::expire_stale_enrichments(writer_);
+    }
+
+    bool ready() const { return writer_.is_open(); }
+
+    void start(unsigned threads) {
+        writer_thread_ = std::thread(&Server::write_loop, this);
+        for (unsigned i = 0; i < threads; ++i) workers_.emplace_back(&Server::work, this);
+    }
+
+    void submit(int client_fd) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.push_back(client_fd);
+        }
+        ready_.notify_one();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        for (auto& t : workers_) t.join();
+        for (int fd : pending_) close(fd);
+        // Writes already accepted still get committed and answered
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            writer_stopping_ = true;
+        }
+        write_ready_.notify_all();
+        writer_thread_.join();
+    }
+
+private:
+    std::string db_path_;
+    db::Database writer_;       // The only connection that writes, used by writer_thread_
+    std::thread writer_thread_;
+    std::mutex write_mutex_;
+    std::condition_variable write_ready_;
+    std::deque<WriteJob> writes_;
+    bool writer_stopping_ = false;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<int> pending_;   // Accepted connections waiting for a worker
+    bool stopping_ = false;
+
+    void work() {
+        // Each worker reads through its own connection, so searches run in
+        // parallel and keep their prepared statements warm
+        db::Database reader(db_path_);
+        while (true) {
+            int fd;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+                if (stopping_) return;
+                fd = pending_.front();
+                pending_.pop_front();
+            }
+            if (handle_client(reader, fd)) close(fd);
+        }
+    }
+
+    // Serves a read directly, or queues a write for the writer thread.
+    // Returns false when the writer now owns the connection.
+    bool handle_client(db::Database& reader, int fd) {
+        timeval timeout{CLIENT_TIMEOUT_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        set_no_sigpipe(fd);
+
+        std::string request;
+        if (!read_frame(fd, request)) return true;
+        PayloadReader in{request};
+        uint32_t version = 0, flags = 0, argc = 0;
+        std::string cwd;
+        std::vector<std::string> args;
+        bool valid = in.u32(version) && version == PROTOCOL_VERSION && in.u32(flags) && in.str(cwd) && in.u32(argc);
+        for (uint32_t i = 0; valid && i < argc; ++i) {
+            args.emplace_back();
+            valid = in.str(args.back());
+        }
+
+        ChunkBuffer out_chunks(fd, REPLY_OUT), err_chunks(fd, REPLY_ERR);
+        std::ostream out(&out_chunks), err(&err_chunks);
+        int code = 1;
+        if (!valid) {
+            err << "Error: Malformed request to ink server." << std::endl;
+        } else if (commands::is_write_command(args)) {
+            WriteJob job{fd, std::move(args), cwd, (flags & FLAG_HIGHLIGHT) != 0, nullptr};
+            bool enrich = job.args.size() >= 3 && job.args[1] == "p" && !cwd.empty();
+            if (enrich) job.enrichment = std::make_shared<Enrichment>();
+            std::shared_ptr<Enrichment> enrichment = job.enrichment;
+            queue_write(std::move(job));
+            // The client hears back as soon as the note commits; the metadata
+            // follows in a later group, so a slow scan never holds one up
+            if (enrich) {
+                enrichment->collected = metadata::collect_metadata_within(cwd, enricher::TIMEOUT, enrichment->metadata);
+                queue_write(WriteJob{-1, {}, cwd, false, enrichment});
+            }
+            return false;
+        } else if (reader.is_open()) {
+            CommandIO io{out, err, cwd, (flags & FLAG_HIGHLIGHT) != 0};
+            code = commands::run(reader, args, io);
+        } else {
+            err << "Error: Could not open database." << std::endl;
+        }
+        out.flush();
+        err.flush();
+        write_exit(fd, code);
+        return true;
+    }
+
+    void queue_write(WriteJob job) {
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            writes_.push_back(std::move(job));
+        }
+        write_ready_.notify_one();
+    }
+
+    // Writes hold their output until the group commits, then send it at once
+    static void respond(int fd, int code, const std::string& out, const std::string& err) {
+        write_chunks(fd, REPLY_OUT, out) && write_chunks(fd, REPLY_ERR, err) && write_exit(fd, code);
+    }
+
+    // Group commit: every write that queued up while the previous group was
+    // committing goes into one transaction, so a burst of notes costs one
+    // commit instead of one each. Each command runs in its own savepoint, and
+    // nobody hears back until the group is durable.
+    void write_loop() {
+        while (true) {
+            std::vector<WriteJob> group;
+            {
+                std::unique_lock<std::mutex> lock(write_mutex_);
+                write_ready_.wait(lock, [this] { return writer_stopping_ || !writes_.empty(); });
+                if (writes_.empty()) return;
+                while (!writes_.empty() && group.size() < MAX_COMMIT_GROUP) {
+                    group.push_back(std::move(writes_.front()));
+                    writes_.pop_front();
+                }
+            }
+
+            struct Result { int code; std::string out, err; };
+            std::vector<Result> results;
+            // Work waiting on the commit, such as completion log entries,
+            // runs only once the whole group is in
+            db::Transaction txn(writer_, true);
+            bool committed = txn.ok();
+            for (size_t i = 0; committed && i < group.size(); ++i) {
+                WriteJob& job = group[i];
+                if (job.fd < 0) {
+                    // The note's own group may have rolled back, leaving no id
+                    const Enrichment& enrichment = *job.enrichment;
+                    if (enrichment.note_id >= 0 && enrichment.collected) {
+                        db::enrich_metadata(writer_, enrichment.note_id, enrichment.metadata);
+                    } else if (enrichment.note_id >= 0) {
+                        db::expire_enrichment(writer_, enrichment.note_id);
+                    }
+                    results.push_back({0, "", ""});
+                    continue;
+                }
+                std::ostringstream out, err;
+                CommandIO io{out, err, job.cwd, job.highlight};
+                io.defer_metadata = job.enrichment != nullptr;
+                int code = commands::run(writer_, job.args, io);
+                if (job.enrichment) job.enrichment->note_id = io.note_id;
+                results.push_back({code, out.str(), err.str()});
+            }
+            committed = committed && txn.commit();
+            if (!committed) {
+                writer_.execute("ROLLBACK;");
+                // Ids handed out in a rolled-back group get reused
+                for (auto& job : group) {
+                    if (job.fd >= 0 && job.enrichment) job.enrichment->note_id = -1;
+                }
+            }
+            trace::count("group_commits", 1);
+            trace::count("group_commit_writes", static_cast<long long>(group.size()));
+
+            for (size_t i = 0; i < group.size(); ++i) {
+                if (group[i].fd < 0) continue;
+                if (committed) {
+                    respond(group[i].fd, results[i].code, results[i].out, results[i].err);
+                } else {
+                    respond(group[i].fd, 1, "", "Error: Failed to save to the database (" + std::string(sqlite3_errmsg(writer_.handle())) + ").\n");
+                }
+                close(group[i].fd);
+            }
+        }
+    }
+};
+
+int serve(const std::string& db_path, const std::string& socket_path) {
+    sockaddr_un address;
+    if (!make_address(socket_path, address)) {
+        std::cerr << "Error: Socket path is too long: " << socket_path << std::endl;
+        return 1;
+    }
+
+    // A socket file nobody answers on is left over from a server that died
+    int existing = connect_to(socket_path);
+    if (existing >= 0) {
+        close(existing);
+        std::cerr << "Error: An ink server is already running at " << socket_path << "." << std::endl;
+        return 1;
+    }
+    unlink(socket_path.c_str());
+
+    Server server(db_path);
+    if (!server.ready()) return 1;
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        std::cerr << "Error: Could not create socket: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    // Only the owner may connect: the socket gives full access to the notes
+    mode_t old_mask = umask(0077);
+    bool bound = bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    umask(old_mask);
+    if (!bound || listen(listen_fd, 64) != 0) {
+        std::cerr << "Error: Could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        close(listen_fd);
+        return 1;
+    }
+    chmod(socket_path.c_str(), 0600);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    unsigned threads = std::min(8u, std::max(2u, std::thread::hardware_concurrency()));
+    server.start(threads);
+    std::cout << "🐌 Den Den Ink serving on " << socket_path << " (" << threads << " workers)" << std::endl;
+
+    while (!stop_requested) {
+        pollfd pfd{listen_fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, 250);
+        if (ready <= 0) continue;
+        int client_fd = accept(listen_fd, nullptr, nullptr);
+        if (client_fd >= 0) server.submit(client_fd);
+    }
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    server.stop();
+    std::cout << "🐌 Den Den Ink server stopped." << std::endl;
+    return 0;
+}
+
+}
@@ -0,0 +1,23 @@
+#ifndef INK_SERVER_HPP
+#define INK_SERVER_HPP
+
+#include <string>
+#include <vector>
+
+namespace server {
+    // Runs `ink serve`: keeps the database open and answers commands from
+    // other `ink` processes over a Unix socket until SIGINT or SIGTERM.
+    // Reads run on a pool of connections; writes share one connection in turn.
+    int serve(const std::string& db_path, const std::string& socket_path);
+
+    // False for commands that must run in the calling process (import reads
+    // the caller's stdin and files), or when INK_NO_DAEMON is set.
+    bool should_forward(const std::vector<std::string>& args);
+
+    // Sends a command to a running server and prints its output. Returns false
+    // if no server is listening, so the caller can run the command itself.
+    bool forward(const std::string& socket_path, const std::vector<std::string>& args,
+                 const std::string& cwd, bool highlight, int& exit_code);
+}
+
+#endif
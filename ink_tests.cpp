@@ -0,0 +1,1031 @@
+// ink_tests: checks of the core modules against throwaway databases. Run by
+// `ctest`; pass test names to run only those.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "archive.hpp"
+#include "completion.hpp"
+#include "database.hpp"
+#include "file_scanner.hpp"
+#include "fuzzy_index.hpp"
+#include "git_resolver.hpp"
+#include "ink_server.hpp"
+#include "note_body.hpp"
+#include "note_formatter.hpp"
+#include "note_importer.hpp"
+#include "note_sync.hpp"
+#include "query_executor.hpp"
+#include "similar_index.hpp"
+#include "stats_engine.hpp"
+#include "tag_index.hpp"
+#include "time_window.hpp"
+
+namespace fs = std::filesystem;
+
+// --- TEST RUNNER ---
+int failures = 0;
+
+#define CHECK(condition)                                                                          \
+    do {                                                                                          \
+        if (!(condition)) {                                                                       \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            ++failures;                                                                           \
+        }                                                                                         \
+    } while (0)
+
+struct Test {
+    const char* name;
+    std::function<void()> run;
+};
+
+// A fresh database in the temporary directory, removed with the files kept
+// beside it (WAL, archives, completion data) when the test is done.
+class TempDatabase {
+public:
+    TempDatabase() {
+        static int counter = 0;
+        path_ = (fs::temp_directory_path() / ("ink_tests_" + std::to_string(getpid()) + "_" + std::to_string(++counter) + ".db")).string();
+        db_ = std::make_unique<db::Database>(path_);
+    }
+    ~TempDatabase() {
+        db_.reset();
+        std::error_code ec;
+        const std::string stem = db::sidecar_path(path_, "");
+        for (const auto& entry : fs::directory_iterator(fs::temp_directory_path(), ec)) {
+            if (entry.path().string().rfind(stem, 0) == 0) fs::remove(entry.path(), ec);
+        }
+    }
+
+    db::Database& operator*() { return *db_; }
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+    std::unique_ptr<db::Database> db_;
+};
+
+// The ids a cursor returns, in order
+std::vector<long long> ids_of(db::NoteCursor cursor) {
+    std::vector<long long> ids;
+    FullNote note;
+    while (cursor.next(note)) ids.push_back(note.id);
+    return ids;
+}
+
+// A statement run while a StatementLog was recording: its query plan, taken
+// on the connection that ran it, and the most rows one run of it stepped
+// through in full scans. The statements of a trigger body are listed on
+// their own, with NEW and OLD columns as parameters; their rows count toward
+// the statement that fired the trigger, so theirs is -1.
+struct StatementRun {
+    std::string sql;
+    std::vector<std::string> plan;
+    long long scan_steps = -1;
+};
+
+// Traces every connection opened while it exists, recording each distinct
+// statement the first time it runs inside record()
+class StatementLog {
+public:
+    StatementLog() {
+        current_ = this;
+        sqlite3_auto_extension(reinterpret_cast<void (*)()>(&StatementLog::attach));
+    }
+    ~StatementLog() {
+        sqlite3_cancel_auto_extension(reinterpret_cast<void (*)()>(&StatementLog::attach));
+        current_ = nullptr;
+    }
+
+    void record(const std::function<void()>& f) {
+        recording_ = true;
+        f();
+        recording_ = false;
+    }
+
+    std::vector<StatementRun> runs;
+
+private:
+    static int attach(sqlite3* db, char**, const void*) {
+        sqlite3_trace_v2(db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE, &StatementLog::trace, nullptr);
+        return SQLITE_OK;
+    }
+
+    static int trace(unsigned event, void*, void* p, void* x) {
+        StatementLog* log = current_;
+        // The plans are read on the same connection, which traces those too
+        if (!log || !log->recording_ || log->busy_) return 0;
+        log->busy_ = true;
+        auto* stmt = static_cast<sqlite3_stmt*>(p);
+        sqlite3* db = sqlite3_db_handle(stmt);
+        if (event == SQLITE_TRACE_PROFILE) {
+            StatementRun* run = log->find(sqlite3_sql(stmt));
+            long long steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+            if (run) run->scan_steps = std::max(run->scan_steps, steps);
+        } else if (std::string text = static_cast<const char*>(x); text.rfind("-- TRIGGER ", 0) == 0) {
+            for (const std::string& sql : trigger_statements(db, text.substr(11))) log->add(db, sql, -1);
+        } else {
+            log->add(db, sqlite3_sql(stmt), 0);
+        }
+        log->busy_ = false;
+        return 0;
+    }
+
+    StatementRun* find(const std::string& sql) {
+        auto it = std::find_if(runs.begin(), runs.end(), [&](const StatementRun& run) { return run.sql == sql; });
+        return it == runs.end() ? nullptr : &*it;
+    }
+
+    void add(sqlite3* db, const std::string& sql, long long scan_steps) {
+        if (find(sql)) return;
+        StatementRun run{sql, {}, scan_steps};
+        sqlite3_stmt* plan = nullptr;
+        if (sqlite3_prepare_v2(db, ("EXPLAIN QUERY PLAN " + sql).c_str(), -1, &plan, nullptr) != SQLITE_OK) {
+            std::cerr << "Can't explain (" << sqlite3_errmsg(db) << "): " << sql << std::endl;
+            ++failures;
+        }
+        while (plan && sqlite3_step(plan) == SQLITE_ROW) run.plan.push_back(reinterpret_cast<const char*>(sqlite3_column_text(plan, 3)));
+        sqlite3_finalize(plan);
+        runs.push_back(run);
+    }
+
+    // The body of a trigger in any attached database, one statement each
+    static std::vector<std::string> trigger_statements(sqlite3* db, const std::string& name) {
+        static const std::regex row_column("\\b(?:new|old)\\.\\w+", std::regex::icase);
+        std::vector<std::string> statements;
+        sqlite3_stmt* schemas = nullptr;
+        sqlite3_prepare_v2(db, "SELECT name FROM pragma_database_list;", -1, &schemas, nullptr);
+        while (statements.empty() && sqlite3_step(schemas) == SQLITE_ROW) {
+            std::string schema = reinterpret_cast<const char*>(sqlite3_column_text(schemas, 0));
+            sqlite3_stmt* stmt = nullptr;
+            std::string query = "SELECT sql FROM \"" + schema + "\".sqlite_master WHERE type = 'trigger' AND name = ?;";
+            sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+            sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                std::string sql = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+                size_t begin = sql.find(" BEGIN ") + 7, end = sql.rfind("END");
+                std::string body = std::regex_replace(sql.substr(begin, end - begin), row_column, "?");
+                for (size_t from = 0, semi; (semi = body.find(';', from)) != std::string::npos; from = semi + 1) {
+                    std::string part = body.substr(from, semi - from);
+                    part.erase(0, part.find_first_not_of(' '));
+                    if (!part.empty()) statements.push_back(part + ";");
+                }
+            }
+            sqlite3_finalize(stmt);
+        }
+        sqlite3_finalize(schemas);
+        if (statements.empty()) {
+            std::cerr << "Can't read trigger " << name << std::endl;
+            ++failures;
+        }
+        return statements;
+    }
+
+    static inline StatementLog* current_ = nullptr;
+    bool recording_ = false;
+    bool busy_ = false;
+};
+
+// Saves a note with its own timestamp through the bulk load path
+bool add_note_at(db::Database& db, const std::string& timestamp, const std::string& text, const ProgMetadata& metadata = {}) {
+    FullNote note;
+    note.timestamp = timestamp;
+    note.text = text;
+    note.type = metadata.current_directory.empty() ? "general" : "programming";
+    note.metadata = metadata;
+    db::Transaction txn(db, true);
+    BulkInsert bulk;
+    return txn.ok() && db::bulk_insert_note(db, bulk, note) >= 0 && db::flush_bulk_insert(db, bulk) && txn.commit();
+}
+
+TagFilter filter_for(db::Database& db, const std::vector<std::string>& tokens) {
+    TagExpression expr;
+    if (!tag_index::parse(tokens, expr)) return {};
+    return tag_index::evaluate(db, expr);
+}
+
+// --- TESTS ---
+void test_notes_round_trip() {
+    TempDatabase db;
+    CHECK((*db).is_open());
+    CHECK(db::add_general_note(*db, "buy coffee beans", {"home"}));
+    CHECK(db::add_prog_note(*db, "fix the parser crash", {"cpp", "bug"}, {"/src/ink", "parser.cpp", "main", "abc123"}));
+    CHECK(db::add_general_note(*db, "parser talk notes", {"cpp"}));
+
+    FullNote note;
+    db::NoteCursor cursor = db::list_recent_notes(*db, {});
+    CHECK(cursor.next(note));
+    CHECK(note.text == "parser talk notes");
+    CHECK(cursor.next(note));
+    CHECK(note.type == "programming");
+    CHECK(note.metadata.current_directory == "/src/ink");
+    CHECK(note.metadata.git_branch == "main");
+    CHECK((note.tags == std::vector<std::string>{"bug", "cpp"} || note.tags == std::vector<std::string>{"cpp", "bug"}));
+    CHECK(cursor.next(note));
+    CHECK(!cursor.next(note));
+
+    PageOptions page;
+    page.limit = 1;
+    CHECK(ids_of(db::list_recent_notes(*db, page)) == std::vector<long long>{3});
+    page.after_id = 3;
+    CHECK(ids_of(db::list_recent_notes(*db, page)) == std::vector<long long>{2});
+}
+
+void test_tag_queries() {
+    TempDatabase db;
+    CHECK(db::add_general_note(*db, "one", {"cpp", "perf"}));
+    CHECK(db::add_general_note(*db, "two", {"cpp"}));
+    CHECK(db::add_general_note(*db, "three", {"perf", "draft"}));
+
+    CHECK(ids_of(db::list_notes_by_tags(*db, filter_for(*db, {"#cpp"}), {})) == (std::vector<long long>{2, 1}));
+    CHECK(ids_of(db::list_notes_by_tags(*db, filter_for(*db, {"#cpp", "AND", "#perf"}), {})) == std::vector<long long>{1});
+    CHECK(ids_of(db::list_notes_by_tags(*db, filter_for(*db, {"#perf", "NOT", "#draft"}), {})) == std::vector<long long>{1});
+    CHECK(ids_of(db::list_notes_by_tags(*db, filter_for(*db, {"#missing"}), {})).empty());
+
+    // `ink list "#cpp AND #perf"` arrives as one argument
+    std::string text;
+    std::vector<std::string> tokens;
+    tag_index::split_query("(#cpp OR #draft) AND NOT #perf", text, tokens);
+    CHECK(text.empty());
+    CHECK((tokens == std::vector<std::string>{"(", "#cpp", "OR", "#draft", ")", "AND", "NOT", "#perf"}));
+    CHECK(ids_of(db::list_notes_by_tags(*db, filter_for(*db, tokens), {})) == std::vector<long long>{2});
+    tokens.clear();
+    tag_index::split_query("f(x) #cpp", text, tokens);
+    CHECK(text == "f(x)" && tokens == std::vector<std::string>{"#cpp"});
+}
+
+void test_search() {
+    TempDatabase db;
+    CHECK(db::add_general_note(*db, "parser crash on empty input", {"bug"}));
+    CHECK(db::add_general_note(*db, "coffee beans", {}));
+    CHECK(db::add_general_note(*db, "parser parser rewrite", {"cpp"}));
+
+    std::vector<long long> ids = ids_of(db::search_notes(*db, "parser", {}, {}));
+    CHECK(ids.size() == 2);
+    CHECK(ids_of(db::search_notes(*db, "parser", filter_for(*db, {"#bug"}), {})) == std::vector<long long>{1});
+    CHECK(ids_of(db::search_notes(*db, "pars*", {}, {})).size() == 2);
+    CHECK(ids_of(db::search_notes(*db, "\"empty input\"", {}, {})) == std::vector<long long>{1});
+    CHECK(ids_of(db::search_notes(*db, "espresso", {}, {})).empty());
+
+    // Matched words are shown; a match elsewhere doesn't repeat the text
+    CHECK(db::add_prog_note(*db, "fix the crash", {}, {"/src/widget", "", "", ""}));
+    std::ostringstream out;
+    db::NoteCursor parser = db::search_notes(*db, "rewrite", {}, {});
+    formatter::print_notes(parser, out);
+    CHECK(out.str().find("  Match: parser parser rewrite\n") != std::string::npos);
+    out.str("");
+    db::NoteCursor widget = db::search_notes(*db, "widget", {}, {});
+    formatter::print_notes(widget, out);
+    CHECK(out.str().find("> fix the crash\n") != std::string::npos && out.str().find("Match:") == std::string::npos);
+}
+
+void test_stats() {
+    TempDatabase db;
+    CHECK(db::add_general_note(*db, "one", {"cpp", "perf"}));
+    CHECK(db::add_general_note(*db, "two", {"cpp"}));
+    CHECK(db::add_prog_note(*db, "three", {}, {"/src/ink", "", "", ""}));
+
+    AppStats stats = stats::gather_stats(*db);
+    CHECK(stats.total_notes == 3);
+    CHECK(!stats.top_tags.empty() && stats.top_tags[0].name == "cpp" && stats.top_tags[0].count == 2);
+    CHECK(stats.notes_per_project.size() == 1 && stats.notes_per_project[0].count == 1);
+    CHECK(stats.notes_per_day.size() == 1 && stats.notes_per_day[0].count == 3);
+
+    // Windows are half-open, whatever the bounds' precision
+    CHECK(add_note_at(*db, "2024-01-01 10:00:00", "four"));
+    CHECK(add_note_at(*db, "2024-01-02 10:00:00", "five"));
+    auto days = db::get_daily_counts_between(*db, "2024-01-01 00:00:00", "2024-01-02 00:00:00");
+    CHECK(days.size() == 1 && days[0].first == "2024-01-01");
+    CHECK(db::get_daily_counts_between(*db, "2024-01-01", "2024-01-03").size() == 2);
+}
+
+void test_timestamps() {
+    long long epoch = 0;
+    CHECK(time_window::parse_timestamp("2024-02-29 23:59:59", epoch));
+    CHECK(time_window::format_timestamp(epoch) == "2024-02-29 23:59:59");
+    CHECK(time_window::parse_timestamp("1970-01-01", epoch) && epoch == 0);
+    CHECK(!time_window::parse_timestamp("2024-13-01", epoch));
+    CHECK(time_window::parse_bound("2024-01-01", true, 0, epoch) && time_window::format_timestamp(epoch) == "2024-01-02 00:00:00");
+    CHECK(time_window::parse_bound("7d", false, 7 * time_window::SECONDS_PER_DAY, epoch) && epoch == 0);
+    CHECK(time_window::parse_bound("2024-01-01 10:30", true, 0, epoch) && time_window::format_timestamp(epoch) == "2024-01-01 10:31:00");
+    CHECK(time_window::parse_bound("2024-01-01 10:30:15", true, 0, epoch) && time_window::format_timestamp(epoch) == "2024-01-01 10:30:16");
+    CHECK(time_window::parse_bound("2024-01-01 10:30", false, 0, epoch) && time_window::format_timestamp(epoch) == "2024-01-01 10:30:00");
+
+    CHECK(time_window::parse_instant("2024-01-01T10:00:00Z", epoch) && time_window::format_timestamp(epoch) == "2024-01-01 10:00:00");
+    CHECK(time_window::parse_instant("2024-01-01T10:00:00.250+02:00", epoch) && time_window::format_timestamp(epoch) == "2024-01-01 08:00:00");
+    CHECK(time_window::parse_instant("2024-01-01T23:30-0130", epoch) && time_window::format_timestamp(epoch) == "2024-01-02 01:00:00");
+    CHECK(time_window::parse_instant("1704103200", epoch) && time_window::format_timestamp(epoch) == "2024-01-01 10:00:00");
+    CHECK(!time_window::parse_instant("01/02/2024", epoch));
+    CHECK(!time_window::parse_instant("2024-01-01 10:00:00 junk", epoch));
+    CHECK(!time_window::parse_instant("", epoch));
+}
+
+// Every statement behind saving, reading, syncing and archiving notes, and
+// every trigger those fire, must reach the per-note tables through an index:
+// a plan step that scans one of them grows with the whole history. The one
+// scan allowed is a walk down an index in ORDER BY order, and only if it
+// stops at the page's LIMIT, which is checked against the rows it took.
+void test_query_plans() {
+    const int HISTORY = 200;
+    PageOptions page;
+    page.limit = 10;
+    // Notes a walk may pass over for a page: #tag1, the sparsest filter
+    // walked here, matches one note in five
+    const long long WALK_LIMIT = 5 * page.limit;
+    PageOptions window = page;
+    window.since = "2000-01-01 00:00:00";
+    window.until = "2100-01-01 00:00:00";
+    PageOptions resumed = page;
+    resumed.after_id = HISTORY - 10;
+
+    StatementLog log;
+    TempDatabase db, other;
+    const std::string year_path = db::sidecar_path(db.path(), ".2020.db");
+    // Opened ahead of the archive run, so its schema is set up before recording
+    { db::Database year(year_path); }
+    std::ostringstream out;
+
+    log.record([&] {
+        for (int i = 0; i < HISTORY; ++i) {
+            std::vector<std::string> tags = {"tag" + std::to_string(i % 5)};
+            std::string n = std::to_string(i);
+            if (i % 3 == 0) {
+                long long id = db::add_pending_prog_note(*db, "pending parser note " + n, tags, "/src/p");
+                CHECK(id > 0 && db::enrich_metadata(*db, id, {"/src/p", "b.cpp", "dev", "abc"}));
+            } else if (i % 2) {
+                CHECK(db::add_prog_note(*db, "parser note " + n, tags, {"/src/p" + std::to_string(i % 3), "a.cpp", "main", ""}));
+            } else {
+                CHECK(db::add_general_note(*db, "general note " + n, tags));
+            }
+        }
+        CHECK(db::replace_metadata(*db, 2, {"/src/q", "c.cpp", "main", "def"}));
+        CHECK(db::expire_stale_enrichments(*db));
+
+        std::FILE* file = std::tmpfile();
+        CHECK(file && std::fputs("body line\nmore\n", file) >= 0 && std::fflush(file) == 0 && std::fseek(file, 0, SEEK_SET) == 0);
+        note_body::Spool body;
+        CHECK(file && body.read(fileno(file)) && db::add_general_note(*db, "with a body", {"tag1"}, &body));
+        CHECK(note_body::write(*db, HISTORY + 1, out) >= 0);
+        if (file) std::fclose(file);
+
+        for (int i = 0; i < 20; ++i) CHECK(add_note_at(*db, "2020-06-0" + std::to_string(1 + i % 9) + " 10:00:00", "old parser note " + std::to_string(i)));
+        CHECK(add_note_at(*other, "2024-01-01 10:00:00", "only there"));
+        CHECK(add_note_at(*other, "2020-06-01 10:00:00", "old parser note 0"));
+    });
+    // Rebuilding an index reads every note by design
+    CHECK(similar_index::rebuild(*db));
+
+    log.record([&] {
+        for (const PageOptions& p : {page, window, resumed}) {
+            ids_of(db::list_recent_notes(*db, p));
+            ids_of(db::list_notes_by_tags(*db, filter_for(*db, {"#tag1"}), p));
+            ids_of(db::list_notes_by_tags(*db, filter_for(*db, {"NOT", "#tag1"}), p));
+            ids_of(db::search_notes(*db, "parser", {}, p));
+            ids_of(db::search_notes(*db, "parser", filter_for(*db, {"#tag1"}), p));
+            ids_of(db::fuzzy_search_notes(*db, "parsr", {}, p));
+        }
+        ids_of(db::get_notes(*db, {1, 2, 3}));
+        std::vector<similar_index::Match> matches;
+        CHECK(similar_index::find_similar(*db, 1, 5, matches));
+        stats::gather_stats(*db);
+        stats::gather_activity(*db, 0, 4102444800, 4102444800);
+
+        CHECK(archive::archive_notes(*db, "2021-01-01 00:00:00", out) == 20);
+        archive::Missing missing;
+        TagExpression tagged;
+        CHECK(tag_index::parse({"#tag1"}, tagged));
+        ids_of(archive::list_notes(*db, nullptr, window, missing));
+        ids_of(archive::list_notes(*db, &tagged, window, missing));
+        ids_of(archive::search_notes(*db, "parser", nullptr, false, window, missing));
+        ids_of(archive::search_notes(*db, "parsr", nullptr, true, window, missing));
+        CHECK(missing.empty());
+
+        note_sync::SyncReport report;
+        CHECK(note_sync::sync(*db, *other, report) && report.pulled == 1 && report.pushed == HISTORY + 20);
+    });
+    CHECK(log.runs.size() > 50);
+
+    // Plans name a table by its alias when it has one
+    const std::regex reference("\\b(?:FROM|JOIN|INTO|UPDATE)\\s+(?:\\w+\\.)?(notes|note_tags|metadata|sync_keys|note_bodies|note_vectors|blobs)\\b"
+                               "(?:\\s+(?:AS\\s+)?(\\w+))?",
+                               std::regex::icase);
+    const std::regex keyword("ON|WHERE|JOIN|LEFT|INNER|CROSS|USING|GROUP|ORDER|LIMIT|INDEXED|NOT|SET|SELECT|VALUES|DEFAULT", std::regex::icase);
+    for (const StatementRun& run : log.runs) {
+        std::vector<std::string> names;
+        for (std::sregex_iterator it(run.sql.begin(), run.sql.end(), reference), end; it != end; ++it) {
+            names.push_back((*it)[1]);
+            if ((*it)[2].matched && !std::regex_match((*it)[2].str(), keyword)) names.push_back((*it)[2]);
+        }
+        for (const std::string& step : run.plan) {
+            for (const std::string& name : names) {
+                std::string scan = "SCAN " + name;
+                if (step.compare(0, scan.size(), scan) != 0 || (step.size() > scan.size() && step[scan.size()] != ' ')) continue;
+                bool walk = step.find(" INDEX ") != std::string::npos && run.scan_steps >= 0 && run.scan_steps <= WALK_LIMIT;
+                if (walk) continue;
+                std::cerr << "Full scan (" << step << ", " << run.scan_steps << " rows) in: " << run.sql << std::endl;
+                ++failures;
+            }
+        }
+    }
+}
+
+// Every note of a database with its metadata, in a stable order
+std::vector<std::string> contents_of(db::Database& db) {
+    std::vector<std::string> notes;
+    FullNote note;
+    db::NoteCursor cursor = db::list_recent_notes(db, {});
+    while (cursor.next(note)) {
+        const ProgMetadata& m = note.metadata;
+        notes.push_back(note.timestamp + "|" + note.type + "|" + note.text + "|" + m.current_directory + "|" + m.last_edited_file + "|" + m.git_branch);
+    }
+    std::sort(notes.begin(), notes.end());
+    return notes;
+}
+
+// Two databases with overlapping notes end up holding the same notes, each
+// as many times as the side with more copies had it, with the fuller metadata
+void test_sync() {
+    TempDatabase a, b;
+    const ProgMetadata pending = {"/src/ink", "", "", ""};
+    const ProgMetadata enriched = {"/src/ink", "parser.cpp", "main", "abc123"};
+    CHECK(add_note_at(*a, "2024-01-01 10:00:00", "on both"));
+    CHECK(add_note_at(*b, "2024-01-01 10:00:00", "on both"));
+    CHECK(add_note_at(*a, "2024-01-01 11:00:00", "twice here"));
+    CHECK(add_note_at(*a, "2024-01-01 11:00:00", "twice here"));
+    CHECK(add_note_at(*b, "2024-01-01 11:00:00", "twice here"));
+    // Same counts on the same day; an XOR of the keys would call these equal
+    CHECK(add_note_at(*a, "2024-02-02 09:00:00", "pair a"));
+    CHECK(add_note_at(*a, "2024-02-02 09:00:00", "pair a"));
+    CHECK(add_note_at(*b, "2024-02-02 09:00:00", "pair b"));
+    CHECK(add_note_at(*b, "2024-02-02 09:00:00", "pair b"));
+    // Copied before its metadata was collected, then enriched on one side
+    CHECK(add_note_at(*a, "2024-03-03 08:00:00", "fix the parser", pending));
+    CHECK(add_note_at(*b, "2024-03-03 08:00:00", "fix the parser", enriched));
+    CHECK(add_note_at(*b, "2024-04-04 12:00:00", "only there"));
+
+    note_sync::SyncReport report;
+    CHECK(note_sync::sync(*a, *b, report));
+    CHECK(report.pulled == 3);  // Both "pair b" and "only there"
+    CHECK(report.pushed == 3);  // The second "twice here" and both "pair a"
+    CHECK(report.updated == 1);
+    std::vector<std::string> merged = contents_of(*a);
+    CHECK(merged.size() == 9);
+    CHECK(merged == contents_of(*b));
+    CHECK(std::count(merged.begin(), merged.end(), "2024-03-03 08:00:00|programming|fix the parser|/src/ink|parser.cpp|main") == 1);
+
+    note_sync::SyncReport again;
+    CHECK(note_sync::sync(*a, *b, again));
+    CHECK(again.days == 0 && again.pulled == 0 && again.pushed == 0 && again.updated == 0);
+}
+
+// The whole of a small file, or "" if it isn't there
+std::string read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Completion weights are logged only for notes that are committed, however
+// deeply the save was nested (the server saves each note in a savepoint of a
+// group commit)
+void test_completion_log() {
+    TempDatabase db;
+    CHECK(completion::rebuild(*db));
+    const std::string log = completion::log_path(db.path());
+    {
+        db::Transaction group(*db, true);
+        CHECK(db::add_general_note(*db, "kept", {"kept"}));
+        {
+            db::Transaction failed(*db);
+            CHECK(db::add_prog_note(*db, "dropped", {"dropped"}, {"/src/gone", "", "", ""}));
+        }
+        CHECK(read_file(log).empty());
+        CHECK(group.commit());
+    }
+    CHECK(read_file(log) == "#kept\n");
+    {
+        db::Transaction group(*db, true);
+        CHECK(db::add_pending_prog_note(*db, "rolled back", {"undone"}, "/src/undone") > 0);
+    }
+    CHECK(read_file(log) == "#kept\n");
+    CHECK(db::add_general_note(*db, "alone", {"solo"}));
+    CHECK(read_file(log) == "#kept\n#solo\n");
+}
+
+// A file import commits in batches, skips records it can't read, and when
+// run again picks up after the last batch it committed
+void test_import() {
+    TempDatabase db;
+    ImportOptions options;
+    options.source = db::sidecar_path(db.path(), ".import.jsonl");
+    options.batch_size = 2;
+    {
+        std::ofstream file(options.source);
+        file << R"({"text": "one", "tags": ["a", "#b"], "timestamp": "2024-01-01T10:00:00Z"})" "\n"
+             << "not json\n"
+             << R"({"text": "two", "timestamp": "2024-01-02 10:00:00"})" "\n"
+             << R"({"text": "three", "type": "programming", "current_directory": "/src/ink", "timestamp": "2024-01-03T10:00:00+02:00"})" "\n";
+    }
+    std::ostringstream out, err;
+    CHECK(importer::run_import(*db, options, out, err));
+    CHECK(out.str().find("Imported 3 notes") != std::string::npos);
+    CHECK(err.str().find("Skipping malformed record on line 2") != std::string::npos);
+    std::vector<std::string> notes = contents_of(*db);
+    CHECK(notes.size() == 3 && notes[2] == "2024-01-03 08:00:00|programming|three|/src/ink||");
+    CHECK(ids_of(db::list_notes_by_tags(*db, filter_for(*db, {"#b"}), {})).size() == 1);
+
+    err.str("");
+    CHECK(!importer::run_import(*db, options, out, err));
+    CHECK(err.str().find("Already imported") != std::string::npos);
+
+    // As if the last run had stopped after its last batch, before more lines arrived
+    {
+        std::ofstream file(options.source, std::ios::app);
+        file << R"({"text": "four", "timestamp": "2024-01-04"})" "\n" << R"({"text": "five"})" "\n";
+    }
+    CHECK((*db).execute("UPDATE import_progress SET completed = 0;"));
+    err.str("");
+    CHECK(importer::run_import(*db, options, out, err));
+    CHECK(err.str().find("Resuming after 3 previously imported notes.") != std::string::npos);
+    CHECK(contents_of(*db).size() == 5);
+    CHECK(db::get_total_notes_count(*db) == 5);
+
+    options.restart = true;
+    CHECK(importer::run_import(*db, options, out, err));
+    CHECK(contents_of(*db).size() == 10);
+}
+
+// Old notes move to one archive per year and still turn up in listings and
+// searches; an archive that goes missing is reported, not fatal
+void test_archive() {
+    TempDatabase db;
+    CHECK(add_note_at(*db, "2020-03-01 10:00:00", "old parser note"));
+    CHECK(add_note_at(*db, "2021-05-01 10:00:00", "older parser note"));
+    CHECK(add_note_at(*db, "2021-06-01 10:00:00", "newer archived note"));
+    CHECK(db::add_general_note(*db, "recent parser note", {"keep"}));
+
+    std::ostringstream out;
+    CHECK(archive::archive_notes(*db, "2022-01-01 00:00:00", out) == 3);
+    CHECK(out.str().find("Archived 2 note(s) from 2021") != std::string::npos);
+    CHECK(db::get_total_notes_count(*db) == 1);
+    std::vector<archive::Tier> tiers = archive::list_tiers(*db);
+    CHECK(tiers.size() == 2 && tiers[0].year == 2021 && tiers[0].notes == 2 && tiers[1].year == 2020);
+    CHECK(archive::list_tiers(*db, "2021-01-01 00:00:00").size() == 1);
+    CHECK(archive::archive_notes(*db, "2022-01-01 00:00:00", out) == 0);
+
+    archive::Missing missing;
+    PageOptions all;
+    all.since = "2000-01-01 00:00:00";
+    CHECK(ids_of(archive::list_notes(*db, nullptr, all, missing)).size() == 4);
+    CHECK(ids_of(archive::search_notes(*db, "parser", nullptr, false, all, missing)).size() == 3);
+    CHECK(ids_of(archive::search_notes(*db, "parsr", nullptr, true, all, missing)).size() == 3);
+    CHECK(missing.empty());
+
+    fs::remove(tiers[1].path);
+    // A page the hot database fills never opens an archive
+    PageOptions first;
+    first.limit = 1;
+    CHECK(ids_of(archive::list_notes(*db, nullptr, first, missing)).size() == 1);
+    CHECK(missing.empty());
+    CHECK(ids_of(archive::list_notes(*db, nullptr, all, missing)).size() == 3);
+    CHECK(missing == std::vector<std::string>{tiers[1].path});
+    std::ostringstream err;
+    archive::report_missing(missing, err);
+    CHECK(err.str().find("Archive " + tiers[1].path + " is missing") != std::string::npos);
+}
+
+// Query words a few edits off still find their notes, through the note
+// text or the last edited file, closest corrections first
+void test_fuzzy() {
+    CHECK(fuzzy_index::bounded_edit_distance("parser", "parser", 2) == 0);
+    CHECK(fuzzy_index::bounded_edit_distance("parser", "pasrer", 2) == 1);
+    CHECK(fuzzy_index::bounded_edit_distance("kitten", "sitting", 3) == 3);
+    CHECK(fuzzy_index::bounded_edit_distance("kitten", "sitting", 2) == 3);
+    CHECK(fuzzy_index::bounded_edit_distance("", "abc", 5) == 3);
+    const std::string long_word(70, 'a');
+    CHECK(fuzzy_index::bounded_edit_distance(long_word, "b" + long_word.substr(2) + "b", 3) == 2);
+
+    TempDatabase db;
+    CHECK(db::add_general_note(*db, "parser crash on empty input", {"bug"}));
+    CHECK(db::add_general_note(*db, "parser rewrite", {}));
+    CHECK(db::add_general_note(*db, "parsing notes", {}));
+    CHECK(db::add_general_note(*db, "coffee beans", {}));
+    CHECK(db::add_prog_note(*db, "split the module", {}, {"/src/ink", "tokenizer.cpp", "main", ""}));
+
+    fuzzy_index::FuzzyQuery query;
+    CHECK(fuzzy_index::correct(*db, "parsr crsh", query));
+    CHECK(query.word_count == 2 && !query.phrases.empty());
+    CHECK(!fuzzy_index::correct(*db, "zzyzx", query));
+
+    // Equally close matches come newest first; "parsing" is too far off
+    CHECK(ids_of(db::fuzzy_search_notes(*db, "parsr", {}, {})) == (std::vector<long long>{2, 1}));
+    CHECK(ids_of(db::fuzzy_search_notes(*db, "parsr crsh", {}, {})) == std::vector<long long>{1});
+    CHECK(ids_of(db::fuzzy_search_notes(*db, "parsr", filter_for(*db, {"NOT", "#bug"}), {})) == std::vector<long long>{2});
+    CHECK(ids_of(db::fuzzy_search_notes(*db, "tokenizr", {}, {})) == std::vector<long long>{5});
+    CHECK(ids_of(db::fuzzy_search_notes(*db, "zzyzx", {}, {})).empty());
+}
+
+// Notes sharing words, tags and a project rank above notes sharing less,
+// from the snapshot and from notes saved after it alike
+void test_similar() {
+    TempDatabase db;
+    CHECK(db::add_general_note(*db, "parser crash on empty input", {"bug"}));
+    CHECK(db::add_general_note(*db, "parser crash again", {"bug"}));
+    CHECK(db::add_general_note(*db, "coffee beans", {}));
+    CHECK(db::add_general_note(*db, "parser docs", {}));
+
+    std::vector<similar_index::Match> matches;
+    CHECK(similar_index::find_similar(*db, 1, 10, matches));
+    CHECK(matches.size() == 2 && matches[0].id == 2 && matches[1].id == 4);
+    CHECK(matches[0].score > matches[1].score && matches[1].score > 0 && matches[0].score <= 1);
+    CHECK(fs::exists(similar_index::snapshot_path(db.path())));
+
+    // Saved after the snapshot, so scored from note_vectors
+    CHECK(db::add_general_note(*db, "parser crash on empty input", {"bug"}));
+    CHECK(similar_index::find_similar(*db, 1, 1, matches));
+    CHECK(matches.size() == 1 && matches[0].id == 5 && matches[0].score > 0.99f);
+    CHECK(similar_index::find_similar(*db, 3, 10, matches) && matches.empty());
+}
+
+// What `ink __complete` prints for the words typed so far
+std::string completions(const std::string& db_path, const std::vector<std::string>& words) {
+    std::ostringstream out;
+    CHECK(completion::run(db_path, words, out) == 0);
+    return out.str();
+}
+
+// The trie returns the heaviest candidates for a prefix, and lookups add in
+// what the log gathered since the trie was built
+void test_completion() {
+    TempDatabase db;
+    const std::string path = db::sidecar_path(db.path(), ".test.complete");
+    CHECK(completion::write_trie(path, {{"#cpp", 5}, {"#cache", 9}, {"#c", 1}, {"/src/ink", 3}, {"#perf", 2}}));
+    completion::Trie trie;
+    CHECK(trie.open(path));
+    std::vector<completion::Candidate> found = trie.complete("#c", 10);
+    CHECK(found.size() == 3 && found[0].text == "#cache" && found[1].text == "#cpp" && found[2].text == "#c" && found[2].weight == 1);
+    CHECK(trie.complete("#c", 1).size() == 1);
+    CHECK(trie.complete("", 10).size() == 5);
+    CHECK(trie.complete("#x", 10).empty());
+    CHECK(trie.weight("#cpp") == 5 && trie.weight("#cp") == 0);
+    {
+        std::ofstream(path, std::ios::trunc) << "not a trie";
+    }
+    completion::Trie broken;
+    CHECK(!broken.open(path));
+
+    CHECK(db::add_general_note(*db, "one", {"cpp"}));
+    CHECK(db::add_general_note(*db, "two", {"cpp", "cache"}));
+    CHECK(db::add_prog_note(*db, "three", {}, {"/src/ink", "", "", ""}));
+    CHECK(completion::rebuild(*db));
+    CHECK(completions(db.path(), {"list", "#c"}) == "#cpp\n#cache\n");
+    // Logged since the rebuild: #cache now outweighs #cpp, and #core is new
+    CHECK(db::add_general_note(*db, "four", {"cache", "core"}));
+    CHECK(db::add_general_note(*db, "five", {"cache"}));
+    CHECK(completions(db.path(), {"list", "#c"}) == "#cache\n#cpp\n#core\n");
+    CHECK(completions(db.path(), {"search", "/s"}) == "/src/ink\n");
+    CHECK(completions(db.path(), {"list", "/s"}).empty());
+    CHECK(completions(db.path(), {"se"}) == "search\nserve\n");
+    CHECK(completions(db.path(), {"list", "--format", "j"}) == "json\njsonl\n");
+}
+
+// The single number a query returns
+long long query_number(db::Database& db, const std::string& sql) {
+    db::Statement stmt = db.prepare(sql);
+    return stmt.step() ? stmt.column_int64(0) : -1;
+}
+
+// Piped bodies are stored once per content, listed by their head and
+// written back whole, whether they came from a pipe or a file
+void test_bodies() {
+    TempDatabase db, other;
+    std::string small;
+    for (int i = 1; i <= 8; ++i) small += i == 1 ? "Build failed\n" : "line " + std::to_string(i) + "\n";
+    int fds[2];
+    CHECK(pipe(fds) == 0 && write(fds[1], small.data(), small.size()) == static_cast<ssize_t>(small.size()));
+    close(fds[1]);
+    note_body::Spool piped;
+    CHECK(piped.read(fds[0]));
+    close(fds[0]);
+    CHECK(piped.size() == small.size() && piped.first_line() == "Build failed");
+    CHECK(db::add_general_note(*db, piped.first_line(), {"build"}, &piped));
+
+    // Larger than a chunk, from a file, twice
+    std::string large;
+    while (large.size() < 200000) large += "log line " + std::to_string(large.size()) + "\n";
+    std::FILE* file = std::tmpfile();
+    CHECK(file && std::fwrite(large.data(), 1, large.size(), file) == large.size() && std::fflush(file) == 0);
+    for (int copy = 0; copy < 2; ++copy) {
+        CHECK(lseek(fileno(file), 0, SEEK_SET) == 0);
+        note_body::Spool spooled;
+        CHECK(spooled.read(fileno(file)) && spooled.size() == large.size());
+        CHECK(db::add_general_note(*db, "big log", {}, &spooled));
+    }
+    std::fclose(file);
+    CHECK(query_number(*db, "SELECT COUNT(*) FROM blobs;") == 2);
+
+    std::ostringstream out;
+    CHECK(note_body::write(*db, 2, out) == static_cast<long long>(large.size()) && out.str() == large);
+    CHECK(note_body::write(*db, 99, out) == -1);
+
+    // The head leaves out the line that titles the note
+    out.str("");
+    db::NoteCursor listed = db::get_notes(*db, {1});
+    formatter::print_notes(listed, out);
+    std::string more = "  | ... " + std::to_string(small.size() - small.find("line 7")) + " more bytes (ink show 1)\n";
+    CHECK(out.str().find("> Build failed\n  | line 2\n") != std::string::npos && out.str().find(more) != std::string::npos);
+
+    CHECK(db::add_general_note(*other, "copied", {}));
+    {
+        db::Transaction txn(*other);
+        CHECK(note_body::copy(*db, 3, *other, 1) && txn.commit());
+    }
+    out.str("");
+    CHECK(note_body::write(*other, 1, out) == static_cast<long long>(large.size()) && out.str() == large);
+
+    // A blob goes with the last note using it
+    CHECK((*db).execute("DELETE FROM notes WHERE id = 2;") && query_number(*db, "SELECT COUNT(*) FROM blobs;") == 2);
+    CHECK((*db).execute("DELETE FROM notes WHERE id = 3;") && query_number(*db, "SELECT COUNT(*) FROM blobs;") == 1);
+}
+
+// Runs `args` through the server at `socket_path`, capturing what it prints.
+// False if nobody answered.
+bool forward_to(const std::string& socket_path, const std::vector<std::string>& args, int& code, std::string& out, std::string& err) {
+    std::ostringstream out_stream, err_stream;
+    std::streambuf* saved_out = std::cout.rdbuf(out_stream.rdbuf());
+    std::streambuf* saved_err = std::cerr.rdbuf(err_stream.rdbuf());
+    bool answered = server::forward(socket_path, args, "/", false, code);
+    std::cout.rdbuf(saved_out);
+    std::cerr.rdbuf(saved_err);
+    out = out_stream.str();
+    err = err_stream.str();
+    return answered;
+}
+
+// Commands sent to a running server save and read notes as they would
+// directly, with their output, errors and exit codes passed back, however
+// long the output
+void test_daemon() {
+    CHECK(server::should_forward({"ink", "list"}));
+    CHECK(!server::should_forward({"ink", "import", "notes.jsonl"}));
+    CHECK(!server::should_forward({"ink", "p", "-", "#build"}));
+    setenv("INK_NO_DAEMON", "1", 1);
+    CHECK(!server::should_forward({"ink", "list"}));
+    unsetenv("INK_NO_DAEMON");
+
+    TempDatabase db;
+    const std::string socket_path = db::sidecar_path(db.path(), ".sock");
+    int code = -1;
+    std::string out, err;
+    CHECK(!forward_to(socket_path, {"ink", "list"}, code, out, err));
+
+    // Enough text to take several reply chunks
+    std::string long_text(1000, 'x');
+    for (int i = 0; i < 200; ++i) CHECK(add_note_at(*db, "2024-01-01 10:00:00", long_text + std::to_string(i)));
+
+    pid_t child = fork();
+    if (child == 0) {
+        std::freopen("/dev/null", "w", stdout);
+        _exit(server::serve(db.path(), socket_path));
+    }
+    bool up = false;
+    for (int tries = 0; tries < 100 && !(up = forward_to(socket_path, {"ink", "list", "--limit", "1"}, code, out, err)); ++tries) usleep(50000);
+    CHECK(up);
+
+    CHECK(forward_to(socket_path, {"ink", "saved through the server", "#daemon"}, code, out, err));
+    CHECK(code == 0 && out.find("Ink captured!") != std::string::npos && err.empty());
+    CHECK(forward_to(socket_path, {"ink", "list", "#daemon"}, code, out, err));
+    CHECK(code == 0 && out.find("> saved through the server\n") != std::string::npos);
+    CHECK(forward_to(socket_path, {"ink", "list", "--limit", "500"}, code, out, err));
+    CHECK(code == 0 && out.size() > 200 * long_text.size() && out.find(long_text + "199\n") != std::string::npos);
+    CHECK(forward_to(socket_path, {"ink", "similar", "999"}, code, out, err));
+    CHECK(code == 1 && err == "Error: No note with id 999.\n");
+
+    kill(child, SIGTERM);
+    int status = 0;
+    CHECK(waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(db::get_total_notes_count(*db) == 201);
+}
+
+// Writes a file under `root`, making its directories, modified `age`
+// seconds ago
+void write_aged(const fs::path& root, const std::string& rel, const std::string& text, int age) {
+    fs::create_directories((root / rel).parent_path());
+    std::ofstream(root / rel) << text;
+    fs::last_write_time(root / rel, fs::file_time_type::clock::now() - std::chrono::seconds(age));
+}
+
+// The scan finds the newest file, leaving out skipped and gitignored
+// directories and anything past the depth limit
+void test_file_scanner() {
+    TempDatabase db;
+    const fs::path root = db::sidecar_path(db.path(), ".scan");
+    write_aged(root, "a.txt", "", 100);
+    write_aged(root, "src/deep/b.cpp", "", 50);
+    write_aged(root, "logs/keep.log", "", 60);
+    write_aged(root, "logs/noise.log", "", 5);
+    write_aged(root, "build/out.o", "", 10);
+    write_aged(root, "node_modules/x.js", "", 1);
+    write_aged(root, ".gitignore", "build/\n*.log\n!keep.log\n", 200);
+
+    ScanOptions options;
+    options.threads = 2;
+    ScanResult result = scanner::find_last_edited_file(root.string(), options);
+    CHECK(result.path == "src/deep/b.cpp" && result.complete && result.mtime_ns > 0);
+    CHECK(result.files_seen >= 4);
+
+    options.max_depth = 1;
+    CHECK(scanner::find_last_edited_file(root.string(), options).path == "logs/keep.log");
+    options.max_depth = 32;
+    options.use_gitignore = false;
+    CHECK(scanner::find_last_edited_file(root.string(), options).path == "logs/noise.log");
+    options.skip_dirs.clear();
+    CHECK(scanner::find_last_edited_file(root.string(), options).path == "node_modules/x.js");
+    CHECK(scanner::find_last_edited_file((root / "missing").string(), options).path.empty());
+
+    setenv("INK_SCAN_SKIP", "src", 1);
+    setenv("INK_SCAN_MAX_DEPTH", "5", 1);
+    ScanOptions from_env = scanner::options_from_env();
+    unsetenv("INK_SCAN_SKIP");
+    unsetenv("INK_SCAN_MAX_DEPTH");
+    CHECK(from_env.max_depth == 5 && std::count(from_env.skip_dirs.begin(), from_env.skip_dirs.end(), "src") == 1);
+    CHECK(scanner::find_last_edited_file(root.string(), from_env).path == "logs/keep.log");
+    fs::remove_all(root);
+}
+
+// HEAD resolves to a branch and commit straight from the files git keeps:
+// loose refs, packed refs, detached and unborn heads, and worktrees
+void test_git_resolver() {
+    TempDatabase db;
+    const fs::path root = db::sidecar_path(db.path(), ".repo");
+    const std::string main_hash(40, 'a'), feature_hash(40, 'b'), detached_hash(40, 'c');
+    auto put = [&](const std::string& rel, const std::string& text) { write_aged(root, rel, text, 0); };
+    CHECK(!git::resolve(root).found);
+
+    put(".git/HEAD", "ref: refs/heads/main\n");
+    put(".git/refs/heads/main", main_hash + "\n");
+    put(".git/packed-refs", "# pack-refs with: peeled\n" + feature_hash + " refs/heads/feature\n^" + detached_hash + "\n");
+    fs::create_directories(root / "src" / "deep");
+    GitInfo info = git::resolve(root / "src" / "deep");
+    CHECK(info.found && info.resolved && info.branch == "main" && info.commit_hash == main_hash);
+
+    put(".git/HEAD", "ref: refs/heads/feature\n");
+    info = git::resolve(root);
+    CHECK(info.resolved && info.branch == "feature" && info.commit_hash == feature_hash);
+    put(".git/HEAD", detached_hash + "\n");
+    info = git::resolve(root);
+    CHECK(info.resolved && info.branch == "HEAD" && info.commit_hash == detached_hash);
+    put(".git/HEAD", "ref: refs/heads/fresh\n");
+    info = git::resolve(root);
+    CHECK(info.resolved && info.branch == "fresh" && info.commit_hash.empty());
+
+    // A linked worktree keeps its own HEAD and shares the main refs
+    put(".git/worktrees/wt/HEAD", "ref: refs/heads/main\n");
+    put(".git/worktrees/wt/commondir", "../..\n");
+    put("wt/.git", "gitdir: " + (root / ".git" / "worktrees" / "wt").string() + "\n");
+    info = git::resolve(root / "wt");
+    CHECK(info.resolved && info.branch == "main" && info.commit_hash == main_hash);
+
+    fs::create_directories(root / ".git" / "reftable");
+    info = git::resolve(root);
+    CHECK(info.found && !info.resolved);
+    fs::remove_all(root);
+}
+
+// Each machine format escapes exactly what would break its framing
+std::string formatted(db::Database& db, formatter::Format format) {
+    std::ostringstream out;
+    db::NoteCursor notes = db::get_notes(db, {1});
+    formatter::print_notes(notes, out, false, format);
+    return out.str();
+}
+
+void test_formatter() {
+    TempDatabase db;
+    const std::string text = "say \"hi\"\tC:\\tmp\nnext\r\x01";
+    CHECK(db::add_prog_note(*db, text, {"cpp"}, {"/src/ink", "main.cpp", "main", ""}));
+
+    std::string json = formatted(*db, formatter::Format::Json);
+    CHECK(json.rfind("[\n{\"id\":1,\"type\":\"programming\",", 0) == 0 && json.size() > 4 && json.compare(json.size() - 4, 4, "}\n]\n") == 0);
+    CHECK(json.find(R"("tags":["cpp"],"text":"say \"hi\"\tC:\\tmp\nnext\r\u0001")") != std::string::npos);
+    CHECK(json.find(R"("directory":"/src/ink","last_edited_file":"main.cpp","git_branch":"main")") != std::string::npos);
+    std::string jsonl = formatted(*db, formatter::Format::Jsonl);
+    CHECK(std::count(jsonl.begin(), jsonl.end(), '\n') == 1 && jsonl.rfind("{\"id\":1,", 0) == 0 && jsonl.back() == '\n');
+
+    std::string fields = "\tprogramming\tcpp\t/src/ink\tmain.cpp\tmain\t";
+    std::string tsv = formatted(*db, formatter::Format::Tsv);
+    CHECK(tsv.rfind("1\t", 0) == 0 && tsv.find(fields + "say \"hi\"\\tC:\\\\tmp\\nnext\\r\x01\n") != std::string::npos);
+    CHECK(std::count(tsv.begin(), tsv.end(), '\n') == 1 && std::count(tsv.begin(), tsv.end(), '\t') == 7);
+    std::string nul = formatted(*db, formatter::Format::Nul);
+    CHECK(nul.find(fields + "say \"hi\"\\tC:\\\\tmp\nnext\r\x01" + std::string(1, '\0')) != std::string::npos);
+    CHECK(nul.back() == '\0' && std::count(nul.begin(), nul.end(), '\0') == 1);
+
+    std::ostringstream out;
+    db::NoteCursor none = db::get_notes(*db, {99});
+    formatter::print_notes(none, out, false, formatter::Format::Json);
+    CHECK(out.str() == "[]\n");
+    formatter::Format format;
+    CHECK(formatter::parse_format("nul", format) && format == formatter::Format::Nul && !formatter::parse_format("xml", format));
+}
+
+// Tasks run side by side on their own query-only connections, which each
+// worker keeps between runs; a file that can't be read fails the run but
+// not the other tasks, and merged results match the single-thread ones
+void test_query_executor() {
+    TempDatabase db;
+    CHECK(add_note_at(*db, "2020-03-01 10:00:00", "archived note"));
+    CHECK(db::add_general_note(*db, "one", {"cpp"}));
+    CHECK(db::add_general_note(*db, "two", {"cpp"}));
+
+    query_executor::Executor executor(3);
+    std::atomic<int> arrived{0};
+    std::vector<long long> counts(3, -1);
+    std::vector<const db::Database*> connections(3, nullptr);
+    std::vector<query_executor::Task> tasks;
+    for (size_t i = 0; i < 3; ++i) {
+        tasks.push_back({db.path(), [&, i](db::Database& reader) {
+            // Every task waits for the others, so they only finish if all run at once
+            ++arrived;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (arrived < 3 && std::chrono::steady_clock::now() < deadline) std::this_thread::yield();
+            counts[i] = arrived == 3 && query_number(reader, "PRAGMA query_only;") == 1 ? query_number(reader, "SELECT COUNT(*) FROM notes;") : -1;
+            connections[i] = &reader;
+        }});
+    }
+    CHECK(executor.run(tasks) && counts == std::vector<long long>(3, 3));
+    CHECK(connections[0] != connections[1] && connections[1] != connections[2] && connections[0] != &*db);
+
+    query_executor::Executor single(1);
+    std::vector<const db::Database*> reused;
+    std::vector<query_executor::Task> repeat{{db.path(), [&](db::Database& reader) { reused.push_back(&reader); }}};
+    CHECK(single.run(repeat) && single.run(repeat) && reused.size() == 2 && reused[0] == reused[1]);
+    bool ran = false;
+    std::vector<query_executor::Task> broken{{db::sidecar_path(db.path(), ".missing.db"), [](db::Database&) {}},
+                                             {db.path(), [&](db::Database&) { ran = true; }}};
+    CHECK(!executor.run(broken) && ran);
+    std::vector<query_executor::Task> empty;
+    CHECK(executor.run(empty));
+
+    // Archives are read on the shared executor's threads when there are any
+    std::ostringstream out;
+    CHECK(archive::archive_notes(*db, "2021-01-01 00:00:00", out) == 1);
+    query_executor::Executor* shared = query_executor::shared();
+    const size_t threads = shared ? shared->threads() : 1;
+    std::ostringstream inline_stats, split_stats;
+    query_executor::set_threads(1);
+    stats::print_stats(stats::gather_stats(*db), inline_stats, formatter::Format::Json);
+    query_executor::set_threads(4);
+    stats::print_stats(stats::gather_stats(*db), split_stats, formatter::Format::Json);
+    query_executor::set_threads(threads);
+    CHECK(split_stats.str() == inline_stats.str() && inline_stats.str().find("\"total_notes\":3,") != std::string::npos);
+}
+
+const std::vector<Test> TESTS = {
+    {"notes_round_trip", test_notes_round_trip},
+    {"tag_queries", test_tag_queries},
+    {"search", test_search},
+    {"stats", test_stats},
+    {"timestamps", test_timestamps},
+    {"query_plans", test_query_plans},
+    {"sync", test_sync},
+    {"completion_log", test_completion_log},
+    {"import", test_import},
+    {"archive", test_archive},
+    {"fuzzy", test_fuzzy},
+    {"similar", test_similar},
+    {"completion", test_completion},
+    {"bodies", test_bodies},
+    {"daemon", test_daemon},
+    {"file_scanner", test_file_scanner},
+    {"git_resolver", test_git_resolver},
+    {"formatter", test_formatter},
+    {"query_executor", test_query_executor},
+};
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> wanted(argv + 1, argv + argc);
+    int ran = 0;
+    for (const auto& test : TESTS) {
+        if (!wanted.empty() && std::find(wanted.begin(), wanted.end(), test.name) == wanted.end()) continue;
+        int before = failures;
+        test.run();
+        ++ran;
+        std::cout << (failures == before ? "ok   " : "FAIL ") << test.name << std::endl;
+    }
+    if (ran == 0) {
+        std::cerr << "No tests matched." << std::endl;
+        return 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -1,12 +1,15 @@
 #include "metadata_collector.hpp"
+#include "file_scanner.hpp"
+#include "git_resolver.hpp"
+#include "trace.hpp"
 #include <iostream>
 #include <cstdio>
 #include <memory>
 #include <stdexcept>
 #include <array>
 #include <filesystem>
-#include <algorithm>  
-#include <chrono>
+#include <future>
+#include <thread>
 
 // Define the namespace alias for convenience
 namespace fs = std::filesystem;
@@ -32,45 +35,32 @@ std::string exec(const char* cmd) {
     return result;
 }
 
+// Wraps a string in single quotes for use as one shell word.
+std::string shell_quote(const std::string& value) {
+    std::string quoted = "'";
+    for (char c : value) {
+        if (c == '\'') quoted += "'\\''";
+        else quoted += c;
+    }
+    return quoted + "'";
+}
+
 // Finds the most recently edited file in the current directory (recursively).
+// The scan is bounded in time and depth, so in a huge tree this is the best
+// candidate found within the budget.
 std::string get_last_edited_file(const fs::path& directory) {
-    fs::file_time_type latest_time;
-    fs::path latest_file_path;
-    bool has_found_file = false;
-
-    try {
-        // Iterate through all files and subdirectories
-        for (const auto& entry : fs::recursive_directory_iterator(directory, fs::directory_options::skip_permission_denied)) {
-            // Ignore directories, symlinks, and anything inside a .git folder
-            if (entry.is_regular_file() && entry.path().string().find(".git") == std::string::npos) {
-                if (!has_found_file) {
-                    latest_time = entry.last_write_time();
-                    latest_file_path = entry.path();
-                    has_found_file = true;
-                } else {
-                    if (entry.last_write_time() > latest_time) {
-                        latest_time = entry.last_write_time();
-                        latest_file_path = entry.path();
-                    }
-                }
-            }
-        }
-    } catch (const fs::filesystem_error& e) {
-        // This can happen if a directory is deleted while we are scanning it
-        std::cerr << "Filesystem error while scanning: " << e.what() << std::endl;
+    trace::Scope scope("scan_last_edited");
+    ScanResult result = scanner::find_last_edited_file(directory.string(), scanner::options_from_env());
+    scope.arg("files_seen", result.files_seen);
+    if (result.path.empty()) {
         return "N/A";
     }
 
-    if (!has_found_file) {
-        return "N/A";
-    }
-    
     // Return just the filename part of the path
-    return latest_file_path.filename().string();
+    return fs::path(result.path).filename().string();
 }
 
 ProgMetadata collect_metadata() {
-    ProgMetadata data;
     fs::path current_path;
 
     try {
@@ -78,19 +68,42 @@ ProgMetadata collect_metadata() {
     } catch(const fs::filesystem_error& e) {
         std::cerr << "Error getting current path: " << e.what() << std::endl;
         // Return empty metadata if we can't even get the path
-        return data;
+        return ProgMetadata();
     }
-    
+    return collect_metadata(current_path);
+}
+
+ProgMetadata collect_metadata(const fs::path& current_path) {
+    INK_TRACE_SCOPE("collect_metadata");
+    ProgMetadata data;
+
     // 1. Get current working directory
     data.current_directory = current_path.string();
 
-    // 2. Check if we are in a Git repository
-    if (fs::exists(current_path / ".git")) {
-        data.git_branch = exec("git rev-parse --abbrev-ref HEAD");
-        data.git_commit_hash = exec("git rev-parse HEAD");
-    } else {
+    // 2. Check if we are in a Git repository. HEAD is read straight from the
+    // .git directory; the git CLI is only a fallback for layouts we can't parse.
+    GitInfo git_info;
+    {
+        INK_TRACE_SCOPE("git_resolve");
+        git_info = git::resolve(current_path);
+    }
+    if (!git_info.found) {
         data.git_branch = "N/A";
         data.git_commit_hash = "N/A";
+    } else if (git_info.resolved) {
+        data.git_branch = git_info.branch;
+        data.git_commit_hash = git_info.commit_hash.empty() ? "N/A" : git_info.commit_hash;
+    } else {
+        INK_TRACE_SCOPE("git_cli");
+        try {
+            std::string git = "git -C " + shell_quote(current_path.string());
+            data.git_branch = exec((git + " rev-parse --abbrev-ref HEAD 2>/dev/null").c_str());
+            data.git_commit_hash = exec((git + " rev-parse HEAD 2>/dev/null").c_str());
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error running git: " << e.what() << std::endl;
+        }
+        if (data.git_branch.empty()) data.git_branch = "N/A";
+        if (data.git_commit_hash.empty()) data.git_commit_hash = "N/A";
     }
 
     // 3. Get last edited file
@@ -99,4 +112,15 @@ ProgMetadata collect_metadata() {
     return data;
 }
 
+bool collect_metadata_within(const fs::path& current_path, std::chrono::milliseconds timeout, ProgMetadata& data) {
+    // A packaged_task's future, unlike std::async's, doesn't block in its
+    // destructor, so a hung git call can't hold up the caller
+    auto task = std::make_shared<std::packaged_task<ProgMetadata()>>([current_path] { return collect_metadata(current_path); });
+    std::future<ProgMetadata> result = task->get_future();
+    std::thread([task] { (*task)(); }).detach();
+    if (result.wait_for(timeout) != std::future_status::ready) return false;
+    data = result.get();
+    return true;
+}
+
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define METADATA_COLLECTOR_HPP
 
 #include <string>
+#include <chrono>
+#include <filesystem>
 
 // A struct to hold all the metadata for a programming note.
 struct ProgMetadata {
@@ -14,6 +16,11 @@ struct ProgMetadata {
 namespace metadata {
     // Collects all relevant metadata from the current environment.
     ProgMetadata collect_metadata();
+    // Same, for a given working directory (used when serving other processes).
+    ProgMetadata collect_metadata(const std::filesystem::path& current_path);
+    // Same, but gives up after `timeout` and returns false. A collection that
+    // overruns keeps going on a detached thread and its result is dropped.
+    bool collect_metadata_within(const std::filesystem::path& current_path, std::chrono::milliseconds timeout, ProgMetadata& data);
 }
 
 #endif
\ No newline at end of file
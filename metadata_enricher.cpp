@@ -0,0 +1,103 @@
+#include "metadata_enricher.hpp"
+#include "database.hpp"
+#include "metadata_collector.hpp"
+#include "trace.hpp"
+#include <iostream>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace enricher {
+
+bool read_note_id(int fd, long long& note_id) {
+    char* buffer = reinterpret_cast<char*>(&note_id);
+    size_t got = 0;
+    while (got < sizeof(note_id)) {
+        ssize_t n = read(fd, buffer + got, sizeof(note_id) - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        got += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+[[noreturn]] void run_child(int id_fd, const std::string& db_path, const std::filesystem::path& cwd) {
+    // Leave the terminal's session, so the shell doesn't wait on us and
+    // Ctrl-C at the prompt doesn't reach us
+    setsid();
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if (null_fd > STDERR_FILENO) close(null_fd);
+    }
+    trace::active = false;
+
+    ProgMetadata metadata;
+    bool collected = metadata::collect_metadata_within(cwd, TIMEOUT, metadata);
+
+    long long note_id = -1;
+    if (read_note_id(id_fd, note_id)) {
+        db::Database db(db_path);
+        if (db.is_open()) {
+            if (collected) db::enrich_metadata(db, note_id, metadata);
+            else db::expire_enrichment(db, note_id);
+            db::expire_stale_enrichments(db);
+        }
+    }
+    // Skip static destructors; a timed-out collection may still be running
+    _exit(0);
+}
+
+bool Enricher::start(const std::string& db_path, const std::filesystem::path& cwd) {
+    // A socket rather than a pipe, so a child that died can't take the
+    // parent down with SIGPIPE
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return false;
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fds[1], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    // Anything still buffered would otherwise be printed by both processes
+    std::cout.flush();
+    std::cerr.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[1]);
+        run_child(fds[0], db_path, cwd);
+    }
+    close(fds[0]);
+    socket_fd_ = fds[1];
+    return true;
+}
+
+void Enricher::hand_off(long long note_id) {
+    if (socket_fd_ < 0) return;
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+    const char* buffer = reinterpret_cast<const char*>(&note_id);
+    size_t sent = 0;
+    while (sent < sizeof(note_id)) {
+        ssize_t n = send(socket_fd_, buffer + sent, sizeof(note_id) - sent, flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        sent += static_cast<size_t>(n);
+    }
+    close(socket_fd_);
+    socket_fd_ = -1;
+}
+
+Enricher::~Enricher() {
+    if (socket_fd_ >= 0) close(socket_fd_);
+}
+
+}
@@ -0,0 +1,37 @@
+#ifndef METADATA_ENRICHER_HPP
+#define METADATA_ENRICHER_HPP
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+// Fills in a programming note's git and file details after `ink p` has
+// saved it, so capturing a note never waits on git or a directory scan.
+namespace enricher {
+    // How long collection may run before the note is marked timed out.
+    const std::chrono::milliseconds TIMEOUT{5000};
+
+    // A forked child that starts collecting as soon as it is spawned, in
+    // parallel with the parent opening the database and saving the note.
+    // Once handed the note id it writes the metadata and exits on its own,
+    // usually after the parent has already returned to the shell.
+    class Enricher {
+    public:
+        Enricher() = default;
+        ~Enricher();
+        Enricher(const Enricher&) = delete;
+        Enricher& operator=(const Enricher&) = delete;
+
+        // Forks the child. Returns false if it couldn't; the caller should
+        // then collect the metadata itself.
+        bool start(const std::string& db_path, const std::filesystem::path& cwd);
+        // Tells the child which note to fill in. Without it the child exits
+        // when this object goes away.
+        void hand_off(long long note_id);
+
+    private:
+        int socket_fd_ = -1; // Our end of the channel to the child
+    };
+}
+
+#endif
@@ -0,0 +1,310 @@
+#include "note_body.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace note_body {
+
+// Bytes per read or write, on the way in and on the way out
+const size_t CHUNK_BYTES = 1 << 16;
+// How much of a body a listing shows
+const size_t HEAD_BYTES = 512;
+const int HEAD_LINES = 6;
+// Longest title taken from a body's first line
+const size_t TITLE_BYTES = 120;
+
+// --- SPOOLING ---
+// Eight bytes per multiply, with a shift after each so high bits reach the
+// low ones, then the splitmix64 finalizer. Fed a chunk at a time; bytes left
+// over from one chunk wait for the next. Only narrows the candidates a body
+// is compared with, so it needn't resist crafted collisions.
+struct Hasher {
+    uint64_t state = 14695981039346656037ULL;
+    unsigned char pending[8];
+    size_t pending_size = 0;
+
+    void mix(const unsigned char* word) {
+        uint64_t value;
+        std::memcpy(&value, word, sizeof(value));
+        state = (state ^ value) * 0x9e3779b97f4a7c15ULL;
+        state ^= state >> 29;
+    }
+
+    void add(const char* data, size_t length) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        if (pending_size > 0) {
+            size_t taken = std::min(length, sizeof(pending) - pending_size);
+            std::memcpy(pending + pending_size, bytes, taken);
+            pending_size += taken;
+            bytes += taken;
+            length -= taken;
+            if (pending_size < sizeof(pending)) return;
+            mix(pending);
+            pending_size = 0;
+        }
+        for (; length >= sizeof(pending); bytes += sizeof(pending), length -= sizeof(pending)) mix(bytes);
+        std::memcpy(pending, bytes, length);
+        pending_size += length;
+    }
+
+    uint64_t finish() {
+        std::memset(pending + pending_size, 0, sizeof(pending) - pending_size);
+        mix(pending);
+        uint64_t hash = state;
+        hash ^= hash >> 30;
+        hash *= 0xbf58476d1ce4e5b9ULL;
+        hash ^= hash >> 27;
+        hash *= 0x94d049bb133111ebULL;
+        hash ^= hash >> 31;
+        return hash;
+    }
+};
+
+// Drops a UTF-8 sequence cut short at the end of `text`
+void trim_partial_utf8(std::string& text) {
+    size_t lead = text.size();
+    while (lead > 0 && text.size() - lead < 3 && (static_cast<unsigned char>(text[lead - 1]) & 0xC0) == 0x80) --lead;
+    if (lead == 0) return;
+    unsigned char c = static_cast<unsigned char>(text[lead - 1]);
+    size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    if (lead - 1 + length > text.size()) text.resize(lead - 1);
+}
+
+bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+Spool::~Spool() {
+    if (owned_) close(fd_);
+}
+
+bool Spool::read(int fd) {
+    INK_TRACE_SCOPE("spool_body");
+    // A regular file can be read again in place; anything else is copied
+    struct stat info;
+    off_t start = -1;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) start = lseek(fd, 0, SEEK_CUR);
+    if (start >= 0) {
+        fd_ = fd;
+        start_ = static_cast<uint64_t>(start);
+    } else {
+        std::FILE* file = std::tmpfile();
+        fd_ = file ? dup(fileno(file)) : -1;
+        if (file) std::fclose(file); // The duplicate keeps the unlinked file open
+        if (fd_ < 0) {
+            std::cerr << "Error: Could not create a temporary file: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        owned_ = true;
+    }
+
+    Hasher hasher;
+    std::vector<char> chunk(CHUNK_BYTES);
+    while (true) {
+        ssize_t got = ::read(fd, chunk.data(), chunk.size());
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            std::cerr << "Error: Could not read the note: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (got == 0) break;
+        hasher.add(chunk.data(), static_cast<size_t>(got));
+        if (head_.size() < HEAD_BYTES) head_.append(chunk.data(), std::min(static_cast<size_t>(got), HEAD_BYTES - head_.size()));
+        if (owned_ && !write_all(fd_, chunk.data(), static_cast<size_t>(got))) {
+            std::cerr << "Error: Could not spool the note: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        size_ += static_cast<uint64_t>(got);
+    }
+    hash_ = hasher.finish();
+
+    size_t end = 0;
+    for (int line = 0; line < HEAD_LINES && end < head_.size(); ++line) {
+        size_t newline = head_.find('\n', end);
+        end = newline == std::string::npos ? head_.size() : newline + 1;
+    }
+    head_.resize(end);
+    trim_partial_utf8(head_);
+    return true;
+}
+
+std::string Spool::first_line() const {
+    std::string_view rest = head_;
+    while (!rest.empty()) {
+        size_t newline = rest.find('\n');
+        std::string_view line = rest.substr(0, newline);
+        rest = newline == std::string_view::npos ? std::string_view() : rest.substr(newline + 1);
+        size_t first = line.find_first_not_of(" \t\r\f\v");
+        if (first == std::string_view::npos) continue;
+        line = line.substr(first, line.find_last_not_of(" \t\r\f\v") - first + 1);
+        std::string title(line.substr(0, TITLE_BYTES));
+        trim_partial_utf8(title);
+        return title;
+    }
+    return "";
+}
+
+bool Spool::read_at(uint64_t offset, char* data, size_t length) const {
+    while (length > 0) {
+        ssize_t got = pread(fd_, data, length, static_cast<off_t>(start_ + offset));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        data += got;
+        offset += static_cast<uint64_t>(got);
+        length -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+// --- STORING ---
+const std::string FIND_BLOBS_SQL = "SELECT id FROM blobs WHERE hash = ? AND size = ?;";
+const std::string INSERT_BLOB_SQL = "INSERT INTO blobs (hash, size, head, data) VALUES (?, ?, ?, zeroblob(?));";
+const std::string INSERT_NOTE_BODY_SQL = "INSERT INTO note_bodies (note_id, blob_id) VALUES (?, ?);";
+const std::string SELECT_NOTE_BLOB_SQL = "SELECT b.id, b.hash, b.size, b.head FROM note_bodies nb JOIN blobs b ON b.id = nb.blob_id WHERE nb.note_id = ?;";
+
+// Reads `length` bytes at `offset` of a body being stored
+using Reader = std::function<bool(uint64_t offset, char* data, size_t length)>;
+
+// An incremental I/O handle on one blob's data, closed on scope exit
+class BlobHandle {
+public:
+    BlobHandle(db::Database& db, long long blob_id, bool writable) {
+        if (sqlite3_blob_open(db.handle(), "main", "blobs", "data", blob_id, writable ? 1 : 0, &blob_) != SQLITE_OK) {
+            std::cerr << "SQL error: " << sqlite3_errmsg(db.handle()) << std::endl;
+            blob_ = nullptr;
+        }
+    }
+    ~BlobHandle() {
+        if (blob_) sqlite3_blob_close(blob_);
+    }
+    BlobHandle(const BlobHandle&) = delete;
+    BlobHandle& operator=(const BlobHandle&) = delete;
+
+    bool ok() const { return blob_ != nullptr; }
+    // Blobs stay under SQLite's length limit, so offsets fit an int
+    bool read(uint64_t offset, char* data, size_t length) {
+        return sqlite3_blob_read(blob_, data, static_cast<int>(length), static_cast<int>(offset)) == SQLITE_OK;
+    }
+    bool write(uint64_t offset, const char* data, size_t length) {
+        return sqlite3_blob_write(blob_, data, static_cast<int>(length), static_cast<int>(offset)) == SQLITE_OK;
+    }
+
+private:
+    sqlite3_blob* blob_ = nullptr;
+};
+
+bool same_content(db::Database& db, long long blob_id, uint64_t size, const Reader& read) {
+    BlobHandle blob(db, blob_id, false);
+    if (!blob.ok()) return false;
+    std::vector<char> ours(CHUNK_BYTES), theirs(CHUNK_BYTES);
+    for (uint64_t offset = 0; offset < size; offset += CHUNK_BYTES) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(CHUNK_BYTES, size - offset));
+        if (!read(offset, ours.data(), length) || !blob.read(offset, theirs.data(), length)) return false;
+        if (std::memcmp(ours.data(), theirs.data(), length) != 0) return false;
+    }
+    return true;
+}
+
+// The id of a blob holding this body, written in chunks if no equal one is
+// stored yet, or -1
+long long store(db::Database& db, uint64_t hash, uint64_t size, const std::string& head, const Reader& read) {
+    INK_TRACE_SCOPE("store_body");
+    std::vector<long long> candidates;
+    {
+        db::Statement find = db.prepare(FIND_BLOBS_SQL);
+        find.bind(1, static_cast<long long>(hash)).bind(2, static_cast<long long>(size));
+        while (find.step()) candidates.push_back(find.column_int64(0));
+    }
+    for (long long id : candidates) {
+        if (same_content(db, id, size, read)) return id;
+    }
+
+    // The whole row, head and all, has to fit in SQLite's length limit
+    uint64_t limit = static_cast<uint64_t>(sqlite3_limit(db.handle(), SQLITE_LIMIT_LENGTH, -1));
+    if (size + head.size() + 64 > limit) {
+        std::cerr << "Error: The note is " << size << " bytes; at most " << limit - head.size() - 64 << " fit." << std::endl;
+        return -1;
+    }
+    db::Statement insert = db.prepare(INSERT_BLOB_SQL);
+    insert.bind(1, static_cast<long long>(hash)).bind(2, static_cast<long long>(size)).bind(3, head).bind(4, static_cast<long long>(size));
+    if (!insert.run()) return -1;
+    long long id = db.last_insert_rowid();
+    BlobHandle blob(db, id, true);
+    if (!blob.ok()) return -1;
+    std::vector<char> chunk(CHUNK_BYTES);
+    for (uint64_t offset = 0; offset < size; offset += CHUNK_BYTES) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(CHUNK_BYTES, size - offset));
+        if (!read(offset, chunk.data(), length) || !blob.write(offset, chunk.data(), length)) {
+            std::cerr << "Error: Could not store the note's body." << std::endl;
+            return -1;
+        }
+    }
+    return id;
+}
+
+bool attach(db::Database& db, long long note_id, const Spool& body) {
+    long long blob_id = store(db, body.hash(), body.size(), body.head(),
+                              [&](uint64_t offset, char* data, size_t length) { return body.read_at(offset, data, length); });
+    return blob_id >= 0 && db.prepare(INSERT_NOTE_BODY_SQL).bind(1, note_id).bind(2, blob_id).run();
+}
+
+bool copy(db::Database& from, long long from_note, db::Database& to, long long to_note) {
+    long long blob_id;
+    uint64_t hash, size;
+    std::string head;
+    {
+        db::Statement select = from.prepare(SELECT_NOTE_BLOB_SQL);
+        if (!select.bind(1, from_note).step()) return true;
+        blob_id = select.column_int64(0);
+        hash = static_cast<uint64_t>(select.column_int64(1));
+        size = static_cast<uint64_t>(select.column_int64(2));
+        head = select.column_text(3);
+    }
+    BlobHandle source(from, blob_id, false);
+    if (!source.ok()) return false;
+    long long copied = store(to, hash, size, head,
+                             [&](uint64_t offset, char* data, size_t length) { return source.read(offset, data, length); });
+    return copied >= 0 && to.prepare(INSERT_NOTE_BODY_SQL).bind(1, to_note).bind(2, copied).run();
+}
+
+// --- READING ---
+long long write(db::Database& db, long long note_id, std::ostream& out) {
+    INK_TRACE_SCOPE("write_body");
+    long long blob_id;
+    uint64_t size;
+    {
+        db::Statement select = db.prepare(SELECT_NOTE_BLOB_SQL);
+        if (!select.bind(1, note_id).step()) return -1;
+        blob_id = select.column_int64(0);
+        size = static_cast<uint64_t>(select.column_int64(2));
+    }
+    BlobHandle blob(db, blob_id, false);
+    if (!blob.ok()) return -1;
+    std::vector<char> chunk(CHUNK_BYTES);
+    uint64_t offset = 0;
+    // A consumer like `head` closing the pipe fails the stream; stop there
+    while (offset < size && out) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(CHUNK_BYTES, size - offset));
+        if (!blob.read(offset, chunk.data(), length)) return -1;
+        out.write(chunk.data(), static_cast<std::streamsize>(length));
+        offset += length;
+    }
+    out.flush();
+    return static_cast<long long>(offset);
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef NOTE_BODY_HPP
+#define NOTE_BODY_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "database.hpp"
+
+// Long bodies piped into a note, as in `make 2>&1 | ink p - #build`. The
+// input is read once into a spool (a temporary file, or stdin itself when
+// that is a regular file) and hashed on the way, so memory stays flat however
+// large it is and no write lock is held while the producer runs.
+//
+// Bodies live in `blobs`, one row per distinct content: a new body whose hash
+// and size match a stored one is compared with it byte for byte and, if
+// equal, shares it. Bodies go in and come back out in fixed-size chunks with
+// SQLite's incremental blob I/O. Each blob keeps its first few lines as a
+// head, which is all that listings read.
+namespace note_body {
+    class Spool {
+    public:
+        Spool() = default;
+        ~Spool();
+        Spool(const Spool&) = delete;
+        Spool& operator=(const Spool&) = delete;
+
+        // Reads `fd` to the end. False, with a message on stderr, on error.
+        bool read(int fd);
+
+        uint64_t size() const { return size_; }
+        uint64_t hash() const { return hash_; }
+        // The first few lines, as listings show them
+        const std::string& head() const { return head_; }
+        // The first line that isn't blank, shortened to fit a title
+        std::string first_line() const;
+        // Reads exactly `length` bytes starting at `offset`.
+        bool read_at(uint64_t offset, char* data, size_t length) const;
+
+    private:
+        int fd_ = -1;
+        bool owned_ = false; // The spool is a temporary file we close
+        uint64_t start_ = 0; // Where the body starts in fd_
+        uint64_t size_ = 0;
+        uint64_t hash_ = 0;
+        std::string head_;
+    };
+
+    // Stores a body, or finds it already stored, and links it to a note.
+    // Runs inside the caller's transaction.
+    bool attach(db::Database& db, long long note_id, const Spool& body);
+
+    // Gives `to_note` in another database the body of `from_note`, if it has
+    // one. Runs inside the caller's transaction on `to`.
+    bool copy(db::Database& from, long long from_note, db::Database& to, long long to_note);
+
+    // Writes a note's whole body to `out`. Returns the bytes written, or -1
+    // if the note has no body or it couldn't be read.
+    long long write(db::Database& db, long long note_id, std::ostream& out);
+}
+
+#endif
@@ -1,42 +1,285 @@
 #include "note_formatter.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
-#include <iomanip>
 
 namespace formatter {
 
-void print_notes(const std::vector<FullNote>& notes) {
-    if (notes.empty()) {
-        std::cout << "No notes found. 🐌" << std::endl;
+bool parse_format(const std::string& name, Format& format) {
+    if (name == "text") format = Format::Text;
+    else if (name == "json") format = Format::Json;
+    else if (name == "jsonl") format = Format::Jsonl;
+    else if (name == "tsv") format = Format::Tsv;
+    else if (name == "nul") format = Format::Nul;
+    else return false;
+    return true;
+}
+
+// --- OUTPUT BUFFER ---
+// Large enough that a page of notes goes out in a handful of writes
+const size_t BUFFER_BYTES = 64 * 1024;
+
+OutputBuffer::OutputBuffer(std::ostream& out) : out_(out) { buffer_.reserve(BUFFER_BYTES); }
+
+OutputBuffer::~OutputBuffer() { flush(); }
+
+void OutputBuffer::write_if_full() {
+    if (buffer_.size() < BUFFER_BYTES) return;
+    out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    buffer_.clear();
+}
+
+OutputBuffer& OutputBuffer::operator<<(std::string_view text) {
+    buffer_.append(text.data(), text.size());
+    write_if_full();
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::operator<<(char c) {
+    buffer_ += c;
+    write_if_full();
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::operator<<(long long number) {
+    char digits[24];
+    int length = std::snprintf(digits, sizeof(digits), "%lld", number);
+    return *this << std::string_view(digits, static_cast<size_t>(length));
+}
+
+void OutputBuffer::json_string(std::string_view text, bool null_if_empty) {
+    if (null_if_empty && text.empty()) {
+        *this << "null";
         return;
     }
+    buffer_ += '"';
+    for (char c : text) {
+        switch (c) {
+            case '"': buffer_ += "\\\""; break;
+            case '\\': buffer_ += "\\\\"; break;
+            case '\n': buffer_ += "\\n"; break;
+            case '\r': buffer_ += "\\r"; break;
+            case '\t': buffer_ += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    buffer_ += escaped;
+                } else {
+                    buffer_ += c;
+                }
+        }
+    }
+    buffer_ += '"';
+    write_if_full();
+}
 
-    std::cout << "--- 🐌 Den Den Ink Found " << notes.size() << " Note(s) ---" << std::endl;
+void OutputBuffer::record_field(std::string_view text, Format format) {
+    for (char c : text) {
+        switch (c) {
+            case '\\': buffer_ += "\\\\"; break;
+            case '\t': buffer_ += "\\t"; break;
+            case '\0': buffer_ += "\\0"; break;
+            case '\n': buffer_ += format == Format::Nul ? "\n" : "\\n"; break;
+            case '\r': buffer_ += format == Format::Nul ? "\r" : "\\r"; break;
+            default: buffer_ += c;
+        }
+    }
+    write_if_full();
+}
 
-    for (const auto& note : notes) {
-        std::cout << "\n----------------------------------------" << std::endl;
-        std::cout << "ID:        " << note.id << std::endl;
-        std::cout << "Type:      " << note.type << std::endl;
-        std::cout << "Created:   " << note.timestamp << std::endl;
-        
-        if (!note.tags.empty()) {
-            std::cout << "Tags:      ";
-            for (const auto& tag : note.tags) {
-                std::cout << "#" << tag << " ";
-            }
-            std::cout << std::endl;
+void OutputBuffer::flush() {
+    if (!buffer_.empty()) {
+        out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+    }
+    out_.flush();
+}
+
+// --- TEXT ---
+// Swaps the search highlight markers for bold text, or drops them when the
+// output isn't going to a terminal.
+void write_snippet(OutputBuffer& out, std::string_view snippet, bool highlight) {
+    size_t start = 0;
+    for (size_t i = 0; i < snippet.size(); ++i) {
+        char c = snippet[i];
+        if (c != SNIPPET_BEGIN[0] && c != SNIPPET_END[0]) continue;
+        out << snippet.substr(start, i - start);
+        if (highlight) out << (c == SNIPPET_BEGIN[0] ? "\033[1m" : "\033[0m");
+        start = i + 1;
+    }
+    out << snippet.substr(start);
+}
+
+// The stored head of a piped body, and how much more `ink show` would print.
+// A first line that titled the note isn't repeated.
+void print_body_head(const db::NoteView& note, OutputBuffer& out) {
+    std::string_view head = note.body_head;
+    bool first = true;
+    while (!head.empty()) {
+        size_t newline = head.find('\n');
+        std::string_view line = head.substr(0, newline);
+        head = newline == std::string_view::npos ? std::string_view() : head.substr(newline + 1);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (!(first && line == note.text)) out << "  | " << line << '\n';
+        first = false;
+    }
+    long long more = note.body_size - static_cast<long long>(note.body_head.size());
+    if (more > 0) out << "  | ... " << more << " more bytes (ink show " << note.id << ")\n";
+}
+
+void print_note(const db::NoteView& note, OutputBuffer& out, bool highlight) {
+    out << "\n----------------------------------------\n";
+    out << "ID:        " << note.id << '\n';
+    out << "Type:      " << note.type << '\n';
+    out << "Created:   " << note.timestamp << '\n';
+
+    if (!note.tags.empty()) {
+        out << "Tags:      ";
+        for (std::string_view tag : note.tags) {
+            out << '#' << tag << ' ';
+        }
+        out << '\n';
+    }
+
+    out << "\n> " << note.text << '\n';
+    if (note.body_size > 0) print_body_head(note, out);
+
+    // A snippet that is the whole text, with nothing marked, would only
+    // repeat it (a match on the directory, say)
+    bool marked = note.snippet.find(SNIPPET_BEGIN[0]) != std::string_view::npos;
+    if (!note.snippet.empty() && (marked || note.snippet.size() < note.text.size())) {
+        out << "  Match: ";
+        write_snippet(out, note.snippet, highlight);
+        out << '\n';
+    }
+
+    if (note.type == "programming") {
+        out << "\n  [Code Meta]\n";
+        out << "  Directory: " << note.current_directory << '\n';
+        // Empty while the note's metadata is still being collected
+        if (!note.git_branch.empty() && note.git_branch != "N/A") {
+            out << "  Git Branch: " << note.git_branch << '\n';
         }
+    }
+    out << "----------------------------------------\n";
+}
 
-        std::cout << "\n> " << note.text << std::endl;
+// --- MACHINE-READABLE ---
+// The search snippet without its highlight markers
+std::string plain_snippet(std::string_view snippet) {
+    std::string plain;
+    for (char c : snippet) {
+        if (c != SNIPPET_BEGIN[0] && c != SNIPPET_END[0]) plain += c;
+    }
+    return plain;
+}
 
-        if (note.type == "programming") {
-            std::cout << "\n  [Code Meta]" << std::endl;
-            std::cout << "  Directory: " << note.metadata.current_directory << std::endl;
-            if (note.metadata.git_branch != "N/A") {
-                std::cout << "  Git Branch: " << note.metadata.git_branch << std::endl;
+// {"id":1,"type":"programming","created":"...","tags":["a"],"text":"...",
+//  "body_bytes":1234,"body_head":"...",
+//  "directory":"...","last_edited_file":"...","git_branch":"...","match":"..."}
+// The body fields appear on notes with a piped body only, the code fields on
+// programming notes only, and "match" on search results.
+void print_json_note(const db::NoteView& note, OutputBuffer& out) {
+    out << "{\"id\":" << note.id << ",\"type\":";
+    out.json_string(note.type);
+    out << ",\"created\":";
+    out.json_string(note.timestamp);
+    out << ",\"tags\":[";
+    bool first = true;
+    for (std::string_view tag : note.tags) {
+        if (!first) out << ',';
+        out.json_string(tag);
+        first = false;
+    }
+    out << "],\"text\":";
+    out.json_string(note.text);
+    if (note.body_size > 0) {
+        out << ",\"body_bytes\":" << note.body_size << ",\"body_head\":";
+        out.json_string(note.body_head);
+    }
+    if (note.type == "programming") {
+        out << ",\"directory\":";
+        out.json_string(note.current_directory, true);
+        out << ",\"last_edited_file\":";
+        out.json_string(note.last_edited_file, true);
+        out << ",\"git_branch\":";
+        out.json_string(note.git_branch, true);
+    }
+    if (!note.snippet.empty()) {
+        out << ",\"match\":";
+        out.json_string(plain_snippet(note.snippet));
+    }
+    out << '}';
+}
+
+// id, created, type, tags (space separated), directory, last_edited_file,
+// git_branch, text
+void print_record(const db::NoteView& note, OutputBuffer& out, Format format) {
+    out << note.id << '\t';
+    out.record_field(note.timestamp, format);
+    out << '\t';
+    out.record_field(note.type, format);
+    out << '\t';
+    bool first = true;
+    for (std::string_view tag : note.tags) {
+        if (!first) out << ' ';
+        out.record_field(tag, format);
+        first = false;
+    }
+    for (std::string_view field : {note.current_directory, note.last_edited_file, note.git_branch, note.text}) {
+        out << '\t';
+        out.record_field(field, format);
+    }
+    out << (format == Format::Nul ? '\0' : '\n');
+}
+
+// Batches start small so the first notes show up as soon as they are found,
+// then grow to the cursor's usual size.
+const size_t FIRST_BATCH_ROWS = 8;
+const size_t MAX_BATCH_ROWS = 128;
+
+PrintSummary print_notes(db::NoteCursor& notes, std::ostream& out, bool highlight, Format format) {
+    trace::Scope scope("print_notes");
+    PrintSummary summary;
+    OutputBuffer buffer(out);
+    db::NoteBatch batch;
+    if (format == Format::Json) buffer << '[';
+    size_t batch_rows = FIRST_BATCH_ROWS;
+    // A consumer like `head` closing the pipe fails the stream; stop reading rows then
+    while (buffer.ok() && notes.next_batch(batch, batch_rows)) {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            db::NoteView note = batch[i];
+            switch (format) {
+                case Format::Text: print_note(note, buffer, highlight); break;
+                case Format::Json:
+                    buffer << (summary.count == 0 ? "\n" : ",\n");
+                    print_json_note(note, buffer);
+                    break;
+                case Format::Jsonl:
+                    print_json_note(note, buffer);
+                    buffer << '\n';
+                    break;
+                case Format::Tsv:
+                case Format::Nul: print_record(note, buffer, format); break;
             }
+            ++summary.count;
+            summary.last_id = note.id;
         }
-        std::cout << "----------------------------------------" << std::endl;
+        buffer.flush();
+        batch_rows = std::min(batch_rows * 4, MAX_BATCH_ROWS);
     }
+
+    if (format == Format::Json) {
+        buffer << (summary.count == 0 ? "]\n" : "\n]\n");
+    } else if (format == Format::Text && summary.count == 0) {
+        buffer << "No notes found. 🐌\n";
+    } else if (format == Format::Text) {
+        buffer << "\n--- 🐌 Den Den Ink Found " << static_cast<long long>(summary.count) << " Note(s) ---\n";
+    }
+    scope.arg("notes", static_cast<long long>(summary.count));
+    return summary;
 }
 
-}
\ No newline at end of file
+}
@@ -1,11 +1,61 @@
 #ifndef NOTE_FORMATTER_HPP
 #define NOTE_FORMATTER_HPP
 
+#include <string>
+#include <string_view>
 #include <vector>
+#include <iostream>
 #include "database.hpp" // For the FullNote struct
 
 namespace formatter {
-    void print_notes(const std::vector<FullNote>& notes);
+    // How notes and stats are written. Text is for people; the others are for
+    // programs like jq, fzf, cut and `xargs -0`, and carry no decoration.
+    //   json   one array of objects
+    //   jsonl  one object per line
+    //   tsv    one record per line, with \\ \t \n \r escaping backslash, tab, newline, CR
+    //   nul    tsv fields, but each record ends in NUL and line breaks stay as they are
+    enum class Format { Text, Json, Jsonl, Tsv, Nul };
+
+    // Parses a --format value. False for an unknown name.
+    bool parse_format(const std::string& name, Format& format);
+
+    // Collects output and hands it to the stream in large writes, so nothing
+    // is flushed line by line. flush() pushes the stream too, for output that
+    // streams results as they arrive; the destructor flushes what's left.
+    class OutputBuffer {
+    public:
+        explicit OutputBuffer(std::ostream& out);
+        ~OutputBuffer();
+        OutputBuffer(const OutputBuffer&) = delete;
+        OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+        OutputBuffer& operator<<(std::string_view text);
+        OutputBuffer& operator<<(char c);
+        OutputBuffer& operator<<(long long number);
+        // A quoted JSON string, or null when `null_if_empty` and `text` is empty
+        void json_string(std::string_view text, bool null_if_empty = false);
+        // A field in a tsv or nul record
+        void record_field(std::string_view text, Format format);
+        void flush();
+        // False once the stream has failed, e.g. a closed pipe
+        bool ok() const { return out_.good(); }
+
+    private:
+        void write_if_full();
+
+        std::ostream& out_;
+        std::string buffer_;
+    };
+
+    struct PrintSummary {
+        size_t count = 0;
+        long long last_id = -1; // Pass as --after to continue from here
+    };
+
+    // Prints notes while the cursor produces them, stopping if the output
+    // fails. `highlight` renders search matches in bold and should only be
+    // set when the output is a terminal; only Format::Text uses it.
+    PrintSummary print_notes(db::NoteCursor& notes, std::ostream& out = std::cout, bool highlight = false, Format format = Format::Text);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,458 @@
+#include "note_importer.hpp"
+#include "trace.hpp"
+#include "database.hpp"
+#include "time_window.hpp"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace importer {
+
+// --- JSONL PARSING ---
+// A small parser for one flat JSON object per line. String and string-array
+// values are kept; anything else is skipped.
+class JsonLineParser {
+public:
+    explicit JsonLineParser(const std::string& line) : s(line), pos(0) {}
+
+    bool parse(FullNote& note) {
+        skip_ws();
+        if (!consume('{')) return false;
+        skip_ws();
+        if (consume('}')) return true;
+        while (true) {
+            std::string key;
+            skip_ws();
+            if (!parse_string(key)) return false;
+            skip_ws();
+            if (!consume(':')) return false;
+            skip_ws();
+            if (!parse_field(key, note)) return false;
+            skip_ws();
+            if (consume(',')) continue;
+            return consume('}');
+        }
+    }
+
+private:
+    const std::string& s;
+    size_t pos;
+
+    void skip_ws() { while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\r' || s[pos] == '\n')) ++pos; }
+    bool consume(char c) { if (pos < s.size() && s[pos] == c) { ++pos; return true; } return false; }
+
+    static void append_utf8(std::string& out, unsigned long cp) {
+        if (cp < 0x80) { out += static_cast<char>(cp); }
+        else if (cp < 0x800) { out += static_cast<char>(0xC0 | (cp >> 6)); out += static_cast<char>(0x80 | (cp & 0x3F)); }
+        else if (cp < 0x10000) { out += static_cast<char>(0xE0 | (cp >> 12)); out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F)); out += static_cast<char>(0x80 | (cp & 0x3F)); }
+        else { out += static_cast<char>(0xF0 | (cp >> 18)); out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F)); out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F)); out += static_cast<char>(0x80 | (cp & 0x3F)); }
+    }
+
+    bool parse_hex4(unsigned long& value) {
+        if (pos + 4 > s.size()) return false;
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = s[pos++];
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    bool parse_string(std::string& out) {
+        if (!consume('"')) return false;
+        out.clear();
+        while (pos < s.size()) {
+            char c = s[pos++];
+            if (c == '"') return true;
+            if (c != '\\') { out += c; continue; }
+            if (pos >= s.size()) return false;
+            char e = s[pos++];
+            switch (e) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned long cp;
+                    if (!parse_hex4(cp)) return false;
+                    // Combine UTF-16 surrogate pairs
+                    if (cp >= 0xD800 && cp <= 0xDBFF && s.compare(pos, 2, "\\u") == 0) {
+                        pos += 2;
+                        unsigned long low;
+                        if (!parse_hex4(low)) return false;
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(out, cp);
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return false;
+    }
+
+    bool skip_value() {
+        skip_ws();
+        if (pos >= s.size()) return false;
+        std::string ignored;
+        if (s[pos] == '"') return parse_string(ignored);
+        if (s[pos] == '{' || s[pos] == '[') {
+            char close = (s[pos] == '{') ? '}' : ']';
+            ++pos;
+            skip_ws();
+            if (consume(close)) return true;
+            while (true) {
+                if (close == '}') {
+                    skip_ws();
+                    if (!parse_string(ignored)) return false;
+                    skip_ws();
+                    if (!consume(':')) return false;
+                }
+                if (!skip_value()) return false;
+                skip_ws();
+                if (consume(',')) continue;
+                return consume(close);
+            }
+        }
+        // Numbers, true, false and null
+        size_t start = pos;
+        while (pos < s.size() && s[pos] != ',' && s[pos] != '}' && s[pos] != ']' && s[pos] != ' ' && s[pos] != '\t') ++pos;
+        return pos > start;
+    }
+
+    bool parse_string_array(std::vector<std::string>& out) {
+        if (!consume('[')) return false;
+        skip_ws();
+        if (consume(']')) return true;
+        while (true) {
+            std::string item;
+            skip_ws();
+            if (!parse_string(item)) return false;
+            out.push_back(std::move(item));
+            skip_ws();
+            if (consume(',')) continue;
+            return consume(']');
+        }
+    }
+
+    bool parse_field(const std::string& key, FullNote& note) {
+        std::string* target = nullptr;
+        if (key == "text") target = &note.text;
+        else if (key == "type") target = &note.type;
+        else if (key == "timestamp") target = &note.timestamp;
+        else if (key == "current_directory") target = &note.metadata.current_directory;
+        else if (key == "last_edited_file") target = &note.metadata.last_edited_file;
+        else if (key == "git_branch") target = &note.metadata.git_branch;
+        else if (key == "git_commit_hash") target = &note.metadata.git_commit_hash;
+
+        if (target && pos < s.size() && s[pos] == '"') return parse_string(*target);
+        if (key == "tags" && pos < s.size() && s[pos] == '[') return parse_string_array(note.tags);
+        return skip_value();
+    }
+};
+
+// --- CSV PARSING ---
+// Reads one RFC 4180 record, pulling in more lines while inside a quoted field.
+// Returns false at end of input. `consumed` is the number of bytes read and
+// `lines` the number of lines.
+bool read_csv_record(std::istream& in, std::string& line, std::vector<std::string>& fields, size_t& consumed, size_t& lines) {
+    fields.clear();
+    consumed = 0;
+    lines = 0;
+    if (!std::getline(in, line)) return false;
+    consumed += line.size() + (in.eof() ? 0 : 1);
+    ++lines;
+
+    std::string field;
+    bool in_quotes = false;
+    size_t i = 0;
+    while (true) {
+        if (i >= line.size()) {
+            if (!in_quotes) break;
+            // Quoted field continues on the next line
+            field += '\n';
+            if (!std::getline(in, line)) break;
+            consumed += line.size() + (in.eof() ? 0 : 1);
+            ++lines;
+            i = 0;
+            continue;
+        }
+        char c = line[i++];
+        if (in_quotes) {
+            if (c == '"') {
+                if (i < line.size() && line[i] == '"') { field += '"'; ++i; }
+                else { in_quotes = false; }
+            } else {
+                field += c;
+            }
+        } else if (c == '"') {
+            in_quotes = true;
+        } else if (c == ',') {
+            fields.push_back(std::move(field));
+            field.clear();
+        } else if (c != '\r') {
+            field += c;
+        }
+    }
+    fields.push_back(std::move(field));
+    return true;
+}
+
+// Maps a CSV row onto a note using the column names from the header.
+void csv_to_note(const std::vector<std::string>& header, const std::vector<std::string>& fields, FullNote& note) {
+    for (size_t i = 0; i < header.size() && i < fields.size(); ++i) {
+        const std::string& key = header[i];
+        const std::string& value = fields[i];
+        if (key == "text") note.text = value;
+        else if (key == "type") note.type = value;
+        else if (key == "timestamp") note.timestamp = value;
+        else if (key == "current_directory") note.metadata.current_directory = value;
+        else if (key == "last_edited_file") note.metadata.last_edited_file = value;
+        else if (key == "git_branch") note.metadata.git_branch = value;
+        else if (key == "git_commit_hash") note.metadata.git_commit_hash = value;
+        else if (key == "tags") {
+            // Tags are separated by spaces, with or without a leading '#'
+            size_t start = 0;
+            while (start < value.size()) {
+                size_t end = value.find(' ', start);
+                if (end == std::string::npos) end = value.size();
+                if (end > start) note.tags.push_back(value.substr(start, end - start));
+                start = end + 1;
+            }
+        }
+    }
+}
+
+// Stores a source's timestamp in the form notes keep, UTC
+// "YYYY-MM-DD HH:MM:SS", so it sorts and windows with the rest. An empty
+// one is left for the database to fill in with the current time.
+bool normalize_timestamp(std::string& timestamp) {
+    if (timestamp.empty()) return true;
+    long long epoch;
+    if (!time_window::parse_instant(timestamp, epoch)) return false;
+    timestamp = time_window::format_timestamp(epoch);
+    return true;
+}
+
+// Fills in the note type when the source didn't specify one.
+bool normalize_note(FullNote& note) {
+    if (note.text.empty()) return false;
+    if (note.type.empty()) {
+        const ProgMetadata& m = note.metadata;
+        bool has_meta = !m.current_directory.empty() || !m.last_edited_file.empty() || !m.git_branch.empty() || !m.git_commit_hash.empty();
+        note.type = has_meta ? "programming" : "general";
+    }
+    return note.type == "general" || note.type == "programming";
+}
+
+void reset_note(FullNote& note) {
+    // clear() keeps the string capacity, so steady-state parsing doesn't allocate
+    note.text.clear();
+    note.type.clear();
+    note.timestamp.clear();
+    note.tags.clear();
+    note.metadata.current_directory.clear();
+    note.metadata.last_edited_file.clear();
+    note.metadata.git_branch.clear();
+    note.metadata.git_commit_hash.clear();
+}
+
+// --- CHECKPOINTS ---
+struct Checkpoint {
+    long long byte_offset = 0;
+    long long records = 0;
+    bool completed = false;
+};
+
+bool load_checkpoint(db::Database& db, const std::string& source, Checkpoint& checkpoint) {
+    db::Statement stmt = db.prepare("SELECT byte_offset, records, completed FROM import_progress WHERE source = ?;");
+    stmt.bind(1, source);
+    if (!stmt.step()) return false;
+    checkpoint.byte_offset = stmt.column_int64(0);
+    checkpoint.records = stmt.column_int64(1);
+    checkpoint.completed = stmt.column_int(2) != 0;
+    return true;
+}
+
+// Records progress inside the current batch transaction, so the checkpoint
+// always matches exactly what has been committed.
+bool save_checkpoint(db::Database& db, const std::string& source, const Checkpoint& checkpoint) {
+    db::Statement stmt = db.prepare("INSERT INTO import_progress (source, byte_offset, records, completed) VALUES (?, ?, ?, ?) "
+                                    "ON CONFLICT(source) DO UPDATE SET byte_offset = excluded.byte_offset, records = excluded.records, completed = excluded.completed;");
+    stmt.bind(1, source).bind(2, checkpoint.byte_offset).bind(3, checkpoint.records).bind(4, checkpoint.completed ? 1 : 0);
+    return stmt.run();
+}
+
+// --- IMPORT DRIVER ---
+bool run_import(db::Database& db, const ImportOptions& options, std::ostream& out, std::ostream& err) {
+    INK_TRACE_SCOPE("import");
+    const bool from_stdin = options.source == "-";
+    std::string format = options.format;
+    if (format.empty()) {
+        format = (!from_stdin && fs::path(options.source).extension() == ".csv") ? "csv" : "jsonl";
+    }
+    if (format != "jsonl" && format != "csv") {
+        err << "Error: Unknown import format '" << format << "'. Use jsonl or csv." << std::endl;
+        return false;
+    }
+    const size_t batch_size = options.batch_size > 0 ? options.batch_size : 1;
+
+    std::ifstream file;
+    std::string source_key;
+    if (!from_stdin) {
+        file.open(options.source, std::ios::binary);
+        if (!file) {
+            err << "Error: Could not open " << options.source << std::endl;
+            return false;
+        }
+        std::error_code ec;
+        source_key = fs::absolute(options.source, ec).string();
+        if (ec) source_key = options.source;
+    }
+    std::istream& in = from_stdin ? std::cin : file;
+
+    Checkpoint checkpoint;
+    if (!from_stdin && !options.restart && load_checkpoint(db, source_key, checkpoint)) {
+        if (checkpoint.completed) {
+            err << "Already imported " << options.source << " (" << checkpoint.records
+                      << " notes). Use --restart to import it again." << std::endl;
+            return false;
+        }
+    } else {
+        checkpoint = Checkpoint();
+    }
+
+    // CSV needs its header even when resuming partway through the file
+    std::vector<std::string> header;
+    std::string line;
+    std::vector<std::string> fields;
+    size_t consumed = 0, lines = 0;
+    if (format == "csv") {
+        if (!read_csv_record(in, line, header, consumed, lines)) {
+            err << "Error: CSV input has no header row." << std::endl;
+            return false;
+        }
+        if (checkpoint.byte_offset < static_cast<long long>(consumed)) checkpoint.byte_offset = consumed;
+    }
+    // Lines are counted from the top, so past a resumed import's offset
+    // records are reported by byte offset instead
+    long long lines_read = checkpoint.byte_offset > static_cast<long long>(consumed) ? -1 : static_cast<long long>(lines);
+    if (checkpoint.byte_offset > 0 && !from_stdin) {
+        std::error_code ec;
+        auto size = fs::file_size(options.source, ec);
+        if (ec || static_cast<long long>(size) < checkpoint.byte_offset) {
+            err << "Error: " << options.source << " is shorter than its saved checkpoint. Use --restart." << std::endl;
+            return false;
+        }
+        in.seekg(checkpoint.byte_offset);
+        if (checkpoint.records > 0) {
+            err << "Resuming after " << checkpoint.records << " previously imported notes." << std::endl;
+        }
+    }
+
+    BulkInsert bulk;
+    // A larger page cache keeps index pages resident across a batch. Foreign
+    // key checks are redundant here since every tag and metadata row points at
+    // the note inserted just before it, and at dictionary ids it just looked up.
+    db.execute("PRAGMA cache_size = -65536;");
+    db.execute("PRAGMA foreign_keys = OFF;");
+
+    const bool show_progress = isatty(STDERR_FILENO);
+    const auto start_time = std::chrono::steady_clock::now();
+    auto elapsed_seconds = [&]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    };
+
+    FullNote note;
+    long long imported = 0, skipped = 0;
+    size_t in_batch = 0;
+    bool ok = db.execute("BEGIN TRANSACTION;");
+
+    auto commit_batch = [&](bool completed) {
+        checkpoint.completed = completed;
+        if (!db::flush_bulk_insert(db, bulk)) return false;
+        if (!from_stdin && !save_checkpoint(db, source_key, checkpoint)) return false;
+        if (!db.execute("COMMIT;")) return false;
+        in_batch = 0;
+        if (show_progress) {
+            double secs = elapsed_seconds();
+            err << "\r  Imported " << imported << " notes (" << static_cast<long long>(secs > 0 ? imported / secs : 0) << " notes/sec)" << std::flush;
+        }
+        return completed || db.execute("BEGIN TRANSACTION;");
+    };
+
+    while (ok) {
+        reset_note(note);
+        const long long record_offset = checkpoint.byte_offset;
+        const long long record_line = lines_read + 1;
+        bool blank;
+        if (format == "csv") {
+            if (!read_csv_record(in, line, fields, consumed, lines)) break;
+            blank = fields.size() == 1 && fields[0].empty();
+        } else {
+            if (!std::getline(in, line)) break;
+            consumed = line.size() + (in.eof() ? 0 : 1);
+            lines = 1;
+            blank = line.find_first_not_of(" \t\r") == std::string::npos;
+        }
+        checkpoint.byte_offset += consumed;
+        if (lines_read >= 0) lines_read += static_cast<long long>(lines);
+        if (blank) continue;
+        if (format == "csv") csv_to_note(header, fields, note);
+        else if (!JsonLineParser(line).parse(note)) reset_note(note);
+
+        const bool well_formed = normalize_note(note);
+        if (!well_formed || !normalize_timestamp(note.timestamp)) {
+            err << (show_progress ? "\n" : "") << "Skipping ";
+            if (well_formed) err << "record with unreadable timestamp '" << note.timestamp << "'";
+            else err << "malformed record";
+            if (record_line > 0) err << " on line " << record_line << std::endl;
+            else err << " at byte " << record_offset << std::endl;
+            ++skipped;
+            continue;
+        }
+        if (db::bulk_insert_note(db, bulk, note) < 0) {
+            err << "\nSQL error: " << sqlite3_errmsg(db.handle()) << std::endl;
+            ok = false;
+            break;
+        }
+        ++imported;
+        ++checkpoint.records;
+        if (++in_batch >= batch_size) ok = commit_batch(false);
+    }
+
+    if (ok) {
+        ok = commit_batch(true);
+    } else {
+        db.execute("ROLLBACK;");
+    }
+    db.execute("PRAGMA foreign_keys = ON;");
+
+    double secs = elapsed_seconds();
+    if (show_progress) err << std::endl;
+    if (!ok) {
+        err << "Error: Import stopped after " << imported << " notes. Run the same command again to resume." << std::endl;
+        return false;
+    }
+    out << "\n🐌 Imported " << imported << " notes in " << secs << "s ("
+              << static_cast<long long>(secs > 0 ? imported / secs : 0) << " notes/sec)";
+    if (skipped > 0) out << ", skipped " << skipped << " unreadable";
+    out << std::endl;
+    return true;
+}
+
+}
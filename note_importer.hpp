@@ -0,0 +1,25 @@
+#ifndef NOTE_IMPORTER_HPP
+#define NOTE_IMPORTER_HPP
+
+#include <string>
+#include <cstddef>
+#include <ostream>
+#include "database.hpp"
+
+// Options for a bulk import run.
+struct ImportOptions {
+    std::string source = "-";   // File path, or "-" for stdin
+    std::string format;         // "jsonl" or "csv"; guessed from the extension when empty
+    size_t batch_size = 10000;  // Notes per transaction
+    bool restart = false;       // Ignore any saved checkpoint for this file
+};
+
+namespace importer {
+    // Streams notes from a JSONL or CSV source into the database, committing
+    // every batch_size notes. File imports checkpoint after each batch and
+    // resume from there if interrupted. Progress and the summary go to err
+    // and out.
+    bool run_import(db::Database& db, const ImportOptions& options, std::ostream& out, std::ostream& err);
+}
+
+#endif
@@ -0,0 +1,302 @@
+#include "note_sync.hpp"
+#include "archive.hpp"
+#include "note_body.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace note_sync {
+
+// --- NOTE KEYS ---
+// FNV-1a over the fields with a zero byte between them, then the splitmix64
+// finalizer so nearby inputs spread over all 64 bits. Changing this changes
+// every key, so it is fixed.
+uint64_t hash_fields(std::initializer_list<std::string_view> fields) {
+    const uint64_t PRIME = 1099511628211ULL;
+    uint64_t hash = 14695981039346656037ULL;
+    for (std::string_view field : fields) {
+        for (unsigned char c : field) {
+            hash ^= c;
+            hash *= PRIME;
+        }
+        hash *= PRIME; // The zero byte after the field
+    }
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+long long note_key(std::string_view timestamp, std::string_view type, std::string_view text) {
+    return static_cast<long long>(hash_fields({timestamp, type, text}));
+}
+
+long long metadata_key(std::string_view directory, std::string_view file, std::string_view branch, std::string_view commit) {
+    if (directory.empty() && file.empty() && branch.empty() && commit.empty()) return 0;
+    return static_cast<long long>(hash_fields({directory, file, branch, commit}));
+}
+
+std::string_view text_arg(sqlite3_value** argv, int i) {
+    const char* text = reinterpret_cast<const char*>(sqlite3_value_text(argv[i]));
+    return text ? std::string_view(text, sqlite3_value_bytes(argv[i])) : std::string_view();
+}
+
+void key_function(sqlite3_context* context, int, sqlite3_value** argv) {
+    sqlite3_result_int64(context, note_key(text_arg(argv, 0), text_arg(argv, 1), text_arg(argv, 2)));
+}
+
+void metadata_key_function(sqlite3_context* context, int, sqlite3_value** argv) {
+    sqlite3_result_int64(context, metadata_key(text_arg(argv, 0), text_arg(argv, 1), text_arg(argv, 2), text_arg(argv, 3)));
+}
+
+void register_functions(sqlite3* db) {
+    sqlite3_create_function(db, "ink_note_key", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, key_function, nullptr, nullptr);
+    sqlite3_create_function(db, "ink_metadata_key", 4, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, metadata_key_function, nullptr, nullptr);
+}
+
+// --- REPLICAS ---
+// A count and the sums of each half of the notes' entries: equal buckets hold
+// the same notes with the same metadata, barring a 64-bit collision. Sums,
+// unlike an XOR, keep count of repeated notes.
+struct Bucket {
+    long long notes = 0;
+    long long low = 0;
+    long long high = 0;
+    bool operator==(const Bucket& other) const { return notes == other.notes && low == other.low && high == other.high; }
+};
+
+// Where a note lives on one side, and how much metadata it has
+struct NoteRef {
+    db::Database* db;
+    long long id;
+    long long meta;   // ink_metadata_key of its metadata, 0 for none
+    int fields;       // Metadata fields that are filled in
+};
+
+// Keys get written along with their notes; these catch up notes saved by
+// something that didn't, like an older ink
+const std::string COUNT_KEYED_SQL = "SELECT (SELECT count FROM stat_totals WHERE name = 'notes') - (SELECT COALESCE(SUM(notes), 0) FROM sync_days);";
+const std::string KEY_MISSING_SQL =
+    "INSERT INTO sync_keys (note_id, key, day, meta) SELECT n.id, ink_note_key(n.timestamp, n.type, n.text), substr(n.timestamp, 1, 10), "
+    "COALESCE(ink_metadata_key(d.path, m.last_edited_file, m.git_branch, m.recent_commit_hash), 0) "
+    "FROM notes n LEFT JOIN metadata m ON m.note_id = n.id LEFT JOIN dir_dict d ON d.id = m.dir_id "
+    "WHERE NOT EXISTS (SELECT 1 FROM sync_keys k WHERE k.note_id = n.id);";
+const std::string SELECT_DAYS_SQL = "SELECT day, notes, key_low, key_high FROM sync_days WHERE day >= ?1 AND day < ?1 || '~';";
+const std::string SELECT_DAY_KEYS_SQL =
+    "SELECT k.key, k.note_id, k.meta, (m.dir_id IS NOT NULL) + (COALESCE(m.last_edited_file, '') <> '') + "
+    "(COALESCE(m.git_branch, '') <> '') + (COALESCE(m.recent_commit_hash, '') <> '') "
+    "FROM sync_keys k LEFT JOIN metadata m ON m.note_id = k.note_id WHERE k.day = ?;";
+
+// A hot database and its archives
+class Replica {
+public:
+    Replica(db::Database& hot, std::vector<std::string>& missing) {
+        databases_.push_back(&hot);
+        for (const auto& tier : archive::list_tiers(hot)) {
+            auto db = archive::open_tier(tier, &missing);
+            if (!db) {
+                ok_ = false;
+                continue;
+            }
+            tiers_.push_back(db);
+            databases_.push_back(db.get());
+        }
+        for (db::Database* db : databases_) ok_ = ok_ && add_missing_keys(*db);
+    }
+
+    bool ok() const { return ok_; }
+    db::Database& hot() const { return *databases_.front(); }
+
+    // Buckets for the days starting with `prefix`, grouped by their first
+    // `length` characters
+    std::map<std::string, Bucket> summarize(const std::string& prefix, size_t length) const {
+        std::map<std::string, Bucket> buckets;
+        for (db::Database* db : databases_) {
+            db::Statement stmt = db->prepare(SELECT_DAYS_SQL);
+            stmt.bind(1, prefix);
+            while (stmt.step()) {
+                Bucket& bucket = buckets[std::string(stmt.column_view(0).substr(0, length))];
+                bucket.notes += stmt.column_int64(1);
+                bucket.low += stmt.column_int64(2);
+                bucket.high += stmt.column_int64(3);
+            }
+        }
+        return buckets;
+    }
+
+    // The day's notes by key, repeats included
+    std::unordered_map<long long, std::vector<NoteRef>> day_notes(const std::string& day) const {
+        std::unordered_map<long long, std::vector<NoteRef>> notes;
+        for (db::Database* db : databases_) {
+            db::Statement stmt = db->prepare(SELECT_DAY_KEYS_SQL);
+            stmt.bind(1, day);
+            while (stmt.step()) {
+                notes[stmt.column_int64(0)].push_back(NoteRef{db, stmt.column_int64(1), stmt.column_int64(2), stmt.column_int(3)});
+            }
+        }
+        return notes;
+    }
+
+private:
+    static bool add_missing_keys(db::Database& db) {
+        bool missing;
+        {
+            db::Statement count = db.prepare(COUNT_KEYED_SQL);
+            missing = count.step() && count.column_int64(0) != 0;
+        }
+        return !missing || db.execute(KEY_MISSING_SQL);
+    }
+
+    std::vector<std::shared_ptr<db::Database>> tiers_;
+    std::vector<db::Database*> databases_;
+    bool ok_ = true;
+};
+
+// --- COMPARING ---
+// Bucket widths below the whole history: years, months, days
+const size_t LEVELS[] = {4, 7, 10};
+
+// Collects the days under `prefix` whose buckets differ
+void differing_days(const Replica& a, const Replica& b, const std::string& prefix, size_t level, std::vector<std::string>& days) {
+    auto left = a.summarize(prefix, LEVELS[level]);
+    auto right = b.summarize(prefix, LEVELS[level]);
+    for (auto& entry : right) left.emplace(entry.first, Bucket());
+    for (const auto& [child, bucket] : left) {
+        auto other = right.find(child);
+        if (other != right.end() && bucket == other->second) continue;
+        if (level + 1 < sizeof(LEVELS) / sizeof(LEVELS[0])) differing_days(a, b, child, level + 1, days);
+        else days.push_back(child);
+    }
+}
+
+// --- COPYING ---
+// Notes per transaction on the receiving side
+const size_t SYNC_BATCH = 10000;
+
+const std::string SELECT_NOTE_SQL =
+    "SELECT n.text, n.timestamp, n.type, d.path, m.last_edited_file, m.git_branch, m.recent_commit_hash, "
+    "(SELECT GROUP_CONCAT(t.name, ' ') FROM note_tags nt JOIN tag_dict t ON t.id = nt.tag_id WHERE nt.note_id = n.id) "
+    "FROM notes n LEFT JOIN metadata m ON m.note_id = n.id LEFT JOIN dir_dict d ON d.id = m.dir_id WHERE n.id = ?;";
+
+bool read_note(const NoteRef& ref, FullNote& note) {
+    db::Statement stmt = ref.db->prepare(SELECT_NOTE_SQL);
+    if (!stmt.bind(1, ref.id).step()) return false;
+    note.text = stmt.column_text(0);
+    note.timestamp = stmt.column_text(1);
+    note.type = stmt.column_text(2);
+    note.metadata.current_directory = stmt.column_text(3);
+    note.metadata.last_edited_file = stmt.column_text(4);
+    note.metadata.git_branch = stmt.column_text(5);
+    note.metadata.git_commit_hash = stmt.column_text(6);
+    note.tags.clear();
+    std::string_view tags = stmt.column_view(7);
+    while (!tags.empty()) {
+        size_t space = tags.find(' ');
+        note.tags.emplace_back(tags.substr(0, space));
+        tags = space == std::string_view::npos ? std::string_view() : tags.substr(space + 1);
+    }
+    return true;
+}
+
+// Copies notes into a hot database through the bulk load path, which keeps
+// their timestamps and so their keys, along with any piped bodies
+bool copy_notes(const std::vector<NoteRef>& notes, db::Database& target) {
+    INK_TRACE_SCOPE("sync_copy");
+    FullNote note;
+    for (size_t begin = 0; begin < notes.size(); begin += SYNC_BATCH) {
+        db::Transaction txn(target, true);
+        if (!txn.ok()) return false;
+        BulkInsert bulk;
+        for (size_t i = begin; i < std::min(notes.size(), begin + SYNC_BATCH); ++i) {
+            if (!read_note(notes[i], note)) return false;
+            long long note_id = db::bulk_insert_note(target, bulk, note);
+            if (note_id < 0 || !note_body::copy(*notes[i].db, notes[i].id, target, note_id)) return false;
+        }
+        if (!db::flush_bulk_insert(target, bulk) || !txn.commit()) return false;
+    }
+    return true;
+}
+
+// Sets each note's metadata to its source's
+bool copy_metadata(const std::vector<std::pair<NoteRef, NoteRef>>& updates) {
+    INK_TRACE_SCOPE("sync_metadata");
+    FullNote source;
+    for (const auto& [target, from] : updates) {
+        if (!read_note(from, source) || !db::replace_metadata(*target.db, target.id, source.metadata)) return false;
+    }
+    return true;
+}
+
+// --- MERGING ---
+// Of all copies of a note, the one with the most metadata filled in, ties
+// going to the larger metadata key, so both sides pick the same one
+const NoteRef* best_copy(const std::vector<NoteRef>& mine, const std::vector<NoteRef>& theirs) {
+    const NoteRef* best = nullptr;
+    for (const auto* copies : {&mine, &theirs}) {
+        for (const NoteRef& ref : *copies) {
+            if (!best || ref.fields > best->fields ||
+                (ref.fields == best->fields && static_cast<uint64_t>(ref.meta) > static_cast<uint64_t>(best->meta))) {
+                best = &ref;
+            }
+        }
+    }
+    return best;
+}
+
+// Plans one key's merge: the side with fewer copies of the note gets the
+// difference, copied from the best copy, and every copy whose metadata
+// differs from the best's takes it over.
+void merge_key(const std::vector<NoteRef>& mine, const std::vector<NoteRef>& theirs, std::vector<NoteRef>& pull, std::vector<NoteRef>& push,
+               std::vector<std::pair<NoteRef, NoteRef>>& updates) {
+    const NoteRef& best = *best_copy(mine, theirs);
+    for (size_t i = mine.size(); i < theirs.size(); ++i) pull.push_back(best);
+    for (size_t i = theirs.size(); i < mine.size(); ++i) push.push_back(best);
+    for (const auto* copies : {&mine, &theirs}) {
+        for (const NoteRef& ref : *copies) {
+            if (ref.meta != best.meta) updates.push_back({ref, best});
+        }
+    }
+}
+
+bool sync(db::Database& local, db::Database& remote, SyncReport& report) {
+    INK_TRACE_SCOPE("sync");
+    Replica here(local, report.missing_archives);
+    Replica there(remote, report.missing_archives);
+    if (!here.ok() || !there.ok()) return false;
+
+    std::vector<std::string> days;
+    {
+        INK_TRACE_SCOPE("sync_compare");
+        differing_days(here, there, "", 0, days);
+    }
+    std::vector<NoteRef> pull, push;
+    std::vector<std::pair<NoteRef, NoteRef>> updates;
+    const std::vector<NoteRef> none;
+    for (const auto& day : days) {
+        auto mine = here.day_notes(day);
+        auto theirs = there.day_notes(day);
+        for (const auto& [key, copies] : theirs) {
+            auto other = mine.find(key);
+            merge_key(other == mine.end() ? none : other->second, copies, pull, push, updates);
+        }
+        for (const auto& [key, copies] : mine) {
+            if (!theirs.count(key)) merge_key(copies, none, pull, push, updates);
+        }
+    }
+    report.days = static_cast<long long>(days.size());
+    // Metadata first: the copies below are read from the best copies, which it leaves alone
+    if (!copy_metadata(updates)) return false;
+    report.updated = static_cast<long long>(updates.size());
+    if (!copy_notes(pull, here.hot())) return false;
+    report.pulled = static_cast<long long>(pull.size());
+    if (!copy_notes(push, there.hot())) return false;
+    report.pushed = static_cast<long long>(push.size());
+    return true;
+}
+
+}
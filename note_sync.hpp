@@ -0,0 +1,44 @@
+#ifndef NOTE_SYNC_HPP
+#define NOTE_SYNC_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sqlite3.h>
+#include "database.hpp"
+
+// Two-way merge of note databases for `ink sync`. Ids differ between copies
+// of the database, so a note is known by a key hashed from its timestamp,
+// type and text, kept in sync_keys along with a key of its metadata.
+// sync_days sums each day's entries into a count and a 64-bit checksum, and
+// the two sides compare those level by level (years, then months, then
+// days) the way a Merkle tree is compared: only days whose summaries differ
+// have their keys read. Notes one side holds fewer copies of are copied
+// over, with their tags, metadata and piped bodies, and a copy with less
+// metadata than the other side's takes that metadata over.
+namespace note_sync {
+    // The key of a note. Stable across machines and versions.
+    long long note_key(std::string_view timestamp, std::string_view type, std::string_view text);
+    // The key of a programming note's metadata, or 0 when it has none.
+    long long metadata_key(std::string_view directory, std::string_view file, std::string_view branch, std::string_view commit);
+
+    // Registers ink_note_key(timestamp, type, text) and
+    // ink_metadata_key(directory, file, branch, commit) on a connection.
+    void register_functions(sqlite3* db);
+
+    struct SyncReport {
+        long long pulled = 0; // Notes copied into the local database
+        long long pushed = 0; // Notes copied into the remote one
+        long long updated = 0; // Notes whose metadata was replaced, on either side
+        long long days = 0;   // Days whose notes were compared one by one
+        std::vector<std::string> missing_archives; // Archives that couldn't be read, failing the sync
+    };
+
+    // Copies each database's missing notes into the other. Archives of
+    // either side count as part of it, but copied notes always go to the
+    // hot database. False on error.
+    bool sync(db::Database& local, db::Database& remote, SyncReport& report);
+}
+
+#endif
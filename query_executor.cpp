@@ -0,0 +1,103 @@
+#include "query_executor.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <unordered_map>
+
+namespace query_executor {
+
+// Same ceiling as the server's worker pool
+const size_t MAX_THREADS = 8;
+
+Executor::Executor(size_t threads) {
+    for (size_t i = 0; i < threads; ++i) workers_.emplace_back(&Executor::work, this);
+}
+
+Executor::~Executor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) worker.join();
+}
+
+bool Executor::run(std::vector<Task>& tasks) {
+    INK_TRACE_SCOPE("executor_run");
+    Batch batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    batch.pending = tasks.size();
+    for (auto& task : tasks) jobs_.push_back({&task, &batch});
+    wake_.notify_all();
+    done_.wait(lock, [&] { return batch.pending == 0; });
+    return batch.ok;
+}
+
+// Opens a connection for reading only. A missing file is an error rather
+// than a new empty database.
+std::unique_ptr<db::Database> open_reader(const std::string& path) {
+    std::error_code ec;
+    if (path.empty() || !std::filesystem::exists(path, ec)) return nullptr;
+    auto reader = std::make_unique<db::Database>(path);
+    if (!reader->is_open() || !reader->execute("PRAGMA query_only = 1;")) return nullptr;
+    return reader;
+}
+
+void Executor::work() {
+    // Kept for the life of the thread, so later runs skip opening and the
+    // statement caches stay warm
+    std::unordered_map<std::string, std::unique_ptr<db::Database>> readers;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [&] { return stopping_ || !jobs_.empty(); });
+        if (jobs_.empty()) return;
+        Job job = jobs_.front();
+        jobs_.pop_front();
+        lock.unlock();
+
+        auto& reader = readers[job.task->path];
+        if (!reader) reader = open_reader(job.task->path);
+        const bool opened = reader != nullptr;
+        if (opened) {
+            INK_TRACE_SCOPE("executor_task");
+            job.task->run(*reader);
+        } else {
+            readers.erase(job.task->path);
+        }
+
+        lock.lock();
+        if (!opened) job.batch->ok = false;
+        if (--job.batch->pending == 0) done_.notify_all();
+    }
+}
+
+// --- THE SHARED EXECUTOR ---
+std::mutex shared_mutex;
+std::unique_ptr<Executor> shared_executor;
+bool shared_started = false;
+
+size_t default_threads() {
+    if (const char* readers = getenv("INK_READERS")) return static_cast<size_t>(std::max(1, std::atoi(readers)));
+    return std::min<size_t>(MAX_THREADS, std::max(1u, std::thread::hardware_concurrency()));
+}
+
+Executor* shared() {
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    if (!shared_started) {
+        shared_started = true;
+        size_t threads = default_threads();
+        if (threads > 1) shared_executor = std::make_unique<Executor>(threads);
+    }
+    return shared_executor.get();
+}
+
+void set_threads(size_t threads) {
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    shared_started = true;
+    shared_executor.reset();
+    if (threads > 1) shared_executor = std::make_unique<Executor>(threads);
+}
+
+}
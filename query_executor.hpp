@@ -0,0 +1,74 @@
+#ifndef QUERY_EXECUTOR_HPP
+#define QUERY_EXECUTOR_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "database.hpp"
+
+// Runs independent read queries side by side. Each worker thread keeps its
+// own connection to every database file it has been asked to read, opened
+// on first use and set to query_only. In WAL mode these read alongside the
+// command's own connection and any writer, each from its own snapshot.
+//
+// Queries that scan a lot split their work into tasks (rowid ranges of a
+// search, slices of a stats window, one archive each) and merge what the
+// tasks return; see db::search_notes and stats::gather_activity.
+namespace query_executor {
+    // A query to run on a worker's connection to the database at `path`
+    struct Task {
+        std::string path;
+        std::function<void(db::Database& db)> run;
+    };
+
+    class Executor {
+    public:
+        explicit Executor(size_t threads);
+        ~Executor();
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        size_t threads() const { return workers_.size(); }
+
+        // Runs every task and waits for all of them. False if a task's
+        // database couldn't be opened; the other tasks still run, and the
+        // caller reads what it needs on its own connection instead.
+        bool run(std::vector<Task>& tasks);
+
+    private:
+        // The tasks of one run() call
+        struct Batch {
+            size_t pending = 0;
+            bool ok = true;
+        };
+        struct Job {
+            Task* task;
+            Batch* batch;
+        };
+
+        void work();
+
+        std::vector<std::thread> workers_;
+        std::mutex mutex_;
+        std::condition_variable wake_; // A job was queued, or we are stopping
+        std::condition_variable done_; // Some batch finished
+        std::deque<Job> jobs_;
+        bool stopping_ = false;
+    };
+
+    // The process-wide executor, started on first use with INK_READERS
+    // threads, or one per core up to 8. Null when that comes to a single
+    // thread: callers then run their queries inline, unsplit.
+    Executor* shared();
+
+    // Replaces the shared executor with one of `threads` threads (1 turns it
+    // off). Only for ink_bench, between queries.
+    void set_threads(size_t threads);
+}
+
+#endif
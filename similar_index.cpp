@@ -0,0 +1,610 @@
+#include "similar_index.hpp"
+#include "fuzzy_index.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define INK_AVX2_KERNEL 1
+#endif
+
+namespace similar_index {
+
+// --- FEATURES ---
+const int KIND_SHIFT = 30;
+const uint32_t ID_MASK = (uint32_t(1) << KIND_SHIFT) - 1;
+enum Kind : uint32_t { WORD = 0, TAG = 1, DIRECTORY = 2, KIND_COUNT = 3 };
+// A shared tag or project says more about two notes than one shared word
+const float KIND_WEIGHTS[KIND_COUNT] = {1.0f, 2.0f, 2.0f};
+
+uint32_t make_feature(Kind kind, long long id) { return (uint32_t(kind) << KIND_SHIFT) | (static_cast<uint32_t>(id) & ID_MASK); }
+Kind kind_of(uint32_t feature) { return Kind(feature >> KIND_SHIFT); }
+
+uint32_t word_feature(long long term_id) { return make_feature(WORD, term_id); }
+uint32_t tag_feature(long long tag_id) { return make_feature(TAG, tag_id); }
+uint32_t directory_feature(long long dir_id) { return make_feature(DIRECTORY, dir_id); }
+
+// Smoothed, so a feature every note has still counts for a little
+float inverse_frequency(uint64_t notes, uint64_t frequency) {
+    return std::log((1.0f + static_cast<float>(notes)) / (1.0f + static_cast<float>(frequency))) + 1.0f;
+}
+
+// Repeats count for less than the first occurrence
+float feature_weight(uint32_t feature, uint32_t count, float idf) {
+    return (1.0f + std::log(static_cast<float>(count))) * idf * KIND_WEIGHTS[kind_of(feature)];
+}
+
+// --- VECTOR BLOBS ---
+// The distinct features in ascending order, each as a varint of its gap
+// from the one before and a varint of how often it occurs. A note of twenty
+// words takes about forty bytes.
+void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool get_varint(const unsigned char*& at, const unsigned char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; at < end && shift < 64; shift += 7) {
+        unsigned char byte = *at++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+std::string encode(std::vector<uint32_t>& features) {
+    std::sort(features.begin(), features.end());
+    std::string blob;
+    uint32_t previous = 0;
+    for (size_t i = 0; i < features.size();) {
+        size_t j = i + 1;
+        while (j < features.size() && features[j] == features[i]) ++j;
+        put_varint(blob, features[i] - previous);
+        put_varint(blob, j - i);
+        previous = features[i];
+        i = j;
+    }
+    return blob;
+}
+
+// A vector read back as (feature, count) pairs in feature order. False, with
+// `out` cleared, if the blob is malformed.
+bool decode(std::string_view blob, std::vector<std::pair<uint32_t, uint32_t>>& out) {
+    out.clear();
+    const auto* at = reinterpret_cast<const unsigned char*>(blob.data());
+    const auto* end = at + blob.size();
+    uint64_t feature = 0;
+    while (at < end) {
+        uint64_t gap, count;
+        if (!get_varint(at, end, gap) || !get_varint(at, end, count) || (gap == 0 && !out.empty()) || count == 0) {
+            out.clear();
+            return false;
+        }
+        feature += gap;
+        if (feature > std::numeric_limits<uint32_t>::max() || kind_of(static_cast<uint32_t>(feature)) >= KIND_COUNT) {
+            out.clear();
+            return false;
+        }
+        out.emplace_back(static_cast<uint32_t>(feature), static_cast<uint32_t>(std::min<uint64_t>(count, std::numeric_limits<uint32_t>::max())));
+    }
+    return true;
+}
+
+const std::string INSERT_VECTOR_SQL = "INSERT INTO note_vectors (note_id, features) VALUES (?, ?);";
+
+bool save(db::Database& db, long long note_id, std::vector<uint32_t>& features) {
+    return db.prepare(INSERT_VECTOR_SQL).bind(1, note_id).bind_blob(2, encode(features)).run();
+}
+
+// --- SNAPSHOT FILE ---
+// A header, then the notes' ids, where each note's entries start, and each
+// entry's column and weight as two parallel arrays; then the features the
+// columns stand for, in ascending order, with their inverse frequencies.
+// Rows are normalized to unit length. Like the completion trie this is a
+// cache, written in the machine's own byte order.
+const char SNAPSHOT_MAGIC[8] = {'I', 'N', 'K', 'V', 'E', 'C', 'S', '1'};
+// Zeroed entries after the last one, so the kernel can always load eight
+const uint64_t PADDING = 8;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint64_t notes;
+    uint64_t entries;
+    uint64_t features;
+    int64_t last_note_id; // Notes saved after it aren't in the snapshot
+};
+
+// Byte offsets of each array
+struct Layout {
+    size_t ids, offsets, columns, weights, features, idf, size;
+};
+
+Layout layout_of(const SnapshotHeader& header) {
+    Layout layout;
+    size_t at = sizeof(SnapshotHeader);
+    layout.ids = at;
+    at += header.notes * sizeof(int64_t);
+    layout.offsets = at;
+    at += (header.notes + 1) * sizeof(uint64_t);
+    layout.columns = at;
+    at += (header.entries + PADDING) * sizeof(uint32_t);
+    layout.weights = at;
+    at += (header.entries + PADDING) * sizeof(float);
+    layout.features = at;
+    at += header.features * sizeof(uint32_t);
+    layout.idf = at;
+    at += header.features * sizeof(float);
+    layout.size = at;
+    return layout;
+}
+
+class Snapshot {
+public:
+    Snapshot() = default;
+    ~Snapshot() { close(); }
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // Maps the file. False if it is missing or malformed.
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(SnapshotHeader))) {
+            ::close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) return false;
+        map_ = map;
+        size_ = static_cast<size_t>(st.st_size);
+
+        const auto* header = static_cast<const SnapshotHeader*>(map_);
+        // Bounded first, so the layout can't overflow
+        if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header->notes > size_ / 8 ||
+            header->entries > size_ / 4 || header->features >= std::numeric_limits<uint32_t>::max() ||
+            layout_of(*header).size != size_) {
+            close();
+            return false;
+        }
+        const Layout layout = layout_of(*header);
+        const char* base = static_cast<const char*>(map_);
+        notes = header->notes;
+        entries = header->entries;
+        features = header->features;
+        last_note_id = header->last_note_id;
+        ids = reinterpret_cast<const int64_t*>(base + layout.ids);
+        offsets = reinterpret_cast<const uint64_t*>(base + layout.offsets);
+        columns = reinterpret_cast<const uint32_t*>(base + layout.columns);
+        weights = reinterpret_cast<const float*>(base + layout.weights);
+        feature_ids = reinterpret_cast<const uint32_t*>(base + layout.features);
+        idf = reinterpret_cast<const float*>(base + layout.idf);
+        return true;
+    }
+
+    // The row holding a note, or -1
+    long long row(long long note_id) const {
+        const int64_t* found = std::lower_bound(ids, ids + notes, note_id);
+        return found != ids + notes && *found == note_id ? found - ids : -1;
+    }
+
+    // A feature's column, or -1 if no note in the snapshot has it
+    long long column(uint32_t feature) const {
+        const uint32_t* found = std::lower_bound(feature_ids, feature_ids + features, feature);
+        return found != feature_ids + features && *found == feature ? found - feature_ids : -1;
+    }
+
+    float inverse_frequency_of(uint32_t feature) const {
+        long long at = column(feature);
+        return at >= 0 ? idf[at] : inverse_frequency(notes, 0);
+    }
+
+    // A row's entries, clamped to the file
+    void span(size_t row, uint64_t& from, uint64_t& to) const {
+        from = std::min(offsets[row], entries);
+        to = std::max(from, std::min(offsets[row + 1], entries));
+    }
+
+    uint64_t notes = 0;
+    uint64_t entries = 0;
+    uint64_t features = 0;
+    int64_t last_note_id = 0;
+    const int64_t* ids = nullptr;
+    const uint64_t* offsets = nullptr;
+    const uint32_t* columns = nullptr;
+    const float* weights = nullptr;
+    const uint32_t* feature_ids = nullptr;
+    const float* idf = nullptr;
+
+private:
+    void close() {
+        if (map_) munmap(map_, size_);
+        map_ = nullptr;
+        size_ = 0;
+        notes = entries = features = 0;
+    }
+
+    void* map_ = nullptr;
+    size_t size_ = 0;
+};
+
+std::string snapshot_path(const std::string& db_path) {
+    return db::sidecar_path(db_path, ".vectors");
+}
+
+// A decoded vector weighted with the snapshot's frequencies and normalized,
+// as (feature, weight) pairs in feature order.
+void weigh(const Snapshot& snapshot, const std::vector<std::pair<uint32_t, uint32_t>>& counts, std::vector<std::pair<uint32_t, float>>& out) {
+    out.clear();
+    double norm = 0;
+    for (const auto& [feature, count] : counts) {
+        float weight = feature_weight(feature, count, snapshot.inverse_frequency_of(feature));
+        out.emplace_back(feature, weight);
+        norm += static_cast<double>(weight) * weight;
+    }
+    if (norm <= 0) return;
+    const float scale = static_cast<float>(1.0 / std::sqrt(norm));
+    for (auto& entry : out) entry.second *= scale;
+}
+
+// --- CATCHING UP ---
+// Notes saved before note_vectors existed, a batch at a time
+const std::string SELECT_MISSING_SQL =
+    "SELECT n.id, n.text, COALESCE(m.dir_id, 0), (SELECT GROUP_CONCAT(tag_id) FROM note_tags WHERE note_id = n.id) "
+    "FROM notes n LEFT JOIN metadata m ON m.note_id = n.id "
+    "WHERE n.id > ?1 AND NOT EXISTS (SELECT 1 FROM note_vectors v WHERE v.note_id = n.id) ORDER BY n.id LIMIT 4096;";
+
+bool backfill(db::Database& db) {
+    INK_TRACE_SCOPE("backfill_vectors");
+    struct Missing {
+        long long id;
+        std::string text;
+        long long dir_id;
+        std::string tag_ids;
+    };
+    std::vector<Missing> batch;
+    std::vector<long long> term_ids;
+    std::vector<uint32_t> features;
+    long long after = -1;
+    while (true) {
+        batch.clear();
+        {
+            db::Statement stmt = db.prepare(SELECT_MISSING_SQL);
+            stmt.bind(1, after);
+            while (stmt.step()) batch.push_back({stmt.column_int64(0), stmt.column_text(1), stmt.column_int64(2), stmt.column_text(3)});
+        }
+        if (batch.empty()) return true;
+
+        db::Transaction txn(db, true);
+        if (!txn.ok()) return false;
+        for (const auto& note : batch) {
+            term_ids.clear();
+            if (!fuzzy_index::add_words(db, note.text, &term_ids)) return false;
+            features.clear();
+            for (long long term_id : term_ids) features.push_back(word_feature(term_id));
+            const char* at = note.tag_ids.c_str();
+            while (*at) {
+                char* end = nullptr;
+                features.push_back(tag_feature(std::strtoll(at, &end, 10)));
+                at = *end == ',' ? end + 1 : end;
+            }
+            if (note.dir_id > 0) features.push_back(directory_feature(note.dir_id));
+            if (!save(db, note.id, features)) return false;
+        }
+        if (!txn.commit()) return false;
+        after = batch.back().id;
+    }
+}
+
+// --- REBUILDING ---
+const std::string SELECT_VECTORS_SQL = "SELECT note_id, features FROM note_vectors ORDER BY note_id;";
+const std::string SELECT_VECTOR_SQL = "SELECT features FROM note_vectors WHERE note_id = ?;";
+const std::string SELECT_TAIL_SQL = "SELECT note_id, features FROM note_vectors WHERE note_id > ? ORDER BY note_id;";
+const std::string COUNT_TAIL_SQL = "SELECT COUNT(*) FROM note_vectors WHERE note_id > ?;";
+
+bool rebuild(db::Database& db) {
+    INK_TRACE_SCOPE("rebuild_similar_index");
+    const std::string db_path = db::file_path(db);
+    if (db_path.empty() || !backfill(db)) return false;
+    // Both passes read the same vectors
+    db::Transaction txn(db);
+    if (!txn.ok()) return false;
+
+    // First pass: rows, their lengths and how many notes have each feature
+    std::vector<int64_t> ids;
+    std::vector<uint64_t> offsets{0};
+    std::vector<uint32_t> frequencies[KIND_COUNT];
+    std::vector<std::pair<uint32_t, uint32_t>> counts;
+    {
+        db::Statement stmt = db.prepare(SELECT_VECTORS_SQL);
+        while (stmt.step()) {
+            decode(stmt.column_blob(1), counts);
+            for (const auto& entry : counts) {
+                auto& frequency = frequencies[kind_of(entry.first)];
+                size_t id = entry.first & ID_MASK;
+                if (id >= frequency.size()) frequency.resize(std::max(id + 1, frequency.size() * 2));
+                ++frequency[id];
+            }
+            ids.push_back(stmt.column_int64(0));
+            offsets.push_back(offsets.back() + counts.size());
+        }
+    }
+
+    // Columns go to features in ascending order. Each frequency is replaced
+    // by its feature's column.
+    const uint32_t NO_COLUMN = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> feature_ids;
+    std::vector<float> idf;
+    for (uint32_t kind = 0; kind < KIND_COUNT; ++kind) {
+        for (size_t id = 0; id < frequencies[kind].size(); ++id) {
+            uint32_t& frequency = frequencies[kind][id];
+            if (frequency == 0) { frequency = NO_COLUMN; continue; }
+            idf.push_back(inverse_frequency(ids.size(), frequency));
+            frequency = static_cast<uint32_t>(feature_ids.size());
+            feature_ids.push_back(make_feature(Kind(kind), static_cast<long long>(id)));
+        }
+    }
+
+    SnapshotHeader header;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.notes = ids.size();
+    header.entries = offsets.back();
+    header.features = feature_ids.size();
+    header.last_note_id = ids.empty() ? 0 : ids.back();
+    const Layout layout = layout_of(header);
+
+    // Filled in place through a shared mapping, then renamed over the old
+    // file so a query that already mapped it keeps reading a whole snapshot
+    const std::string path = snapshot_path(db_path);
+    const std::string temp_path = path + "." + std::to_string(getpid());
+    int fd = ::open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    void* map = ftruncate(fd, static_cast<off_t>(layout.size)) == 0
+                    ? mmap(nullptr, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                    : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    char* base = static_cast<char*>(map);
+    std::memcpy(base, &header, sizeof(header));
+    std::memcpy(base + layout.ids, ids.data(), ids.size() * sizeof(int64_t));
+    std::memcpy(base + layout.offsets, offsets.data(), offsets.size() * sizeof(uint64_t));
+    std::memcpy(base + layout.features, feature_ids.data(), feature_ids.size() * sizeof(uint32_t));
+    std::memcpy(base + layout.idf, idf.data(), idf.size() * sizeof(float));
+
+    // Second pass: each row's columns and normalized weights
+    auto* columns = reinterpret_cast<uint32_t*>(base + layout.columns);
+    auto* weights = reinterpret_cast<float*>(base + layout.weights);
+    size_t row = 0;
+    bool ok = true;
+    {
+        db::Statement stmt = db.prepare(SELECT_VECTORS_SQL);
+        while (ok && stmt.step()) {
+            decode(stmt.column_blob(1), counts);
+            ok = row < ids.size() && offsets[row + 1] - offsets[row] == counts.size();
+            if (!ok) break;
+            double norm = 0;
+            uint64_t at = offsets[row];
+            for (const auto& [feature, count] : counts) {
+                uint32_t column = frequencies[kind_of(feature)][feature & ID_MASK];
+                columns[at] = column;
+                weights[at] = feature_weight(feature, count, idf[column]);
+                norm += static_cast<double>(weights[at]) * weights[at];
+                ++at;
+            }
+            const float scale = norm > 0 ? static_cast<float>(1.0 / std::sqrt(norm)) : 0.0f;
+            for (at = offsets[row]; at < offsets[row + 1]; ++at) weights[at] *= scale;
+            ++row;
+        }
+    }
+    ok = ok && row == ids.size();
+    munmap(map, layout.size);
+    if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// --- SCORING ---
+// Notes saved since the snapshot are scored from note_vectors; past this
+// many, the next query rebuilds the snapshot first
+const long long TAIL_LIMIT = 4096;
+// Below this many rows per thread, another thread costs more than it saves
+const size_t ROWS_PER_THREAD = 65536;
+const size_t MAX_THREADS = 16;
+
+// The best `limit` matches seen so far, the worst of them on top of a heap
+class TopK {
+public:
+    explicit TopK(size_t limit) : limit_(limit) {}
+
+    // Scores at or below this can't get in
+    float floor() const { return heap_.empty() || heap_.size() < limit_ ? 0.0f : heap_.front().score; }
+
+    void push(long long id, float score) {
+        Match match{id, score};
+        if (score <= 0 || limit_ == 0) return;
+        if (heap_.size() < limit_) {
+            heap_.push_back(match);
+            std::push_heap(heap_.begin(), heap_.end(), better);
+        } else if (better(match, heap_.front())) {
+            std::pop_heap(heap_.begin(), heap_.end(), better);
+            heap_.back() = match;
+            std::push_heap(heap_.begin(), heap_.end(), better);
+        }
+    }
+
+    void merge(const TopK& other) {
+        for (const auto& match : other.heap_) push(match.id, match.score);
+    }
+
+    std::vector<Match> sorted() const {
+        std::vector<Match> matches = heap_;
+        std::sort(matches.begin(), matches.end(), better);
+        return matches;
+    }
+
+private:
+    // Ties go to the newer note
+    static bool better(const Match& a, const Match& b) { return a.score > b.score || (a.score == b.score && a.id > b.id); }
+
+    size_t limit_;
+    std::vector<Match> heap_;
+};
+
+// Scores rows [begin, end) against a dense query with one slot per column
+// plus a zero at `max_column`, where out-of-range columns are sent.
+void scan_scalar(const Snapshot& snapshot, const float* query, uint32_t max_column, size_t begin, size_t end, long long skip_id, TopK& top) {
+    for (size_t row = begin; row < end; ++row) {
+        uint64_t from, to;
+        snapshot.span(row, from, to);
+        float score = 0;
+        for (uint64_t at = from; at < to; ++at) score += snapshot.weights[at] * query[std::min(snapshot.columns[at], max_column)];
+        if (score > top.floor() && snapshot.ids[row] != skip_id) top.push(snapshot.ids[row], score);
+    }
+}
+
+#ifdef INK_AVX2_KERNEL
+// The same, gathering eight query weights per step. Lanes past the end of a
+// row are masked off, and the padding after the last row keeps the loads
+// inside the file.
+__attribute__((target("avx2,fma")))
+void scan_avx2(const Snapshot& snapshot, const float* query, uint32_t max_column, size_t begin, size_t end, long long skip_id, TopK& top) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i last = _mm256_set1_epi32(static_cast<int>(max_column));
+    for (size_t row = begin; row < end; ++row) {
+        uint64_t from, to;
+        snapshot.span(row, from, to);
+        __m256 sum = _mm256_setzero_ps();
+        for (uint64_t at = from; at < to; at += 8) {
+            const __m256i left = _mm256_set1_epi32(static_cast<int>(std::min<uint64_t>(to - at, 8)));
+            const __m256 mask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(left, lanes));
+            __m256i columns = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(snapshot.columns + at));
+            columns = _mm256_min_epu32(columns, last);
+            const __m256 gathered = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), query, columns, mask, 4);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(snapshot.weights + at), gathered, sum);
+        }
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        half = _mm_hadd_ps(half, half);
+        half = _mm_hadd_ps(half, half);
+        const float score = _mm_cvtss_f32(half);
+        if (score > top.floor() && snapshot.ids[row] != skip_id) top.push(snapshot.ids[row], score);
+    }
+}
+#endif
+
+using ScanFunction = void (*)(const Snapshot&, const float*, uint32_t, size_t, size_t, long long, TopK&);
+
+ScanFunction pick_kernel() {
+#ifdef INK_AVX2_KERNEL
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return scan_avx2;
+#endif
+    return scan_scalar;
+}
+
+// Scores every snapshot row, split across threads, each with its own heap
+void scan_snapshot(const Snapshot& snapshot, const std::vector<std::pair<uint32_t, float>>& query, long long skip_id, TopK& top, size_t limit) {
+    INK_TRACE_SCOPE("scan_snapshot");
+    if (snapshot.notes == 0) return;
+    const uint32_t max_column = static_cast<uint32_t>(snapshot.features);
+    std::vector<float> dense(snapshot.features + 1, 0.0f);
+    for (const auto& [feature, weight] : query) {
+        long long column = snapshot.column(feature);
+        if (column >= 0) dense[column] = weight;
+    }
+
+    static const ScanFunction scan = pick_kernel();
+    const size_t rows = snapshot.notes;
+    size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    threads = std::min({threads, MAX_THREADS, (rows + ROWS_PER_THREAD - 1) / ROWS_PER_THREAD});
+    std::vector<TopK> tops(threads, TopK(limit));
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(scan, std::cref(snapshot), dense.data(), max_column, rows * t / threads, rows * (t + 1) / threads, skip_id, std::ref(tops[t]));
+    }
+    scan(snapshot, dense.data(), max_column, 0, rows / threads, skip_id, tops[0]);
+    for (auto& worker : workers) worker.join();
+    for (const auto& partial : tops) top.merge(partial);
+}
+
+// Dot product of two vectors in feature order
+float dot(const std::vector<std::pair<uint32_t, float>>& a, const std::vector<std::pair<uint32_t, float>>& b) {
+    float sum = 0;
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (a[i].first < b[j].first) ++i;
+        else if (b[j].first < a[i].first) ++j;
+        else sum += a[i++].second * b[j++].second;
+    }
+    return sum;
+}
+
+long long count_tail(db::Database& db, long long last_note_id) {
+    db::Statement stmt = db.prepare(COUNT_TAIL_SQL);
+    return stmt.bind(1, last_note_id).step() ? stmt.column_int64(0) : -1;
+}
+
+bool find_similar(db::Database& db, long long note_id, size_t limit, std::vector<Match>& matches) {
+    INK_TRACE_SCOPE("find_similar");
+    matches.clear();
+    const std::string path = snapshot_path(db::file_path(db));
+    Snapshot snapshot;
+    long long tail = -1;
+    if (snapshot.open(path)) tail = count_tail(db, snapshot.last_note_id);
+    // Rebuilt when notes have gone (or never got vectors), or too many are new
+    if (tail < 0 || tail > TAIL_LIMIT || static_cast<long long>(snapshot.notes) + tail != db::get_total_notes_count(db)) {
+        if (!rebuild(db) || !snapshot.open(path)) return false;
+        tail = count_tail(db, snapshot.last_note_id);
+    }
+
+    // The query note's weighted vector, from the snapshot if it is there
+    std::vector<std::pair<uint32_t, float>> query;
+    std::vector<std::pair<uint32_t, uint32_t>> counts;
+    long long row = snapshot.row(note_id);
+    if (row >= 0) {
+        uint64_t from, to;
+        snapshot.span(static_cast<size_t>(row), from, to);
+        for (uint64_t at = from; at < to; ++at) {
+            if (snapshot.columns[at] < snapshot.features) query.emplace_back(snapshot.feature_ids[snapshot.columns[at]], snapshot.weights[at]);
+        }
+    } else {
+        db::Statement stmt = db.prepare(SELECT_VECTOR_SQL);
+        if (stmt.bind(1, note_id).step() && decode(stmt.column_blob(0), counts)) weigh(snapshot, counts, query);
+    }
+    if (query.empty() || limit == 0) return true;
+
+    TopK top(limit);
+    scan_snapshot(snapshot, query, note_id, top, limit);
+    if (tail > 0) {
+        std::vector<std::pair<uint32_t, float>> vector;
+        db::Statement stmt = db.prepare(SELECT_TAIL_SQL);
+        stmt.bind(1, static_cast<long long>(snapshot.last_note_id));
+        while (stmt.step()) {
+            long long id = stmt.column_int64(0);
+            if (id == note_id || !decode(stmt.column_blob(1), counts)) continue;
+            weigh(snapshot, counts, vector);
+            top.push(id, dot(query, vector));
+        }
+    }
+    matches = top.sorted();
+    return true;
+}
+
+}
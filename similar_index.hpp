@@ -0,0 +1,48 @@
+#ifndef SIMILAR_INDEX_HPP
+#define SIMILAR_INDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "database.hpp"
+
+// Related notes for `ink similar`. Each note keeps a sparse term vector in
+// note_vectors, written along with the note: its words (by fuzzy_terms id),
+// tags and project directory, with how often each occurs. Two notes are as
+// similar as the cosine of their TF-IDF weighted vectors.
+//
+// A query scores its note against every other one. Most vectors come from a
+// snapshot beside the database (~/.den_den_ink.vectors) that holds them
+// already weighted and normalized in flat arrays, mapped read-only and
+// scanned on every core, eight entries at a time where the CPU has AVX2.
+// Notes saved since the snapshot are read from note_vectors; once there are
+// too many of them, or notes have gone, the next query rebuilds it.
+namespace similar_index {
+    // A feature is a word, tag or directory id with its kind in the top two bits
+    uint32_t word_feature(long long term_id);
+    uint32_t tag_feature(long long tag_id);
+    uint32_t directory_feature(long long dir_id);
+
+    // Stores a new note's vector. `features` may be in any order and repeat;
+    // it is sorted in place. Runs inside the caller's transaction.
+    bool save(db::Database& db, long long note_id, std::vector<uint32_t>& features);
+
+    struct Match {
+        long long id;
+        float score; // Cosine similarity, in (0, 1]
+    };
+
+    // The `limit` notes most like `note_id`, best first, leaving out the
+    // note itself and notes with nothing in common with it. Only the hot
+    // database is searched. False on error.
+    bool find_similar(db::Database& db, long long note_id, size_t limit, std::vector<Match>& matches);
+
+    // Gives notes saved before vectors existed theirs, then writes a fresh
+    // snapshot of every vector.
+    bool rebuild(db::Database& db);
+
+    // Path of the snapshot for a database file.
+    std::string snapshot_path(const std::string& db_path);
+}
+
+#endif
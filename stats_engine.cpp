@@ -1,27 +1,110 @@
 #include "stats_engine.hpp"
+#include "archive.hpp"
 #include "database.hpp"
+#include "query_executor.hpp"
+#include "trace.hpp"
 #include <iostream>
 #include <iomanip> 
 #include <algorithm>
+#include <cstdio>
+#include <map>
+#include <unordered_map>
+#include "time_window.hpp"
 
 namespace stats {
 
-AppStats gather_stats(sqlite3* db) {
+// How many rows each section of the report shows
+const int TOP_TAGS = 5;
+const int TOP_PROJECTS = 5;
+const int RECENT_DAYS = 7;
+
+// Adds one database's counts into `totals`, by name
+void add_counts(std::map<std::string, int>& totals, const std::vector<std::pair<std::string, int>>& counts) {
+    for (const auto& p : counts) totals[p.first] += p.second;
+}
+
+// The `limit` largest counts, ties by name
+std::vector<StatItem> top_counts(const std::map<std::string, int>& totals, int limit) {
+    std::vector<StatItem> items;
+    for (const auto& p : totals) items.push_back({p.first, p.second});
+    std::stable_sort(items.begin(), items.end(), [](const StatItem& a, const StatItem& b) { return a.count > b.count; });
+    if (items.size() > static_cast<size_t>(limit)) items.resize(static_cast<size_t>(limit));
+    return items;
+}
+
+// One database's counter tables
+struct Counters {
+    int total = 0;
+    std::vector<std::pair<std::string, int>> tags, projects, days;
+};
+
+Counters read_counters(db::Database& db) {
+    return {db::get_total_notes_count(db), db::get_tag_counts(db, -1), db::get_project_counts(db, -1), db::get_daily_counts(db, RECENT_DAYS)};
+}
+
+// Sums each archive's counter tables with the hot database's. Archives are
+// few (one per year) and their counters are as cheap to read as the hot
+// ones; with reader threads the cost is mostly opening them, so they are
+// opened and read side by side.
+AppStats gather_tiered_stats(db::Database& db, const std::vector<archive::Tier>& tiers) {
+    AppStats app_stats;
+    std::vector<Counters> counters(tiers.size() + 1);
+    counters[0] = read_counters(db);
+    std::vector<size_t> present;
+    for (size_t i = 0; i < tiers.size(); ++i) {
+        if (archive::tier_present(tiers[i])) present.push_back(i);
+        else app_stats.missing_archives.push_back(tiers[i].path);
+    }
+    bool read = false;
+    if (query_executor::Executor* executor = query_executor::shared()) {
+        std::vector<query_executor::Task> tasks;
+        for (size_t i : present) {
+            tasks.push_back({tiers[i].path, [&counters, i](db::Database& reader) { counters[i + 1] = read_counters(reader); }});
+        }
+        read = executor->run(tasks);
+    }
+    // Without reader threads, or if one couldn't open its archive
+    for (size_t i = 0; i < present.size() && !read; ++i) {
+        if (auto archive_db = archive::open_tier(tiers[present[i]], &app_stats.missing_archives)) {
+            counters[present[i] + 1] = read_counters(*archive_db);
+        }
+    }
+
+    app_stats.total_notes = 0;
+    std::map<std::string, int> tags, projects, days;
+    for (const auto& source : counters) {
+        app_stats.total_notes += source.total;
+        add_counts(tags, source.tags);
+        add_counts(projects, source.projects);
+        add_counts(days, source.days);
+    }
+    app_stats.top_tags = top_counts(tags, TOP_TAGS);
+    app_stats.notes_per_project = top_counts(projects, TOP_PROJECTS);
+    for (auto it = days.rbegin(); it != days.rend() && app_stats.notes_per_day.size() < static_cast<size_t>(RECENT_DAYS); ++it) {
+        app_stats.notes_per_day.push_back({it->first, it->second});
+    }
+    return app_stats;
+}
+
+AppStats gather_stats(db::Database& db) {
+    INK_TRACE_SCOPE("gather_stats");
+    std::vector<archive::Tier> tiers = archive::list_tiers(db);
+    if (!tiers.empty()) return gather_tiered_stats(db, tiers);
     AppStats app_stats;
     app_stats.total_notes = db::get_total_notes_count(db);
     
     // Convert std::pair to StatItem
-    auto tag_pairs = db::get_tag_counts(db);
+    auto tag_pairs = db::get_tag_counts(db, TOP_TAGS);
     for (const auto& p : tag_pairs) {
         app_stats.top_tags.push_back({p.first, p.second});
     }
 
-    auto project_pairs = db::get_project_counts(db);
+    auto project_pairs = db::get_project_counts(db, TOP_PROJECTS);
     for (const auto& p : project_pairs) {
         app_stats.notes_per_project.push_back({p.first, p.second});
     }
     
-    auto daily_pairs = db::get_daily_counts(db);
+    auto daily_pairs = db::get_daily_counts(db, RECENT_DAYS);
     for (const auto& p : daily_pairs) {
         app_stats.notes_per_day.push_back({p.first, p.second});
     }
@@ -29,43 +112,395 @@ AppStats gather_stats(sqlite3* db) {
     return app_stats;
 }
 
-void print_stats(const AppStats& stats) {
-    std::cout << "\n--- 📊 Den Den Ink Statistics ---" << std::endl;
+void print_text(const AppStats& stats, std::ostream& out) {
+    out << "\n--- 📊 Den Den Ink Statistics ---\n";
     
     // 1. Total Notes
-    std::cout << "\nTotal Notes: " << stats.total_notes << std::endl;
+    out << "\nTotal Notes: " << stats.total_notes << '\n';
 
     // 2. Top Tags
     if (!stats.top_tags.empty()) {
-        std::cout << "\n--- Top 5 Tags ---" << std::endl;
-        size_t limit = std::min<size_t>(5, stats.top_tags.size());
+        out << "\n--- Top 5 Tags ---\n";
+        size_t limit = std::min<size_t>(TOP_TAGS, stats.top_tags.size());
         for (size_t i = 0; i < limit; ++i) {
-            std::cout << " #" << std::left << std::setw(20) << stats.top_tags[i].name 
-                      << " (" << stats.top_tags[i].count << " uses)" << std::endl;
+            out << " #" << std::left << std::setw(20) << stats.top_tags[i].name 
+                      << " (" << stats.top_tags[i].count << " uses)\n";
         }
     }
 
     // 3. Notes Per Project
     if (!stats.notes_per_project.empty()) {
-        std::cout << "\n--- Top 5 Projects ---" << std::endl;
-        size_t limit = std::min<size_t>(5, stats.notes_per_project.size());
+        out << "\n--- Top 5 Projects ---\n";
+        size_t limit = std::min<size_t>(TOP_PROJECTS, stats.notes_per_project.size());
         for (size_t i = 0; i < limit; ++i) {
-             std::cout << " " << std::left << std::setw(30) << stats.notes_per_project[i].name 
-                       << " (" << stats.notes_per_project[i].count << " notes)" << std::endl;
+             out << " " << std::left << std::setw(30) << stats.notes_per_project[i].name 
+                       << " (" << stats.notes_per_project[i].count << " notes)\n";
         }
     }
     
     // 4. Notes Per Day
     if (!stats.notes_per_day.empty()) {
-        std::cout << "\n--- Recent Activity (Last 7 Days) ---" << std::endl;
-        size_t limit = std::min<size_t>(7, stats.notes_per_day.size());
+        out << "\n--- Recent Activity (Last 7 Days) ---\n";
+        size_t limit = std::min<size_t>(RECENT_DAYS, stats.notes_per_day.size());
         for (size_t i = 0; i < limit; ++i) {
-             std::cout << " " << stats.notes_per_day[i].name << ": " 
-                       << stats.notes_per_day[i].count << " notes" << std::endl;
+             out << " " << stats.notes_per_day[i].name << ": " 
+                       << stats.notes_per_day[i].count << " notes\n";
+        }
+    }
+
+    out << "\n-----------------------------------\n";
+    out.flush();
+}
+
+// The sections as (name, rows) in report order
+struct Section {
+    const char* name;
+    const std::vector<StatItem>& items;
+};
+
+// {"total_notes":N,"tags":[{"name":"cpp","count":3}],"projects":[...],"days":[...]}
+// ,"days":[{"name":"2024-01-01","count":3},...]
+void print_json_section(const Section& section, formatter::OutputBuffer& out) {
+    out << ",\"" << section.name << "\":[";
+    for (size_t i = 0; i < section.items.size(); ++i) {
+        out << (i ? ",{\"name\":" : "{\"name\":");
+        out.json_string(section.items[i].name);
+        out << ",\"count\":" << static_cast<long long>(section.items[i].count) << '}';
+    }
+    out << ']';
+}
+
+void print_json(const AppStats& stats, const Section (&sections)[3], formatter::OutputBuffer& out) {
+    out << "{\"total_notes\":" << static_cast<long long>(stats.total_notes);
+    for (const auto& section : sections) print_json_section(section, out);
+    out << "}\n";
+}
+
+// One row per line, led by its section: {"section":"tags","name":"cpp","count":3}
+// in jsonl, or section, name, count fields in tsv and nul.
+void print_row(formatter::OutputBuffer& out, formatter::Format format, std::string_view section, std::string_view name, long long count) {
+    if (format == formatter::Format::Jsonl) {
+        out << "{\"section\":";
+        out.json_string(section);
+        out << ",\"name\":";
+        out.json_string(name);
+        out << ",\"count\":" << count << "}\n";
+        return;
+    }
+    out.record_field(section, format);
+    out << '\t';
+    out.record_field(name, format);
+    out << '\t' << count << (format == formatter::Format::Nul ? '\0' : '\n');
+}
+
+// The total comes first, as section "total" with name "notes".
+void print_rows(const AppStats& stats, const Section (&sections)[3], formatter::OutputBuffer& out, formatter::Format format) {
+    print_row(out, format, "total", "notes", stats.total_notes);
+    for (const auto& section : sections) {
+        for (const auto& item : section.items) print_row(out, format, section.name, item.name, item.count);
+    }
+}
+
+void print_stats(const AppStats& stats, std::ostream& out, formatter::Format format) {
+    INK_TRACE_SCOPE("print_stats");
+    if (format == formatter::Format::Text) {
+        print_text(stats, out);
+        return;
+    }
+    const Section sections[3] = {{"tags", stats.top_tags}, {"projects", stats.notes_per_project}, {"days", stats.notes_per_day}};
+    formatter::OutputBuffer buffer(out);
+    if (format == formatter::Format::Json) print_json(stats, sections, buffer);
+    else print_rows(stats, sections, buffer, format);
+}
+
+// --- ACTIVITY WINDOWS ---
+// Per-day bins cover the window; the other histograms are folded from them
+// afterwards, so the notes are read once.
+
+// Notes per slice when a database's part of the window is split up to be
+// scanned by several reader threads
+const long long ACTIVITY_SPLIT_NOTES = 50000;
+
+// Counts from one scan, added together afterwards
+struct Tally {
+    int total = 0;
+    std::vector<int> days;
+    int hours[24] = {};
+    std::unordered_map<long long, std::pair<int, int>> dir_halves; // By dir_id, which is per database
+};
+
+// A stretch of the window in one database, scanned on its own
+struct Slice {
+    size_t source;
+    std::string since;
+    std::string until;
+    Tally tally;
+};
+
+// Cuts a database's part of the window at midnights into up to `parts`
+// slices holding about as many notes each, going by its daily counters
+void add_slices(db::Database& db, size_t source, const std::string& since, const std::string& until, size_t parts, std::vector<Slice>& slices) {
+    std::vector<std::pair<std::string, int>> days;
+    long long notes = 0;
+    if (parts > 1) {
+        days = db::get_daily_counts_between(db, since, until);
+        for (const auto& day : days) notes += day.second;
+        parts = static_cast<size_t>(std::max(1LL, std::min(static_cast<long long>(parts), notes / ACTIVITY_SPLIT_NOTES)));
+    }
+    std::string from = since;
+    long long seen = 0;
+    for (const auto& day : days) {
+        if (parts <= 1) break;
+        // A slice ends before the first day that would take it past its
+        // share of the notes left
+        std::string midnight = day.first + " 00:00:00";
+        if (seen * static_cast<long long>(parts) >= notes && midnight > from && (until.empty() || midnight < until)) {
+            slices.push_back({source, from, midnight, {}});
+            from = midnight;
+            --parts;
+            notes -= seen;
+            seen = 0;
+        }
+        seen += day.second;
+    }
+    slices.push_back({source, from, until, {}});
+}
+
+ActivityReport gather_activity(db::Database& db, long long since, long long until, long long now) {
+    INK_TRACE_SCOPE("gather_activity");
+    ActivityReport report;
+    const std::string since_text = since >= 0 ? time_window::format_timestamp(since) : "";
+    const std::string until_text = until >= 0 ? time_window::format_timestamp(until) : "";
+    // The hot database and any archives the window reaches into
+    std::vector<std::shared_ptr<db::Database>> archives;
+    for (const auto& tier : archive::list_tiers(db, since_text, until_text)) {
+        if (auto archive_db = archive::open_tier(tier, &report.missing_archives)) archives.push_back(archive_db);
+    }
+    std::vector<db::Database*> sources = {&db};
+    for (const auto& archive_db : archives) sources.push_back(archive_db.get());
+
+    long long start = since;
+    if (start < 0) {
+        // An open window starts at the oldest note anywhere
+        std::string oldest;
+        for (db::Database* source : sources) {
+            std::string candidate = db::get_oldest_timestamp(*source);
+            if (!candidate.empty() && (oldest.empty() || candidate < oldest)) oldest = candidate;
+        }
+        if (!time_window::parse_timestamp(oldest, start)) start = now;
+    }
+    const long long end = until >= 0 ? until : now + 1;
+    const long long first_day = time_window::day_of(start);
+    const long long middle = start + (end - start) / 2;
+    const size_t day_count = static_cast<size_t>(std::max(1LL, time_window::day_of(end - 1) - first_day + 1));
+
+    auto count = [&](Tally& tally) {
+        tally.days.assign(day_count, 0);
+        return [&tally, first_day, middle](std::string_view timestamp, long long dir_id) {
+            long long epoch;
+            if (!time_window::parse_timestamp(timestamp, epoch)) return;
+            ++tally.total;
+            // Notes dated ahead of an open-ended window still get a bin
+            long long day = time_window::day_of(epoch) - first_day;
+            if (day >= static_cast<long long>(tally.days.size())) tally.days.resize(static_cast<size_t>(day) + 1, 0);
+            if (day >= 0) ++tally.days[static_cast<size_t>(day)];
+            ++tally.hours[(epoch - time_window::day_of(epoch) * time_window::SECONDS_PER_DAY) / 3600];
+            if (dir_id >= 0) {
+                auto& halves = tally.dir_halves[dir_id];
+                ++(epoch < middle ? halves.first : halves.second);
+            }
+        };
+    };
+
+    // With reader threads, large windows are scanned a slice per thread
+    query_executor::Executor* executor = query_executor::shared();
+    std::vector<std::string> paths;
+    std::vector<Slice> slices;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        paths.push_back(executor ? db::file_path(*sources[i]) : "");
+        add_slices(*sources[i], i, since_text, until_text, paths[i].empty() ? 1 : executor->threads(), slices);
+    }
+    bool scanned = false;
+    if (slices.size() > sources.size()) {
+        std::vector<query_executor::Task> tasks;
+        for (auto& slice : slices) {
+            tasks.push_back({paths[slice.source], [&count, &slice](db::Database& reader) {
+                db::scan_window(reader, slice.since, slice.until, count(slice.tally));
+            }});
+        }
+        scanned = executor->run(tasks);
+    }
+    if (!scanned) {
+        slices.clear();
+        for (size_t i = 0; i < sources.size(); ++i) {
+            slices.push_back({i, since_text, until_text, {}});
+            db::scan_window(*sources[i], since_text, until_text, count(slices.back().tally));
+        }
+    }
+
+    std::vector<int> days(day_count, 0);
+    int hours[24] = {};
+    std::unordered_map<std::string, std::pair<int, int>> projects; // Path -> (first half, second half)
+    for (const auto& slice : slices) {
+        report.total_notes += slice.tally.total;
+        if (slice.tally.days.size() > days.size()) days.resize(slice.tally.days.size(), 0);
+        for (size_t i = 0; i < slice.tally.days.size(); ++i) days[i] += slice.tally.days[i];
+        for (int hour = 0; hour < 24; ++hour) hours[hour] += slice.tally.hours[hour];
+        // Directory ids are per database, so projects are matched up by path
+        for (const auto& p : slice.tally.dir_halves) {
+            auto& halves = projects[db::get_directory_path(*sources[slice.source], p.first)];
+            halves.first += p.second.first;
+            halves.second += p.second.second;
+        }
+    }
+
+    report.first_day = time_window::format_day(first_day);
+    report.last_day = time_window::format_day(first_day + static_cast<long long>(days.size()) - 1);
+    int streak = 0;
+    for (size_t i = 0; i < days.size(); ++i) {
+        const long long day = first_day + static_cast<long long>(i);
+        report.per_day.push_back({time_window::format_day(day), days[i]});
+        // A week is named by its Monday; the first may start before the window
+        if (i == 0 || time_window::weekday(day) == 0) {
+            report.per_week.push_back({time_window::format_day(day - time_window::weekday(day)), 0});
+        }
+        report.per_week.back().count += days[i];
+        streak = days[i] > 0 ? streak + 1 : 0;
+        if (streak > report.longest_streak) {
+            report.longest_streak = streak;
+            report.longest_streak_end = report.per_day.back().name;
         }
     }
+    // Today may simply not have a note yet, so a streak through yesterday still counts
+    size_t last = days.size() - 1;
+    if (days[last] == 0 && last > 0) --last;
+    for (size_t i = last + 1; i-- > 0 && days[i] > 0;) ++report.current_streak;
+
+    for (int hour = 0; hour < 24; ++hour) {
+        char name[4];
+        std::snprintf(name, sizeof(name), "%02d", hour);
+        report.per_hour.push_back({name, hours[hour]});
+    }
+
+    std::vector<std::pair<std::string, std::pair<int, int>>> busiest(projects.begin(), projects.end());
+    auto total = [](const std::pair<std::string, std::pair<int, int>>& p) { return p.second.first + p.second.second; };
+    std::sort(busiest.begin(), busiest.end(), [&](const auto& a, const auto& b) {
+        return total(a) != total(b) ? total(a) > total(b) : a.first < b.first;
+    });
+    if (busiest.size() > static_cast<size_t>(TOP_PROJECTS)) busiest.resize(TOP_PROJECTS);
+    for (const auto& p : busiest) {
+        report.projects.push_back({p.first, total(p), p.second.first, p.second.second});
+    }
+    return report;
+}
+
+// Longest histograms are printed per week only
+const size_t MAX_TEXT_DAYS = 31;
+const int BAR_WIDTH = 30;
 
-    std::cout << "\n-----------------------------------\n";
+std::string bar(int count, int largest) {
+    std::string text;
+    int length = largest > 0 ? (count * BAR_WIDTH + largest - 1) / largest : 0;
+    for (int i = 0; i < length; ++i) text += "█";
+    return text;
 }
 
-}
\ No newline at end of file
+void print_histogram(const std::vector<StatItem>& items, std::ostream& out) {
+    int largest = 0;
+    for (const auto& item : items) largest = std::max(largest, item.count);
+    for (const auto& item : items) {
+        out << " " << item.name << " " << std::right << std::setw(6) << item.count;
+        if (item.count > 0) out << " " << bar(item.count, largest);
+        out << '\n';
+    }
+}
+
+void print_activity_text(const ActivityReport& report, std::ostream& out) {
+    out << "\n--- 📈 Den Den Ink Activity: " << report.first_day << " to " << report.last_day << " ---\n";
+    out << "\nNotes: " << report.total_notes << '\n';
+    if (report.total_notes > 0) {
+        if (report.per_day.size() <= MAX_TEXT_DAYS) {
+            out << "\n--- Notes Per Day ---\n";
+            print_histogram(report.per_day, out);
+        }
+        if (report.per_week.size() > 1) {
+            out << "\n--- Notes Per Week (from Monday) ---\n";
+            print_histogram(report.per_week, out);
+        }
+        out << "\n--- Notes By Hour (UTC) ---\n";
+        print_histogram(report.per_hour, out);
+    }
+
+    out << "\n--- Streaks ---\n";
+    out << " Longest: " << report.longest_streak << " day(s)";
+    if (report.longest_streak > 0) out << ", ending " << report.longest_streak_end;
+    out << "\n Current: " << report.current_streak << " day(s)\n";
+
+    if (!report.projects.empty()) {
+        out << "\n--- Top " << report.projects.size() << " Projects ---\n";
+        for (const auto& project : report.projects) {
+            const char* trend = project.second_half > project.first_half ? "▲" : project.second_half < project.first_half ? "▼" : "=";
+            out << " " << std::left << std::setw(30) << project.name << " (" << project.count << " notes, "
+                << project.first_half << " → " << project.second_half << " " << trend << ")\n";
+        }
+    }
+    out << "\n-----------------------------------\n";
+    out.flush();
+}
+
+// {"first_day":"...","last_day":"...","total_notes":N,"days":[...],"weeks":[...],"hours":[...],
+//  "streaks":{"longest":5,"longest_end":"...","current":2},
+//  "projects":[{"name":"...","count":12,"first_half":4,"second_half":8}]}
+void print_activity_json(const ActivityReport& report, formatter::OutputBuffer& out) {
+    out << "{\"first_day\":";
+    out.json_string(report.first_day);
+    out << ",\"last_day\":";
+    out.json_string(report.last_day);
+    out << ",\"total_notes\":" << static_cast<long long>(report.total_notes);
+    print_json_section({"days", report.per_day}, out);
+    print_json_section({"weeks", report.per_week}, out);
+    print_json_section({"hours", report.per_hour}, out);
+    out << ",\"streaks\":{\"longest\":" << static_cast<long long>(report.longest_streak) << ",\"longest_end\":";
+    out.json_string(report.longest_streak_end, true);
+    out << ",\"current\":" << static_cast<long long>(report.current_streak) << "},\"projects\":[";
+    for (size_t i = 0; i < report.projects.size(); ++i) {
+        const ProjectTrend& project = report.projects[i];
+        out << (i ? ",{\"name\":" : "{\"name\":");
+        out.json_string(project.name);
+        out << ",\"count\":" << static_cast<long long>(project.count)
+            << ",\"first_half\":" << static_cast<long long>(project.first_half)
+            << ",\"second_half\":" << static_cast<long long>(project.second_half) << '}';
+    }
+    out << "]}\n";
+}
+
+// Rows as in print_rows. Streaks are section "streaks" with names "longest"
+// and "current"; each project has a "projects" row with its count and
+// "projects_first_half" and "projects_second_half" rows.
+void print_activity_rows(const ActivityReport& report, formatter::OutputBuffer& out, formatter::Format format) {
+    print_row(out, format, "total", "notes", report.total_notes);
+    const Section sections[3] = {{"days", report.per_day}, {"weeks", report.per_week}, {"hours", report.per_hour}};
+    for (const auto& section : sections) {
+        for (const auto& item : section.items) print_row(out, format, section.name, item.name, item.count);
+    }
+    print_row(out, format, "streaks", "longest", report.longest_streak);
+    print_row(out, format, "streaks", "current", report.current_streak);
+    for (const auto& project : report.projects) {
+        print_row(out, format, "projects", project.name, project.count);
+        print_row(out, format, "projects_first_half", project.name, project.first_half);
+        print_row(out, format, "projects_second_half", project.name, project.second_half);
+    }
+}
+
+void print_activity(const ActivityReport& report, std::ostream& out, formatter::Format format) {
+    INK_TRACE_SCOPE("print_activity");
+    if (format == formatter::Format::Text) {
+        print_activity_text(report, out);
+        return;
+    }
+    formatter::OutputBuffer buffer(out);
+    if (format == formatter::Format::Json) print_activity_json(report, buffer);
+    else print_activity_rows(report, buffer, format);
+}
+
+}
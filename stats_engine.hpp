@@ -3,7 +3,9 @@
 
 #include <string>
 #include <vector>
-#include <sqlite3.h> // For the sqlite3 pointer
+#include <iostream>
+#include "database.hpp" // For db::Database
+#include "note_formatter.hpp"
 
 // A simple struct to hold a name and a count.
 // Used for tags, projects, and daily counts.
@@ -18,14 +20,50 @@ struct AppStats {
     std::vector<StatItem> top_tags;
     std::vector<StatItem> notes_per_project;
     std::vector<StatItem> notes_per_day;
+    std::vector<std::string> missing_archives; // Left out because they couldn't be read
+};
+
+// A project's notes within an activity window, split at its midpoint so the
+// two halves show which way it is going.
+struct ProjectTrend {
+    std::string name;
+    int count;
+    int first_half;
+    int second_half;
+};
+
+// Activity within one --since/--until window. Days and hours are UTC, like
+// the stored timestamps.
+struct ActivityReport {
+    std::string first_day;        // The window's days, "YYYY-MM-DD"
+    std::string last_day;
+    int total_notes = 0;
+    std::vector<StatItem> per_day;  // Every day of the window, oldest first
+    std::vector<StatItem> per_week; // Named by their Monday
+    std::vector<StatItem> per_hour; // "00" to "23"
+    int longest_streak = 0;         // Most consecutive days with notes
+    std::string longest_streak_end;
+    int current_streak = 0;         // Days with notes up to the window's last day (or the day before)
+    std::vector<ProjectTrend> projects; // Busiest first
+    std::vector<std::string> missing_archives; // Left out because they couldn't be read
 };
 
 namespace stats {
     // Gathers all statistics from the database.
-    AppStats gather_stats(sqlite3* db);
+    AppStats gather_stats(db::Database& db);
+
+    // Prints the gathered statistics to the console. Machine-readable formats
+    // carry the same sections: a total, then tags, projects and days.
+    void print_stats(const AppStats& stats, std::ostream& out = std::cout, formatter::Format format = formatter::Format::Text);
+
+    // Builds the report in one pass over the notes in [since, until), given
+    // in epoch seconds; -1 leaves that end open. The cost follows the size
+    // of the window, not of the whole history.
+    ActivityReport gather_activity(db::Database& db, long long since, long long until, long long now);
 
-    // Prints the gathered statistics to the console.
-    void print_stats(const AppStats& stats);
+    // Prints the report. Machine-readable formats carry every day and hour,
+    // including empty ones.
+    void print_activity(const ActivityReport& report, std::ostream& out = std::cout, formatter::Format format = formatter::Format::Text);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,262 @@
+#include "tag_index.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+
+namespace tag_index {
+
+// --- POSTING LISTS ---
+void TagIndex::drop_if_stale(db::Database& db) {
+    // data_version moves when another connection commits; total_changes
+    // counts this connection's own writes
+    db::Statement stmt = db.prepare("PRAGMA data_version;");
+    long long version = stmt.step() ? stmt.column_int64(0) : -1;
+    int changes = sqlite3_total_changes(db.handle());
+    if (version != data_version_ || changes != total_changes_) {
+        lists_.clear();
+        data_version_ = version;
+        total_changes_ = changes;
+    }
+}
+
+std::shared_ptr<const Postings> TagIndex::postings(db::Database& db, const std::string& tag) {
+    drop_if_stale(db);
+    auto found = lists_.find(tag);
+    if (found != lists_.end()) return found->second;
+
+    auto list = std::make_shared<Postings>();
+    // One range of note_tags' (tag_id, note_id) key, already sorted and unique
+    db::Statement stmt = db.prepare("SELECT note_id FROM note_tags WHERE tag_id = (SELECT id FROM tag_dict WHERE name = ?) ORDER BY note_id;");
+    stmt.bind(1, tag);
+    while (stmt.step()) list->push_back(stmt.column_int64(0));
+    lists_.emplace(tag, list);
+    return list;
+}
+
+// --- SET OPERATIONS ---
+// Past this length ratio, binary searching forward through the longer list
+// beats walking it element by element.
+const size_t GALLOP_RATIO = 32;
+
+// Finds the first element >= value at or after `from`, probing 1, 2, 4...
+// steps ahead before binary searching the last gap.
+Postings::const_iterator gallop(Postings::const_iterator from, Postings::const_iterator end, long long value) {
+    size_t step = 1;
+    auto low = from;
+    while (true) {
+        if (static_cast<size_t>(end - low) <= step) return std::lower_bound(low, end, value);
+        auto probe = low + step;
+        if (*probe >= value) return std::lower_bound(low, probe, value);
+        low = probe;
+        step *= 2;
+    }
+}
+
+Postings intersect(const Postings& a, const Postings& b) {
+    const Postings& small = a.size() <= b.size() ? a : b;
+    const Postings& large = a.size() <= b.size() ? b : a;
+    Postings result;
+    if (large.size() / GALLOP_RATIO > small.size()) {
+        auto it = large.begin();
+        for (long long id : small) {
+            it = gallop(it, large.end(), id);
+            if (it == large.end()) break;
+            if (*it == id) result.push_back(id);
+        }
+        return result;
+    }
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+
+Postings unite(const Postings& a, const Postings& b) {
+    Postings result;
+    result.reserve(a.size() + b.size());
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+
+Postings subtract(const Postings& a, const Postings& b) {
+    Postings result;
+    if (b.size() / GALLOP_RATIO > a.size()) {
+        auto it = b.begin();
+        for (long long id : a) {
+            it = gallop(it, b.end(), id);
+            if (it == b.end() || *it != id) result.push_back(id);
+        }
+        return result;
+    }
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+
+// --- QUERY PARSING ---
+bool is_operator(const std::string& token) {
+    return token == "AND" || token == "OR" || token == "NOT";
+}
+
+bool starts_operand(const std::string& token) {
+    return token[0] == '#' || token == "(" || token == "NOT";
+}
+
+void split_query(const std::string& input, std::string& text, std::vector<std::string>& tag_tokens) {
+    // Tokenize on whitespace, keeping "quoted phrases" whole
+    std::vector<std::string> words;
+    size_t i = 0;
+    while (i < input.size()) {
+        if (std::isspace(static_cast<unsigned char>(input[i]))) { ++i; continue; }
+        size_t end = i;
+        if (input[i] == '"') {
+            end = input.find('"', i + 1);
+            end = end == std::string::npos ? input.size() : end + 1;
+        }
+        while (end < input.size() && !std::isspace(static_cast<unsigned char>(input[end]))) ++end;
+        std::string word = input.substr(i, end - i);
+        i = end;
+        // Parentheses written against a tag, as in `(#cpp OR #go)`, are tokens of their own
+        size_t open = word.find_first_not_of('(');
+        size_t close = word.find_last_not_of(')');
+        if (open == std::string::npos || word[open] != '#') {
+            words.push_back(word);
+            continue;
+        }
+        words.insert(words.end(), open, "(");
+        words.push_back(word.substr(open, close + 1 - open));
+        words.insert(words.end(), word.size() - close - 1, ")");
+    }
+
+    text.clear();
+    for (size_t w = 0; w < words.size(); ++w) {
+        const std::string& word = words[w];
+        bool tag_token = word[0] == '#' || word == "(" || word == ")";
+        // "AND" in `cache AND #perf` joins tags; in `rock AND roll` it's text
+        if (!tag_token && is_operator(word) && w + 1 < words.size() && starts_operand(words[w + 1])) tag_token = true;
+        if (tag_token) {
+            if (word.size() > 1 || word[0] != '#') tag_tokens.push_back(word);
+        } else {
+            if (!text.empty()) text += ' ';
+            text += word;
+        }
+    }
+}
+
+// Recursive descent over the token list: or := and (OR and)*,
+// and := unary ([AND] unary)*, unary := NOT unary | ( or ) | #tag.
+struct Parser {
+    const std::vector<std::string>& tokens;
+    size_t pos = 0;
+
+    bool at(const char* token) const { return pos < tokens.size() && tokens[pos] == token; }
+
+    bool parse_or(TagExpression& expr) {
+        if (!parse_and(expr)) return false;
+        while (at("OR")) {
+            ++pos;
+            TagExpression right;
+            if (!parse_and(right)) return false;
+            combine(TagExpression::Kind::Or, expr, std::move(right));
+        }
+        return true;
+    }
+
+    bool parse_and(TagExpression& expr) {
+        if (!parse_unary(expr)) return false;
+        while (pos < tokens.size() && !at("OR") && !at(")")) {
+            if (at("AND")) ++pos;
+            TagExpression right;
+            if (!parse_unary(right)) return false;
+            combine(TagExpression::Kind::And, expr, std::move(right));
+        }
+        return true;
+    }
+
+    bool parse_unary(TagExpression& expr) {
+        if (pos >= tokens.size()) return false;
+        const std::string& token = tokens[pos++];
+        if (token == "NOT") {
+            expr.kind = TagExpression::Kind::Not;
+            expr.operands.emplace_back();
+            return parse_unary(expr.operands.back());
+        }
+        if (token == "(") {
+            if (!parse_or(expr) || !at(")")) return false;
+            ++pos;
+            return true;
+        }
+        if (token[0] != '#' || token.size() < 2) return false;
+        expr.kind = TagExpression::Kind::Tag;
+        expr.tag = token.substr(1);
+        return true;
+    }
+
+    // Folds `right` into `left`, flattening chains like a AND b AND c.
+    static void combine(TagExpression::Kind kind, TagExpression& left, TagExpression right) {
+        if (left.kind != kind) {
+            TagExpression node;
+            node.kind = kind;
+            node.operands.push_back(std::move(left));
+            left = std::move(node);
+        }
+        left.operands.push_back(std::move(right));
+    }
+};
+
+bool parse(const std::vector<std::string>& tokens, TagExpression& expr) {
+    if (tokens.empty()) return false;
+    Parser parser{tokens};
+    return parser.parse_or(expr) && parser.pos == tokens.size();
+}
+
+// --- EVALUATION ---
+// A negated filter stands for every note outside its ids, so NOT never has
+// to materialize the full set of notes.
+TagFilter evaluate_node(TagIndex& index, db::Database& db, const TagExpression& expr) {
+    if (expr.kind == TagExpression::Kind::Tag) {
+        return TagFilter{index.postings(db, expr.tag), false};
+    }
+    if (expr.kind == TagExpression::Kind::Not) {
+        TagFilter inner = evaluate_node(index, db, expr.operands[0]);
+        inner.negated = !inner.negated;
+        return inner;
+    }
+
+    // Intersect the shortest lists first so the working set shrinks fastest
+    std::vector<TagFilter> parts;
+    for (const auto& operand : expr.operands) parts.push_back(evaluate_node(index, db, operand));
+    std::sort(parts.begin(), parts.end(), [](const TagFilter& a, const TagFilter& b) {
+        return a.ids->size() < b.ids->size();
+    });
+
+    bool is_and = expr.kind == TagExpression::Kind::And;
+    TagFilter result = parts[0];
+    for (size_t i = 1; i < parts.size(); ++i) {
+        const TagFilter& part = parts[i];
+        const Postings& a = *result.ids;
+        const Postings& b = *part.ids;
+        Postings combined;
+        bool negated;
+        if (is_and) {
+            // A & B, A & ~B, ~A & B, ~A & ~B = ~(A | B)
+            if (!result.negated && !part.negated) { combined = intersect(a, b); negated = false; }
+            else if (!result.negated) { combined = subtract(a, b); negated = false; }
+            else if (!part.negated) { combined = subtract(b, a); negated = false; }
+            else { combined = unite(a, b); negated = true; }
+        } else {
+            // A | B, A | ~B = ~(B - A), ~A | B = ~(A - B), ~A | ~B = ~(A & B)
+            if (!result.negated && !part.negated) { combined = unite(a, b); negated = false; }
+            else if (!result.negated) { combined = subtract(b, a); negated = true; }
+            else if (!part.negated) { combined = subtract(a, b); negated = true; }
+            else { combined = intersect(a, b); negated = true; }
+        }
+        result = TagFilter{std::make_shared<const Postings>(std::move(combined)), negated};
+    }
+    return result;
+}
+
+TagFilter evaluate(db::Database& db, const TagExpression& expr) {
+    INK_TRACE_SCOPE("tag_query");
+    return evaluate_node(db.tag_index(), db, expr);
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef TAG_INDEX_HPP
+#define TAG_INDEX_HPP
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "database.hpp"
+
+// A parsed tag query such as `#cpp AND #perf NOT #draft`.
+struct TagExpression {
+    enum class Kind { Tag, And, Or, Not };
+    Kind kind = Kind::Tag;
+    std::string tag;                    // Set for Kind::Tag, without the '#'
+    std::vector<TagExpression> operands;
+};
+
+namespace tag_index {
+    using Postings = std::vector<long long>; // Note ids, sorted ascending
+
+    // Posting lists per tag, read the first time a tag is queried from
+    // note_tags, the WITHOUT ROWID table keyed on interned (tag_id, note_id),
+    // where each list is one range of the key. Lists are dropped as soon as
+    // the database changes, whether through this connection or another one.
+    class TagIndex {
+    public:
+        std::shared_ptr<const Postings> postings(db::Database& db, const std::string& tag);
+
+    private:
+        void drop_if_stale(db::Database& db);
+
+        long long data_version_ = -1;
+        int total_changes_ = -1;
+        std::unordered_map<std::string, std::shared_ptr<const Postings>> lists_;
+    };
+
+    // Splits search input into free text and tag query tokens: #tags,
+    // parentheses, and AND/OR/NOT when they lead into a tag. Quoted phrases
+    // stay in the text.
+    void split_query(const std::string& input, std::string& text, std::vector<std::string>& tag_tokens);
+
+    // Parses tag query tokens. NOT binds tighter than AND, and AND than OR;
+    // tags next to each other are ANDed. Returns false on a syntax error.
+    bool parse(const std::vector<std::string>& tokens, TagExpression& expr);
+
+    // Resolves an expression to the set of matching note ids.
+    TagFilter evaluate(db::Database& db, const TagExpression& expr);
+
+    // Set operations on sorted posting lists. Intersections and differences
+    // gallop through the longer list when the lengths are far apart.
+    Postings intersect(const Postings& a, const Postings& b);
+    Postings unite(const Postings& a, const Postings& b);
+    Postings subtract(const Postings& a, const Postings& b);
+}
+
+#endif
@@ -0,0 +1,163 @@
+#include "time_window.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+namespace time_window {
+
+// --- CALENDAR ---
+// Howard Hinnant's days_from_civil and civil_from_days: whole 400-year eras,
+// with years starting in March so the leap day falls at the end.
+long long days_from_civil(long long year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    const long long era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned year_of_era = static_cast<unsigned>(year - era * 400);
+    const unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + static_cast<long long>(day_of_era) - 719468;
+}
+
+void civil_from_days(long long days, long long& year, unsigned& month, unsigned& day) {
+    days += 719468;
+    const long long era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned day_of_era = static_cast<unsigned>(days - era * 146097);
+    const unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const unsigned shifted_month = (5 * day_of_year + 2) / 153;
+    day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+    month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+    year = static_cast<long long>(year_of_era) + era * 400 + (month <= 2);
+}
+
+unsigned days_in_month(long long year, unsigned month) {
+    static const unsigned DAYS[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return month == 2 && leap ? 29 : DAYS[month - 1];
+}
+
+// --- TIMESTAMPS ---
+// Reads `count` digits at `at`, or returns false
+bool read_digits(std::string_view text, size_t at, size_t count, unsigned& value) {
+    if (at + count > text.size()) return false;
+    value = 0;
+    for (size_t i = at; i < at + count; ++i) {
+        if (text[i] < '0' || text[i] > '9') return false;
+        value = value * 10 + static_cast<unsigned>(text[i] - '0');
+    }
+    return true;
+}
+
+bool parse_timestamp(std::string_view text, long long& epoch) {
+    unsigned year, month, day, hour = 0, minute = 0, second = 0;
+    if (text.size() < 10 || !read_digits(text, 0, 4, year) || text[4] != '-' || !read_digits(text, 5, 2, month) ||
+        text[7] != '-' || !read_digits(text, 8, 2, day)) {
+        return false;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > days_in_month(year, month)) return false;
+    if (text.size() > 10) {
+        if ((text[10] != ' ' && text[10] != 'T') || !read_digits(text, 11, 2, hour) ||
+            text.size() < 16 || text[13] != ':' || !read_digits(text, 14, 2, minute)) {
+            return false;
+        }
+        if (text.size() > 16 && text[16] == ':' && !read_digits(text, 17, 2, second)) return false;
+        if (hour > 23 || minute > 59 || second > 59) return false;
+    }
+    epoch = days_from_civil(year, month, day) * SECONDS_PER_DAY + hour * 3600 + minute * 60 + second;
+    return true;
+}
+
+bool parse_instant(std::string_view text, long long& epoch) {
+    auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+    size_t at = !text.empty() && text[0] == '-' ? 1 : 0;
+    size_t digits = at;
+    while (digits < text.size() && is_digit(text[digits])) ++digits;
+    // Epoch seconds; eleven digits reach past the year 5000
+    if (digits > at && digits - at <= 11 && (digits == text.size() || text[digits] == '.')) {
+        size_t end = digits;
+        if (end < text.size()) {
+            while (++end < text.size() && is_digit(text[end])) {}
+            if (end != text.size() || end == digits + 1) return false;
+        }
+        epoch = std::strtoll(std::string(text.substr(0, digits)).c_str(), nullptr, 10);
+        return true;
+    }
+
+    // The date and time parse_timestamp reads, then what may follow it
+    size_t end = text.size() > 10 ? (text.size() > 16 && text[16] == ':' ? 19 : 16) : 10;
+    if (end > text.size() || !parse_timestamp(text.substr(0, end), epoch)) return false;
+    if (end == 19 && end < text.size() && text[end] == '.') {
+        size_t fraction = end + 1;
+        while (++end < text.size() && is_digit(text[end])) {}
+        if (end == fraction) return false;
+    }
+    if (end == text.size()) return true;
+    if (text[end] == 'Z' || text[end] == 'z') return end + 1 == text.size();
+    if (end == 10 || (text[end] != '+' && text[end] != '-')) return false;
+    // "+HH", "+HHMM" or "+HH:MM"
+    unsigned hours, minutes = 0;
+    size_t rest = text.size() - end - 1;
+    if (!read_digits(text, end + 1, 2, hours)) return false;
+    if (rest == 4 ? !read_digits(text, end + 3, 2, minutes)
+                  : rest == 5 ? text[end + 3] != ':' || !read_digits(text, end + 4, 2, minutes) : rest != 2) {
+        return false;
+    }
+    if (hours > 23 || minutes > 59) return false;
+    long long offset = hours * 3600 + minutes * 60;
+    epoch -= text[end] == '+' ? offset : -offset;
+    return true;
+}
+
+std::string format_timestamp(long long epoch) {
+    long long day = day_of(epoch);
+    long long seconds = epoch - day * SECONDS_PER_DAY;
+    long long year;
+    unsigned month, day_of_month;
+    civil_from_days(day, year, month, day_of_month);
+    char text[64];
+    std::snprintf(text, sizeof(text), "%04lld-%02u-%02u %02lld:%02lld:%02lld", year, month, day_of_month,
+                  seconds / 3600, seconds / 60 % 60, seconds % 60);
+    return text;
+}
+
+std::string format_day(long long day) {
+    return format_timestamp(day * SECONDS_PER_DAY).substr(0, 10);
+}
+
+// --- WINDOW BOUNDS ---
+bool parse_bound(const std::string& value, bool until, long long now, long long& epoch) {
+    const long long today = day_of(now) * SECONDS_PER_DAY;
+    const long long day_end = until ? SECONDS_PER_DAY : 0;
+    if (value == "today") {
+        epoch = today + day_end;
+        return true;
+    }
+    if (value == "yesterday") {
+        epoch = today - SECONDS_PER_DAY + day_end;
+        return true;
+    }
+
+    // An age: digits followed by one unit letter
+    if (value.size() >= 2 && value[0] >= '0' && value[0] <= '9') {
+        char* end = nullptr;
+        long long amount = std::strtoll(value.c_str(), &end, 10);
+        if (end == value.c_str() + value.size() - 1 && amount <= 1000000) {
+            long long unit = 0;
+            switch (*end) {
+                case 'm': unit = 60; break;
+                case 'h': unit = 3600; break;
+                case 'd': unit = SECONDS_PER_DAY; break;
+                case 'w': unit = 7 * SECONDS_PER_DAY; break;
+            }
+            if (unit > 0) {
+                epoch = now - amount * unit;
+                return true;
+            }
+        }
+    }
+
+    if (!parse_timestamp(value, epoch)) return false;
+    // The end of the named day, minute or second
+    if (until) epoch += value.size() == 10 ? SECONDS_PER_DAY : value.size() == 16 ? 60 : 1;
+    return true;
+}
+
+}
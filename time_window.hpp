@@ -0,0 +1,52 @@
+#ifndef TIME_WINDOW_HPP
+#define TIME_WINDOW_HPP
+
+#include <string>
+#include <string_view>
+
+// Date arithmetic on plain integers. Note timestamps are SQLite's UTC
+// "YYYY-MM-DD HH:MM:SS" text; these turn them into seconds since the Unix
+// epoch and back without going through the C library's time zone code.
+namespace time_window {
+    const long long SECONDS_PER_DAY = 86400;
+
+    // Days since 1970-01-01 for a date in the proleptic Gregorian calendar.
+    long long days_from_civil(long long year, unsigned month, unsigned day);
+
+    // Epoch seconds for "YYYY-MM-DD", "YYYY-MM-DD HH:MM" or "YYYY-MM-DD HH:MM:SS"
+    // (a 'T' may stand in for the space). Anything after the seconds is
+    // ignored. False if malformed.
+    bool parse_timestamp(std::string_view text, long long& epoch);
+
+    // Epoch seconds for a timestamp from another program: the forms above
+    // with optional fractional seconds and a "Z" or "+HH:MM" offset (as in
+    // "2024-01-01T10:00:00Z"), or a bare number of seconds since the epoch.
+    // Unlike parse_timestamp, nothing may follow. False if malformed.
+    bool parse_instant(std::string_view text, long long& epoch);
+
+    // The day an epoch second falls on, as days since 1970-01-01.
+    inline long long day_of(long long epoch) {
+        return epoch >= 0 ? epoch / SECONDS_PER_DAY : -((-epoch + SECONDS_PER_DAY - 1) / SECONDS_PER_DAY);
+    }
+
+    // Monday-based weekday of a day: 0 for Monday through 6 for Sunday.
+    inline int weekday(long long day) {
+        // 1970-01-01 was a Thursday
+        return static_cast<int>(((day + 3) % 7 + 7) % 7);
+    }
+
+    // "YYYY-MM-DD HH:MM:SS", the form notes are stored in
+    std::string format_timestamp(long long epoch);
+    // "YYYY-MM-DD" for a day since 1970-01-01
+    std::string format_day(long long day);
+
+    // Parses a --since or --until value into epoch seconds, taking `now` as
+    // the current time. Accepts a date or date and time (UTC), "today",
+    // "yesterday", or an age such as 90m, 12h, 7d or 4w. A date alone means
+    // the start of that day for --since and the end of it for --until, so
+    // the window [since, until) includes the named day in both cases; a
+    // time to the minute or second works the same way.
+    bool parse_bound(const std::string& value, bool until, long long now, long long& epoch);
+}
+
+#endif
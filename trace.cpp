@@ -0,0 +1,203 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+
+namespace trace {
+
+bool active = false;
+bool counting_allocations = false;
+
+struct Event {
+    std::string name;
+    long long start_us;
+    long long duration_us;
+    int depth;
+    int thread;
+    std::vector<std::pair<const char*, long long>> args;
+};
+
+std::mutex events_mutex;
+std::vector<Event> events;
+std::vector<std::pair<std::string, long long>> counters; // In first-seen order
+std::string output_path;
+std::chrono::steady_clock::time_point origin;
+std::atomic<long long> allocations{0};
+thread_local int current_depth = 0;
+
+int thread_number() {
+    static std::mutex mutex;
+    static std::map<std::thread::id, int> numbers;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = numbers.emplace(std::this_thread::get_id(), static_cast<int>(numbers.size()) + 1).first;
+    return it->second;
+}
+
+long long micros_since_start(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t - origin).count();
+}
+
+long long allocation_count() { return allocations.load(std::memory_order_relaxed); }
+
+void start(const std::string& target) {
+#ifndef INK_NO_TRACE
+    origin = std::chrono::steady_clock::now();
+    output_path = (target.empty() || target == "1") ? "" : target;
+    active = true;
+#else
+    (void)target;
+#endif
+}
+
+void count(const char* name, long long delta) {
+    if (!active) return;
+    std::lock_guard<std::mutex> lock(events_mutex);
+    for (auto& counter : counters) {
+        if (counter.first == name) { counter.second += delta; return; }
+    }
+    counters.emplace_back(name, delta);
+}
+
+void record_db_status(sqlite3* db) {
+    if (!active || !db) return;
+    int current = 0, high = 0;
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_HIT, &current, &high, 0);
+    count("sqlite_cache_hits", current);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &current, &high, 0);
+    count("sqlite_cache_misses", current);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_USED, &current, &high, 0);
+    count("sqlite_cache_bytes", current);
+}
+
+void Scope::begin(const char* name) {
+    name_ = name;
+    depth_ = current_depth++;
+    start_ = std::chrono::steady_clock::now();
+}
+
+void Scope::end() {
+    auto now = std::chrono::steady_clock::now();
+    --current_depth;
+    Event event{name_, micros_since_start(start_),
+                std::chrono::duration_cast<std::chrono::microseconds>(now - start_).count(),
+                depth_, thread_number(), std::move(args_)};
+    std::lock_guard<std::mutex> lock(events_mutex);
+    events.push_back(std::move(event));
+}
+
+// --- OUTPUT ---
+// One line per phase; repeated phases at the same depth are folded together.
+void print_summary(std::ostream& out, long long total_us) {
+    struct Row {
+        std::string name;
+        int depth;
+        long long start_us;
+        long long calls = 0;
+        long long total_us = 0;
+        std::vector<std::pair<const char*, long long>> args;
+    };
+    std::vector<Row> rows;
+    std::vector<const Event*> ordered;
+    for (const auto& e : events) ordered.push_back(&e);
+    std::stable_sort(ordered.begin(), ordered.end(), [](const Event* a, const Event* b) {
+        return a->start_us < b->start_us;
+    });
+    for (const Event* e : ordered) {
+        auto row = std::find_if(rows.begin(), rows.end(), [&](const Row& r) {
+            return r.name == e->name && r.depth == e->depth;
+        });
+        if (row == rows.end()) row = rows.insert(rows.end(), Row{e->name, e->depth, e->start_us, 0, 0, {}});
+        ++row->calls;
+        row->total_us += e->duration_us;
+        for (const auto& arg : e->args) {
+            auto found = std::find_if(row->args.begin(), row->args.end(), [&](const std::pair<const char*, long long>& a) {
+                return std::string(a.first) == arg.first;
+            });
+            if (found == row->args.end()) row->args.push_back(arg);
+            else found->second += arg.second;
+        }
+    }
+
+    out << "\n--- 🐌 ink profile: " << std::fixed << std::setprecision(2) << total_us / 1000.0 << " ms ---" << std::endl;
+    for (const auto& row : rows) {
+        std::string label = std::string(row.depth * 2, ' ') + row.name;
+        out << "  " << std::left << std::setw(28) << label << std::right << std::setw(10) << row.total_us / 1000.0 << " ms";
+        if (row.calls > 1) out << "  x" << row.calls;
+        for (const auto& arg : row.args) out << "  " << arg.first << "=" << arg.second;
+        out << std::endl;
+    }
+    for (const auto& counter : counters) {
+        out << "  " << std::left << std::setw(28) << counter.first << std::right << std::setw(10) << counter.second << std::endl;
+    }
+}
+
+void write_chrome_trace(std::ostream& out, long long total_us) {
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto& e : events) {
+        out << (first ? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+            << ",\"ts\":" << e.start_us << ",\"dur\":" << e.duration_us << ",\"args\":{";
+        for (size_t i = 0; i < e.args.size(); ++i) {
+            out << (i ? "," : "") << "\"" << e.args[i].first << "\":" << e.args[i].second;
+        }
+        out << "}}";
+        first = false;
+    }
+    // Run-wide counters go on a single counter event at the end of the run
+    out << (first ? "" : ",\n") << "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":" << total_us << ",\"args\":{";
+    for (size_t i = 0; i < counters.size(); ++i) {
+        out << (i ? "," : "") << "\"" << counters[i].first << "\":" << counters[i].second;
+    }
+    out << "}}\n]}\n";
+}
+
+void finish() {
+    if (!active) return;
+    active = false;
+    long long total_us = micros_since_start(std::chrono::steady_clock::now());
+    int current = 0, high = 0;
+    sqlite3_status(SQLITE_STATUS_MALLOC_COUNT, &current, &high, 0);
+    counters.emplace_back("sqlite_allocations_live", current);
+    counters.emplace_back("cxx_allocations", allocations.load(std::memory_order_relaxed));
+
+    std::lock_guard<std::mutex> lock(events_mutex);
+    if (output_path.empty()) {
+        print_summary(std::cerr, total_us);
+        return;
+    }
+    std::ofstream out(output_path);
+    if (!out) {
+        std::cerr << "Error: Could not write trace to " << output_path << std::endl;
+        return;
+    }
+    write_chrome_trace(out, total_us);
+    std::cerr << "🐌 Trace written to " << output_path << std::endl;
+}
+
+}
+
+#ifndef INK_NO_TRACE
+// Counts C++ heap allocations while tracing. The other operator new forms
+// forward to this one by default.
+void* operator new(std::size_t size) {
+    if (trace::active || trace::counting_allocations) trace::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    while (true) {
+        if (void* p = std::malloc(size)) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
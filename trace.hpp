@@ -0,0 +1,71 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sqlite3.h>
+
+// Phase timing for a single `ink` run. Turned on with INK_TRACE or --profile;
+// when off, a scope costs one branch on a global flag. Building with
+// -DINK_NO_TRACE removes the scopes entirely.
+namespace trace {
+    extern bool active;
+
+    inline bool enabled() { return active; }
+
+    // `target` is "1" (or empty) for a summary on stderr, or a file path to
+    // write Chrome trace-event JSON (open it in chrome://tracing or Perfetto).
+    void start(const std::string& target);
+    // Adds SQLite page-cache and allocation counters for a connection.
+    void record_db_status(sqlite3* db);
+    // Writes the summary or trace file. Safe to call when tracing is off.
+    void finish();
+
+    // Adds to a named run-wide counter.
+    void count(const char* name, long long delta);
+
+    // C++ heap allocations counted so far. Counting runs while tracing, or
+    // while counting_allocations is set (ink_bench sets it around a
+    // measurement). Always 0 in INK_NO_TRACE builds.
+    extern bool counting_allocations;
+    long long allocation_count();
+
+    // Times the enclosing block and records it as one event.
+    class Scope {
+    public:
+        explicit Scope(const char* name) {
+            if (active) begin(name);
+        }
+        ~Scope() {
+            if (name_) end();
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        // Attaches a value to the event, e.g. rows returned.
+        void arg(const char* key, long long value) {
+            if (name_) args_.emplace_back(key, value);
+        }
+
+    private:
+        void begin(const char* name);
+        void end();
+
+        const char* name_ = nullptr;
+        std::chrono::steady_clock::time_point start_;
+        int depth_ = 0;
+        std::vector<std::pair<const char*, long long>> args_;
+    };
+}
+
+#define INK_TRACE_CONCAT_(a, b) a##b
+#define INK_TRACE_CONCAT(a, b) INK_TRACE_CONCAT_(a, b)
+#ifdef INK_NO_TRACE
+#define INK_TRACE_SCOPE(name) ((void)0)
+#else
+#define INK_TRACE_SCOPE(name) trace::Scope INK_TRACE_CONCAT(ink_trace_scope_, __LINE__)(name)
+#endif
+
+#endif